@@ -164,34 +164,23 @@ void remove_kid(int pid) {
 }
 
 bool measure_binary(const string &file, string *m) {
-  int size = file_size(file.c_str());
-  if (size <= 0) {
+  if (file_size(file) <= 0) {
     printf("%s() error, line %d, Can't get executable file %s\n",
            __func__,
            __LINE__,
            file.c_str());
     return false;
   }
-  byte *file_contents = (byte *)malloc(size);
-  int   bytes_read = size;
-  if (!read_file(file, &bytes_read, file_contents) || bytes_read < size) {
-    printf("%s() error, line %d, Executable read failed\n", __func__, __LINE__);
-    free(file_contents);
-    return false;
-  }
   byte         digest[32];
   unsigned int len = 32;
-  if (!digest_message(Digest_method_sha256,
-                      file_contents,
-                      bytes_read,
-                      digest,
-                      len)) {
-    printf("%s() error, line %d, Digest failed\n", __func__, __LINE__);
-    free(file_contents);
+  if (!digest_file(Digest_method_sha256, file, digest, &len)) {
+    printf("%s() error, line %d, Can't measure executable file %s\n",
+           __func__,
+           __LINE__,
+           file.c_str());
     return false;
   }
   m->assign((char *)digest, (int)len);
-  free(file_contents);
   return true;
 }
 
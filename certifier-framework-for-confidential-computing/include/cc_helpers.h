@@ -35,6 +35,10 @@
 
 bool open_client_socket(const string &host_name, int port, int *soc);
 bool open_server_socket(const string &host_name, int port, int *soc);
+bool open_server_socket(const string &host_name,
+                        int           port,
+                        int           backlog,
+                        int *         soc);
 
 bool construct_platform_evidence_package(string &          enclave_type,
                                          const string &    purpose,
@@ -23,6 +23,9 @@
 
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -95,6 +98,14 @@ class predicate_dominance {
   predicate_dominance *first_child_;
   predicate_dominance *next_;
 
+  // Set on the root by freeze(): each predicate's id and, per id, a row
+  // of bits for the ids it dominates.  A frozen tree can't be changed and
+  // may be shared between threads.
+  bool                            frozen_;
+  int                             words_;
+  std::unordered_map<string, int> ids_;
+  std::vector<uint64_t>           dominated_;
+
   predicate_dominance();
   ~predicate_dominance();
 
@@ -104,17 +115,142 @@ class predicate_dominance {
   predicate_dominance *find_node(const string &pred);
   bool                 insert(const string &parent, const string &descendant);
   bool                 is_child(const string &descendant);
+  bool                 freeze();
 };
 bool dominates(predicate_dominance &root,
                const string &       parent,
                const string &       descendant);
 
+// The process-wide dominance tree of the certifier rules, built and
+// frozen on first use.
+predicate_dominance &certifier_dominance_tree();
+
+// What every validation against one policy key starts from: the frozen
+// dominance tree and the axiom "policy-key is-trusted".  Read-only after
+// init, so one context serves concurrent requests.
+class verification_context {
+ public:
+  verification_context();
+
+  bool init(const key_message &policy_pk);
+  bool initialized() const { return initialized_; }
+
+  const key_message &  policy_key() const { return policy_key_; }
+  predicate_dominance &dominance_tree() const { return *dom_tree_; }
+  // already_proved gets a copy of the axioms.
+  void start_proof(proved_statements *already_proved) const;
+
+ private:
+  bool                 initialized_;
+  key_message          policy_key_;
+  predicate_dominance *dom_tree_;
+  proved_statements    axioms_;
+};
+
+// Policy database
+// -------------------------------------------------------------
+
+// Claims of the form "policy-key says X", parsed once and indexed by
+// what X vouches for: a measurement that is-trusted, a platform key that
+// is-trusted(-for-attestation) and platforms by type.  compile() checks
+// every signature up front, so facts added from a compiled database need
+// no crypto.  index() only parses; the caller's sequences must outlive
+// the database and each claim is verified when a lookup adds it.
+class policy_database {
+ public:
+  policy_database();
+
+  // Every claim must be a well formed statement by policy_pk.
+  bool compile(const key_message &          policy_pk,
+               const signed_claim_sequence &policy);
+  // Claims that are malformed, not by policy_pk or badly signed are
+  // skipped, as the trusted list lookups always did.
+  bool compile(const key_message &          policy_pk,
+               const signed_claim_sequence &trusted_platforms,
+               const signed_claim_sequence &trusted_measurements);
+  bool index(const key_message &          policy_pk,
+             const signed_claim_sequence &trusted_platforms,
+             const signed_claim_sequence &trusted_measurements);
+  void clear();
+
+  int                         size() const { return claims_.size(); }
+  bool                        verified() const { return verified_; }
+  const key_message &         policy_key() const { return policy_key_; }
+  const verification_context &context() const { return context_; }
+  // Distinct for every successful compile or index; 0 when empty.
+  unsigned long               generation() const { return generation_; }
+  const signed_claim_message *find_measurement(const string &m) const;
+  const signed_claim_message *find_platform_key(const key_message &k) const;
+  const signed_claim_message *find_platform(const platform &p) const;
+
+  // Add "policy-key says ..." for the match to already_proved.
+  bool add_measurement_fact(const string &     m,
+                            proved_statements *already_proved) const;
+  bool add_platform_key_fact(const key_message &k,
+                             proved_statements *already_proved) const;
+  // The SEV policy filter: every claim that is neither a measurement nor
+  // a platform, plus the first satisfying one of each, in policy order.
+  bool add_sev_policy_facts(const string &     m,
+                            const platform &   p,
+                            proved_statements *already_proved) const;
+
+ private:
+  // claims_ points into owned_ (or the caller's sequences), which a copy
+  // would not follow.
+  policy_database(const policy_database &);
+  policy_database &operator=(const policy_database &);
+
+  bool build(const key_message &                 policy_pk,
+             int                                 num_seqs,
+             const signed_claim_sequence *const *seqs,
+             bool                                strict,
+             bool                                verify);
+  int  measurement_index(const string &m) const;
+  int  platform_key_index(const key_message &k) const;
+  int  platform_index(const platform &p) const;
+  bool add_fact(int i, proved_statements *already_proved) const;
+
+  key_message                                  policy_key_;
+  bool                                         verified_;
+  unsigned long                                generation_;
+  verification_context                         context_;
+  signed_claim_sequence                        owned_;
+  std::vector<const signed_claim_message *>    claims_;
+  std::vector<vse_clause>                      said_;
+  std::unordered_map<string, int>              measurements_;
+  std::unordered_map<string, std::vector<int>> platform_keys_;
+  std::unordered_map<string, std::vector<int>> platforms_;
+  // In policy order, every claim but measurements and platforms.
+  std::vector<int>                             others_;
+};
+
 // Certifier proofs
 // -------------------------------------------------------------
 
 bool statement_already_proved(const vse_clause & cl,
                               proved_statements *are_proved);
 
+// proved_statements with a hash set of a canonical encoding of each
+// clause beside it, so membership is a probe rather than a same_vse_claim
+// scan.  Platform comparisons are one-sided (a missing key or property
+// matches), so a miss on a clause naming a platform still falls back to
+// the scan.  Statements appended to the protobuf directly are picked up
+// on the next lookup.
+class proved_index {
+ public:
+  explicit proved_index(proved_statements *are_proved);
+
+  bool contains(const vse_clause &cl);
+  void add(const vse_clause &cl);
+
+ private:
+  void sync();
+
+  proved_statements *        proved_;
+  int                        indexed_;
+  std::unordered_set<string> canonical_;
+};
+
 bool construct_vse_attestation_statement(const key_message &attest_key,
                                          const key_message &auth_key,
                                          const string &     measurement,
@@ -159,9 +295,9 @@ bool verify_rule_6(predicate_dominance &dom_tree,
 bool verify_external_proof_step(predicate_dominance &dom_tree,
                                 proof_step &         step);
 bool verify_internal_proof_step(predicate_dominance &dom_tree,
-                                const vse_clause     s1,
-                                const vse_clause     s2,
-                                const vse_clause     conclude,
+                                const vse_clause &   s1,
+                                const vse_clause &   s2,
+                                const vse_clause &   conclude,
                                 int                  rule_to_apply);
 
 bool verify_proof(key_message &        policy_pk,
@@ -181,6 +317,14 @@ bool add_new_facts_for_abbreviatedplatformattestation(
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved);
+bool add_newfacts_for_sdk_platform_attestation(
+    key_message &          policy_pk,
+    const policy_database &policy,
+    proved_statements *    already_proved);
+bool add_new_facts_for_abbreviatedplatformattestation(
+    key_message &          policy_pk,
+    const policy_database &policy,
+    proved_statements *    already_proved);
 bool construct_proof_from_sev_evidence(key_message &      policy_pk,
                                        const string &     purpose,
                                        proved_statements *already_proved,
@@ -205,17 +349,57 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                   proved_statements *    already_proved,
                                   vse_clause *           to_prove,
                                   proof *                pf);
+bool construct_proof_from_request(const string &         evidence_descriptor,
+                                  key_message &          policy_pk,
+                                  const string &         purpose,
+                                  const policy_database &policy,
+                                  evidence_package &     evp,
+                                  proved_statements *    already_proved,
+                                  vse_clause *           to_prove,
+                                  proof *                pf);
 bool validate_evidence(const string &         evidence_descriptor,
                        signed_claim_sequence &trusted_platforms,
                        signed_claim_sequence &trusted_measurements,
                        const string &         purpose,
                        evidence_package &     evp,
                        key_message &          policy_pk);
+bool validate_evidence(const string &         evidence_descriptor,
+                       const policy_database &policy,
+                       const string &         purpose,
+                       evidence_package &     evp,
+                       key_message &          policy_pk);
+// Also returns the statement proved, "enclaveKey is-trusted-for-...",
+// and the measurement it rests on, for the artifact a certifier issues.
+bool validate_evidence(const string &         evidence_descriptor,
+                       const policy_database &policy,
+                       const string &         purpose,
+                       evidence_package &     evp,
+                       key_message &          policy_pk,
+                       vse_clause *           proved,
+                       string *               measurement);
+
+// Verdicts for the platform and measurement halves of full-vse-support
+// and platform-attestation-only proofs against a compiled policy_database
+// are cached under (policy key, database, endorsement digest, measurement).
+// A repeat request then only has its attestation verified.  Entries last
+// for a TTL (300 seconds by default; 0 turns caching off) and never
+// outlive the not-after of a claim they rest on.
+void set_verdict_cache_ttl(int seconds);
+void clear_verdict_cache();
+int  verdict_cache_size();
 
 bool get_platform_from_sev_attest(const sev_attestation_message &sev_att,
                                   entity_message *               ent);
 bool get_measurement_from_sev_attest(const sev_attestation_message &sev_att,
                                      entity_message *               ent);
+// Keeps every policy claim except measurements and platforms, plus the
+// first measurement equal to measurement and the first platform plat
+// satisfies.  filter_sev_policy does this for an attestation's values.
+bool filter_policy(const string &               measurement,
+                   const platform &             plat,
+                   const key_message &          policy_pk,
+                   const signed_claim_sequence &policy,
+                   signed_claim_sequence *      filtered_policy);
 bool filter_sev_policy(const sev_attestation_message &sev_att,
                        const key_message &            policy_pk,
                        const signed_claim_sequence &  policy,
@@ -244,6 +428,18 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
                                    const string &         purpose,
                                    evidence_package &     evp,
                                    key_message &          policy_pk);
+bool validate_evidence_from_policy(const string &         evidence_descriptor,
+                                   const policy_database &policy,
+                                   const string &         purpose,
+                                   evidence_package &     evp,
+                                   key_message &          policy_pk);
+bool validate_evidence_from_policy(const string &         evidence_descriptor,
+                                   const policy_database &policy,
+                                   const string &         purpose,
+                                   evidence_package &     evp,
+                                   key_message &          policy_pk,
+                                   vse_clause *           proved,
+                                   string *               measurement);
 
 // -------------------------------------------------------------------
 
@@ -29,6 +29,8 @@ extern const char *Enc_method_aes_256_cbc;
 extern const char *Enc_method_aes_256_cbc_hmac_sha256;
 extern const char *Enc_method_aes_256_cbc_hmac_sha384;
 extern const char *Enc_method_aes_256_gcm;
+extern const char *Enc_method_aes_256_gcm_siv;
+extern const char *Enc_method_chacha20_poly1305;
 extern const char *Enc_method_ecc_256_private;
 extern const char *Enc_method_ecc_256_public;
 extern const char *Enc_method_ecc_256_sha256_pkcs_sign;
@@ -68,6 +70,8 @@ extern const char *Digest_method_sha_512;
 extern const char *Integrity_method_aes_256_cbc_hmac_sha256;
 extern const char *Integrity_method_aes_256_cbc_hmac_sha384;
 extern const char *Integrity_method_aes_256_gcm;
+extern const char *Integrity_method_aes_256_gcm_siv;
+extern const char *Integrity_method_chacha20_poly1305;
 extern const char *Integrity_method_hmac_sha256;
 
 extern std::vector<const char *> Enc_public_key_algorithms;
@@ -17,6 +17,10 @@
 #define _CERTIFIER_FRAMEWORK_H__
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
 #include <openssl/ssl.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
@@ -299,6 +303,12 @@ class cc_trust_manager {
   bool fetch_store();
   void clear_sensitive_data();
 
+  // Resumable TLS sessions for channels using this trust manager's
+  // admissions cert, sealed like the store.  Sessions for a different
+  // (e.g. reissued) admissions cert are ignored on restore.
+  bool save_tls_sessions(const string &file_name);
+  bool restore_tls_sessions(const string &file_name);
+
   bool generate_symmetric_key(bool regen);
   bool generate_sealing_key(bool regen);
   bool generate_auth_key(bool regen);
@@ -373,6 +383,50 @@ class certifiers {
   void print_certifiers_entry();
 };
 
+#ifndef SWIG
+// Channel contexts
+// -------------------------------------------------------------------
+//  A channel_context holds everything a channel needs that does not
+//  change between connections: the parsed root and admissions certs, the
+//  auth key, one X509_STORE and a client and a server SSL_CTX built from
+//  them.  It is initialized once and is read-only afterwards, so any
+//  number of threads can open channels from it concurrently; each channel
+//  then only allocates its SSL.  Channels hold references to the
+//  context's OpenSSL objects and may outlive it.
+
+class channel_context {
+ public:
+  bool        initialized_;
+  string      asn1_root_cert_;       // root cert for my certificate
+  string      asn1_peer_root_cert_;  // root cert for peers
+  string      asn1_my_cert_;         // admissions cert
+  X509 *      root_cert_;
+  X509 *      peer_root_cert_;
+  X509 *      my_cert_;
+  EVP_PKEY *  auth_key_;
+  X509_STORE *store_;
+  SSL_CTX *   client_ctx_;
+  SSL_CTX *   server_ctx_;
+  string      session_identity_;  // client TLS session cache identity
+
+  channel_context();
+  ~channel_context();
+
+  bool init(const cc_trust_manager &mgr);
+  bool init(const string &asn1_root_cert,
+            key_message & private_key,
+            const string &private_key_cert);
+  bool init(const string &asn1_root_cert,
+            const string &asn1_peer_root_cert,
+            key_message & private_key,
+            const string &private_key_cert);
+
+ private:
+  channel_context(const channel_context &) = delete;
+  channel_context &operator=(const channel_context &) = delete;
+};
+#endif  // SWIG
+
 class secure_authenticated_channel {
  public:
   string          role_;
@@ -398,6 +452,13 @@ class secure_authenticated_channel {
   X509 * peer_cert_;
   string peer_id_;
 
+  // Client: slot in the TLS session cache, "<identity>|<host>:<port>".
+  string session_key_;
+
+  // Application bytes moved over this channel.
+  uint64_t bytes_in_;
+  uint64_t bytes_out_;
+
   secure_authenticated_channel(string &role);  // role is client or server
   ~secure_authenticated_channel();
 
@@ -448,16 +509,60 @@ class secure_authenticated_channel {
                        key_message & private_key,
                        const string &auth_cert);
 
+#ifndef SWIG
+  // Connect or prepare to accept using a shared, pre-built context.
+  bool init_client_ssl(const string &         host_name,
+                       int                    port,
+                       const channel_context &ctx);
+  bool init_server_ssl(const channel_context &ctx);
+#endif
+
   void server_channel_accept_and_auth(
       void (*func)(secure_authenticated_channel &));
 
   int  read(string *out);
   int  read(int size, byte *b);
+  // Read one framed message into b; fails if it is longer than max_size.
+  int  read_message(int max_size, byte *b);
   int  write(int size, byte *b);
   void close();
   bool get_peer_id(string *out_peer_id);
+  // True if the handshake resumed an earlier session.
+  bool session_resumed();
 };
 
+// Drop all cached client TLS sessions.
+void clear_tls_session_cache();
+
+bool server_dispatch(const string &host_name,
+                     int           port,
+                     const string &asn1_root_cert,
+                     const string &asn1_peer_root_cert,
+                     int           num_certs,
+                     string *      cert_chain,
+                     key_message & private_key,
+                     const string &private_key_cert,
+                     void (*func)(secure_authenticated_channel &));
+
+bool server_dispatch(const string &host_name,
+                     int           port,
+                     const string &asn1_root_cert,
+                     key_message & private_key,
+                     const string &private_key_cert,
+                     void (*)(secure_authenticated_channel &));
+
+bool server_dispatch(const string &          host_name,
+                     int                     port,
+                     const cc_trust_manager &mgr,
+                     void (*)(secure_authenticated_channel &));
+
+// Concurrent dispatch.  The calling thread accepts connections and hands
+// each one to a pool of num_workers threads which run SSL_accept and func.
+// At most max_pending accepted connections wait for a free worker; once
+// that many are queued, accept pauses until a worker picks one up.
+// num_workers == 0 keeps the serial behavior of the calls above, and
+// max_pending <= 0 defaults to num_workers.  func is called concurrently
+// so it must not modify unprotected shared state.
 bool server_dispatch(const string &host_name,
                      int           port,
                      const string &asn1_root_cert,
@@ -466,6 +571,8 @@ bool server_dispatch(const string &host_name,
                      string *      cert_chain,
                      key_message & private_key,
                      const string &private_key_cert,
+                     int           num_workers,
+                     int           max_pending,
                      void (*func)(secure_authenticated_channel &));
 
 bool server_dispatch(const string &host_name,
@@ -473,13 +580,223 @@ bool server_dispatch(const string &host_name,
                      const string &asn1_root_cert,
                      key_message & private_key,
                      const string &private_key_cert,
+                     int           num_workers,
+                     int           max_pending,
                      void (*)(secure_authenticated_channel &));
 
 bool server_dispatch(const string &          host_name,
                      int                     port,
                      const cc_trust_manager &mgr,
+                     int                     num_workers,
+                     int                     max_pending,
                      void (*)(secure_authenticated_channel &));
 
+#ifndef SWIG
+// Dispatch metrics
+// -------------------------------------------------------------------
+//  server_dispatch records where connection setup time goes: how long
+//  accepted sockets wait for a worker, SSL_accept, peer-cert extraction
+//  and the handler, bytes per channel, and handshake failures by reason.
+//  Recording is lock-free.  Read a snapshot with get_dispatch_metrics or
+//  attach sinks that publish it periodically or on request.
+
+class metrics_histogram {
+ public:
+  // Bucket i counts values in [2^(i-1), 2^i); bucket 0 counts zeros.
+  static const int num_buckets = 40;
+
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+  uint64_t buckets_[num_buckets];
+
+  metrics_histogram();
+  // Smallest bucket bound at or above the q-quantile, 0 <= q <= 1.
+  uint64_t quantile_bound(double q) const;
+};
+
+class dispatch_metrics {
+ public:
+  enum failure_reason {
+    FAIL_INIT = 0,  // channel setup before the handshake
+    FAIL_VERIFY,    // peer certificate rejected
+    FAIL_PROTOCOL,  // other TLS errors
+    FAIL_IO,        // socket errors, resets
+    FAIL_CLOSED,    // peer closed during the handshake
+    FAIL_OTHER,
+    NUM_FAILURE_REASONS
+  };
+  static const char *failure_name(int reason);
+
+  uint64_t connections_accepted_;
+  uint64_t accept_errors_;
+  uint64_t handshakes_completed_;
+  uint64_t handshakes_resumed_;
+  uint64_t handshake_failures_[NUM_FAILURE_REASONS];
+  uint64_t channels_closed_;
+  uint64_t bytes_in_;
+  uint64_t bytes_out_;
+
+  // Latencies in microseconds, sizes in bytes.
+  metrics_histogram queue_wait_us_;
+  metrics_histogram ssl_accept_us_;
+  metrics_histogram peer_cert_us_;
+  metrics_histogram handler_us_;
+  metrics_histogram channel_bytes_in_;
+  metrics_histogram channel_bytes_out_;
+
+  dispatch_metrics();
+  // Prometheus text exposition format.
+  string to_text() const;
+};
+
+void get_dispatch_metrics(dispatch_metrics *out);
+void reset_dispatch_metrics();
+
+// Sinks run on their own threads until stop_metrics_sinks().
+typedef std::function<void(const dispatch_metrics &)> metrics_callback;
+bool add_metrics_callback(metrics_callback cb, int interval_ms);
+// Rewrite file_name with the text format every interval_ms.
+bool add_metrics_file_sink(const string &file_name, int interval_ms);
+// Serve the text format to any HTTP GET on host_name:port (e.g. a local
+// Prometheus scrape target).
+bool add_metrics_http_sink(const string &host_name, int port);
+void stop_metrics_sinks();
+
+// As above, but every connection shares ctx.
+bool server_dispatch(const string &         host_name,
+                     int                    port,
+                     const channel_context &ctx,
+                     int                    num_workers,
+                     int                    max_pending,
+                     void (*)(secure_authenticated_channel &));
+
+// Serve sock, which the caller has already bound and put in the listening
+// state.  Returns after sock is shut down (shutdown(sock, SHUT_RDWR)) and
+// the connections already accepted have been served; the caller closes
+// sock.
+bool server_dispatch(int                    sock,
+                     const channel_context &ctx,
+                     int                    num_workers,
+                     int                    max_pending,
+                     void (*)(secure_authenticated_channel &));
+
+// Event-driven channels
+// -------------------------------------------------------------------
+//  A channel_reactor drives many secure_authenticated_channels from a
+//  small, fixed number of threads.  Sockets are non-blocking and every
+//  connection is owned by one reactor thread, which runs its TLS
+//  handshake, reads and writes and calls the handlers.  Messages use the
+//  same size-prefixed framing as secure_authenticated_channel::read and
+//  write, so reactor servers interoperate with blocking peers.
+
+class reactor_thread;
+
+class async_channel : public std::enable_shared_from_this<async_channel> {
+  friend class channel_reactor;
+  friend class reactor_thread;
+
+ public:
+  typedef std::function<void(async_channel &)>                 event_handler;
+  typedef std::function<void(async_channel &, const string &)> message_handler;
+  typedef std::function<void(async_channel &, bool)>           write_handler;
+
+  // peer_id_ and peer_cert_ are valid once the open handler runs.
+  secure_authenticated_channel channel_;
+  void *                       user_data_;
+
+  async_channel(string &role);
+  ~async_channel();
+
+  // Queue a message.  Safe to call from any thread.  done, if set, runs on
+  // the reactor thread once the message has been handed to TLS (true) or
+  // the channel has closed first (false).
+  bool async_write(int size, byte *b, write_handler done = nullptr);
+
+  // Close once queued writes are flushed.  Safe to call from any thread.
+  void async_close();
+
+  bool is_open() { return open_; }
+
+ private:
+  enum { HANDSHAKING = 0, OPEN = 1, CLOSED = 2 };
+
+  reactor_thread *  owner_;
+  int               state_;
+  std::atomic<bool> open_;
+  bool              want_write_;
+  bool              close_after_flush_;
+  string            in_;
+  string            out_;
+  uint64_t          bytes_flushed_;
+  uint64_t          bytes_queued_;
+  std::vector<std::pair<uint64_t, write_handler>> write_done_;
+};
+
+typedef std::shared_ptr<async_channel> async_channel_ptr;
+
+class channel_reactor {
+ public:
+  // Handlers run on the reactor thread that owns the channel and must not
+  // block.  on_open_ runs after the handshake, on_message_ once per framed
+  // message and on_close_ when the channel is gone.
+  async_channel::event_handler   on_open_;
+  async_channel::message_handler on_message_;
+  async_channel::event_handler   on_close_;
+
+  // Each channel buffers at most one message.  A channel whose peer
+  // announces a longer message than max_message_size_ is closed.
+  static const int default_max_message_size = 16 * 1024 * 1024;
+  int              max_message_size_;
+
+  channel_reactor();
+  ~channel_reactor();
+
+  // Start num_threads reactor threads.
+  bool init(int num_threads);
+
+  // Accept certifier-authenticated connections on host_name:port.
+  bool listen(const string &host_name,
+              int           port,
+              const string &asn1_root_cert,
+              key_message & private_key,
+              const string &private_key_cert);
+  bool listen(const string &          host_name,
+              int                     port,
+              const cc_trust_manager &mgr);
+
+  // Connect (blocking handshake) and hand the channel to a reactor thread.
+  async_channel_ptr connect(const string &          host_name,
+                            int                     port,
+                            const cc_trust_manager &mgr);
+  async_channel_ptr connect(const string &host_name,
+                            int           port,
+                            const string &asn1_root_cert,
+                            key_message & private_key,
+                            const string &private_key_cert);
+  async_channel_ptr connect(const string &         host_name,
+                            int                    port,
+                            const channel_context &ctx);
+
+  // The port listen bound, e.g. after listening on port 0.
+  int port();
+
+  // Accept connections until stop() is called.
+  bool run();
+  void stop();
+
+ private:
+  channel_context               context_;
+  int                           listen_sock_;
+  int                           stop_fd_;
+  std::atomic<bool>             stopped_;
+  std::atomic<unsigned>         next_thread_;
+  std::vector<reactor_thread *> threads_;
+
+  bool attach(async_channel_ptr c);
+};
+#endif  // SWIG
+
 }  // namespace framework
 }  // namespace certifier
 
@@ -0,0 +1,119 @@
+//  Copyright (c) 2021-22, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CERTIFIER_SERVICE_H__
+#define _CERTIFIER_SERVICE_H__
+
+#include "support.h"
+#include "certifier.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool
+//   Each worker owns a deque.  Submissions from outside the pool are
+//   spread round robin; a worker takes its newest task from the back of
+//   its own deque and, when that is empty, steals the oldest from the
+//   front of another's.  submit blocks while max_pending tasks wait.
+//   The destructor runs every task already submitted, then joins.
+class work_stealing_pool {
+ public:
+  typedef std::function<void()> task;
+
+  work_stealing_pool(int num_workers, int max_pending);
+  ~work_stealing_pool();
+
+  void submit(task t);
+  int  num_workers() const { return (int)queues_.size(); }
+
+ private:
+  work_stealing_pool(const work_stealing_pool &);
+  work_stealing_pool &operator=(const work_stealing_pool &);
+
+  struct worker_queue {
+    std::mutex       mtx_;
+    std::deque<task> tasks_;
+  };
+
+  bool pop_local(int i, task *t);
+  bool steal(int i, task *t);
+  void run(int i);
+
+  std::vector<std::unique_ptr<worker_queue>> queues_;
+  std::vector<std::thread>                   threads_;
+  std::atomic<unsigned>                      next_;
+  int                                        max_pending_;
+  int                                        queued_;
+  bool                                       stopping_;
+  std::mutex                                 mtx_;
+  std::condition_variable                    not_empty_;
+  std::condition_variable                    not_full_;
+};
+
+// Certifier service
+//   Speaks the wire format of certifier_service/simpleserver.go: a
+//   trust_request_message in and a trust_response_message out, each
+//   framed by sized_socket_read/write.  The policy is compiled once by
+//   init and shared, read only, by every serve call.
+class certifier_service {
+ public:
+  certifier_service();
+
+  // Largest request accepted, artifact lifetime in seconds, and whether
+  // requests and responses are printed.
+  int    max_request_size_;
+  double duration_;
+  bool   print_all_;
+
+  bool init(const key_message &          private_policy_key,
+            const string &               serialized_policy_cert,
+            const signed_claim_sequence &policy);
+  bool init_from_files(const string &policy_key_file,
+                       const string &policy_cert_file,
+                       const string &policy_file);
+
+  // Answers one request on fd, then closes it.
+  void serve(int fd);
+
+ private:
+  certifier_service(const certifier_service &);
+  certifier_service &operator=(const certifier_service &);
+
+  bool validate(const string &     evidence_type,
+                const string &     purpose,
+                evidence_package & evp,
+                vse_clause *       proved,
+                string *           measurement);
+  bool admission_cert(const key_message &subject,
+                      const string &     measurement,
+                      string *           artifact);
+  bool platform_rule(const key_message &subject, string *artifact);
+
+  key_message           private_policy_key_;
+  key_message           public_policy_key_;
+  string                issuer_name_;
+  string                issuer_description_;
+  const char *          sign_alg_;
+  policy_database       policy_;
+  std::atomic<uint64_t> serial_number_;
+};
+
+#endif  // _CERTIFIER_SERVICE_H__
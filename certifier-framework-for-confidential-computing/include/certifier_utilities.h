@@ -48,6 +48,46 @@ bool digest_message(const char * alg,
                     byte *       digest,
                     unsigned int digest_len);
 
+// Incremental form of digest_message; the context is reused by later
+// init() calls.  *digest_len is the room in digest on entry and the
+// digest size on return.
+class digest_stream {
+ public:
+  digest_stream();
+  ~digest_stream();
+
+  bool init(const char *alg);
+  bool update(const byte *data, size_t len);
+  bool update_file(const string &file_name);
+  bool final(byte *digest, unsigned int *digest_len);
+
+ private:
+  digest_stream(const digest_stream &);
+  digest_stream &operator=(const digest_stream &);
+
+  EVP_MD_CTX *ctx_;
+  bool        started_;
+};
+
+// digest_message over a file's contents, without reading it into memory.
+bool digest_file(const char *  alg,
+                 const string &file_name,
+                 byte *        digest,
+                 unsigned int *digest_len);
+
+// SHA-256 Merkle tree over leaf_size chunks (1 MiB if 0), with leaves
+// hashed in parallel; num_threads <= 0 uses every core.  The 32 byte
+// result differs from the plain digest of the same data.
+bool tree_hash(const byte *data,
+               size_t      len,
+               size_t      leaf_size,
+               int         num_threads,
+               byte *      digest);
+bool tree_hash_file(const string &file_name,
+                    size_t        leaf_size,
+                    int           num_threads,
+                    byte *        digest);
+
 
 bool authenticated_encrypt(const char *alg,
                            byte *      in,
@@ -65,17 +105,138 @@ bool authenticated_decrypt(const char *alg,
                            int         key_len,
                            byte *      out,
                            int *       out_size);
+// aes-256-gcm where the CPU has AES and carry-less multiply instructions,
+// chacha20-poly1305 otherwise.
+const char *preferred_authenticated_algorithm();
+// True if alg_name is an authenticated algorithm this OpenSSL build can
+// run; aes-256-gcm-siv needs OpenSSL 3.2 or later.
+bool authenticated_algorithm_available(const char *alg_name);
+
+// Streaming form of authenticated_encrypt / authenticated_decrypt for
+// inputs too large to hold in memory.  The stream is byte-for-byte what
+// the one-shot calls produce (iv, ciphertext, tag), so either side may
+// be streamed independently.  The cipher, MAC and their contexts are
+// set up once and reused by later init calls.  aes-256-gcm-siv needs
+// the whole message and is not supported.
+//
+// *out_size is the room in out on entry and the bytes written on return.
+// Decrypted bytes are unauthenticated until final() returns true.
+class aead_stream {
+ public:
+  // update() needs in_len + max_expansion bytes of room, final()
+  // max_expansion.
+  static const int max_expansion = 96;
+
+  aead_stream();
+  ~aead_stream();
+
+  bool init_encrypt(const char *alg,
+                    byte *      key,
+                    int         key_len,
+                    byte *      iv,
+                    int         iv_len);
+  bool init_decrypt(const char *alg, byte *key, int key_len);
+  bool update(byte *in, int in_len, byte *out, int *out_size);
+  bool final(byte *out, int *out_size);
+
+ private:
+  aead_stream(const aead_stream &);
+  aead_stream &operator=(const aead_stream &);
+
+  bool init(const char *alg, byte *key, int key_len, bool encrypt);
+  bool start(byte *iv);
+  bool cipher_update(byte *in, int in_len, byte *out, int *out_len);
+
+  int             alg_;
+  bool            encrypt_;
+  bool            started_;
+  EVP_CIPHER_CTX *ctx_;
+  HMAC_CTX *      hmac_;
+  int             mac_size_;
+  bool            use_hmac_;
+  int             iv_size_;
+  byte            iv_[block_size];
+  int             iv_len_;
+  // Decrypt: the last mac_size_ bytes seen, which may be the tag.
+  byte            held_[64];
+  int             num_held_;
+};
+
+// Encrypt or decrypt a file with an aead_stream in constant memory.
+// Output is written next to out_file and renamed into place; decrypted
+// output only appears once the tag has been verified.
+bool authenticated_encrypt_file(const char *  alg,
+                                byte *        key,
+                                int           key_len,
+                                const string &in_file,
+                                const string &out_file);
+bool authenticated_decrypt_file(const char *  alg,
+                                byte *        key,
+                                int           key_len,
+                                const string &in_file,
+                                const string &out_file);
+
+// Chunked AES-256-GCM container for large blobs.  Each chunk is sealed
+// independently under a per-file key derived from key and a random salt,
+// with nonce = chunk index and the header, index and last-chunk flag as
+// additional data, so chunks can be sealed and opened in parallel and
+// read back one at a time.  An HMAC over the header and every chunk tag
+// (the index) closes the container.
+//
+//   header (chunked_aead_header_size) | chunk 0 ct | tag | ... | index mac
+//
+// key_len must be at least 32.  chunk_size <= 0 uses 1 MiB chunks and
+// num_threads <= 0 uses every core.
+const int chunked_aead_header_size = 40;
+const int chunked_aead_tag_size = 16;
+const int chunked_aead_mac_size = 32;
+
+bool chunked_aead_encrypt(byte *        key,
+                          int           key_len,
+                          const string &in,
+                          int           chunk_size,
+                          int           num_threads,
+                          string *      out);
+bool chunked_aead_decrypt(byte *        key,
+                          int           key_len,
+                          const string &in,
+                          int           num_threads,
+                          string *      out);
+// Random access: open chunk index only.  The index mac is not checked,
+// but each chunk is bound to its header, position and the final length.
+bool chunked_aead_decrypt_chunk(byte *        key,
+                                int           key_len,
+                                const string &in,
+                                uint64_t      index,
+                                string *      out);
+// File forms read and write chunks in place with pread/pwrite, so memory
+// is one chunk per thread whatever the file size.
+bool chunked_aead_encrypt_file(byte *        key,
+                               int           key_len,
+                               const string &in_file,
+                               const string &out_file,
+                               int           chunk_size,
+                               int           num_threads);
+bool chunked_aead_decrypt_file(byte *        key,
+                               int           key_len,
+                               const string &in_file,
+                               const string &out_file,
+                               int           num_threads);
 
 EC_KEY *generate_new_ecc_key(int num_bits);
 EC_KEY *key_to_ECC(const key_message &kr);
 bool    ECC_to_key(const EC_KEY *e, key_message *k);
 
 bool private_key_to_public_key(const key_message &in, key_message *out);
+// Per-thread CSPRNG seeded from getrandom(); no syscall per call.
 bool get_random(int num_bits, byte *out);
+// Bulk form for large amounts, e.g. many IVs or nonces at once.
+bool get_random_bytes(size_t n, byte *out);
 
 // Serialized time: YYYY-MM-DDTHH:mm:ss. sssZ
 bool time_t_to_tm_time(time_t *t, struct tm *tm_time);
 bool tm_time_to_time_point(struct tm *tm_time, time_point *tp);
+bool time_point_to_time_t(const time_point &tp, time_t *t);
 bool asn1_time_to_tm_time(const ASN1_TIME *s, struct tm *tm_time);
 bool get_not_before_from_cert(X509 *c, time_point *tp);
 bool get_not_after_from_cert(X509 *c, time_point *tp);
@@ -117,6 +278,99 @@ bool verify_artifact(X509 &       cert,
                      string *     subject_description_str,
                      uint64_t *   sn);
 
+// Algorithm registry.  Each name in certifier_algorithms.h has one
+// descriptor with its sizes (-1 where they do not apply), key type and
+// OpenSSL primitives; crypto entry points dispatch on the descriptor
+// rather than comparing names.
+enum alg_id {
+  alg_unknown = 0,
+  alg_aes_128,
+  alg_aes_128_cbc_hmac_sha256,
+  alg_aes_256,
+  alg_aes_256_cbc,
+  alg_aes_256_cbc_hmac_sha256,
+  alg_aes_256_cbc_hmac_sha384,
+  alg_aes_256_gcm,
+  alg_aes_256_gcm_siv,
+  alg_chacha20_poly1305,
+  alg_ecc_256_private,
+  alg_ecc_256_public,
+  alg_ecc_256_sha256_pkcs_sign,
+  alg_ecc_384,
+  alg_ecc_384_private,
+  alg_ecc_384_public,
+  alg_ecc_384_sha384_pkcs_sign,
+  alg_rsa_1024,
+  alg_rsa_1024_private,
+  alg_rsa_1024_public,
+  alg_rsa_1024_sha256_pkcs_sign,
+  alg_rsa_2048,
+  alg_rsa_2048_private,
+  alg_rsa_2048_public,
+  alg_rsa_2048_sha256_pkcs_sign,
+  alg_rsa_3072,
+  alg_rsa_3072_private,
+  alg_rsa_3072_public,
+  alg_rsa_3072_sha384_pkcs_sign,
+  alg_rsa_4096,
+  alg_rsa_4096_private,
+  alg_rsa_4096_public,
+  alg_rsa_4096_sha384_pkcs_sign,
+  alg_sha256,
+  alg_sha_256,
+  alg_sha_384,
+  alg_sha_512,
+  alg_hmac_sha256,
+  num_alg_ids
+};
+
+enum alg_class {
+  alg_class_none = 0,
+  alg_class_cipher,      // unauthenticated symmetric
+  alg_class_aead,        // authenticated_encrypt / authenticated_decrypt
+  alg_class_key_family,  // rsa-2048, ecc-384: no public/private split
+  alg_class_key,         // key_message key_type
+  alg_class_sign,        // signing_algorithm in claims
+  alg_class_digest,
+  alg_class_mac,
+};
+
+typedef bool (*aead_encrypt_fn)(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *iv,
+                                byte *out,
+                                int * out_size);
+typedef bool (*aead_decrypt_fn)(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *out,
+                                int * out_size);
+
+struct alg_descriptor {
+  const char *name;
+  alg_id      id;
+  alg_class   cls;
+  int         block_size;   // cipher_block_byte_size
+  int         key_size;     // cipher_key_byte_size
+  int         digest_size;  // digest_output_byte_size
+  int         mac_size;     // mac_output_byte_size
+  int         iv_size;      // authenticated_encrypt iv bytes used
+  int         pkey_type;    // EVP_PKEY_RSA, EVP_PKEY_EC or EVP_PKEY_NONE
+  alg_id      digest;       // signatures: the hash signed
+  alg_id      public_key;   // private keys: the matching public key type
+  const EVP_MD *(*md)();            // digest, signature hash or HMAC hash
+  const EVP_CIPHER *(*cipher)();    // symmetric algorithms
+  aead_encrypt_fn aead_encrypt;
+  aead_decrypt_fn aead_decrypt;
+};
+
+// nullptr if the name is unknown.  Passing the Enc_method_* (etc.)
+// pointers themselves resolves without hashing the name.
+const alg_descriptor *find_algorithm(const char *alg_name);
+const alg_descriptor *find_algorithm(const string &alg_name);
+const alg_descriptor *algorithm_by_id(alg_id id);
+
 int cipher_block_byte_size(const char *alg_name);
 int cipher_key_byte_size(const char *alg_name);
 int digest_output_byte_size(const char *alg_name);
@@ -20,10 +20,20 @@ bool test_claims_1(bool print_all);
 
 bool test_signed_claims(bool print_all);
 
+bool test_verify_signed_claims(bool print_all);
+
+bool test_policy_database(bool print_all);
+
+bool test_sev_policy_facts(bool print_all);
+
+bool test_proved_index(bool print_all);
+
 bool test_predicate_dominance(bool print_all);
 
 bool test_certify_steps(bool print_all);
 
 bool test_full_certification(bool print_all);
 
+bool test_certifier_service(bool print_all);
+
 #endif  // __CLAIMS_TESTS_H__
@@ -176,6 +176,17 @@ bool make_signed_claim(const char *          alg,
                        signed_claim_message *out);
 bool verify_signed_claim(const signed_claim_message &claim,
                          const key_message &         key);
+// Verifies n claims at once: claims[i] against keys[i], or against its
+// own signing key when keys is nullptr.  Each distinct key is converted
+// once and claims are checked on num_threads threads (every core if
+// <= 0; short batches always run inline).  Per-request callers pass 1 so
+// they don't start threads under a server's own workers.  results[i] is
+// claim i's verdict; true if all verified.
+bool verify_signed_claims(int                                n,
+                          const signed_claim_message *const *claims,
+                          const key_message *const *         keys,
+                          int                                num_threads,
+                          bool *                             results);
 bool get_vse_clause_from_signed_claim(const signed_claim_message &scm,
                                       vse_clause *                c);
 
@@ -183,6 +194,7 @@ int sized_pipe_read(int fd, string *out);
 int sized_pipe_write(int fd, int size, byte *buf);
 
 int sized_ssl_read(SSL *ssl, string *out);
+int sized_ssl_read(SSL *ssl, int max_size, byte *buf);
 int sized_ssl_write(SSL *ssl, int size, byte *buf);
 
 class cert_keys_seen {
@@ -205,6 +217,51 @@ class cert_keys_seen_list {
 
 key_message *get_issuer_key(X509 *x, cert_keys_seen_list &list);
 EVP_PKEY *   pkey_from_key(const key_message &k);
+
+// Key handles are converted once and shared; cached_pkey returns a new
+// reference, release it with EVP_PKEY_free.
+EVP_PKEY *cached_pkey(const key_message &k);
+void      clear_key_handle_cache();
+int       key_handle_cache_size();
+
+// Digest and EVP_PKEY type for a *_pkcs_sign method.
+bool signing_alg_params(const string &signing_alg,
+                        const char ** digest_alg,
+                        int *         pkey_type);
+bool pkey_sign(const char *digest_alg,
+               EVP_PKEY *  pkey,
+               int         size,
+               byte *      msg,
+               int *       sig_size,
+               byte *      sig);
+bool pkey_verify(const char *digest_alg,
+                 EVP_PKEY *  pkey,
+                 int         size,
+                 byte *      msg,
+                 int         sig_size,
+                 byte *      sig);
+bool sign_with_key(const string &     alg,
+                   const key_message &key,
+                   int                size,
+                   byte *             msg,
+                   string *           sig);
+bool verify_with_key(const string &     alg,
+                     const key_message &key,
+                     int                size,
+                     byte *             msg,
+                     int                sig_size,
+                     byte *             sig);
+
+// Successful signature checks in verify_with_key, verify_signed_claims
+// and verify_cert_with_key are cached for a TTL (300 seconds by
+// default; 0 turns caching off), and a certificate's entry never
+// outlives its not-after time.
+void set_verify_cache_ttl(int seconds);
+void clear_verify_cache();
+void invalidate_verify_cache_key(const key_message &k);
+int  verify_cache_size();
+bool verify_cert_with_key(X509 *x, const key_message &signer_key);
+
 bool         x509_to_public_key(X509 *x, key_message *k);
 bool         construct_vse_attestation_from_cert(const key_message &subj,
                                                  const key_message &signer,
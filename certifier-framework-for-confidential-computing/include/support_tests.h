@@ -22,18 +22,32 @@ bool test_encrypt(bool print_all);
 
 bool test_authenticated_encrypt(bool print_all);
 
+bool test_aead_stream(bool print_all);
+bool test_nonce_aead(bool print_all);
+
+bool test_chunked_aead(bool print_all);
+
 bool test_public_keys(bool print_all);
 
 bool test_digest(bool print_all);
 
 bool test_digest_multiple(bool print_all);
 
+bool test_digest_stream(bool print_all);
+bool test_algorithm_registry(bool print_all);
+
 bool test_sign_and_verify(bool print_all);
 
 bool test_time(bool print_all);
 
 bool test_key_translation(bool print_all);
 
+bool test_key_handle_cache(bool print_all);
+
+bool test_verify_cache(bool print_all);
+
+bool test_work_stealing_pool(bool print_all);
+
 bool test_artifact(bool print_all);
 
 bool test_local_certify(bool print_all);
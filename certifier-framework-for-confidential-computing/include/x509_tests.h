@@ -22,6 +22,14 @@ bool test_x_509_chain(bool print_all);
 
 bool test_x_509_sign(bool print_all);
 
+bool test_dispatch_pool(bool print_all);
+
+bool test_channel_reactor(bool print_all);
+
+bool test_tls_resumption(bool print_all);
+
+bool test_dispatch_metrics(bool print_all);
+
 #ifdef RUN_SEV_TESTS
 
 bool test_sev_certs(bool print_all);
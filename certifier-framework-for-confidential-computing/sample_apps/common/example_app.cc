@@ -34,10 +34,25 @@
 #include <cstdlib>      // For system()
 #include <string>
 #include <exception>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <unistd.h>
 
 #include "certifier_framework.h"
 #include "certifier_utilities.h"
 #include "certifier_algorithms.h"
+#include "fedavg.h"
 
 // #include "bioinformatics.pb.h"
 // #include <google/protobuf/text_format.h>
@@ -100,6 +115,28 @@ DEFINE_bool(stream_client_logs, true, "Send client stdout/stderr lines over the
 DEFINE_string(provision_map, "", "Server: path to client-id -> file mapping (e.g., client-1=/path/file.py)");
 DEFINE_string(provision_dir, "./provisioned", "Client: directory to write provisioned files");
 DEFINE_bool(provision_accept, true, "Client: accept provisioning from server (if true)");
+DEFINE_int32(provision_chunk_bytes, 1 << 20, "Server: frame size for streamed (chunked) provisioning");
+
+// --- Server dispatch flags ---
+DEFINE_int32(server_workers, 0, "Server: worker threads serving clients concurrently (0 = one client at a time)");
+DEFINE_int32(server_max_pending, 64, "Server: accepted connections allowed to wait for a free worker");
+DEFINE_string(tls_session_file, "tls_sessions.bin", "Client: sealed TLS session tickets in data_dir, for resumed reconnects (empty = off)");
+DEFINE_string(metrics_file, "", "Server: rewrite this file with dispatch metrics (Prometheus text) every metrics_interval_ms (empty = off)");
+DEFINE_int32(metrics_interval_ms, 10000, "Server: how often metrics_file is rewritten (ms)");
+DEFINE_int32(metrics_port, 0, "Server: serve dispatch metrics over HTTP on server_app_host:metrics_port (0 = off)");
+
+// --- Log streaming flags ---
+DEFINE_int32(log_batch_bytes, 16384, "Client: forward streamed logs once this many bytes are buffered");
+DEFINE_int32(log_flush_ms, 250, "Client: forward buffered logs at least this often (ms)");
+DEFINE_int32(log_buffer_bytes, 1 << 20, "Client: log bytes held for a slow server before the oldest are dropped");
+
+// --- Federated averaging over the secure channel ---
+DEFINE_int32(fedavg_clients, 0, "Server: aggregate model updates natively once this many clients report a round (0 = run server_script instead)");
+DEFINE_int32(fedavg_threads, 0, "Server: threads summing each update (0 = all cores)");
+DEFINE_int32(fedavg_round_timeout_s, 600, "Server: close a round with the updates received after this long (0 = wait forever)");
+DEFINE_string(fedavg_output_dir, "", "Server: also save each averaged model here as global_round_<n>.fav");
+DEFINE_int32(fedavg_rounds, 0, "Client: training rounds to run against the native aggregator (0 = use Flower)");
+DEFINE_string(fedavg_update_dir, "./fedavg_updates", "Client: where client_script writes its updates (relative to workdir)");
 
 
 
@@ -115,8 +152,168 @@ std::string read_file_contents(const std::string& file_path) {
                       std::istreambuf_iterator<char>());
 }
 
+// Forwards a child's output over a secure channel without ever making the
+// child wait on the network.  Lines go into a bounded buffer (oldest lines
+// are dropped when a stalled server lets it fill) and a sender thread ships
+// them as multi-line messages once batch_bytes accumulate or flush_ms pass.
+class log_forwarder {
+ public:
+  log_forwarder(secure_authenticated_channel* chan,
+                size_t batch_bytes,
+                size_t max_bytes,
+                int flush_ms)
+      : chan_(chan),
+        batch_bytes_(batch_bytes > 0 ? batch_bytes : 1),
+        max_bytes_(max_bytes > batch_bytes_ ? max_bytes : batch_bytes_),
+        flush_ms_(flush_ms > 0 ? flush_ms : 1),
+        buffered_(0),
+        dropped_(0),
+        done_(false),
+        failed_(false) {
+    sender_ = std::thread([this]() { send_loop(); });
+  }
+
+  ~log_forwarder() { finish(); }
+
+  // Never blocks on the channel.
+  void add(const char* line, size_t len) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (failed_) return;
+    lines_.emplace_back(line, len);
+    buffered_ += len;
+    while (buffered_ > max_bytes_ && lines_.size() > 1) {
+      buffered_ -= lines_.front().size();
+      dropped_ += lines_.front().size();
+      lines_.pop_front();
+    }
+    if (buffered_ >= batch_bytes_) cv_.notify_one();
+  }
+
+  // Send the lines buffered so far, then msg, and wait for the peer's one
+  // message reply.  Only the caller blocks; add() keeps buffering.
+  bool exchange(const std::string& msg, std::string* reply) {
+    std::lock_guard<std::mutex> c(chan_mtx_);
+    std::string pending;
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      if (failed_) return false;
+      for (const auto& line : lines_) pending += line;
+      lines_.clear();
+      buffered_ = 0;
+    }
+    if (!pending.empty() && chan_->write((int)pending.size(), (byte*)pending.data()) < 0)
+      return false;
+    if (chan_->write((int)msg.size(), (byte*)msg.data()) < 0) return false;
+    return chan_->read(reply) > 0;
+  }
+
+  // Send whatever is left and stop the sender.
+  void finish() {
+    if (!sender_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      done_ = true;
+    }
+    cv_.notify_one();
+    sender_.join();
+  }
+
+ private:
+  secure_authenticated_channel* chan_;
+  const size_t batch_bytes_;
+  const size_t max_bytes_;
+  const int flush_ms_;
+  std::mutex mtx_;
+  std::mutex chan_mtx_;  // one channel user at a time
+  std::condition_variable cv_;
+  std::deque<std::string> lines_;
+  size_t buffered_;
+  size_t dropped_;
+  bool done_;
+  bool failed_;
+  std::thread sender_;
+
+  void send_loop() {
+    std::string batch;
+    std::unique_lock<std::mutex> l(mtx_);
+    for (;;) {
+      cv_.wait_for(l, std::chrono::milliseconds(flush_ms_), [this]() {
+        return done_ || buffered_ >= batch_bytes_;
+      });
+      while (!lines_.empty()) {
+        batch.clear();
+        if (dropped_ > 0) {
+          batch = "[log] dropped " + std::to_string(dropped_) +
+                  " bytes while the server was slow\n";
+          dropped_ = 0;
+        }
+        while (!lines_.empty() &&
+               (batch.empty() || batch.size() + lines_.front().size() <= batch_bytes_)) {
+          batch += lines_.front();
+          buffered_ -= lines_.front().size();
+          lines_.pop_front();
+        }
+        // Write without the lock so add() keeps running meanwhile.
+        l.unlock();
+        int n;
+        {
+          std::lock_guard<std::mutex> c(chan_mtx_);
+          n = chan_->write((int)batch.size(), (byte*)batch.data());
+        }
+        l.lock();
+        if (n < 0) {
+          printf("[runner] log forwarding stopped: channel write failed\n");
+          failed_ = true;
+          lines_.clear();
+          buffered_ = 0;
+          return;
+        }
+        if (!done_ && buffered_ < batch_bytes_) break;
+      }
+      if (done_ && lines_.empty()) return;
+    }
+  }
+};
+
+// Server side; set up in main when --fedavg_clients > 0.
+static std::unique_ptr<fedavg_aggregator> g_fedavg;
+
+// Client side: the training script printed "[UPDATE] <path>".  Send the
+// update at path and store the server's answer next to it as <path>.global
+// (or <path>.err), which the script is waiting for.
+static void push_model_update(const std::string& line,
+                              secure_authenticated_channel* chan,
+                              log_forwarder* forward) {
+  std::istringstream iss(line);
+  std::string tag, path;
+  iss >> tag >> path;
+  std::string update = read_file_contents(path);
+  std::string reply, err;
+  model_view m;
+  if (path.empty() || !parse_model(update, &m, &err)) {
+    reply = "FEDAVG-ERR " + (err.empty() ? std::string("unreadable") : err) + "\n";
+  } else if (forward != nullptr ? !forward->exchange(update, &reply)
+                                : (chan->write((int)update.size(), (byte*)update.data()) < 0 ||
+                                   chan->read(&reply) <= 0)) {
+    reply = "FEDAVG-ERR channel\n";
+  }
+  std::string out = path + (is_model_message(reply) ? ".global" : ".err");
+  std::string tmp = out + ".tmp";
+  {
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+    f.write(reply.data(), (std::streamsize)reply.size());
+  }
+  if (rename(tmp.c_str(), out.c_str()) != 0)
+    printf("[fedavg] can't write %s\n", out.c_str());
+  if (is_model_message(reply))
+    printf("[fedavg] round %u: sent %zu bytes, got averaged model\n", m.round, update.size());
+  else
+    printf("[fedavg] update %s rejected: %s", path.c_str(), reply.c_str());
+}
+
 // Run a command via bash -lc "<cd && [source venv &&] cmd>".
-// If chan is non-null, each stdout/stderr line is also sent over the secure channel.
+// If chan is non-null, stdout/stderr is also forwarded over the secure
+// channel in batches (see log_forwarder).
 bool run_command_stream(const std::string& workdir,
                         const std::string& venv_path,
                         const std::string& command_body,
@@ -133,19 +330,25 @@ bool run_command_stream(const std::string& workdir,
     if (exit_code_out) *exit_code_out = -1;
     return false;
   }
-  char buffer[512];
+  std::unique_ptr<log_forwarder> forward;
+  if (chan != nullptr && FLAGS_stream_client_logs) {
+    forward.reset(new log_forwarder(chan,
+                                    (size_t)FLAGS_log_batch_bytes,
+                                    (size_t)FLAGS_log_buffer_bytes,
+                                    FLAGS_log_flush_ms));
+  }
+  char buffer[4096];
   while (fgets(buffer, sizeof(buffer), pipe)) {
     // Always print locally
     fputs(buffer, stdout);
     fflush(stdout);
     // Optionally forward to peer
-    if (chan != nullptr && FLAGS_stream_client_logs) {
-      int n = static_cast<int>(strlen(buffer));
-      chan->write(n, reinterpret_cast<byte*>(buffer));
-      // chan->write(strlen(buffer), reinterpret_cast<const byte*>(buffer));
-    }
+    if (forward) forward->add(buffer, strlen(buffer));
+    if (chan != nullptr && strncmp(buffer, "[UPDATE] ", 9) == 0)
+      push_model_update(buffer, chan, forward.get());
   }
   int rc = pclose(pipe);
+  if (forward) forward->finish();
   if (exit_code_out) *exit_code_out = rc;
   if (rc != 0) {
     printf("[runner] Process exited with code %d\n", rc);
@@ -336,6 +539,352 @@ static inline void rstrip_eol(std::string* s){
   while(!s->empty() && (s->back()=='\n' || s->back()=='\r')) s->pop_back();
 }
 
+// ---- Chunked provisioning ----
+// Server: PROVISION-CHUNKED <fname> <size> <sha256> <chunk>\n
+// Client: RESUME <offset>\n            (bytes of this exact file already held)
+// Server: ceil((size - offset) / chunk) messages of at most <chunk> bytes
+// Client: PROVISION-OK\n | PROVISION-ERR <reason>\n
+// The client streams into <dir>/.<fname>.<sha256>.part and renames it into
+// place only after the whole-file hash checks out, so a dropped connection
+// leaves a part file the next session resumes from.
+static const size_t kMaxProvisionChunk = 64u << 20;
+
+static std::string sha256_final_hex(SHA256_CTX* ctx) {
+  unsigned char hash[32];
+  SHA256_Final(hash, ctx);
+  static const char* kHex = "0123456789abcdef";
+  std::string out; out.resize(64);
+  for (int i=0;i<32;i++){ out[2*i]=kHex[(hash[i]>>4)&0xF]; out[2*i+1]=kHex[hash[i]&0xF]; }
+  return out;
+}
+
+// Hash the first `limit` bytes of path (all of it if limit < 0) without
+// loading it.  Returns the number of bytes hashed, or -1.
+static long long sha256_file_prefix(const std::string& path, long long limit, SHA256_CTX* ctx) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) return -1;
+  std::vector<unsigned char> buf(1 << 16);
+  long long total = 0;
+  while (limit < 0 || total < limit) {
+    size_t want = buf.size();
+    if (limit >= 0 && (long long)want > limit - total) want = (size_t)(limit - total);
+    size_t n = fread(buf.data(), 1, want, f);
+    if (n == 0) break;
+    SHA256_Update(ctx, buf.data(), n);
+    total += (long long)n;
+  }
+  bool err = ferror(f) != 0;
+  fclose(f);
+  return err ? -1 : total;
+}
+
+static bool sha256_file_hex(const std::string& path, long long* size, std::string* hex) {
+  SHA256_CTX ctx; SHA256_Init(&ctx);
+  *size = sha256_file_prefix(path, -1, &ctx);
+  if (*size < 0) return false;
+  *hex = sha256_final_hex(&ctx);
+  return true;
+}
+
+static void send_line(secure_authenticated_channel* chan, const std::string& line) {
+  chan->write((int)line.size(), (byte*)line.data());
+}
+
+// ---- Provisioning content cache ----
+// The client keeps <dir>/.provision_index ("<sha256> <size> <mtime> <fname>"
+// per line) for files it has provisioned and lists the hashes that still
+// match on disk in its HELLO ("have=<sha>,<sha>").  When the server's file
+// is among them it sends PROVISION-CACHED <fname> <sha256> instead of the
+// content; if the client can't use its copy the server sends the content,
+// unless the client answered PROVISION-ERR not-accepted.  The server
+// memoizes its own file hashes by size and mtime.
+struct provisioned_file {
+  std::string fname;
+  long long size;
+  long long mtime_ns;
+};
+
+static long long stat_mtime_ns(const struct stat& st) {
+  return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static std::string provision_index_path() {
+  return FLAGS_provision_dir + "/.provision_index";
+}
+
+// Entries whose file is unchanged since it was recorded, keyed by sha256.
+static std::unordered_map<std::string, provisioned_file> load_provision_index() {
+  std::unordered_map<std::string, provisioned_file> idx;
+  std::ifstream f(provision_index_path());
+  std::string sha;
+  provisioned_file e;
+  while (f >> sha >> e.size >> e.mtime_ns >> e.fname) {
+    struct stat st;
+    std::string path = FLAGS_provision_dir + "/" + e.fname;
+    if (sha.size() == 64 && stat(path.c_str(), &st) == 0 &&
+        (long long)st.st_size == e.size && stat_mtime_ns(st) == e.mtime_ns)
+      idx[sha] = e;
+  }
+  return idx;
+}
+
+static void record_provisioned(const std::string& sha, const std::string& fname) {
+  std::unordered_map<std::string, provisioned_file> idx = load_provision_index();
+  // One hash per file name.
+  for (auto it = idx.begin(); it != idx.end(); ) {
+    if (it->second.fname == fname) it = idx.erase(it); else ++it;
+  }
+  struct stat st;
+  std::string path = FLAGS_provision_dir + "/" + fname;
+  if (stat(path.c_str(), &st) != 0) return;
+  idx[sha] = provisioned_file{fname, (long long)st.st_size, stat_mtime_ns(st)};
+
+  std::string tmp = provision_index_path() + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    for (const auto& kv : idx)
+      out << kv.first << " " << kv.second.size << " " << kv.second.mtime_ns
+          << " " << kv.second.fname << "\n";
+    if (!out.good()) return;
+  }
+  if (rename(tmp.c_str(), provision_index_path().c_str()) != 0)
+    printf("[prov-client] cannot update %s\n", provision_index_path().c_str());
+}
+
+static std::string provision_have_list() {
+  std::string have;
+  for (const auto& kv : load_provision_index()) {
+    if (!have.empty()) have += ",";
+    have += kv.first;
+  }
+  return have;
+}
+
+// Server side: hash of a mapped file, recomputed only when it changes.
+static bool provision_file_digest(const std::string& path, long long* size, std::string* hex) {
+  struct memo { long long size; long long mtime_ns; std::string hex; };
+  static std::mutex memo_mtx;
+  static std::unordered_map<std::string, memo> memos;
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  {
+    std::lock_guard<std::mutex> l(memo_mtx);
+    auto it = memos.find(path);
+    if (it != memos.end() && it->second.size == (long long)st.st_size &&
+        it->second.mtime_ns == stat_mtime_ns(st)) {
+      *size = it->second.size;
+      *hex = it->second.hex;
+      return true;
+    }
+  }
+  if (!sha256_file_hex(path, size, hex)) return false;
+  // Only remember it if the file did not change while we hashed it.
+  struct stat after;
+  if (stat(path.c_str(), &after) == 0 && stat_mtime_ns(after) == stat_mtime_ns(st) &&
+      (long long)after.st_size == *size) {
+    std::lock_guard<std::mutex> l(memo_mtx);
+    memos[path] = memo{*size, stat_mtime_ns(st), *hex};
+  }
+  return true;
+}
+
+static std::unordered_set<std::string> parse_have_list(const std::string& hello) {
+  std::unordered_set<std::string> have;
+  size_t pos = hello.find(" have=");
+  if (pos == std::string::npos) return have;
+  pos += 6;
+  while (pos < hello.size()) {
+    size_t end = hello.find_first_of(", \r\n", pos);
+    if (end == std::string::npos) end = hello.size();
+    if (end - pos == 64) have.insert(hello.substr(pos, 64));
+    if (end >= hello.size() || hello[end] != ',') break;
+    pos = end + 1;
+  }
+  return have;
+}
+
+// Client: materialize a cached file under the name the server uses.
+static std::string provision_from_cache(secure_authenticated_channel* chan,
+                                        const std::string& hdr) {
+  std::istringstream iss(hdr);
+  std::string tag, fname, sha_hex;
+  iss >> tag >> fname >> sha_hex;
+  std::string safe = basename_only(fname);
+  std::unordered_map<std::string, provisioned_file> idx = load_provision_index();
+  auto it = idx.find(sha_hex);
+  std::string reply = "PROVISION-OK";
+  if (safe.empty() || it == idx.end()) {
+    reply = "PROVISION-ERR not-cached";
+  } else if (it->second.fname != safe) {
+    std::string src = FLAGS_provision_dir + "/" + it->second.fname;
+    std::string dst = FLAGS_provision_dir + "/" + safe;
+    std::string tmp = dst + ".tmp";
+    unlink(tmp.c_str());
+    bool ok = link(src.c_str(), tmp.c_str()) == 0;
+    if (!ok) {
+      std::ifstream in(src, std::ios::binary);
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      out << in.rdbuf();
+      ok = in.good() && out.good();
+    }
+    if (!ok || rename(tmp.c_str(), dst.c_str()) != 0) {
+      unlink(tmp.c_str());
+      reply = "PROVISION-ERR write-failed";
+    } else {
+      record_provisioned(sha_hex, safe);
+    }
+  }
+  if (reply == "PROVISION-OK")
+    printf("[prov-client] %s already present (sha256=%s), transfer skipped\n", safe.c_str(), sha_hex.c_str());
+  send_line(chan, reply + "\n");
+  return reply;
+}
+
+// A declined offer was answered in place of RESUME, so no final ack follows
+// it; only a sent file is acknowledged.
+enum provision_send_result { PROVISION_SENT, PROVISION_DECLINED, PROVISION_FAILED };
+
+static provision_send_result provision_send_chunked(secure_authenticated_channel* chan,
+                                                    const std::string& path,
+                                                    long long size,
+                                                    const std::string& hex) {
+  size_t chunk = FLAGS_provision_chunk_bytes > 0 ? (size_t)FLAGS_provision_chunk_bytes : (1u << 20);
+  if (chunk > kMaxProvisionChunk) chunk = kMaxProvisionChunk;
+  std::string fname = basename_only(path);
+  std::ostringstream hdr;
+  hdr << "PROVISION-CHUNKED " << fname << " " << size << " " << hex << " " << chunk << "\n";
+  send_line(chan, hdr.str());
+
+  std::string reply;
+  if (!chan_readline(chan, &reply)) {
+    printf("[prov-server] no resume offset from client (closed?)\n");
+    return PROVISION_FAILED;
+  }
+  rstrip_eol(&reply);
+  if (reply.rfind("RESUME ", 0) != 0) {
+    printf("[prov-server] client declined %s: %s\n", fname.c_str(), reply.c_str());
+    return PROVISION_DECLINED;
+  }
+  long long offset = atoll(reply.c_str() + 7);
+  if (offset < 0 || offset > size) offset = 0;
+
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr || fseeko(f, (off_t)offset, SEEK_SET) != 0) {
+    printf("[prov-server] cannot read %s at offset %lld\n", path.c_str(), offset);
+    if (f != nullptr) fclose(f);
+    return PROVISION_FAILED;
+  }
+  std::vector<byte> buf(chunk);
+  long long sent = offset;
+  while (sent < size) {
+    size_t want = chunk;
+    if ((long long)want > size - sent) want = (size_t)(size - sent);
+    size_t n = fread(buf.data(), 1, want, f);
+    if (n != want) {
+      printf("[prov-server] short read on %s (file changed?)\n", path.c_str());
+      fclose(f);
+      return PROVISION_FAILED;
+    }
+    if (chan->write((int)n, buf.data()) < 0) {
+      printf("[prov-server] channel closed after %lld/%lld bytes of %s\n", sent, size, fname.c_str());
+      fclose(f);
+      return PROVISION_FAILED;
+    }
+    sent += (long long)n;
+  }
+  fclose(f);
+  printf("[prov-server] sent %s (%lld bytes, resumed at %lld), sha256=%s\n",
+         fname.c_str(), size, offset, hex.c_str());
+  return PROVISION_SENT;
+}
+
+// Returns the reply already sent to the server ("PROVISION-OK" or an error).
+static std::string provision_receive_chunked(secure_authenticated_channel* chan,
+                                             const std::string& hdr) {
+  std::istringstream iss(hdr);
+  std::string tag, fname, sha_hex;
+  long long size = -1;
+  size_t chunk = 0;
+  iss >> tag >> fname >> size >> sha_hex >> chunk;
+  std::string reply;
+  if (fname.empty() || size <= 0 || sha_hex.size() != 64 || chunk == 0 || chunk > kMaxProvisionChunk) {
+    reply = "PROVISION-ERR bad-header";
+    send_line(chan, reply + "\n");
+    return reply;
+  }
+
+  std::string safe = basename_only(fname);
+  std::string dir  = FLAGS_provision_dir;
+  std::string mkdir_cmd = "mkdir -p " + dir;
+  int mkrc = system(mkdir_cmd.c_str());
+  if (mkrc != 0) {
+    printf("[prov-client] mkdir failed rc=%d for '%s' (continuing)\n", mkrc, mkdir_cmd.c_str());
+  }
+  std::string path = dir + "/" + safe;
+  std::string part = dir + "/." + safe + "." + sha_hex + ".part";
+
+  // Pick up where an earlier session stopped.
+  SHA256_CTX ctx; SHA256_Init(&ctx);
+  long long have = 0;
+  struct stat st;
+  if (stat(part.c_str(), &st) == 0 && st.st_size > 0 && st.st_size <= size) {
+    have = sha256_file_prefix(part, st.st_size, &ctx);
+    if (have != st.st_size) { SHA256_Init(&ctx); have = 0; }
+  }
+  FILE* out = fopen(part.c_str(), have > 0 ? "r+b" : "wb");
+  if (out == nullptr || fseeko(out, (off_t)have, SEEK_SET) != 0) {
+    if (out != nullptr) fclose(out);
+    reply = "PROVISION-ERR write-failed";
+    send_line(chan, reply + "\n");
+    return reply;
+  }
+  if (have > 0) printf("[prov-client] resuming %s at %lld/%lld bytes\n", safe.c_str(), have, size);
+  send_line(chan, "RESUME " + std::to_string(have) + "\n");
+
+  std::vector<byte> buf(chunk);
+  int last_pct = (int)(100 * have / size);
+  while (have < size) {
+    int n = chan->read_message((int)chunk, buf.data());
+    if (n <= 0) {
+      fclose(out);
+      printf("[prov-client] transfer of %s interrupted at %lld/%lld bytes\n", safe.c_str(), have, size);
+      return "PROVISION-ERR read-failed";
+    }
+    if (have + n > size || fwrite(buf.data(), 1, (size_t)n, out) != (size_t)n) {
+      fclose(out);
+      unlink(part.c_str());
+      reply = "PROVISION-ERR write-failed";
+      send_line(chan, reply + "\n");
+      return reply;
+    }
+    SHA256_Update(&ctx, buf.data(), (size_t)n);
+    have += n;
+    int pct = (int)(100 * have / size);
+    if (pct / 10 != last_pct / 10) {
+      printf("[prov-client] %s: %d%% (%lld/%lld bytes)\n", safe.c_str(), pct, have, size);
+      last_pct = pct;
+    }
+  }
+  bool flushed = fflush(out) == 0 && fsync(fileno(out)) == 0;
+  fclose(out);
+
+  std::string got_hex = sha256_final_hex(&ctx);
+  if (got_hex != sha_hex) {
+    printf("[prov-client] SHA256 mismatch: got=%s exp=%s\n", got_hex.c_str(), sha_hex.c_str());
+    unlink(part.c_str());
+    reply = "PROVISION-ERR sha256-mismatch";
+  } else if (!flushed || rename(part.c_str(), path.c_str()) != 0) {
+    reply = "PROVISION-ERR write-failed";
+  } else {
+    printf("[prov-client] saved provisioned file: %s (%lld bytes)\n", path.c_str(), size);
+    record_provisioned(sha_hex, safe);
+    reply = "PROVISION-OK";
+  }
+  send_line(chan, reply + "\n");
+  return reply;
+}
+
   // Utilities
   static inline void trim(std::string &s) {
     // remove leading/trailing spaces and CRs
@@ -477,7 +1026,11 @@ cc_trust_manager *trust_mgr = nullptr;
 // Client & Server application logic
 // --------------------------------------------------------------------------------------
 static std::unordered_set<std::string> ACL_ALLOW, ACL_DENY;
+// server_application runs on several dispatch workers at once; this guards
+// the ACL sets and their hot-reload state.
+static std::mutex acl_mtx;
 static inline bool acl_is_allowed(const std::string& id){
+  std::lock_guard<std::mutex> l(acl_mtx);
   g_acl_hot.MaybeReload();  // hot-reload on demand (cheap unless file changed)
   if (!FLAGS_acl_deny_file.empty() && ACL_DENY.count(id)) return false;
   if (!FLAGS_acl_allow_file.empty() && !ACL_ALLOW.empty() && !ACL_ALLOW.count(id)) return false;
@@ -500,7 +1053,10 @@ bool client_application(secure_authenticated_channel &channel) {
   // channel.write(strlen(msg), (byte *)msg);
   // 1) Announce logical client id to server
   {
-  std::ostringstream hello; hello << "HELLO id=" << FLAGS_client_id << "\n";
+  std::ostringstream hello; hello << "HELLO id=" << FLAGS_client_id << " caps=chunked,cached";
+  std::string have = provision_have_list();
+  if (!have.empty()) hello << " have=" << have;
+  hello << "\n";
   auto s = hello.str(); channel.write((int)s.size(), (byte*)s.data());
   }
 
@@ -521,6 +1077,25 @@ bool client_application(secure_authenticated_channel &channel) {
       rstrip_eol(&hdr);
       if (hdr == "PROVISION-NONE") {
         printf("[prov-client] no provision for this client\n");
+      } else if (hdr.rfind("PROVISION-CACHED ", 0) == 0) {
+        if (!FLAGS_provision_accept) {
+          // The server takes this as final and does not send the content.
+          send_line(&channel, "PROVISION-ERR not-accepted\n");
+        } else if (provision_from_cache(&channel, hdr) != "PROVISION-OK") {
+          // The server falls back to sending the content.
+          std::string next;
+          if (chan_readline(&channel, &next)) {
+            rstrip_eol(&next);
+            if (next.rfind("PROVISION-CHUNKED ", 0) == 0)
+              provision_receive_chunked(&channel, next);
+          }
+        }
+      } else if (hdr.rfind("PROVISION-CHUNKED ", 0) == 0) {
+        if (!FLAGS_provision_accept) {
+          send_line(&channel, "PROVISION-ERR not-accepted\n");
+        } else {
+          provision_receive_chunked(&channel, hdr);
+        }
       } else if (hdr.rfind("PROVISION ", 0) == 0) {
         if (!FLAGS_provision_accept) {
           const char* msg = "PROVISION-ERR not-accepted\n";
@@ -570,6 +1145,7 @@ bool client_application(secure_authenticated_channel &channel) {
                   } else {
                     f.write(blob.data(), (std::streamsize)blob.size()); f.close();
                     printf("[prov-client] saved provisioned file: %s (%zu bytes)\n", path.c_str(), blob.size());
+                    record_provisioned(sha_hex, safe);
                     const char* ok = "PROVISION-OK\n";
                     channel.write((int)strlen(ok), (byte*)ok);
                   }
@@ -591,6 +1167,10 @@ bool client_application(secure_authenticated_channel &channel) {
                    FLAGS_client_script
                   +  " -i " + std::to_string(FLAGS_client_id) + 
                    " -d " + FLAGS_dataset_dir;
+  if (FLAGS_fedavg_rounds > 0) {
+    cmd += " --rounds " + std::to_string(FLAGS_fedavg_rounds) +
+           " --update-dir " + FLAGS_fedavg_update_dir;
+  }
 
   printf("[client] Executing in %s: %s\n", FLAGS_workdir.c_str(), cmd.c_str());
   int exit_code = 0;
@@ -619,9 +1199,7 @@ void server_application(secure_authenticated_channel &channel) {
 //   channel.close();
   // Gate by measurement (peer_id_) and by announced client-id
  // Preload once; further changes are hot-reloaded by acl_is_allowed()
-  if (!FLAGS_acl_allow_file.empty()) ACL_ALLOW = load_set_file(FLAGS_acl_allow_file);
-  if (!FLAGS_acl_deny_file.empty())  ACL_DENY  = load_set_file(FLAGS_acl_deny_file);
-  g_acl_hot.Init(&ACL_ALLOW, &ACL_DENY, FLAGS_acl_allow_file, FLAGS_acl_deny_file);
+  // ACL sets are loaded once in main(); acl_is_allowed() hot-reloads them.
 
   std::string first; 
   int n = channel.read(&first);
@@ -629,6 +1207,10 @@ void server_application(secure_authenticated_channel &channel) {
   if (first.find("HELLO id=") == 0){ 
     announced_id = atoi(first.c_str()+9); 
   }
+  // Clients that can take streamed provisioning say so in their HELLO.
+  const bool peer_chunked = first.find(" caps=chunked") != std::string::npos;
+  const bool peer_cached = first.find(",cached") != std::string::npos;
+  const std::unordered_set<std::string> peer_has = parse_have_list(first);
 
   std::string logical_id = (announced_id>=0)? ("client-"+std::to_string(announced_id)) : std::string("client-unknown");
   // const std::string peer_only = channel.peer_id_;
@@ -647,8 +1229,11 @@ void server_application(secure_authenticated_channel &channel) {
   for (unsigned char c : composite) printf("%02X ", c);
   printf("\n");
 
-  if (ACL_DENY.count(composite)) printf("[acl] matched DENY\n");
-  if (!ACL_ALLOW.empty() && !ACL_ALLOW.count(composite)) printf("[acl] not in ALLOW -> deny\n");
+  {
+    std::lock_guard<std::mutex> l(acl_mtx);
+    if (ACL_DENY.count(composite)) printf("[acl] matched DENY\n");
+    if (!ACL_ALLOW.empty() && !ACL_ALLOW.count(composite)) printf("[acl] not in ALLOW -> deny\n");
+  }
 
   if (!acl_is_allowed(composite)){
     const char* msg = "unauthorized client\n"; 
@@ -718,10 +1303,37 @@ void server_application(secure_authenticated_channel &channel) {
   } else {
     const std::string& path = it->second;
     std::ifstream f(path, std::ios::binary);
+    long long fsize = 0;
+    std::string fhex;
     if (!f.good()){
       printf("[prov-server] cannot read %s; sending NONE\n", path.c_str());
       const char* none = "PROVISION-NONE\n";
       channel.write((int)strlen(none), (byte*)none);
+    } else if (peer_chunked && provision_file_digest(path, &fsize, &fhex) && fsize > 0) {
+      f.close();
+      bool send = true;
+      if (peer_cached && peer_has.count(fhex)) {
+        send_line(&channel, "PROVISION-CACHED " + basename_only(path) + " " + fhex + "\n");
+        std::string ack;
+        if (!chan_readline(&channel, &ack)) {
+          printf("[prov-server] no client ack (closed?)\n");
+          send = false;
+        } else {
+          rstrip_eol(&ack);
+          printf("[prov-server] %s cached on client: %s\n", basename_only(path).c_str(), ack.c_str());
+          // Fall back to sending it unless the client has it or refuses it.
+          send = ack != "PROVISION-OK" && ack != "PROVISION-ERR not-accepted";
+        }
+      }
+      if (send && provision_send_chunked(&channel, path, fsize, fhex) == PROVISION_SENT) {
+        std::string ack;
+        if (chan_readline(&channel, &ack)) {
+          rstrip_eol(&ack);
+          printf("[prov-server] client response: %s\n", ack.c_str());
+        } else {
+          printf("[prov-server] no client ack (closed?)\n");
+        }
+      }
     } else {
       std::string blob((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
       f.close();
@@ -748,12 +1360,12 @@ void server_application(secure_authenticated_channel &channel) {
   // ---- end provisioning ----
 
   // -------- Per-round & per-update ACL enforcement --------
-  std::string line;
+  std::string batch;
   for (;;) {
-    int n = channel.read(&line);
+    int n = channel.read(&batch);
     if (n <= 0) break;  // channel closed
 
-    // Re-check ACL on *every* inbound line (covers mid-round deny)
+    // Re-check ACL on *every* inbound message (covers mid-round deny)
     if (!acl_is_allowed(composite)) {
       printf("[acl] DENY(update/round): %s — closing channel\n", composite.c_str());
       const char* deny_msg = "unauthorized mid-round\n";
@@ -762,20 +1374,42 @@ void server_application(secure_authenticated_channel &channel) {
       return;
     }
 
-    // Optional: special handling for round markers emitted by Python
-    if (line.rfind("[ROUND]", 0) == 0) {
-      printf("[acl] round-marker from %s: %s", composite.c_str(), line.c_str());
-      if (!acl_is_allowed(composite)) {
-        printf("[acl] DENY(begin-round): %s — halting\n", composite.c_str());
-        const char* deny2 = "unauthorized at round barrier\n";
-        channel.write((int)strlen(deny2), (byte*)deny2);
-        channel.close();
-        return;
+    if (is_model_message(batch)) {
+      std::string global, err;
+      if (!g_fedavg) {
+        send_line(&channel, "FEDAVG-ERR not-aggregating\n");
+      } else if (g_fedavg->submit(composite, batch, &global, &err)) {
+        channel.write((int)global.size(), (byte*)global.data());
+      } else {
+        printf("[fedavg] rejected update from %s: %s\n", composite.c_str(), err.c_str());
+        send_line(&channel, "FEDAVG-ERR " + err + "\n");
+      }
+      continue;
+    }
+
+    // Clients batch several log lines per message.
+    size_t pos = 0;
+    while (pos < batch.size()) {
+      size_t eol = batch.find('\n', pos);
+      size_t end = (eol == std::string::npos) ? batch.size() : eol + 1;
+      std::string line = batch.substr(pos, end - pos);
+      pos = end;
+
+      // Optional: special handling for round markers emitted by Python
+      if (line.rfind("[ROUND]", 0) == 0) {
+        printf("[acl] round-marker from %s: %s", composite.c_str(), line.c_str());
+        if (!acl_is_allowed(composite)) {
+          printf("[acl] DENY(begin-round): %s — halting\n", composite.c_str());
+          const char* deny2 = "unauthorized at round barrier\n";
+          channel.write((int)strlen(deny2), (byte*)deny2);
+          channel.close();
+          return;
+        }
       }
     }
 
     // Forward logs to local stdout (as before)
-    fputs(line.c_str(), stdout);
+    fputs(batch.c_str(), stdout);
     fflush(stdout);
   }
 }
@@ -931,6 +1565,7 @@ int main(int an, char **av) {
     for (int i = 0; i < Num_symmetric_key_algorithms; i++) {
       printf("  %s\n", Enc_authenticated_symmetric_key_algorithms[i]);
     }
+    printf("  (empty: %s on this CPU)\n", preferred_authenticated_algorithm());
 
 #endif  // SIMPLE_APP
     return 0;
@@ -1089,6 +1724,13 @@ printf("[acl] allow=%s (%zu), deny=%s (%zu)\n",
       ret = 1;
       goto done;
     }
+    // Resume an earlier TLS session with the server if we have one.
+    if (!FLAGS_tls_session_file.empty()
+        && file_size(FLAGS_data_dir + FLAGS_tls_session_file) > 0
+        && !trust_mgr->restore_tls_sessions(FLAGS_data_dir
+                                            + FLAGS_tls_session_file)) {
+      printf("[client] stale TLS session file ignored\n");
+    }
     if (!channel.init_client_ssl(FLAGS_server_app_host,
                                  FLAGS_server_app_port,
                                  *trust_mgr)) {
@@ -1106,7 +1748,10 @@ printf("[acl] allow=%s (%zu), deny=%s (%zu)\n",
     // }
 
     // This is the actual application code.
-    if (!client_application(channel)) {
+    bool app_ok = client_application(channel);
+    if (!FLAGS_tls_session_file.empty())
+      trust_mgr->save_tls_sessions(FLAGS_data_dir + FLAGS_tls_session_file);
+    if (!app_ok) {
       printf("%s() error, line %d, client_application failed\n",
              __func__,
              __LINE__);
@@ -1122,7 +1767,19 @@ printf("[acl] allow=%s (%zu), deny=%s (%zu)\n",
     printf("Running App as server\n");
 
      // Start the Python FL server *once* in background and log to server.log
-    {
+    if (FLAGS_fedavg_clients > 0) {
+      g_fedavg.reset(new fedavg_aggregator(FLAGS_fedavg_clients,
+                                           FLAGS_fedavg_threads,
+                                           FLAGS_fedavg_round_timeout_s,
+                                           FLAGS_fedavg_output_dir));
+      printf("[server] aggregating model updates for %d clients per round\n",
+             FLAGS_fedavg_clients);
+      // Each client's worker waits in its round until the round closes.
+      if (FLAGS_server_workers < FLAGS_fedavg_clients)
+        printf("[server] WARNING: --server_workers=%d can't hold a round of %d "
+               "clients; rounds will only close at the timeout\n",
+               FLAGS_server_workers, FLAGS_fedavg_clients);
+    } else {
       std::string cmd = FLAGS_python_bin + std::string(" ") + FLAGS_server_script;
       // Redirect to a logfile so the process keeps running after we return.
       cmd += " > server.log 2>&1 &";
@@ -1138,9 +1795,21 @@ printf("[acl] allow=%s (%zu), deny=%s (%zu)\n",
     }
 
 
+    printf("[server] dispatch workers=%d max_pending=%d\n",
+           FLAGS_server_workers, FLAGS_server_max_pending);
+    if (!FLAGS_metrics_file.empty()
+        && !add_metrics_file_sink(FLAGS_metrics_file, FLAGS_metrics_interval_ms))
+      printf("[server] WARNING: can't write metrics to %s\n",
+             FLAGS_metrics_file.c_str());
+    if (FLAGS_metrics_port > 0
+        && !add_metrics_http_sink(FLAGS_server_app_host, FLAGS_metrics_port))
+      printf("[server] WARNING: can't serve metrics on port %d\n",
+             FLAGS_metrics_port);
     if (!server_dispatch(FLAGS_server_app_host,
                          FLAGS_server_app_port,
                          *trust_mgr,
+                         FLAGS_server_workers,
+                         FLAGS_server_max_pending,
                          server_application)) {
       ret = 1;
       goto done;
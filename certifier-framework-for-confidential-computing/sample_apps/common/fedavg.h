@@ -0,0 +1,408 @@
+//  Copyright (c) 2021-23, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __FEDAVG_H__
+#define __FEDAVG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Model updates
+// --------------------------------------------------------------------------------------
+//  Clients push their weights over the secure channel instead of a separate
+//  gRPC link.  A model is a list of float32 tensors:
+//    "\0FAV" | u32 version | u32 round | u64 num_examples | u32 num_tensors
+//    then per tensor: u32 ndim | u32 dims[ndim] | f32 values[prod(dims)]
+//  all little endian.  The training script writes an update in this layout,
+//  the client sends the file as one message and the server answers with the
+//  averaged model in the same layout.  Log batches never start with a NUL,
+//  so both share the channel.
+
+static const char kModelMagic[4] = {'\0', 'F', 'A', 'V'};
+static const uint32_t kModelVersion = 1;
+static const uint32_t kMaxModelTensors = 1u << 16;
+static const uint32_t kMaxTensorDims = 8;
+
+struct model_tensor_view {
+  std::vector<uint32_t> dims;
+  const char* values;  // count little-endian floats, possibly unaligned
+  size_t count;
+};
+
+// Points into the message it was parsed from.
+struct model_view {
+  uint32_t round;
+  uint64_t num_examples;
+  size_t total_values;
+  std::vector<model_tensor_view> tensors;
+};
+
+inline bool is_model_message(const std::string& m) {
+  return m.size() >= sizeof(kModelMagic) &&
+         memcmp(m.data(), kModelMagic, sizeof(kModelMagic)) == 0;
+}
+
+inline bool get_le(const std::string& b, size_t* pos, void* v, size_t n) {
+  if (b.size() - *pos < n) return false;
+  memcpy(v, b.data() + *pos, n);
+  *pos += n;
+  return true;
+}
+
+inline void put_le(std::string* b, const void* v, size_t n) {
+  b->append((const char*)v, n);
+}
+
+inline bool parse_model(const std::string& b, model_view* m, std::string* err) {
+  size_t pos = sizeof(kModelMagic);
+  uint32_t version = 0, num_tensors = 0;
+  if (!is_model_message(b) || !get_le(b, &pos, &version, 4) ||
+      version != kModelVersion || !get_le(b, &pos, &m->round, 4) ||
+      !get_le(b, &pos, &m->num_examples, 8) ||
+      !get_le(b, &pos, &num_tensors, 4) || num_tensors > kMaxModelTensors) {
+    *err = "bad-header";
+    return false;
+  }
+  m->total_values = 0;
+  m->tensors.resize(num_tensors);
+  for (uint32_t t = 0; t < num_tensors; t++) {
+    model_tensor_view& tv = m->tensors[t];
+    uint32_t ndim = 0;
+    if (!get_le(b, &pos, &ndim, 4) || ndim > kMaxTensorDims) {
+      *err = "bad-tensor";
+      return false;
+    }
+    tv.dims.resize(ndim);
+    size_t count = 1;
+    for (uint32_t d = 0; d < ndim; d++) {
+      if (!get_le(b, &pos, &tv.dims[d], 4) ||
+          (tv.dims[d] != 0 && count > (b.size() / 4) / tv.dims[d])) {
+        *err = "bad-tensor";
+        return false;
+      }
+      count *= tv.dims[d];
+    }
+    if ((b.size() - pos) / 4 < count) {
+      *err = "truncated";
+      return false;
+    }
+    tv.values = b.data() + pos;
+    tv.count = count;
+    pos += 4 * count;
+    m->total_values += count;
+  }
+  if (pos != b.size()) {
+    *err = "trailing-bytes";
+    return false;
+  }
+  return true;
+}
+
+// Runs fn(begin, end) over [0, n), split across up to num_threads threads
+// when there is enough work to pay for them.
+inline void parallel_ranges(size_t n,
+                            int num_threads,
+                            const std::function<void(size_t, size_t)>& fn) {
+  const size_t min_per_thread = 1 << 16;
+  size_t parts = (n + min_per_thread - 1) / min_per_thread;
+  if (num_threads > 0 && parts > (size_t)num_threads) parts = num_threads;
+  if (parts <= 1) {
+    fn(0, n);
+    return;
+  }
+  size_t step = (n + parts - 1) / parts;
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < parts; i++)
+    workers.emplace_back(fn, i * step, std::min(n, (i + 1) * step));
+  fn(0, step);
+  for (auto& w : workers) w.join();
+}
+
+// sums[i] += w * values[i].  The memcpy is a plain load, so this vectorizes.
+inline void add_scaled(double* sums, const char* values, size_t n, double w) {
+  for (size_t i = 0; i < n; i++) {
+    float v;
+    memcpy(&v, values + 4 * i, sizeof(v));
+    sums[i] += w * (double)v;
+  }
+}
+
+// out[i] = sums[i] * scale as little-endian floats.
+inline void store_scaled(char* out, const double* sums, size_t n, double scale) {
+  for (size_t i = 0; i < n; i++) {
+    float v = (float)(sums[i] * scale);
+    memcpy(out + 4 * i, &v, sizeof(v));
+  }
+}
+
+// Weighted federated averaging (FedAvg) of the updates for each round,
+// weighted by num_examples.  Updates are folded into running sums as they
+// arrive, so a round costs one double per weight however many clients
+// contribute, and the average is ready as soon as the last update lands.
+class fedavg_aggregator {
+ public:
+  fedavg_aggregator(int clients_per_round,
+                    int num_threads,
+                    int round_timeout_s,
+                    const std::string& output_dir)
+      : clients_per_round_(clients_per_round > 0 ? clients_per_round : 1),
+        num_threads_(num_threads > 0 ? num_threads
+                                     : (int)std::thread::hardware_concurrency()),
+        round_timeout_s_(round_timeout_s),
+        output_dir_(output_dir),
+        job_(0),
+        any_closed_(false),
+        last_closed_(0) {}
+
+  // Adds client's update to its round and waits for the round to close,
+  // either with clients_per_round updates or, after round_timeout_s, with
+  // those received so far.  *global is then the averaged model.
+  bool submit(const std::string& client,
+              const std::string& update,
+              std::string* global,
+              std::string* err) {
+    model_view m;
+    if (!parse_model(update, &m, err)) return false;
+    if (m.num_examples == 0 || m.total_values == 0) {
+      *err = "empty-update";
+      return false;
+    }
+
+    round_state* r = nullptr;
+    round_key key;
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      // Training scripts number every job's rounds from 1, so a round 1
+      // update once this job has no round in progress starts a new job.
+      if (m.round == 1 && any_closed_ && !round_open_locked()) {
+        job_++;
+        any_closed_ = false;
+        last_closed_ = 0;
+        printf("[fedavg] %s starts job %llu\n", client.c_str(),
+               (unsigned long long)job_);
+      }
+      if (any_closed_ && m.round <= last_closed_) {
+        *err = "round-closed";
+        return false;
+      }
+      key = round_key(job_, m.round);
+      std::unique_ptr<round_state>& slot = rounds_[key];
+      if (!slot) {
+        slot.reset(new round_state());
+        size_t offset = 0;
+        for (const auto& t : m.tensors) {
+          slot->dims.push_back(t.dims);
+          slot->offsets.push_back(offset);
+          offset += t.count;
+        }
+        slot->sums.assign(offset, 0.0);
+      }
+      r = slot.get();
+      if (r->done) {
+        *err = "round-closed";
+        return false;
+      }
+      if (!same_layout(*r, m)) {
+        *err = "layout-mismatch";
+        return false;
+      }
+      if (!r->clients.insert(client).second) {
+        *err = "duplicate-update";
+        return false;
+      }
+      r->waiters++;
+    }
+
+    // Accumulate without mtx_ so other clients and rounds keep going.
+    bool included = false, closed_here = false;
+    {
+      std::lock_guard<std::mutex> a(r->add_mtx);
+      if (!r->closed) {
+        const double w = (double)m.num_examples;
+        parallel_ranges(r->sums.size(), num_threads_, [&](size_t b, size_t e) {
+          for (size_t t = 0; t < m.tensors.size(); t++) {
+            size_t lo = std::max(b, r->offsets[t]);
+            size_t hi = std::min(e, r->offsets[t] + m.tensors[t].count);
+            if (lo < hi)
+              add_scaled(r->sums.data() + lo,
+                         m.tensors[t].values + 4 * (lo - r->offsets[t]),
+                         hi - lo,
+                         w);
+          }
+        });
+        r->weight += w;
+        r->examples += m.num_examples;
+        r->received++;
+        included = true;
+        if (r->received >= clients_per_round_) {
+          close_locked(m.round, r);
+          closed_here = true;
+        }
+      }
+    }
+
+    std::unique_lock<std::mutex> l(mtx_);
+    if (closed_here) {
+      r->done = true;
+      cv_.notify_all();
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(round_timeout_s_);
+    while (!r->done) {
+      if (round_timeout_s_ <= 0) {
+        cv_.wait(l);
+      } else if (cv_.wait_until(l, deadline) == std::cv_status::timeout &&
+                 !r->done) {
+        l.unlock();
+        {
+          std::lock_guard<std::mutex> a(r->add_mtx);
+          if (!r->closed) {
+            printf("[fedavg] round %u timed out with %d of %d updates\n",
+                   m.round, r->received, clients_per_round_);
+            close_locked(m.round, r);
+          }
+        }
+        l.lock();
+        r->done = true;
+        cv_.notify_all();
+      }
+    }
+    if (!included)
+      printf("[fedavg] update from %s arrived after round %u closed\n",
+             client.c_str(), m.round);
+    *global = r->result;
+    if (--r->waiters == 0) {
+      if (key.first == job_) {
+        if (!any_closed_ || m.round > last_closed_) last_closed_ = m.round;
+        any_closed_ = true;
+      }
+      rounds_.erase(key);
+    }
+    return true;
+  }
+
+ private:
+  struct round_state {
+    round_state() : weight(0), examples(0), received(0), closed(false),
+                    done(false), waiters(0) {}
+    std::vector<std::vector<uint32_t>> dims;
+    std::vector<size_t> offsets;
+    // Guarded by add_mtx.
+    std::mutex add_mtx;
+    std::vector<double> sums;
+    double weight;
+    uint64_t examples;
+    int received;
+    bool closed;
+    std::string result;
+    // Guarded by mtx_.
+    std::unordered_set<std::string> clients;
+    bool done;
+    int waiters;
+  };
+
+  const int clients_per_round_;
+  const int num_threads_;
+  const int round_timeout_s_;
+  const std::string output_dir_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // Rounds are keyed by (job, round); the closed-round bookkeeping below
+  // covers the current job only.
+  typedef std::pair<uint64_t, uint32_t> round_key;
+  std::map<round_key, std::unique_ptr<round_state>> rounds_;
+  uint64_t job_;
+  bool any_closed_;
+  uint32_t last_closed_;
+
+  // True if a round of the current job is still taking updates.
+  bool round_open_locked() const {
+    for (const auto& kv : rounds_)
+      if (kv.first.first == job_ && !kv.second->done) return true;
+    return false;
+  }
+
+  static bool same_layout(const round_state& r, const model_view& m) {
+    if (r.dims.size() != m.tensors.size()) return false;
+    for (size_t t = 0; t < m.tensors.size(); t++)
+      if (r.dims[t] != m.tensors[t].dims) return false;
+    return true;
+  }
+
+  // Turn the sums into the averaged model.  Caller holds r->add_mtx.
+  void close_locked(uint32_t round, round_state* r) {
+    auto start = std::chrono::steady_clock::now();
+    std::string& out = r->result;
+    out.assign(kModelMagic, sizeof(kModelMagic));
+    uint32_t num_tensors = (uint32_t)r->dims.size();
+    put_le(&out, &kModelVersion, 4);
+    put_le(&out, &round, 4);
+    put_le(&out, &r->examples, 8);
+    put_le(&out, &num_tensors, 4);
+    std::vector<size_t> value_pos;
+    for (size_t t = 0; t < r->dims.size(); t++) {
+      uint32_t ndim = (uint32_t)r->dims[t].size();
+      put_le(&out, &ndim, 4);
+      for (uint32_t d : r->dims[t]) put_le(&out, &d, 4);
+      value_pos.push_back(out.size());
+      size_t count = (t + 1 < r->offsets.size() ? r->offsets[t + 1]
+                                                : r->sums.size()) - r->offsets[t];
+      out.append(4 * count, '\0');
+    }
+    const double scale = 1.0 / r->weight;
+    parallel_ranges(r->sums.size(), num_threads_, [&](size_t b, size_t e) {
+      for (size_t t = 0; t < r->dims.size(); t++) {
+        size_t end = t + 1 < r->offsets.size() ? r->offsets[t + 1] : r->sums.size();
+        size_t lo = std::max(b, r->offsets[t]);
+        size_t hi = std::min(e, end);
+        if (lo < hi)
+          store_scaled(&out[value_pos[t] + 4 * (lo - r->offsets[t])],
+                       r->sums.data() + lo,
+                       hi - lo,
+                       scale);
+      }
+    });
+    r->closed = true;
+    std::vector<double>().swap(r->sums);
+
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+    printf("[fedavg] round %u: %d updates, %llu examples, %zu bytes, averaged in %.1f ms\n",
+           round, r->received, (unsigned long long)r->examples, out.size(), ms);
+    if (!output_dir_.empty()) {
+      std::string path = output_dir_ + "/global_round_" + std::to_string(round) + ".fav";
+      std::ofstream f(path, std::ios::binary | std::ios::trunc);
+      f.write(out.data(), (std::streamsize)out.size());
+      if (!f.good()) printf("[fedavg] can't write %s\n", path.c_str());
+    }
+  }
+};
+
+#endif  // __FEDAVG_H__
@@ -0,0 +1,107 @@
+//  Copyright (c) 2021-23, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "fedavg.h"
+
+// A one-tensor update with every weight set to value.
+static std::string make_update(uint32_t round,
+                               uint64_t num_examples,
+                               uint32_t n,
+                               float value) {
+  std::string b(kModelMagic, sizeof(kModelMagic));
+  uint32_t num_tensors = 1, ndim = 1;
+  put_le(&b, &kModelVersion, 4);
+  put_le(&b, &round, 4);
+  put_le(&b, &num_examples, 8);
+  put_le(&b, &num_tensors, 4);
+  put_le(&b, &ndim, 4);
+  put_le(&b, &n, 4);
+  for (uint32_t i = 0; i < n; i++) put_le(&b, &value, 4);
+  return b;
+}
+
+// True if global is a round-`round` model whose weights all equal value.
+static bool model_is(const std::string& global, uint32_t round, float value) {
+  model_view m;
+  std::string err;
+  if (!parse_model(global, &m, &err) || m.round != round ||
+      m.tensors.size() != 1)
+    return false;
+  for (size_t i = 0; i < m.tensors[0].count; i++) {
+    float v;
+    memcpy(&v, m.tensors[0].values + 4 * i, sizeof(v));
+    if (v != value) return false;
+  }
+  return true;
+}
+
+// Two clients report round `round`; both must get the weighted average,
+// (1 * 1 + 3 * 3) / 4 = 2.5.
+static void run_round(fedavg_aggregator* agg, uint32_t round) {
+  std::string global_a, global_b, err_a, err_b;
+  bool ok_a = false;
+  std::thread a([&]() {
+    ok_a = agg->submit("a",
+                       make_update(round, 1, 1000, 1.0f),
+                       &global_a,
+                       &err_a);
+  });
+  bool ok_b = agg->submit("b",
+                          make_update(round, 3, 1000, 3.0f),
+                          &global_b,
+                          &err_b);
+  a.join();
+  EXPECT_TRUE(ok_a) << err_a;
+  EXPECT_TRUE(ok_b) << err_b;
+  EXPECT_TRUE(model_is(global_a, round, 2.5f));
+  EXPECT_TRUE(model_is(global_b, round, 2.5f));
+}
+
+TEST(fedavg, two_jobs_in_a_row) {
+  fedavg_aggregator agg(2, 1, 10, "");
+  for (int job = 0; job < 2; job++) {
+    for (uint32_t round = 1; round <= 3; round++)
+      run_round(&agg, round);
+  }
+}
+
+TEST(fedavg, stale_update_rejected_mid_job) {
+  fedavg_aggregator agg(2, 1, 10, "");
+  run_round(&agg, 1);
+
+  // Round 2 is open, so a round 1 update is late, not a new job.
+  std::string global_a, err_a;
+  bool ok_a = false;
+  std::thread a([&]() {
+    ok_a = agg.submit("a", make_update(2, 1, 10, 1.0f), &global_a, &err_a);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::string global, err;
+  EXPECT_FALSE(agg.submit("c", make_update(1, 1, 10, 1.0f), &global, &err));
+  EXPECT_EQ(err, "round-closed");
+
+  std::string global_b, err_b;
+  EXPECT_TRUE(agg.submit("b", make_update(2, 3, 10, 3.0f), &global_b, &err_b));
+  a.join();
+  EXPECT_TRUE(ok_a) << err_a;
+  EXPECT_TRUE(model_is(global_a, 2, 2.5f));
+}
+
+int main(int an, char** av) {
+  ::testing::InitGoogleTest(&an, av);
+  return RUN_ALL_TESTS();
+}
@@ -19,6 +19,8 @@ from tensorflow.keras.layers import Dense, Dropout, Conv1D, MaxPooling1D, Flatte
 
 import flwr as fl
 
+import fedavg_io
+
 def cnn_lstm_gru_model(input_shape, num_classes):
     model = Sequential([
         Input(shape=input_shape),
@@ -68,6 +70,8 @@ if __name__ == "__main__":
     parser.add_argument("-p", "--port", help="Aggregator server's serving port", default=8000, type=int)
     parser.add_argument("-i", "--id", help="client ID", default=1, type=int)
     parser.add_argument("-d", "--dataset", help="dataset directory", default="../federated_datasets/")
+    parser.add_argument("--rounds", help="rounds to train when using --update-dir", default=1, type=int)
+    parser.add_argument("--update-dir", help="exchange updates with example_app's aggregator through this directory instead of Flower", default=None)
     args = parser.parse_args()
 
     try:
@@ -158,6 +162,21 @@ if __name__ == "__main__":
             #     return loss, len(X_test), {"accuracy": accuracy, "f1_score": f1, "high_intrusion": True}
             return loss, len(X_test), {"accuracy": accuracy, "f1_score": f1, "recall": recall, "precision": precision}
                 
+    if args.update_dir:
+        # Weights travel over example_app's attested channel to its native
+        # FedAvg aggregator instead of Flower's gRPC link.
+        os.makedirs(args.update_dir, exist_ok=True)
+        client = Client()
+        weights = client.get_parameters({})
+        for rnd in range(1, args.rounds + 1):
+            print(f"[ROUND] {rnd}", flush=True)
+            weights, num_examples, _ = client.fit(weights, {"server_round": rnd})
+            path = os.path.abspath(os.path.join(args.update_dir, f"client{args.id}_round{rnd}.fav"))
+            weights = fedavg_io.exchange_update(path, rnd, num_examples, weights)
+            loss, _, metrics = client.evaluate(weights, {})
+            print(f"[Round {rnd}] loss={loss:.4f} {metrics}", flush=True)
+        sys.exit(0)
+
     # fl.client.start_numpy_client(server_address=f"{args.address}:{args.port}", client=Client())
     fl.client.start_client(
     server_address=f"{args.address}:{args.port}",
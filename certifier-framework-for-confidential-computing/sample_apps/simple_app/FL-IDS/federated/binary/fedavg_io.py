@@ -0,0 +1,67 @@
+# Model updates for the certifier server's native FedAvg aggregator.
+#
+# A model is a list of float32 tensors, stored little endian as
+#   b"\0FAV" | u32 version | u32 round | u64 num_examples | u32 num_tensors
+#   then per tensor: u32 ndim | u32 dims[ndim] | f32 values[prod(dims)]
+# (see "Model updates" in sample_apps/common/example_app.cc).  The client
+# writes its update to a file and prints "[UPDATE] <path>"; example_app
+# sends it over the attested channel and drops the averaged model next to
+# it as <path>.global, or the server's refusal as <path>.err.
+
+import os
+import struct
+import time
+
+import numpy as np
+
+MAGIC = b"\0FAV"
+VERSION = 1
+
+
+def write_model(path, server_round, num_examples, weights):
+    parts = [MAGIC, struct.pack("<IIQI", VERSION, server_round, num_examples, len(weights))]
+    for w in weights:
+        a = np.ascontiguousarray(w, dtype="<f4")
+        parts.append(struct.pack(f"<I{a.ndim}I", a.ndim, *a.shape))
+        parts.append(a.tobytes())
+    tmp = path + ".tmp"
+    with open(tmp, "wb") as f:
+        f.write(b"".join(parts))
+    os.replace(tmp, path)
+
+
+def read_model(path):
+    with open(path, "rb") as f:
+        b = f.read()
+    if b[:4] != MAGIC:
+        raise ValueError(f"{path}: not a model file")
+    version, server_round, num_examples, num_tensors = struct.unpack_from("<IIQI", b, 4)
+    if version != VERSION:
+        raise ValueError(f"{path}: unsupported version {version}")
+    pos = 24
+    weights = []
+    for _ in range(num_tensors):
+        (ndim,) = struct.unpack_from("<I", b, pos)
+        dims = struct.unpack_from(f"<{ndim}I", b, pos + 4)
+        pos += 4 + 4 * ndim
+        count = int(np.prod(dims, dtype=np.int64))
+        weights.append(np.frombuffer(b, dtype="<f4", count=count, offset=pos).reshape(dims).copy())
+        pos += 4 * count
+    return server_round, num_examples, weights
+
+
+def exchange_update(path, server_round, num_examples, weights, poll_s=0.05):
+    """Hand an update to example_app and wait for the round's averaged weights."""
+    for suffix in (".global", ".err"):
+        if os.path.exists(path + suffix):
+            os.remove(path + suffix)
+    write_model(path, server_round, num_examples, weights)
+    print(f"[UPDATE] {path}", flush=True)
+    while True:
+        if os.path.exists(path + ".global"):
+            _, _, averaged = read_model(path + ".global")
+            return averaged
+        if os.path.exists(path + ".err"):
+            with open(path + ".err") as f:
+                raise RuntimeError(f"update for round {server_round} rejected: {f.read().strip()}")
+        time.sleep(poll_s)
@@ -53,14 +53,16 @@ robj = $(O)/example_key_rotation.o $(O)/certifier.pb.o $(O)/certifier.o $(O)/cer
        $(O)/support.o $(O)/simulated_enclave.o $(O)/application_enclave.o $(O)/cc_helpers.o \
        $(O)/cc_useful.o
 
-all:	example_app.exe example_key_rotation.exe
+tobj = $(O)/fedavg_tests.o
+
+all:	example_app.exe example_key_rotation.exe fedavg_tests.exe
 clean:
 	@echo "removing generated files"
 	rm -rf $(US)/certifier.pb.cc $(US)/certifier.pb.h $(I)/certifier.pb.h
 	@echo "removing object files"
 	rm -rf $(O)/*.o
 	@echo "removing executable file"
-	rm -rf $(EXE_DIR)/example_app.exe
+	rm -rf $(EXE_DIR)/example_app.exe $(EXE_DIR)/fedavg_tests.exe
 
 $(EXE_DIR)/example_app.exe: $(dobj)
 	@echo "\nlinking executable $@"
@@ -70,6 +72,10 @@ $(EXE_DIR)/example_key_rotation.exe: $(robj)
 	@echo "\nlinking executable $@"
 	$(LINK) $(robj) $(LDFLAGS) -o $(@D)/$@
 
+$(EXE_DIR)/fedavg_tests.exe: $(tobj)
+	@echo "\nlinking executable $@"
+	$(LINK) $(tobj) $(LDFLAGS) -o $(@D)/$@
+
 $(I)/certifier.pb.h: $(US)/certifier.pb.cc
 $(US)/certifier.pb.cc: $(CP)/certifier.proto
 	$(PROTO) --proto_path=$(<D) --cpp_out=$(@D) $<
@@ -79,7 +85,11 @@ $(O)/certifier.pb.o: $(US)/certifier.pb.cc $(I)/certifier.pb.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS_NOERROR) -o $(@D)/$@ -c $<
 
-$(O)/example_app.o: $(COMMON_SRC)/example_app.cc $(I)/certifier.h $(US)/certifier.pb.cc
+$(O)/example_app.o: $(COMMON_SRC)/example_app.cc $(COMMON_SRC)/fedavg.h $(I)/certifier.h $(US)/certifier.pb.cc
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/fedavg_tests.o: $(COMMON_SRC)/fedavg_tests.cc $(COMMON_SRC)/fedavg.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
 
@@ -25,6 +25,22 @@
 #include <openssl/hmac.h>
 #include <openssl/err.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
 #include "support.h"
 #include "certifier.h"
 #include "simulated_enclave.h"
@@ -699,6 +715,8 @@ bool certifier::framework::cc_trust_manager::fetch_store() {
 void certifier::framework::cc_trust_manager::clear_sensitive_data() {
   // Clear symmetric and private keys.
   // Not necessary on most platforms.
+  // Cached key handles hold private keys too.
+  clear_key_handle_cache();
 }
 
 //  cc_trust_manager relies on the following data in the store
@@ -1079,9 +1097,7 @@ bool certifier::framework::cc_trust_manager::generate_symmetric_key(
 
   // Make up symmetric keys (e.g.-for sealing) for app
   int num_key_bytes;
-  if (symmetric_key_algorithm_ == Enc_method_aes_256_cbc_hmac_sha256
-      || symmetric_key_algorithm_ == Enc_method_aes_256_cbc_hmac_sha384
-      || symmetric_key_algorithm_ == Enc_method_aes_256_gcm) {
+  if (authenticated_algorithm_available(symmetric_key_algorithm_.c_str())) {
     num_key_bytes = cipher_key_byte_size(symmetric_key_algorithm_.c_str());
     if (num_key_bytes <= 0) {
       printf("%s() error, line %d, Can't recover symmetric alg key size\n",
@@ -1118,9 +1134,7 @@ bool certifier::framework::cc_trust_manager::generate_sealing_key(bool regen) {
 
   // Make up symmetric keys (e.g.-for sealing)for app
   int num_key_bytes;
-  if (symmetric_key_algorithm_ == Enc_method_aes_256_cbc_hmac_sha256
-      || symmetric_key_algorithm_ == Enc_method_aes_256_cbc_hmac_sha384
-      || symmetric_key_algorithm_ == Enc_method_aes_256_gcm) {
+  if (authenticated_algorithm_available(symmetric_key_algorithm_.c_str())) {
     num_key_bytes = cipher_key_byte_size(symmetric_key_algorithm_.c_str());
     if (num_key_bytes <= 0) {
       printf("%s() error, line %d, Can't get symmetric alg key size\n",
@@ -1257,8 +1271,10 @@ bool certifier::framework::cc_trust_manager::generate_service_key(bool regen) {
 }
 
 //  public_key_alg can be rsa-2048, rsa-1024, rsa-3072, rsa-4096, ecc-384
-//  symmetric_key_alg can be aes-256-cbc-hmac-sha256, aes-256-cbc-hmac-sha384 or
-//  aes-256-gcm
+//  symmetric_key_alg can be aes-256-cbc-hmac-sha256, aes-256-cbc-hmac-sha384,
+//  aes-256-gcm, aes-256-gcm-siv (OpenSSL 3.2 and later) or
+//  chacha20-poly1305; empty picks
+//  preferred_authenticated_algorithm() for this CPU.
 bool certifier::framework::cc_trust_manager::cold_init(
     const string &public_key_alg,
     const string &symmetric_key_alg,
@@ -1297,7 +1313,10 @@ bool certifier::framework::cc_trust_manager::cold_init(
   }
 
   public_key_algorithm_ = public_key_alg;
-  symmetric_key_algorithm_ = symmetric_key_alg;
+  if (symmetric_key_alg.empty())
+    symmetric_key_algorithm_ = preferred_authenticated_algorithm();
+  else
+    symmetric_key_algorithm_ = symmetric_key_alg;
 
   // Make up symmetric keys (e.g.-for sealing)for app
   if (!generate_symmetric_key(true)) {
@@ -2253,6 +2272,13 @@ bool open_client_socket(const string &host_name, int port, int *soc) {
 }
 
 bool open_server_socket(const string &host_name, int port, int *soc) {
+  return open_server_socket(host_name, port, 10, soc);
+}
+
+bool open_server_socket(const string &host_name,
+                        int           port,
+                        int           backlog,
+                        int *         soc) {
   struct addrinfo  hints;
   struct addrinfo *result, *rp;
   int              sfd, s;
@@ -2326,7 +2352,7 @@ bool open_server_socket(const string &host_name, int port, int *soc) {
 
   freeaddrinfo(result);
 
-  if (listen(sfd, 10) != 0) {
+  if (listen(sfd, backlog) != 0) {
     printf("%s: cant listen\n", __func__);
     return false;
   }
@@ -2392,14 +2418,11 @@ bool load_server_certs_and_key(X509 *        root_cert,
                                SSL_CTX *     ctx) {
 
   // load auth key, policy_cert and certificate chain
-  // Todo: Add other key types
-  RSA *r = RSA_new();
-  if (!key_to_RSA(private_key, r)) {
-    printf("%s() error, line %d, key_to_RSA failed\n", __func__, __LINE__);
+  EVP_PKEY *auth_private_key = cached_pkey(private_key);
+  if (auth_private_key == nullptr) {
+    printf("%s() error, line %d, Can't get auth key\n", __func__, __LINE__);
     return false;
   }
-  EVP_PKEY *auth_private_key = EVP_PKEY_new();
-  EVP_PKEY_set1_RSA(auth_private_key, r);
 
   X509 *x509_auth_key_cert = X509_new();
   if (!asn1_to_x509(private_key_cert, x509_auth_key_cert)) {
@@ -2476,6 +2499,7 @@ bool load_server_certs_and_key(X509 *        root_cert,
 #  endif
 #endif  // BORING_SSL
 
+  EVP_PKEY_free(auth_private_key);
   return true;
 }
 
@@ -2491,26 +2515,17 @@ bool load_server_certs_and_key(X509 *        root_cert,
   private_key.set_certificate(private_key_cert);  // new
 
   // load auth key, policy_cert and certificate chain
-  // Todo: Add other key types
-  RSA *r = RSA_new();
-  if (r == nullptr) {
-    printf("%s() error, line %d, Can't allocate RSA key\n", __func__, __LINE__);
-    return false;
-  }
-
   bool      ret = true;
   EVP_PKEY *auth_private_key = nullptr;
   X509 *    x509_auth_key_cert = nullptr;
   STACK_OF(X509) *stack = nullptr;
 
-
-  if (!key_to_RSA(private_key, r)) {
-    printf("%s() error, line %d, key_to_RSA failed\n", __func__, __LINE__);
+  auth_private_key = cached_pkey(private_key);
+  if (auth_private_key == nullptr) {
+    printf("%s() error, line %d, Can't get auth key\n", __func__, __LINE__);
     ret = false;
     goto done;
   }
-  auth_private_key = EVP_PKEY_new();
-  EVP_PKEY_set1_RSA(auth_private_key, r);
 
   x509_auth_key_cert = X509_new();
   if (!asn1_to_x509(private_key_cert, x509_auth_key_cert)) {
@@ -2616,10 +2631,6 @@ bool load_server_certs_and_key(X509 *        root_cert,
 #endif
 
 done:
-  if (r != nullptr) {
-    RSA_free(r);
-    r = nullptr;
-  }
   if (auth_private_key != nullptr) {
     EVP_PKEY_free(auth_private_key);
     auth_private_key = nullptr;
@@ -2627,230 +2638,1017 @@ done:
   return ret;
 }
 
-bool certifier::framework::server_dispatch(
-    const string &host_name,
-    int           port,
-    const string &asn1_root_cert,
-    const string &asn1_peer_root_cert,
-    int           num_certs,
-    string *      cert_chain,
-    key_message & private_key,
-    const string &private_key_cert,
-    void (*func)(secure_authenticated_channel &)) {
+// TLS session resumption
+// ----------------------------------------------------------------------------------
+//  Client sessions (TLS 1.3 tickets) are cached per identity and peer.  The
+//  identity is a hash of our admissions cert and the peer's root, so after
+//  the admissions cert is reissued old sessions are never offered, and they
+//  are purged once the new cert caches a session for the same peer.  Each
+//  cached session is handed out once; the server issues fresh tickets on
+//  every connection.
+
+const int max_cached_tls_sessions = 256;
+const int max_tls_sessions_per_peer = 4;
+
+class tls_session_cache {
+ public:
+  // Returns a session the caller must SSL_SESSION_free, or nullptr.
+  SSL_SESSION *take(const string &identity, const string &peer) {
+    std::lock_guard<std::mutex> l(mtx_);
+    time_t now = time(nullptr);
+    for (int i = (int)entries_.size() - 1; i >= 0; i--) {
+      if (entries_[i].identity != identity || entries_[i].peer != peer)
+        continue;
+      SSL_SESSION *s = entries_[i].session;
+      entries_.erase(entries_.begin() + i);
+      if (SSL_SESSION_get_time(s) + SSL_SESSION_get_timeout(s) > now)
+        return s;
+      SSL_SESSION_free(s);
+    }
+    return nullptr;
+  }
+
+  void put(const string &identity, const string &peer, SSL_SESSION *s) {
+    std::lock_guard<std::mutex> l(mtx_);
+    int same = 0;
+    for (int i = (int)entries_.size() - 1; i >= 0; i--) {
+      if (entries_[i].peer != peer)
+        continue;
+      if (entries_[i].identity != identity
+          || ++same >= max_tls_sessions_per_peer) {
+        SSL_SESSION_free(entries_[i].session);
+        entries_.erase(entries_.begin() + i);
+      }
+    }
+    // Keep a copy: OpenSSL marks the connection's own session object
+    // unresumable if the connection is freed without a TLS shutdown.
+    SSL_SESSION *copy = SSL_SESSION_dup(s);
+    if (copy == nullptr)
+      return;
+    entry e;
+    e.identity = identity;
+    e.peer = peer;
+    e.session = copy;
+    entries_.push_back(e);
+    while ((int)entries_.size() > max_cached_tls_sessions) {
+      SSL_SESSION_free(entries_.front().session);
+      entries_.pop_front();
+    }
+  }
 
-#ifdef DEBUG
-  printf("\nserver_dispatch\n");
-  printf("ans1_root_cert: ");
-  print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
-  printf("\n");
-  printf("ans1_peer_root_cert: ");
-  print_bytes(asn1_peer_root_cert.size(), (byte *)asn1_peer_root_cert.data());
-  printf("\n");
-  printf("private_key_cert: ");
-  print_bytes(private_key_cert.size(), (byte *)private_key_cert.data());
-  printf("\n");
-  printf("private_key: ");
-  print_key(private_key);
-  printf("\n");
-#endif
+  void clear() {
+    std::lock_guard<std::mutex> l(mtx_);
+    for (unsigned i = 0; i < entries_.size(); i++)
+      SSL_SESSION_free(entries_[i].session);
+    entries_.clear();
+  }
+
+  // Format: repeated [int peer size][peer][int der size][der session].
+  bool serialize(const string &identity, string *out) {
+    std::lock_guard<std::mutex> l(mtx_);
+    out->clear();
+    for (unsigned i = 0; i < entries_.size(); i++) {
+      if (entries_[i].identity != identity)
+        continue;
+      int len = i2d_SSL_SESSION(entries_[i].session, nullptr);
+      if (len <= 0)
+        continue;
+      string der;
+      der.resize(len);
+      byte *p = (byte *)&der[0];
+      i2d_SSL_SESSION(entries_[i].session, &p);
+      int peer_size = entries_[i].peer.size();
+      out->append((char *)&peer_size, sizeof(int));
+      out->append(entries_[i].peer);
+      out->append((char *)&len, sizeof(int));
+      out->append(der);
+    }
+    return true;
+  }
 
-  OPENSSL_init_ssl(0, NULL);
-  SSL_load_error_strings();
+  bool deserialize(const string &identity, const string &in) {
+    size_t pos = 0;
+    while (pos < in.size()) {
+      int peer_size = 0;
+      int len = 0;
+      if (in.size() - pos < sizeof(int))
+        return false;
+      memcpy(&peer_size, in.data() + pos, sizeof(int));
+      pos += sizeof(int);
+      if (peer_size < 0 || in.size() - pos < (size_t)peer_size + sizeof(int))
+        return false;
+      string peer(in, pos, peer_size);
+      pos += peer_size;
+      memcpy(&len, in.data() + pos, sizeof(int));
+      pos += sizeof(int);
+      if (len < 0 || in.size() - pos < (size_t)len)
+        return false;
+      const byte * p = (const byte *)in.data() + pos;
+      SSL_SESSION *s = d2i_SSL_SESSION(nullptr, &p, len);
+      pos += len;
+      if (s == nullptr)
+        continue;
+      if (SSL_SESSION_is_resumable(s)
+          && SSL_SESSION_get_time(s) + SSL_SESSION_get_timeout(s)
+                 > time(nullptr))
+        put(identity, peer, s);
+      SSL_SESSION_free(s);
+    }
+    return true;
+  }
+
+ private:
+  struct entry {
+    string       identity;
+    string       peer;
+    SSL_SESSION *session;
+  };
+  std::mutex        mtx_;
+  std::deque<entry> entries_;  // oldest first
+};
+
+// Never destroyed: sessions must not be freed after OpenSSL's atexit cleanup.
+static tls_session_cache &client_sessions() {
+  static tls_session_cache *cache = new tls_session_cache();
+  return *cache;
+}
+
+const int tls_identity_size = 32;
+
+static string tls_session_identity(const string &my_cert,
+                                   const string &peer_root_cert) {
+  string both(my_cert);
+  both.append(peer_root_cert);
+  byte digest[tls_identity_size];
+  if (!digest_message(Digest_method_sha_256,
+                      (byte *)both.data(),
+                      both.size(),
+                      digest,
+                      sizeof(digest)))
+    return "";
+  return string((char *)digest, sizeof(digest));
+}
+
+static int cache_new_client_session(SSL *ssl, SSL_SESSION *s) {
+  secure_authenticated_channel *c =
+      (secure_authenticated_channel *)SSL_get_app_data(ssl);
+  if (c == nullptr || c->session_key_.size() <= tls_identity_size + 1)
+    return 0;
+  if (SSL_SESSION_is_resumable(s)) {
+    client_sessions().put(c->session_key_.substr(0, tls_identity_size),
+                          c->session_key_.substr(tls_identity_size + 1),
+                          s);
+  }
+  // The cache keeps its own copy.
+  return 0;
+}
+
+// Hand the sessions ctx receives to the cache.
+static void enable_client_session_cache(SSL_CTX *ctx) {
+  SSL_CTX_set_session_cache_mode(ctx,
+                                 SSL_SESS_CACHE_CLIENT
+                                     | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, cache_new_client_session);
+}
+
+// Offer a cached session for identity on c's SSL.
+static void offer_cached_session(secure_authenticated_channel *c,
+                                 const string &                identity,
+                                 const string &                host_name,
+                                 int                           port) {
+  if (identity.size() != tls_identity_size)
+    return;
+  string peer = host_name + ":" + std::to_string(port);
+  c->session_key_ = identity + "|" + peer;
+  SSL_set_app_data(c->ssl_, c);
+
+  SSL_SESSION *s = client_sessions().take(identity, peer);
+  if (s != nullptr) {
+    SSL_set_session(c->ssl_, s);
+    SSL_SESSION_free(s);
+  }
+}
+
+// Offer a cached session on c's SSL and cache the tickets it receives.
+static void enable_client_resumption(secure_authenticated_channel *c,
+                                     const string &                host_name,
+                                     int                           port) {
+  enable_client_session_cache(c->ssl_ctx_);
+  offer_cached_session(
+      c,
+      tls_session_identity(c->asn1_my_cert_, c->asn1_peer_root_cert_),
+      host_name,
+      port);
+}
+
+// Servers bind sessions to their admissions cert so tickets from before a
+// reissue are not accepted.
+static void set_server_session_context(SSL_CTX *ctx, const string &auth_cert) {
+  byte sid[SSL_MAX_SID_CTX_LENGTH];
+  if (digest_message(Digest_method_sha_256,
+                     (byte *)auth_cert.data(),
+                     auth_cert.size(),
+                     sid,
+                     sizeof(sid)))
+    SSL_CTX_set_session_id_context(ctx, sid, sizeof(sid));
+}
+
+void certifier::framework::clear_tls_session_cache() {
+  client_sessions().clear();
+}
+
+bool certifier::framework::cc_trust_manager::save_tls_sessions(
+    const string &file_name) {
+  string identity = tls_session_identity(serialized_primary_admissions_cert_,
+                                         serialized_policy_cert_);
+  string serialized;
+  if (!client_sessions().serialize(identity, &serialized)) {
+    printf("%s() error, line %d, can't serialize sessions\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  int  size_protected_blob = serialized.size() + max_pad_size_for_store;
+  byte protected_blob[size_protected_blob];
 
-  X509 *root_cert = X509_new();
-  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
-    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+  byte pkb[max_symmetric_key_size_];
+  memset(pkb, 0, max_symmetric_key_size_);
+  int num_key_bytes = cipher_key_byte_size(symmetric_key_algorithm_.c_str());
+  if (num_key_bytes <= 0) {
+    printf("%s() error, line %d, can't get key size\n", __func__, __LINE__);
     return false;
   }
-  X509 *peer_root_cert = X509_new();
-  if (!asn1_to_x509(asn1_peer_root_cert, peer_root_cert)) {
-    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+  if (!get_random(8 * num_key_bytes, pkb)) {
+    printf("%s() error, line %d, can't generate key\n", __func__, __LINE__);
     return false;
   }
+  key_message pk;
+  pk.set_key_name("protect-key");
+  pk.set_key_type(symmetric_key_algorithm_);
+  pk.set_key_format("vse-key");
+  pk.set_secret_key_bits(pkb, num_key_bytes);
 
-  // Get a socket.
-  int sock = -1;
-  if (!open_server_socket(host_name, port, &sock)) {
-    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+  if (!protect_blob(enclave_type_,
+                    pk,
+                    serialized.size(),
+                    (byte *)serialized.data(),
+                    &size_protected_blob,
+                    protected_blob)) {
+    printf("%s() error, line %d, can't protect blob\n", __func__, __LINE__);
+    return false;
+  }
+  if (!write_file(file_name, size_protected_blob, protected_blob)) {
+    printf("%s() error, line %d, can't write %s\n",
            __func__,
            __LINE__,
-           host_name.c_str(),
-           port);
+           file_name.c_str());
     return false;
   }
+  return true;
+}
 
-  // Set up TLS handshake data.
-  SSL_METHOD *method = (SSL_METHOD *)TLS_server_method();
-  SSL_CTX *   ctx = SSL_CTX_new(method);
-  if (ctx == NULL) {
-    printf("%s() error, line %d, SSL_CTX_new failed (1)\n", __func__, __LINE__);
+bool certifier::framework::cc_trust_manager::restore_tls_sessions(
+    const string &file_name) {
+  int size_protected_blob = file_size(file_name);
+  if (size_protected_blob <= 0) {
+    printf("%s() error, line %d, can't read %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
     return false;
   }
-  X509_STORE *cs = SSL_CTX_get_cert_store(ctx);
-  X509_STORE_add_cert(cs, peer_root_cert);
+  byte protected_blob[size_protected_blob];
+  int  size_unprotected_blob = size_protected_blob;
+  byte unprotected_blob[size_unprotected_blob];
 
-  X509 *x509_auth_cert = X509_new();
-  if (asn1_to_x509(private_key_cert, x509_auth_cert)) {
-    X509_STORE_add_cert(cs, x509_auth_cert);
-  } else {
-    printf("DIDNT ADD AUTH CERT\n");
+  if (!read_file(file_name, &size_protected_blob, protected_blob)) {
+    printf("%s() error, line %d, can't read %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
   }
 
-  if (!load_server_certs_and_key(root_cert,
-                                 peer_root_cert,
-                                 num_certs,
-                                 cert_chain,
-                                 private_key,
-                                 private_key_cert,
-                                 ctx)) {
-    printf("%s() error, line %d, SSL_CTX_new failed (2)\n", __func__, __LINE__);
+  key_message pk;
+  pk.set_key_name("protect-key");
+  pk.set_key_type(symmetric_key_algorithm_);
+  pk.set_key_format("vse-key");
+  if (!unprotect_blob(enclave_type_,
+                      size_protected_blob,
+                      protected_blob,
+                      &pk,
+                      &size_unprotected_blob,
+                      unprotected_blob)) {
+    printf("%s() error, line %d, can't unprotect\n", __func__, __LINE__);
     return false;
   }
 
-  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
-  SSL_CTX_set_options(ctx, flags);
+  string identity = tls_session_identity(serialized_primary_admissions_cert_,
+                                         serialized_policy_cert_);
+  string serialized((char *)unprotected_blob, size_unprotected_blob);
+  return client_sessions().deserialize(identity, serialized);
+}
 
-#if 0
-  // This is unnecessary usually.
-  if(!isRoot()) {
-    printf("server_dispatch: This program must be run as root/sudo user!!");
-    return false;
-  }
-#endif
+// Channel contexts
+// ----------------------------------------------------------------------------------
 
-  // Verify peer
-  SSL_CTX_set_verify(ctx,
-                     SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
-                     nullptr);
-#ifdef DEBUG
-  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
-#endif
+certifier::framework::channel_context::channel_context() {
+  initialized_ = false;
+  root_cert_ = nullptr;
+  peer_root_cert_ = nullptr;
+  my_cert_ = nullptr;
+  auth_key_ = nullptr;
+  store_ = nullptr;
+  client_ctx_ = nullptr;
+  server_ctx_ = nullptr;
+}
 
-  // Testing hook: Allow pytests to invoke with NULL 'func' hdlr.
-  // Close socket before exiting, so we don't have unpredictable
-  // behaviour when tests are run on CI machines.
-  if (!func) {
-    close(sock);
-    return true;
-  }
+certifier::framework::channel_context::~channel_context() {
+  initialized_ = false;
+  if (client_ctx_ != nullptr)
+    SSL_CTX_free(client_ctx_);
+  client_ctx_ = nullptr;
+  if (server_ctx_ != nullptr)
+    SSL_CTX_free(server_ctx_);
+  server_ctx_ = nullptr;
+  if (store_ != nullptr)
+    X509_STORE_free(store_);
+  store_ = nullptr;
+  if (auth_key_ != nullptr)
+    EVP_PKEY_free(auth_key_);
+  auth_key_ = nullptr;
+  if (my_cert_ != nullptr)
+    X509_free(my_cert_);
+  my_cert_ = nullptr;
+  if (peer_root_cert_ != nullptr)
+    X509_free(peer_root_cert_);
+  peer_root_cert_ = nullptr;
+  if (root_cert_ != nullptr)
+    X509_free(root_cert_);
+  root_cert_ = nullptr;
+  session_identity_.clear();
+}
 
-  while (1) {
-#ifdef DEBUG
-    printf("at accept\n");
+// Load the admissions cert and auth key into ssl_ctx, with chain as the
+// certificate chain (may be empty).
+static bool use_context_cert_and_key(SSL_CTX *ssl_ctx,
+                                     const channel_context &ctx,
+                                     STACK_OF(X509) * chain) {
+#ifdef BORING_SSL
+  if (!SSL_CTX_use_certificate(ssl_ctx, ctx.my_cert_)) {
+    printf("%s() error, line %d, use cert failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (!SSL_CTX_use_PrivateKey(ssl_ctx, ctx.auth_key_)) {
+    printf("%s() error, line %d, use priv key failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (!SSL_CTX_set1_chain(ssl_ctx, chain)) {
+    printf("%s() error, line %d, set1 chain error\n", __func__, __LINE__);
+    return false;
+  }
+  if (sk_X509_num(chain) == 0)
+    SSL_CTX_add1_chain_cert(ssl_ctx, ctx.peer_root_cert_);
+#else
+  if (SSL_CTX_use_cert_and_key(ssl_ctx, ctx.my_cert_, ctx.auth_key_, chain, 1)
+      <= 0) {
+    printf("%s() error, line %d, SSL_CTX_use_cert_and_key failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  SSL_CTX_add1_to_CA_list(ssl_ctx, ctx.peer_root_cert_);
 #endif
-    struct sockaddr_in addr;
-    unsigned int       len = sizeof(sockaddr_in);
-    int                client = accept(sock, (struct sockaddr *)&addr, &len);
-    string             my_role("server");
-    secure_authenticated_channel nc(my_role);
-    if (!nc.init_server_ssl(host_name,
-                            port,
-                            asn1_root_cert,
-                            asn1_peer_root_cert,
-                            num_certs,
-                            cert_chain,
-                            private_key,
-                            private_key_cert)) {
-      continue;
-    }
-    nc.ssl_ = SSL_new(ctx);
-    SSL_set_fd(nc.ssl_, client);
-    nc.sock_ = client;
-    nc.server_channel_accept_and_auth(func);
+
+  if (!SSL_CTX_check_private_key(ssl_ctx)) {
+    printf("%s() error, line %d, SSL_CTX_check_private_key failed\n",
+           __func__,
+           __LINE__);
+    return false;
   }
   return true;
 }
 
-bool certifier::framework::server_dispatch(
-    const string &host_name,
-    int           port,
+bool certifier::framework::channel_context::init(
     const string &asn1_root_cert,
+    const string &asn1_peer_root_cert,
     key_message & private_key,
-    const string &private_key_cert,
-    void (*func)(secure_authenticated_channel &)) {
+    const string &private_key_cert) {
 
-#ifdef DEBUG
-  printf("\nserver_dispatch\n");
-  printf("ans1_root_cert: ");
-  print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
-  printf("\n");
-  printf("private_key_cert: ");
-  print_bytes(private_key_cert.size(), (byte *)private_key_cert.data());
-  printf("\n");
-  printf("private_key: ");
-  print_key(private_key);
-  printf("\n");
-#endif
+  if (initialized_ || root_cert_ != nullptr) {
+    printf("%s() error, line %d, context already initialized\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
 
   OPENSSL_init_ssl(0, NULL);
   SSL_load_error_strings();
 
-  X509 *root_cert = X509_new();
-  if (!asn1_to_x509(asn1_root_cert, root_cert)) {
-    printf("%s() error, line %d, Can't convert cert\n", __func__, __LINE__);
+  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
+  bool       ret = true;
+  STACK_OF(X509) *chain = nullptr;
+
+  asn1_root_cert_.assign(asn1_root_cert.data(), asn1_root_cert.size());
+  asn1_peer_root_cert_.assign(asn1_peer_root_cert.data(),
+                              asn1_peer_root_cert.size());
+  asn1_my_cert_.assign(private_key_cert.data(), private_key_cert.size());
+
+  root_cert_ = X509_new();
+  if (!asn1_to_x509(asn1_root_cert_, root_cert_)) {
+    printf("%s() error, line %d, root cert invalid\n", __func__, __LINE__);
     return false;
   }
-
-  // Get a socket.
-  int sock = -1;
-  if (!open_server_socket(host_name, port, &sock)) {
-    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+  peer_root_cert_ = X509_new();
+  if (!asn1_to_x509(asn1_peer_root_cert_, peer_root_cert_)) {
+    printf("%s() error, line %d, peer root cert invalid\n", __func__, __LINE__);
+    return false;
+  }
+  my_cert_ = X509_new();
+  if (!asn1_to_x509(asn1_my_cert_, my_cert_)) {
+    printf("%s() error, line %d, admissions cert invalid %d\n",
            __func__,
            __LINE__,
-           host_name.c_str(),
-           port);
+           (int)asn1_my_cert_.size());
     return false;
   }
-
-  // Set up TLS handshake data.
-  SSL_METHOD *method = (SSL_METHOD *)TLS_server_method();
-  SSL_CTX *   ctx = SSL_CTX_new(method);
-  if (ctx == NULL) {
-    printf("%s() error, line %d, SSL_CTX_new failed (1)\n", __func__, __LINE__);
+  auth_key_ = cached_pkey(private_key);
+  if (auth_key_ == nullptr) {
+    printf("%s() error, line %d, can't convert auth key\n", __func__, __LINE__);
     return false;
   }
-  X509_STORE *cs = SSL_CTX_get_cert_store(ctx);
-  X509_STORE_add_cert(cs, root_cert);
-
-  X509 *x509_auth_cert = X509_new();
-  if (asn1_to_x509(private_key_cert, x509_auth_cert)) {
-    X509_STORE_add_cert(cs, x509_auth_cert);
-  }
 
-  if (!load_server_certs_and_key(root_cert,
-                                 private_key,
-                                 private_key_cert,
-                                 ctx)) {
-    printf("%s() error, line %d, SSL_CTX_new failed (2)\n", __func__, __LINE__);
+  // Both roles verify peers against the same store.
+  store_ = X509_STORE_new();
+  if (store_ == nullptr) {
+    printf("%s() error, line %d, can't allocate store\n", __func__, __LINE__);
     return false;
   }
+  X509_STORE_add_cert(store_, peer_root_cert_);
+  X509_STORE_add_cert(store_, my_cert_);
 
-  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
-  SSL_CTX_set_options(ctx, flags);
-
-#if 0
-  // This is unnecessary usually.
-  if(!isRoot()) {
-    printf("server_dispatch: This program must be run as root/sudo user!!");
+  client_ctx_ = SSL_CTX_new(TLS_client_method());
+  server_ctx_ = SSL_CTX_new(TLS_server_method());
+  if (client_ctx_ == nullptr || server_ctx_ == nullptr) {
+    printf("%s() error, line %d, SSL_CTX_new failed\n", __func__, __LINE__);
     return false;
   }
-#endif
 
-  // Verify peer
-  SSL_CTX_set_verify(ctx,
+  // Client
+  SSL_CTX_set1_cert_store(client_ctx_, store_);
+  SSL_CTX_set_verify(client_ctx_, SSL_VERIFY_PEER, nullptr);
+  SSL_CTX_set_verify_depth(client_ctx_, 4);
+  SSL_CTX_set_options(client_ctx_, flags);
+  chain = sk_X509_new_null();
+  if (chain == nullptr || !use_context_cert_and_key(client_ctx_, *this, chain)) {
+    printf("%s() error, line %d, client cert and key failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  sk_X509_free(chain);
+  chain = nullptr;
+  enable_client_session_cache(client_ctx_);
+  session_identity_ = tls_session_identity(asn1_my_cert_, asn1_peer_root_cert_);
+
+  // Server
+  SSL_CTX_set1_cert_store(server_ctx_, store_);
+  SSL_CTX_set_options(server_ctx_, flags);
+  // As load_server_certs_and_key did, servers send the peer root as their
+  // chain.
+  chain = sk_X509_new_null();
+  if (chain == nullptr || sk_X509_push(chain, peer_root_cert_) == 0
+      || !use_context_cert_and_key(server_ctx_, *this, chain)) {
+    printf("%s() error, line %d, server cert and key failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  SSL_CTX_add_client_CA(server_ctx_, peer_root_cert_);
+  set_server_session_context(server_ctx_, asn1_my_cert_);
+  SSL_CTX_set_verify(server_ctx_,
                      SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
                      nullptr);
 #ifdef DEBUG
-  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+  SSL_CTX_set_verify(server_ctx_, SSL_VERIFY_PEER, nullptr);
 #endif
 
-  // Testing hook: Allow pytests to invoke with NULL 'func' hdlr.
-  // Close socket before exiting, so we don't have unpredictable
-  // behaviour when tests are run on CI machines.
-  if (!func) {
-    close(sock);
-    return true;
-  }
+  initialized_ = true;
+
+done:
+  if (chain != nullptr)
+    sk_X509_free(chain);
+  return ret;
+}
+
+bool certifier::framework::channel_context::init(
+    const string &asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert) {
+  return init(asn1_root_cert, asn1_root_cert, private_key, private_key_cert);
+}
+
+bool certifier::framework::channel_context::init(const cc_trust_manager &mgr) {
+  return init(mgr.serialized_policy_cert_,
+              (key_message &)mgr.private_auth_key_,
+              mgr.serialized_primary_admissions_cert_);
+}
+
+// Dispatch metrics
+// ----------------------------------------------------------------------------------
+
+class atomic_histogram {
+ public:
+  atomic_histogram() { reset(); }
+
+  void record(uint64_t v) {
+    int b = v == 0 ? 0 : 64 - __builtin_clzll(v);
+    if (b >= metrics_histogram::num_buckets)
+      b = metrics_histogram::num_buckets - 1;
+    buckets_[b].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(v, std::memory_order_relaxed);
+    uint64_t m = max_.load(std::memory_order_relaxed);
+    while (v > m && !max_.compare_exchange_weak(m, v))
+      ;
+  }
+
+  void snapshot(metrics_histogram *out) const {
+    out->count_ = count_.load();
+    out->sum_ = sum_.load();
+    out->max_ = max_.load();
+    for (int i = 0; i < metrics_histogram::num_buckets; i++)
+      out->buckets_[i] = buckets_[i].load();
+  }
+
+  void reset() {
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+    for (int i = 0; i < metrics_histogram::num_buckets; i++)
+      buckets_[i] = 0;
+  }
+
+ private:
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+  std::atomic<uint64_t> buckets_[metrics_histogram::num_buckets];
+};
+
+class metrics_registry {
+ public:
+  metrics_registry() { reset(); }
+
+  std::atomic<uint64_t> connections_accepted;
+  std::atomic<uint64_t> accept_errors;
+  std::atomic<uint64_t> handshakes_completed;
+  std::atomic<uint64_t> handshakes_resumed;
+  std::atomic<uint64_t> failures[dispatch_metrics::NUM_FAILURE_REASONS];
+  std::atomic<uint64_t> channels_closed;
+  std::atomic<uint64_t> bytes_in;
+  std::atomic<uint64_t> bytes_out;
+  atomic_histogram      queue_wait_us;
+  atomic_histogram      ssl_accept_us;
+  atomic_histogram      peer_cert_us;
+  atomic_histogram      handler_us;
+  atomic_histogram      channel_bytes_in;
+  atomic_histogram      channel_bytes_out;
+
+  void reset() {
+    connections_accepted = 0;
+    accept_errors = 0;
+    handshakes_completed = 0;
+    handshakes_resumed = 0;
+    for (int i = 0; i < dispatch_metrics::NUM_FAILURE_REASONS; i++)
+      failures[i] = 0;
+    channels_closed = 0;
+    bytes_in = 0;
+    bytes_out = 0;
+    queue_wait_us.reset();
+    ssl_accept_us.reset();
+    peer_cert_us.reset();
+    handler_us.reset();
+    channel_bytes_in.reset();
+    channel_bytes_out.reset();
+  }
+};
+
+static metrics_registry &metrics() {
+  static metrics_registry *m = new metrics_registry();
+  return *m;
+}
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - since)
+      .count();
+}
+
+static int count_bytes_in(secure_authenticated_channel *c, int n) {
+  if (n > 0) {
+    c->bytes_in_ += n;
+    metrics().bytes_in.fetch_add(n, std::memory_order_relaxed);
+  }
+  return n;
+}
+
+// Call before anything else reads the thread's OpenSSL error queue.
+static int handshake_failure_reason(SSL *ssl, int res) {
+  switch (SSL_get_error(ssl, res)) {
+    case SSL_ERROR_ZERO_RETURN:
+      return dispatch_metrics::FAIL_CLOSED;
+    case SSL_ERROR_SYSCALL:
+      return dispatch_metrics::FAIL_IO;
+    case SSL_ERROR_SSL:
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+      // OpenSSL 3 reports a peer hanging up mid-handshake this way.
+      if (ERR_GET_REASON(ERR_peek_error())
+          == SSL_R_UNEXPECTED_EOF_WHILE_READING)
+        return dispatch_metrics::FAIL_CLOSED;
+#endif
+      if (SSL_get_verify_result(ssl) != X509_V_OK)
+        return dispatch_metrics::FAIL_VERIFY;
+      return dispatch_metrics::FAIL_PROTOCOL;
+    default:
+      return dispatch_metrics::FAIL_OTHER;
+  }
+}
+
+certifier::framework::metrics_histogram::metrics_histogram() {
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+  for (int i = 0; i < num_buckets; i++)
+    buckets_[i] = 0;
+}
+
+uint64_t certifier::framework::metrics_histogram::quantile_bound(
+    double q) const {
+  if (count_ == 0)
+    return 0;
+  uint64_t target = (uint64_t)(q * count_ + 0.5);
+  if (target < 1)
+    target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < num_buckets; i++) {
+    seen += buckets_[i];
+    if (seen >= target)
+      return i == 0 ? 0 : (((uint64_t)1) << i) - 1;
+  }
+  return max_;
+}
+
+certifier::framework::dispatch_metrics::dispatch_metrics() {
+  connections_accepted_ = 0;
+  accept_errors_ = 0;
+  handshakes_completed_ = 0;
+  handshakes_resumed_ = 0;
+  for (int i = 0; i < NUM_FAILURE_REASONS; i++)
+    handshake_failures_[i] = 0;
+  channels_closed_ = 0;
+  bytes_in_ = 0;
+  bytes_out_ = 0;
+}
+
+const char *certifier::framework::dispatch_metrics::failure_name(int reason) {
+  static const char *names[NUM_FAILURE_REASONS] =
+      {"init", "verify", "protocol", "io", "closed", "other"};
+  if (reason < 0 || reason >= NUM_FAILURE_REASONS)
+    return "other";
+  return names[reason];
+}
+
+static void append_counter(string *out, const char *name, uint64_t v) {
+  *out += "# TYPE ";
+  *out += name;
+  *out += " counter\n";
+  *out += name;
+  *out += " " + std::to_string(v) + "\n";
+}
+
+static void append_histogram(string *                   out,
+                             const char *               name,
+                             const metrics_histogram &h) {
+  int last = 0;
+  for (int i = 0; i < metrics_histogram::num_buckets; i++)
+    if (h.buckets_[i] != 0)
+      last = i;
+  *out += "# TYPE ";
+  *out += name;
+  *out += " histogram\n";
+  uint64_t cumulative = 0;
+  for (int i = 0; i <= last; i++) {
+    cumulative += h.buckets_[i];
+    uint64_t le = i == 0 ? 0 : (((uint64_t)1) << i) - 1;
+    *out += string(name) + "_bucket{le=\"" + std::to_string(le) + "\"} "
+            + std::to_string(cumulative) + "\n";
+  }
+  *out += string(name) + "_bucket{le=\"+Inf\"} " + std::to_string(h.count_)
+          + "\n";
+  *out += string(name) + "_sum " + std::to_string(h.sum_) + "\n";
+  *out += string(name) + "_count " + std::to_string(h.count_) + "\n";
+}
+
+string certifier::framework::dispatch_metrics::to_text() const {
+  string out;
+  append_counter(&out,
+                 "certifier_connections_accepted_total",
+                 connections_accepted_);
+  append_counter(&out, "certifier_accept_errors_total", accept_errors_);
+  append_counter(&out,
+                 "certifier_handshakes_completed_total",
+                 handshakes_completed_);
+  append_counter(&out,
+                 "certifier_handshakes_resumed_total",
+                 handshakes_resumed_);
+  out += "# TYPE certifier_handshake_failures_total counter\n";
+  for (int i = 0; i < NUM_FAILURE_REASONS; i++) {
+    out += "certifier_handshake_failures_total{reason=\"";
+    out += failure_name(i);
+    out += "\"} " + std::to_string(handshake_failures_[i]) + "\n";
+  }
+  append_counter(&out, "certifier_channels_closed_total", channels_closed_);
+  append_counter(&out, "certifier_channel_bytes_in_total", bytes_in_);
+  append_counter(&out, "certifier_channel_bytes_out_total", bytes_out_);
+  append_histogram(&out, "certifier_queue_wait_us", queue_wait_us_);
+  append_histogram(&out, "certifier_ssl_accept_us", ssl_accept_us_);
+  append_histogram(&out, "certifier_peer_cert_us", peer_cert_us_);
+  append_histogram(&out, "certifier_handler_us", handler_us_);
+  append_histogram(&out, "certifier_channel_bytes_in", channel_bytes_in_);
+  append_histogram(&out, "certifier_channel_bytes_out", channel_bytes_out_);
+  return out;
+}
+
+void certifier::framework::get_dispatch_metrics(dispatch_metrics *out) {
+  metrics_registry &m = metrics();
+  out->connections_accepted_ = m.connections_accepted;
+  out->accept_errors_ = m.accept_errors;
+  out->handshakes_completed_ = m.handshakes_completed;
+  out->handshakes_resumed_ = m.handshakes_resumed;
+  for (int i = 0; i < dispatch_metrics::NUM_FAILURE_REASONS; i++)
+    out->handshake_failures_[i] = m.failures[i];
+  out->channels_closed_ = m.channels_closed;
+  out->bytes_in_ = m.bytes_in;
+  out->bytes_out_ = m.bytes_out;
+  m.queue_wait_us.snapshot(&out->queue_wait_us_);
+  m.ssl_accept_us.snapshot(&out->ssl_accept_us_);
+  m.peer_cert_us.snapshot(&out->peer_cert_us_);
+  m.handler_us.snapshot(&out->handler_us_);
+  m.channel_bytes_in.snapshot(&out->channel_bytes_in_);
+  m.channel_bytes_out.snapshot(&out->channel_bytes_out_);
+}
+
+void certifier::framework::reset_dispatch_metrics() {
+  metrics().reset();
+}
+
+// Sink threads share one stop flag.
+class metrics_sink_threads {
+ public:
+  metrics_sink_threads() : stopping_(false) {}
+
+  std::mutex               mtx_;
+  std::condition_variable  cv_;
+  std::atomic<bool>        stopping_;
+  std::vector<std::thread> threads_;
+
+  // Sleeps up to ms; false once stop_metrics_sinks() was called.
+  bool wait(int ms) {
+    std::unique_lock<std::mutex> l(mtx_);
+    return !cv_.wait_for(l, std::chrono::milliseconds(ms), [this] {
+      return (bool)stopping_;
+    });
+  }
+};
+
+static metrics_sink_threads &sink_threads() {
+  static metrics_sink_threads *s = new metrics_sink_threads();
+  return *s;
+}
+
+bool certifier::framework::add_metrics_callback(metrics_callback cb,
+                                                int              interval_ms) {
+  if (!cb || interval_ms <= 0) {
+    printf("%s() error, line %d, bad sink\n", __func__, __LINE__);
+    return false;
+  }
+  metrics_sink_threads &s = sink_threads();
+  std::lock_guard<std::mutex> l(s.mtx_);
+  s.threads_.push_back(std::thread([cb, interval_ms]() {
+    while (sink_threads().wait(interval_ms)) {
+      dispatch_metrics m;
+      get_dispatch_metrics(&m);
+      cb(m);
+    }
+  }));
+  return true;
+}
+
+bool certifier::framework::add_metrics_file_sink(const string &file_name,
+                                                 int           interval_ms) {
+  return add_metrics_callback(
+      [file_name](const dispatch_metrics &m) {
+        string text = m.to_text();
+        string tmp = file_name + ".tmp";
+        if (!write_file(tmp, text.size(), (byte *)text.data())
+            || rename(tmp.c_str(), file_name.c_str()) != 0) {
+          printf("add_metrics_file_sink: can't write %s\n", file_name.c_str());
+        }
+      },
+      interval_ms);
+}
+
+bool certifier::framework::add_metrics_http_sink(const string &host_name,
+                                                 int           port) {
+  int sock = -1;
+  if (!open_server_socket(host_name, port, 16, &sock)) {
+    printf("%s() error, line %d, Can't open metrics socket %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+  metrics_sink_threads &s = sink_threads();
+  std::lock_guard<std::mutex> l(s.mtx_);
+  s.threads_.push_back(std::thread([sock]() {
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    while (!sink_threads().stopping_) {
+      if (poll(&pfd, 1, 200) <= 0)
+        continue;
+      int client = accept(sock, nullptr, nullptr);
+      if (client < 0)
+        continue;
+      // Any request gets the metrics; read it so the close is clean.
+      struct timeval tv = {1, 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      char req[4096];
+      if (::read(client, req, sizeof(req)) < 0) {
+        ::close(client);
+        continue;
+      }
+      dispatch_metrics m;
+      get_dispatch_metrics(&m);
+      string body = m.to_text();
+      string resp = "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: "
+                    + std::to_string(body.size()) + "\r\n\r\n" + body;
+      size_t off = 0;
+      while (off < resp.size()) {
+        ssize_t k = ::send(client, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (k <= 0)
+          break;
+        off += k;
+      }
+      ::close(client);
+    }
+    ::close(sock);
+  }));
+  return true;
+}
+
+void certifier::framework::stop_metrics_sinks() {
+  metrics_sink_threads &s = sink_threads();
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> l(s.mtx_);
+    s.stopping_ = true;
+    threads.swap(s.threads_);
+  }
+  s.cv_.notify_all();
+  for (unsigned i = 0; i < threads.size(); i++)
+    threads[i].join();
+  std::lock_guard<std::mutex> l(s.mtx_);
+  s.stopping_ = false;
+}
+
+// Connection dispatch
+// ----------------------------------------------------------------------------------
+
+// Accepted socket and when accept returned it.
+struct pending_connection {
+  int                                   fd;
+  std::chrono::steady_clock::time_point accepted;
+};
+
+// Bounded queue of accepted sockets waiting for a dispatch worker.
+class dispatch_queue {
+ public:
+  dispatch_queue(int max_pending) : max_pending_(max_pending) {}
+
+  // Blocks while the queue is full.
+  void push(const pending_connection &c) {
+    std::unique_lock<std::mutex> l(mtx_);
+    not_full_.wait(l, [this] { return (int)fds_.size() < max_pending_; });
+    fds_.push_back(c);
+    not_empty_.notify_one();
+  }
+
+  // Blocks while the queue is empty.  Fails once the queue is closed and
+  // every queued connection has been taken.
+  bool pop(pending_connection *c) {
+    std::unique_lock<std::mutex> l(mtx_);
+    not_empty_.wait(l, [this] { return closed_ || !fds_.empty(); });
+    if (fds_.empty())
+      return false;
+    *c = fds_.front();
+    fds_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> l(mtx_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  int                            max_pending_;
+  bool                           closed_ = false;
+  std::deque<pending_connection> fds_;
+  std::mutex              mtx_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+// accept fails this way once the listening socket is shut down or closed.
+static bool listener_closed(int err) {
+  return err == EBADF || err == EINVAL || err == ENOTSOCK;
+}
+
+// Handshake and run func on one accepted connection.
+static void serve_connection(const pending_connection &client,
+                             const channel_context &   ctx,
+                             void (*func)(secure_authenticated_channel &)) {
+  metrics().queue_wait_us.record(elapsed_us(client.accepted));
+  string                       my_role("server");
+  secure_authenticated_channel nc(my_role);
+  if (!nc.init_server_ssl(ctx)) {
+    metrics().failures[dispatch_metrics::FAIL_INIT]++;
+    ::close(client.fd);
+    return;
+  }
+  nc.ssl_ = SSL_new(nc.ssl_ctx_);
+  if (nc.ssl_ == nullptr) {
+    metrics().failures[dispatch_metrics::FAIL_INIT]++;
+    ::close(client.fd);
+    return;
+  }
+  SSL_set_fd(nc.ssl_, client.fd);
+  nc.sock_ = client.fd;
+  nc.server_channel_accept_and_auth(func);
+}
+
+// Accept loop shared by the server_dispatch variants.  If num_workers is 0,
+// connections are served one at a time on the calling thread.  Returns
+// once sock is shut down and the connections already accepted are served.
+static bool dispatch_connections(int                    sock,
+                                 const channel_context &ctx,
+                                 int                    num_workers,
+                                 int                    max_pending,
+                                 void (*func)(secure_authenticated_channel &)) {
+  if (num_workers <= 0) {
+    while (1) {
+#ifdef DEBUG
+      printf("at accept\n");
+#endif
+      struct sockaddr_in addr;
+      unsigned int       len = sizeof(sockaddr_in);
+      int                client = accept(sock, (struct sockaddr *)&addr, &len);
+      if (client < 0) {
+        if (listener_closed(errno))
+          break;
+        metrics().accept_errors++;
+        printf("%s() error, line %d, accept failed\n", __func__, __LINE__);
+        continue;
+      }
+      metrics().connections_accepted++;
+      serve_connection({client, std::chrono::steady_clock::now()}, ctx, func);
+    }
+    return true;
+  }
+
+  if (max_pending <= 0)
+    max_pending = num_workers;
+
+  dispatch_queue           pending(max_pending);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_workers; i++) {
+    workers.push_back(std::thread([&pending, &ctx, func]() {
+      pending_connection c;
+      while (pending.pop(&c)) {
+        serve_connection(c, ctx, func);
+      }
+    }));
+  }
 
   while (1) {
 #ifdef DEBUG
@@ -2859,39 +3657,227 @@ bool certifier::framework::server_dispatch(
     struct sockaddr_in addr;
     unsigned int       len = sizeof(sockaddr_in);
     int                client = accept(sock, (struct sockaddr *)&addr, &len);
-    string             my_role("server");
-    secure_authenticated_channel nc(my_role);
-    if (!nc.init_server_ssl(host_name,
-                            port,
-                            asn1_root_cert,
-                            private_key,
-                            private_key_cert)) {
+    if (client < 0) {
+      if (listener_closed(errno))
+        break;
+      metrics().accept_errors++;
+      printf("%s() error, line %d, accept failed\n", __func__, __LINE__);
       continue;
     }
-    nc.ssl_ = SSL_new(ctx);
-    SSL_set_fd(nc.ssl_, client);
-    nc.sock_ = client;
-    nc.server_channel_accept_and_auth(func);
+    metrics().connections_accepted++;
+    pending.push({client, std::chrono::steady_clock::now()});
   }
+
+  pending.close();
+  for (unsigned i = 0; i < workers.size(); i++)
+    workers[i].join();
   return true;
 }
 
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    const string &asn1_root_cert,
+    const string &asn1_peer_root_cert,
+    int           num_certs,
+    string *      cert_chain,
+    key_message & private_key,
+    const string &private_key_cert,
+    void (*func)(secure_authenticated_channel &)) {
+  return server_dispatch(host_name,
+                         port,
+                         asn1_root_cert,
+                         asn1_peer_root_cert,
+                         num_certs,
+                         cert_chain,
+                         private_key,
+                         private_key_cert,
+                         0,
+                         0,
+                         func);
+}
+
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    const string &asn1_root_cert,
+    const string &asn1_peer_root_cert,
+    int           num_certs,
+    string *      cert_chain,
+    key_message & private_key,
+    const string &private_key_cert,
+    int           num_workers,
+    int           max_pending,
+    void (*func)(secure_authenticated_channel &)) {
+
+#ifdef DEBUG
+  printf("\nserver_dispatch\n");
+  printf("ans1_root_cert: ");
+  print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
+  printf("\n");
+  printf("ans1_peer_root_cert: ");
+  print_bytes(asn1_peer_root_cert.size(), (byte *)asn1_peer_root_cert.data());
+  printf("\n");
+  printf("private_key_cert: ");
+  print_bytes(private_key_cert.size(), (byte *)private_key_cert.data());
+  printf("\n");
+  printf("private_key: ");
+  print_key(private_key);
+  printf("\n");
+#endif
+
+  // Intermediate certs are not used yet; see load_server_certs_and_key,
+  // which also recorded the cert in private_key.
+  private_key.set_certificate(private_key_cert);
+  channel_context ctx;
+  if (!ctx.init(asn1_root_cert,
+                asn1_peer_root_cert,
+                private_key,
+                private_key_cert)) {
+    printf("%s() error, line %d, Can't initialize channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return server_dispatch(host_name, port, ctx, num_workers, max_pending, func);
+}
+
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    const string &asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert,
+    void (*func)(secure_authenticated_channel &)) {
+  return server_dispatch(host_name,
+                         port,
+                         asn1_root_cert,
+                         private_key,
+                         private_key_cert,
+                         0,
+                         0,
+                         func);
+}
+
+bool certifier::framework::server_dispatch(
+    const string &host_name,
+    int           port,
+    const string &asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert,
+    int           num_workers,
+    int           max_pending,
+    void (*func)(secure_authenticated_channel &)) {
+
+#ifdef DEBUG
+  printf("\nserver_dispatch\n");
+  printf("ans1_root_cert: ");
+  print_bytes(asn1_root_cert.size(), (byte *)asn1_root_cert.data());
+  printf("\n");
+  printf("private_key_cert: ");
+  print_bytes(private_key_cert.size(), (byte *)private_key_cert.data());
+  printf("\n");
+  printf("private_key: ");
+  print_key(private_key);
+  printf("\n");
+#endif
+
+  channel_context ctx;
+  if (!ctx.init(asn1_root_cert, private_key, private_key_cert)) {
+    printf("%s() error, line %d, Can't initialize channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return server_dispatch(host_name, port, ctx, num_workers, max_pending, func);
+}
+
 bool certifier::framework::server_dispatch(
     const string &          host_name,
     int                     port,
     const cc_trust_manager &mgr,
     void (*func)(secure_authenticated_channel &)) {
+  return server_dispatch(host_name, port, mgr, 0, 0, func);
+}
 
-  return server_dispatch(
-      host_name,
-      port,
-      (string &)mgr.serialized_policy_cert_,  // Policy-certificate / Root cert
-      (key_message &)mgr.private_auth_key_,  // Private key (whose public key is
-                                             // named in the admission cert)
+bool certifier::framework::server_dispatch(
+    const string &          host_name,
+    int                     port,
+    const cc_trust_manager &mgr,
+    int                     num_workers,
+    int                     max_pending,
+    void (*func)(secure_authenticated_channel &)) {
+  channel_context ctx;
+  if (!ctx.init(mgr)) {
+    printf("%s() error, line %d, Can't initialize channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return server_dispatch(host_name, port, ctx, num_workers, max_pending, func);
+}
+
+bool certifier::framework::server_dispatch(
+    const string &         host_name,
+    int                    port,
+    const channel_context &ctx,
+    int                    num_workers,
+    int                    max_pending,
+    void (*func)(secure_authenticated_channel &)) {
+
+  if (!ctx.initialized_) {
+    printf("%s() error, line %d, channel context not initialized\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Get a socket.
+  int sock = -1;
+  int backlog = max_pending > 10 ? max_pending : 10;
+  if (!open_server_socket(host_name, port, backlog, &sock)) {
+    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+
+#if 0
+  // This is unnecessary usually.
+  if(!isRoot()) {
+    printf("server_dispatch: This program must be run as root/sudo user!!");
+    return false;
+  }
+#endif
+
+  // Testing hook: Allow pytests to invoke with NULL 'func' hdlr.
+  // Close socket before exiting, so we don't have unpredictable
+  // behaviour when tests are run on CI machines.
+  if (!func) {
+    close(sock);
+    return true;
+  }
+
+  bool ret = server_dispatch(sock, ctx, num_workers, max_pending, func);
+  close(sock);
+  return ret;
+}
 
-      // Admission cert
-      (const string &)mgr.serialized_primary_admissions_cert_,
-      func);
+bool certifier::framework::server_dispatch(
+    int                    sock,
+    const channel_context &ctx,
+    int                    num_workers,
+    int                    max_pending,
+    void (*func)(secure_authenticated_channel &)) {
+  if (!ctx.initialized_ || func == nullptr) {
+    printf("%s() error, line %d, bad channel context or handler\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return dispatch_connections(sock, ctx, num_workers, max_pending, func);
 }
 
 certifier::framework::secure_authenticated_channel::
@@ -2909,6 +3895,8 @@ certifier::framework::secure_authenticated_channel::
   num_cert_chain_ = 0;
   cert_chain_ = nullptr;
   peer_id_.clear();
+  bytes_in_ = 0;
+  bytes_out_ = 0;
 }
 
 certifier::framework::secure_authenticated_channel::
@@ -3081,6 +4069,7 @@ bool certifier::framework::secure_authenticated_channel::init_client_ssl(
   ssl_ = SSL_new(ssl_ctx_);
   SSL_set_fd(ssl_, sock_);
   int res = SSL_set_cipher_list(ssl_, "TLS_AES_256_GCM_SHA384");  // Change?
+  enable_client_resumption(this, host_name, port);
 
   // SSL_connect - initiate the TLS/SSL handshake with an TLS/SSL server
   int ret = SSL_connect(ssl_);
@@ -3256,6 +4245,7 @@ bool certifier::framework::secure_authenticated_channel::init_client_ssl(
   ssl_ = SSL_new(ssl_ctx_);
   SSL_set_fd(ssl_, sock_);
   int res = SSL_set_cipher_list(ssl_, "TLS_AES_256_GCM_SHA384");  // Change?
+  enable_client_resumption(this, host_name, port);
 
   // SSL_connect - initiate the TLS/SSL handshake with an TLS/SSL server
   int ret = SSL_connect(ssl_);
@@ -3307,16 +4297,11 @@ bool certifier::framework::secure_authenticated_channel::init_client_ssl(
 //    the key.
 bool certifier::framework::secure_authenticated_channel::
     load_client_certs_and_key() {
-  // Todo: Add other key types
-  RSA *r = RSA_new();
-  if (!key_to_RSA(private_key_, r)) {
-    printf("%s() error, line %d, Can't convert to RSA key\n",
-           __func__,
-           __LINE__);
+  EVP_PKEY *auth_private_key = cached_pkey(private_key_);
+  if (auth_private_key == nullptr) {
+    printf("%s() error, line %d, Can't get auth key\n", __func__, __LINE__);
     return false;
   }
-  EVP_PKEY *auth_private_key = EVP_PKEY_new();
-  EVP_PKEY_set1_RSA(auth_private_key, r);
 
   X509 *x509_auth_key_cert = X509_new();
   if (!asn1_to_x509(asn1_my_cert_, x509_auth_key_cert)) {
@@ -3379,6 +4364,7 @@ bool certifier::framework::secure_authenticated_channel::
   }
 #  endif  // DEBUG
 #endif    // BORING_SSL
+  EVP_PKEY_free(auth_private_key);
   return true;
 }
 
@@ -3387,8 +4373,11 @@ void certifier::framework::secure_authenticated_channel::
         void (*func)(secure_authenticated_channel &)) {
 
   // accept and carry out auth
-  int res = SSL_accept(ssl_);
+  metrics_registry &m = metrics();
+  auto              t = std::chrono::steady_clock::now();
+  int               res = SSL_accept(ssl_);
   if (res != 1) {
+    m.failures[handshake_failure_reason(ssl_, res)]++;
     printf("%s() error, line %d, Can't SSL_accept connection"
            ", res=%d\n",
            __func__,
@@ -3406,6 +4395,10 @@ void certifier::framework::secure_authenticated_channel::
     }
     return;
   }
+  m.ssl_accept_us.record(elapsed_us(t));
+  m.handshakes_completed++;
+  if (SSL_session_reused(ssl_))
+    m.handshakes_resumed++;
   sock_ = SSL_get_fd(ssl_);
 
 #ifdef DEBUG
@@ -3413,12 +4406,14 @@ void certifier::framework::secure_authenticated_channel::
 #endif
 
   // Verify a client certificate was presented during the negotiation
+  t = std::chrono::steady_clock::now();
   peer_cert_ = SSL_get_peer_certificate(ssl_);
   if (peer_cert_ != nullptr) {
     if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
       printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
     }
   }
+  m.peer_cert_us.record(elapsed_us(t));
 
 #ifdef DEBUG
   if (peer_cert_) {
@@ -3429,7 +4424,12 @@ void certifier::framework::secure_authenticated_channel::
 #endif
 
   channel_initialized_ = true;
+  t = std::chrono::steady_clock::now();
   func(*this);
+  m.handler_us.record(elapsed_us(t));
+  m.channel_bytes_in.record(bytes_in_);
+  m.channel_bytes_out.record(bytes_out_);
+  m.channels_closed++;
   return;
 }
 
@@ -3478,30 +4478,738 @@ bool certifier::framework::secure_authenticated_channel::init_server_ssl(
       mgr.serialized_primary_admissions_cert_);
 }
 
+// Take references to ctx's certs and ssl_ctx instead of rebuilding them.
+static bool share_channel_context(secure_authenticated_channel *c,
+                                  const channel_context &       ctx,
+                                  SSL_CTX *                     ssl_ctx) {
+  if (!ctx.initialized_ || c->ssl_ctx_ != nullptr || c->root_cert_ != nullptr) {
+    printf("%s() error, line %d, bad channel context\n", __func__, __LINE__);
+    return false;
+  }
+  X509_up_ref(ctx.root_cert_);
+  c->root_cert_ = ctx.root_cert_;
+  X509_up_ref(ctx.peer_root_cert_);
+  c->peer_root_cert_ = ctx.peer_root_cert_;
+  X509_up_ref(ctx.my_cert_);
+  c->my_cert_ = ctx.my_cert_;
+  SSL_CTX_up_ref(ssl_ctx);
+  c->ssl_ctx_ = ssl_ctx;
+  return true;
+}
+
+bool certifier::framework::secure_authenticated_channel::init_client_ssl(
+    const string &         host_name,
+    int                    port,
+    const channel_context &ctx) {
+
+  if (!share_channel_context(this, ctx, ctx.client_ctx_)) {
+    printf("%s() error, line %d, Can't use channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (!open_client_socket(host_name, port, &sock_)) {
+    printf(
+        "%s() error, line %d, Can't open client socket: host='%s', port=%d\n",
+        __func__,
+        __LINE__,
+        host_name.c_str(),
+        port);
+    return false;
+  }
+
+  ssl_ = SSL_new(ssl_ctx_);
+  if (ssl_ == nullptr) {
+    printf("%s() error, line %d, SSL_new failed\n", __func__, __LINE__);
+    return false;
+  }
+  SSL_set_fd(ssl_, sock_);
+  SSL_set_cipher_list(ssl_, "TLS_AES_256_GCM_SHA384");
+  offer_cached_session(this, ctx.session_identity_, host_name, port);
+
+  int ret = SSL_connect(ssl_);
+  if (ret <= 0) {
+    int err = SSL_get_error(ssl_, ret);
+    printf("%s() error, line %d, ssl_connect failed, ret=%d, err=%d: %s\n",
+           __func__,
+           __LINE__,
+           ret,
+           err,
+           ssl_strerror(err));
+    return false;
+  }
+
+  peer_cert_ = SSL_get_peer_certificate(ssl_);
+  if (peer_cert_ != nullptr) {
+    peer_id_.clear();
+    if (!extract_id_from_cert(peer_cert_, &peer_id_)) {
+      printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+    }
+  }
+  channel_initialized_ = true;
+  return true;
+}
+
+// The caller creates ssl_ from ssl_ctx_ for the accepted socket.
+bool certifier::framework::secure_authenticated_channel::init_server_ssl(
+    const channel_context &ctx) {
+  return share_channel_context(this, ctx, ctx.server_ctx_);
+}
+
 int certifier::framework::secure_authenticated_channel::read(int   size,
                                                              byte *b) {
-  return SSL_read(ssl_, b, size);
+  return count_bytes_in(this, SSL_read(ssl_, b, size));
 }
 
 int certifier::framework::secure_authenticated_channel::read(string *out) {
-  return sized_ssl_read(ssl_, out);
+  return count_bytes_in(this, sized_ssl_read(ssl_, out));
+}
+
+int certifier::framework::secure_authenticated_channel::read_message(
+    int   max_size,
+    byte *b) {
+  return count_bytes_in(this, sized_ssl_read(ssl_, max_size, b));
 }
 
 int certifier::framework::secure_authenticated_channel::write(int   size,
                                                               byte *b) {
-  return sized_ssl_write(ssl_, size, b);
+  int n = sized_ssl_write(ssl_, size, b);
+  if (n > 0) {
+    bytes_out_ += n;
+    metrics().bytes_out.fetch_add(n, std::memory_order_relaxed);
+  }
+  return n;
 }
 
 void certifier::framework::secure_authenticated_channel::close() {
-  ::close(sock_);
+  // Reset sock_ so the destructor does not close a descriptor that another
+  // connection may already have been given.
+  if (sock_ >= 0)
+    ::close(sock_);
+  sock_ = -1;
   if (ssl_ != nullptr) {
     SSL_free(ssl_);
     ssl_ = nullptr;
   }
 }
 
+bool certifier::framework::secure_authenticated_channel::session_resumed() {
+  return ssl_ != nullptr && SSL_session_reused(ssl_) == 1;
+}
+
 bool certifier::framework::secure_authenticated_channel::get_peer_id(
     string *out_peer_id) {
   out_peer_id->assign((char *)peer_id_.data(), peer_id_.size());
   return true;
 }
+
+// Event-driven channels
+// ----------------------------------------------------------------------------------
+
+static bool set_non_blocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return false;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void signal_event_fd(int fd) {
+  uint64_t one = 1;
+  if (::write(fd, &one, sizeof(one)) < 0) {
+    printf("%s() error, line %d, eventfd write failed\n", __func__, __LINE__);
+  }
+}
+
+static void drain_event_fd(int fd) {
+  uint64_t v;
+  if (::read(fd, &v, sizeof(v)) < 0 && errno != EAGAIN) {
+    printf("%s() error, line %d, eventfd read failed\n", __func__, __LINE__);
+  }
+}
+
+namespace certifier {
+namespace framework {
+
+// One epoll loop.  Every channel it owns is touched only on this thread;
+// other threads hand it work through post().
+class reactor_thread {
+ public:
+  reactor_thread(channel_reactor *reactor)
+      : reactor_(reactor), epfd_(-1), wake_fd_(-1), stopping_(false) {}
+
+  ~reactor_thread() {
+    stop();
+    if (epfd_ >= 0)
+      ::close(epfd_);
+    if (wake_fd_ >= 0)
+      ::close(wake_fd_);
+  }
+
+  bool start() {
+    epfd_ = epoll_create1(0);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK);
+    if (epfd_ < 0 || wake_fd_ < 0) {
+      printf("%s() error, line %d, can't create epoll fds\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev) != 0) {
+      printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+      return false;
+    }
+    thread_ = std::thread([this]() { loop(); });
+    return true;
+  }
+
+  void stop() {
+    if (!thread_.joinable())
+      return;
+    stopping_ = true;
+    signal_event_fd(wake_fd_);
+    thread_.join();
+
+    // The loop has exited, so it is safe to tear down from here.
+    std::vector<async_channel_ptr> left;
+    for (auto &e : channels_)
+      left.push_back(e.second);
+    for (unsigned i = 0; i < left.size(); i++)
+      drop(left[i]);
+  }
+
+  void post(const std::function<void()> &task) {
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      tasks_.push_back(task);
+    }
+    signal_event_fd(wake_fd_);
+  }
+
+  void add(async_channel_ptr c) {
+    post([this, c]() {
+      int fd = c->channel_.sock_;
+      channels_[fd] = c;
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLOUT;
+      ev.data.fd = fd;
+      if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        printf("%s() error, line %d, epoll_ctl failed\n", __func__, __LINE__);
+        drop(c);
+        return;
+      }
+      if (c->state_ == async_channel::OPEN && reactor_->on_open_)
+        reactor_->on_open_(*c);
+      service(c);
+    });
+  }
+
+  // Advance the handshake, read and deliver messages, flush writes.
+  void service(async_channel_ptr c) {
+    async_channel &ch = *c;
+    if (ch.state_ == async_channel::CLOSED)
+      return;
+    ch.want_write_ = false;
+
+    if (ch.state_ == async_channel::HANDSHAKING) {
+      if (!handshake(ch)) {
+        drop(c);
+        return;
+      }
+      if (ch.state_ == async_channel::HANDSHAKING) {
+        update_interest(ch);
+        return;
+      }
+      if (reactor_->on_open_)
+        reactor_->on_open_(ch);
+      if (ch.state_ == async_channel::CLOSED)
+        return;
+    }
+
+    if (!read_messages(ch) || !flush_writes(ch)) {
+      drop(c);
+      return;
+    }
+    if (ch.close_after_flush_ && ch.out_.empty()) {
+      SSL_shutdown(ch.channel_.ssl_);
+      drop(c);
+      return;
+    }
+    update_interest(ch);
+  }
+
+ private:
+  channel_reactor *                          reactor_;
+  int                                        epfd_;
+  int                                        wake_fd_;
+  std::atomic<bool>                          stopping_;
+  std::thread                                thread_;
+  std::mutex                                 mtx_;
+  std::vector<std::function<void()>>         tasks_;
+  std::unordered_map<int, async_channel_ptr> channels_;
+
+  void loop() {
+    const int          max_events = 64;
+    struct epoll_event events[max_events];
+
+    while (!stopping_) {
+      int n = epoll_wait(epfd_, events, max_events, -1);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        printf("%s() error, line %d, epoll_wait failed\n", __func__, __LINE__);
+        break;
+      }
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd_) {
+          drain_event_fd(wake_fd_);
+          continue;
+        }
+        auto it = channels_.find(fd);
+        if (it == channels_.end())
+          continue;
+        async_channel_ptr c = it->second;
+        service(c);
+      }
+      run_tasks();
+    }
+  }
+
+  void run_tasks() {
+    std::vector<std::function<void()>> todo;
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      todo.swap(tasks_);
+    }
+    for (unsigned i = 0; i < todo.size(); i++)
+      todo[i]();
+  }
+
+  bool handshake(async_channel &ch) {
+    SSL *ssl = ch.channel_.ssl_;
+
+    // The error queue is per thread and shared by every channel on it; a
+    // stale entry would make SSL_get_error misreport WANT_READ as fatal.
+    ERR_clear_error();
+    int res = SSL_accept(ssl);
+    if (res != 1) {
+      int err = SSL_get_error(ssl, res);
+      if (err == SSL_ERROR_WANT_READ)
+        return true;
+      if (err == SSL_ERROR_WANT_WRITE) {
+        ch.want_write_ = true;
+        return true;
+      }
+      printf("%s() error, line %d, SSL_accept failed: %s\n",
+             __func__,
+             __LINE__,
+             ssl_strerror(err));
+      return false;
+    }
+
+    ch.channel_.peer_cert_ = SSL_get_peer_certificate(ssl);
+    if (ch.channel_.peer_cert_ != nullptr) {
+      if (!extract_id_from_cert(ch.channel_.peer_cert_,
+                                &ch.channel_.peer_id_)) {
+        printf("%s() error, line %d, Can't extract id\n", __func__, __LINE__);
+      }
+    }
+    ch.channel_.channel_initialized_ = true;
+    ch.state_ = async_channel::OPEN;
+    ch.open_ = true;
+    return true;
+  }
+
+  // Drain TLS and hand every complete size-prefixed message to on_message_.
+  bool read_messages(async_channel &ch) {
+    SSL *     ssl = ch.channel_.ssl_;
+    const int read_stride = 16384;
+    byte      buf[read_stride];
+
+    while (ch.state_ == async_channel::OPEN) {
+      ERR_clear_error();
+      int n = SSL_read(ssl, buf, read_stride);
+      if (n <= 0) {
+        int err = SSL_get_error(ssl, n);
+        if (err == SSL_ERROR_WANT_READ)
+          return true;
+        if (err == SSL_ERROR_WANT_WRITE) {
+          ch.want_write_ = true;
+          return true;
+        }
+        return false;
+      }
+      ch.in_.append((char *)buf, n);
+
+      size_t pos = 0;
+      while (ch.in_.size() - pos >= sizeof(int)) {
+        int size = 0;
+        memcpy(&size, ch.in_.data() + pos, sizeof(int));
+        if (size < 0 || size > reactor_->max_message_size_) {
+          printf("%s() error, line %d, bad message size %d\n",
+                 __func__,
+                 __LINE__,
+                 size);
+          return false;
+        }
+        if (ch.in_.size() - pos - sizeof(int) < (size_t)size)
+          break;
+        string msg(ch.in_, pos + sizeof(int), size);
+        pos += sizeof(int) + size;
+        if (reactor_->on_message_)
+          reactor_->on_message_(ch, msg);
+      }
+      ch.in_.erase(0, pos);
+    }
+    return true;
+  }
+
+  bool flush_writes(async_channel &ch) {
+    SSL *ssl = ch.channel_.ssl_;
+    while (!ch.out_.empty()) {
+      int len = ch.out_.size() > (1 << 30) ? (1 << 30) : (int)ch.out_.size();
+      ERR_clear_error();
+      int n = SSL_write(ssl, ch.out_.data(), len);
+      if (n <= 0) {
+        int err = SSL_get_error(ssl, n);
+        if (err == SSL_ERROR_WANT_WRITE) {
+          ch.want_write_ = true;
+          return true;
+        }
+        if (err == SSL_ERROR_WANT_READ)
+          return true;
+        return false;
+      }
+      ch.out_.erase(0, n);
+      ch.bytes_flushed_ += n;
+
+      unsigned done = 0;
+      while (done < ch.write_done_.size()
+             && ch.write_done_[done].first <= ch.bytes_flushed_)
+        done++;
+      if (done > 0) {
+        std::vector<std::pair<uint64_t, async_channel::write_handler>> fire(
+            ch.write_done_.begin(),
+            ch.write_done_.begin() + done);
+        ch.write_done_.erase(ch.write_done_.begin(),
+                             ch.write_done_.begin() + done);
+        for (unsigned i = 0; i < fire.size(); i++)
+          fire[i].second(ch, true);
+      }
+    }
+    return true;
+  }
+
+  void update_interest(async_channel &ch) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (ch.want_write_ ? EPOLLOUT : 0);
+    ev.data.fd = ch.channel_.sock_;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, ch.channel_.sock_, &ev);
+  }
+
+  void drop(async_channel_ptr c) {
+    async_channel &ch = *c;
+    if (ch.state_ == async_channel::CLOSED)
+      return;
+    bool was_open = ch.state_ == async_channel::OPEN;
+    ch.state_ = async_channel::CLOSED;
+    ch.open_ = false;
+
+    int fd = ch.channel_.sock_;
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    channels_.erase(fd);
+    ch.channel_.close();
+
+    std::vector<std::pair<uint64_t, async_channel::write_handler>> fire;
+    fire.swap(ch.write_done_);
+    for (unsigned i = 0; i < fire.size(); i++)
+      fire[i].second(ch, false);
+    if (was_open && reactor_->on_close_)
+      reactor_->on_close_(ch);
+  }
+};
+
+}  // namespace framework
+}  // namespace certifier
+
+certifier::framework::async_channel::async_channel(string &role)
+    : channel_(role),
+      user_data_(nullptr),
+      owner_(nullptr),
+      state_(HANDSHAKING),
+      open_(false),
+      want_write_(false),
+      close_after_flush_(false),
+      bytes_flushed_(0),
+      bytes_queued_(0) {}
+
+certifier::framework::async_channel::~async_channel() {}
+
+bool certifier::framework::async_channel::async_write(int           size,
+                                                      byte *        b,
+                                                      write_handler done) {
+  if (!open_ || owner_ == nullptr || size < 0)
+    return false;
+
+  std::shared_ptr<string> frame(new string);
+  frame->reserve(sizeof(int) + size);
+  frame->append((char *)&size, sizeof(int));
+  frame->append((char *)b, size);
+
+  async_channel_ptr self = shared_from_this();
+  owner_->post([self, frame, done]() {
+    if (self->state_ == CLOSED) {
+      if (done)
+        done(*self, false);
+      return;
+    }
+    self->out_.append(*frame);
+    self->bytes_queued_ += frame->size();
+    if (done)
+      self->write_done_.push_back(std::make_pair(self->bytes_queued_, done));
+    self->owner_->service(self);
+  });
+  return true;
+}
+
+void certifier::framework::async_channel::async_close() {
+  if (owner_ == nullptr)
+    return;
+  async_channel_ptr self = shared_from_this();
+  owner_->post([self]() {
+    self->close_after_flush_ = true;
+    self->owner_->service(self);
+  });
+}
+
+certifier::framework::channel_reactor::channel_reactor()
+    : max_message_size_(default_max_message_size),
+      listen_sock_(-1),
+      stop_fd_(-1),
+      stopped_(false),
+      next_thread_(0) {}
+
+certifier::framework::channel_reactor::~channel_reactor() {
+  stop();
+  for (unsigned i = 0; i < threads_.size(); i++)
+    delete threads_[i];
+  threads_.clear();
+  if (listen_sock_ >= 0)
+    ::close(listen_sock_);
+  listen_sock_ = -1;
+  if (stop_fd_ >= 0)
+    ::close(stop_fd_);
+  stop_fd_ = -1;
+}
+
+bool certifier::framework::channel_reactor::init(int num_threads) {
+  OPENSSL_init_ssl(0, NULL);
+  SSL_load_error_strings();
+
+  // A peer that disappears mid-write must not kill a process that may
+  // hold thousands of other channels.
+  struct sigaction sa;
+  if (sigaction(SIGPIPE, nullptr, &sa) == 0 && sa.sa_handler == SIG_DFL)
+    signal(SIGPIPE, SIG_IGN);
+
+  stop_fd_ = eventfd(0, EFD_NONBLOCK);
+  if (stop_fd_ < 0) {
+    printf("%s() error, line %d, eventfd failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (num_threads <= 0)
+    num_threads = 1;
+  for (int i = 0; i < num_threads; i++) {
+    reactor_thread *t = new reactor_thread(this);
+    threads_.push_back(t);
+    if (!t->start())
+      return false;
+  }
+  return true;
+}
+
+bool certifier::framework::channel_reactor::listen(
+    const string &host_name,
+    int           port,
+    const string &asn1_root_cert,
+    key_message & private_key,
+    const string &private_key_cert) {
+  if (!context_.init(asn1_root_cert, private_key, private_key_cert)) {
+    printf("%s() error, line %d, Can't initialize channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (!open_server_socket(host_name, port, SOMAXCONN, &listen_sock_)) {
+    printf("%s() error, line %d, Can't open server socket to %s:%d\n",
+           __func__,
+           __LINE__,
+           host_name.c_str(),
+           port);
+    return false;
+  }
+  return set_non_blocking(listen_sock_);
+}
+
+bool certifier::framework::channel_reactor::listen(
+    const string &          host_name,
+    int                     port,
+    const cc_trust_manager &mgr) {
+  return listen(host_name,
+                port,
+                mgr.serialized_policy_cert_,
+                (key_message &)mgr.private_auth_key_,
+                mgr.serialized_primary_admissions_cert_);
+}
+
+certifier::framework::async_channel_ptr certifier::framework::channel_reactor::
+    connect(const string &host_name,
+            int           port,
+            const string &asn1_root_cert,
+            key_message & private_key,
+            const string &private_key_cert) {
+  string            role("client");
+  async_channel_ptr c(new async_channel(role));
+  if (!c->channel_.init_client_ssl(host_name,
+                                   port,
+                                   asn1_root_cert,
+                                   private_key,
+                                   private_key_cert)) {
+    printf("%s() error, line %d, init_client_ssl failed\n", __func__, __LINE__);
+    return nullptr;
+  }
+  c->state_ = async_channel::OPEN;
+  c->open_ = true;
+  if (!attach(c))
+    return nullptr;
+  return c;
+}
+
+certifier::framework::async_channel_ptr certifier::framework::channel_reactor::
+    connect(const string &         host_name,
+            int                    port,
+            const channel_context &ctx) {
+  string            role("client");
+  async_channel_ptr c(new async_channel(role));
+  if (!c->channel_.init_client_ssl(host_name, port, ctx)) {
+    printf("%s() error, line %d, init_client_ssl failed\n", __func__, __LINE__);
+    return nullptr;
+  }
+  c->state_ = async_channel::OPEN;
+  c->open_ = true;
+  if (!attach(c))
+    return nullptr;
+  return c;
+}
+
+certifier::framework::async_channel_ptr certifier::framework::channel_reactor::
+    connect(const string &host_name, int port, const cc_trust_manager &mgr) {
+  return connect(host_name,
+                 port,
+                 mgr.serialized_policy_cert_,
+                 (key_message &)mgr.private_auth_key_,
+                 mgr.serialized_primary_admissions_cert_);
+}
+
+bool certifier::framework::channel_reactor::attach(async_channel_ptr c) {
+  if (threads_.empty()) {
+    printf("%s() error, line %d, reactor not initialized\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (!set_non_blocking(c->channel_.sock_)) {
+    printf("%s() error, line %d, can't set non-blocking\n", __func__, __LINE__);
+    return false;
+  }
+  SSL_set_mode(c->channel_.ssl_,
+               SSL_MODE_ENABLE_PARTIAL_WRITE
+                   | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  reactor_thread *t = threads_[next_thread_++ % threads_.size()];
+  c->owner_ = t;
+  t->add(c);
+  return true;
+}
+
+int certifier::framework::channel_reactor::port() {
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof(addr);
+  if (listen_sock_ < 0
+      || getsockname(listen_sock_, (struct sockaddr *)&addr, &len) != 0)
+    return -1;
+  return ntohs(addr.sin_port);
+}
+
+bool certifier::framework::channel_reactor::run() {
+  if (!context_.initialized_ || listen_sock_ < 0 || stop_fd_ < 0) {
+    printf("%s() error, line %d, reactor not listening\n", __func__, __LINE__);
+    return false;
+  }
+
+  int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    printf("%s() error, line %d, epoll_create1 failed\n", __func__, __LINE__);
+    return false;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_sock_;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listen_sock_, &ev);
+  ev.data.fd = stop_fd_;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, stop_fd_, &ev);
+
+  struct epoll_event events[2];
+  while (!stopped_) {
+    int n = epoll_wait(epfd, events, 2, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      printf("%s() error, line %d, epoll_wait failed\n", __func__, __LINE__);
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd != listen_sock_)
+        continue;
+      while (1) {
+        struct sockaddr_in addr;
+        socklen_t          len = sizeof(addr);
+        int client = accept(listen_sock_, (struct sockaddr *)&addr, &len);
+        if (client < 0)
+          break;
+
+        string            role("server");
+        async_channel_ptr c(new async_channel(role));
+        c->channel_.sock_ = client;
+        if (!c->channel_.init_server_ssl(context_)) {
+          c->channel_.close();
+          continue;
+        }
+        c->channel_.ssl_ = SSL_new(c->channel_.ssl_ctx_);
+        SSL_set_fd(c->channel_.ssl_, client);
+        SSL_set_accept_state(c->channel_.ssl_);
+        if (!attach(c))
+          c->channel_.close();
+      }
+    }
+  }
+  ::close(epfd);
+  return true;
+}
+
+void certifier::framework::channel_reactor::stop() {
+  if (stopped_.exchange(true))
+    return;
+  if (stop_fd_ >= 0)
+    signal_event_fd(stop_fd_);
+  for (unsigned i = 0; i < threads_.size(); i++)
+    threads_[i]->stop();
+}
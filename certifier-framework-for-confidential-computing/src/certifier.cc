@@ -808,7 +808,15 @@ bool   GetParentEnclaveType(string *type) {
 
 // the padding size includes an IV and possibly 3 additional blocks
 const int max_key_seal_pad = 1024;
-const int protect_key_size = 64;
+
+// Key bytes needed to protect with alg, or -1 if alg is not an
+// authenticated cipher.
+static int protect_key_size(const string &alg) {
+  const alg_descriptor *d = find_algorithm(alg);
+  if (d == nullptr || d->aead_encrypt == nullptr)
+    return -1;
+  return d->key_size;
+}
 
 bool certifier::framework::protect_blob(const string &enclave_type,
                                         key_message & key,
@@ -856,7 +864,7 @@ bool certifier::framework::protect_blob(const string &enclave_type,
     return false;
   }
   byte *key_buf = (byte *)key.secret_key_bits().data();
-  if (key.secret_key_bits().size() < protect_key_size) {
+  if ((int)key.secret_key_bits().size() < protect_key_size(key.key_type())) {
     printf("%s() error, line %d, protect_blob: key too small\n",
            __func__,
            __LINE__);
@@ -955,7 +963,7 @@ bool certifier::framework::unprotect_blob(const string &enclave_type,
     return false;
   }
 
-  if (key->key_type() != Enc_method_aes_256_cbc_hmac_sha256) {
+  if (protect_key_size(key->key_type()) <= 0) {
     printf("%s() error, line %d, unprotect_blob, unsupported encryption "
            "scheme: '%s'\n",
            __func__,
@@ -970,7 +978,7 @@ bool certifier::framework::unprotect_blob(const string &enclave_type,
     return false;
   }
   byte *key_buf = (byte *)key->secret_key_bits().data();
-  if (key->secret_key_bits().size() < protect_key_size) {
+  if ((int)key->secret_key_bits().size() < protect_key_size(key->key_type())) {
     printf("%s() error, line %d, unprotect_blob: key too small\n",
            __func__,
            __LINE__);
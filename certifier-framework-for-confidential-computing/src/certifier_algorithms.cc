@@ -29,6 +29,8 @@ const char * Enc_method_aes_128_cbc_hmac_sha256   = "aes-128-cbc-hmac-sha256";
 const char * Enc_method_aes_256_cbc_hmac_sha256   = "aes-256-cbc-hmac-sha256";
 const char * Enc_method_aes_256_cbc_hmac_sha384   = "aes-256-cbc-hmac-sha384";
 const char * Enc_method_aes_256_gcm               = "aes-256-gcm";
+const char * Enc_method_aes_256_gcm_siv           = "aes-256-gcm-siv";
+const char * Enc_method_chacha20_poly1305         = "chacha20-poly1305";
 
 const char * Enc_method_ecc_256_private           = "ecc-256-private";
 const char * Enc_method_ecc_256_public            = "ecc-256-public";
@@ -63,13 +65,30 @@ std::vector<const char *> Enc_public_key_algorithms =
 
 const int Num_public_key_algorithms = Enc_public_key_algorithms.size();
 
+// aes-256-gcm-siv needs OpenSSL 3.2 or later; it is listed only when
+// this build provides it.
+bool aes_256_gcm_siv_available();
+
+static std::vector<const char *> available_algorithms(
+    std::vector<const char *> names) {
+  std::vector<const char *> out;
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] != Enc_method_aes_256_gcm_siv || aes_256_gcm_siv_available())
+      out.push_back(names[i]);
+  }
+  return out;
+}
+
 // Names of Authenticated symmetric-key algorithms
 std::vector<const char *> Enc_authenticated_symmetric_key_algorithms =
+  available_algorithms(
                     {   Enc_method_aes_128_cbc_hmac_sha256
                       , Enc_method_aes_256_cbc_hmac_sha256
                       , Enc_method_aes_256_cbc_hmac_sha384
                       , Enc_method_aes_256_gcm
-                    };
+                      , Enc_method_aes_256_gcm_siv
+                      , Enc_method_chacha20_poly1305
+                    });
 
 const int Num_symmetric_key_algorithms = Enc_authenticated_symmetric_key_algorithms.size();
 
@@ -87,6 +106,8 @@ const char * Digest_method_sha_512 = "sha-512";
 const char * Integrity_method_aes_256_cbc_hmac_sha256 = "aes-256-cbc-hmac-sha256";
 const char * Integrity_method_aes_256_cbc_hmac_sha384 = "aes-256-cbc-hmac-sha384";
 const char * Integrity_method_aes_256_gcm             = "aes-256-gcm";
+const char * Integrity_method_aes_256_gcm_siv         = "aes-256-gcm-siv";
+const char * Integrity_method_chacha20_poly1305       = "chacha20-poly1305";
 const char * Integrity_method_hmac_sha256             = "hmac-sha256";
 
 // clang-format on
@@ -19,6 +19,10 @@
 #include "application_enclave.h"
 #include <sys/socket.h>
 #include <netdb.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #ifdef SEV_SNP
 #  include "attestation.h"
 #endif
@@ -35,6 +39,8 @@ using namespace certifier::utilities;
 predicate_dominance::predicate_dominance() {
   first_child_ = nullptr;
   next_ = nullptr;
+  frozen_ = false;
+  words_ = 0;
 }
 
 predicate_dominance::~predicate_dominance() {
@@ -58,9 +64,8 @@ predicate_dominance *predicate_dominance::find_node(const string &pred) {
 
   // breadth first search
   while (current != nullptr) {
-    t = find_node(pred);
-    if (t != nullptr)
-      return t;
+    if (current->predicate_ == pred)
+      return current;
     current = current->next_;
   }
 
@@ -80,6 +85,8 @@ predicate_dominance *predicate_dominance::find_node(const string &pred) {
 bool predicate_dominance::insert(const string &parent,
                                  const string &descendant) {
 
+  if (frozen_)
+    return false;
   predicate_dominance *t = find_node(parent);
   if (t == nullptr)
     return false;
@@ -135,11 +142,57 @@ void predicate_dominance::print_descendants(int indent) {
   }
 }
 
+// Ids in preorder; a node's descendants are the ids after it up to the
+// end of its subtree.
+static void number_predicates(predicate_dominance *            n,
+                              std::unordered_map<string, int> *ids,
+                              std::vector<int> *               subtree_end) {
+  int id = ids->size();
+  ids->emplace(n->predicate_, id);
+  subtree_end->push_back(id);
+  for (predicate_dominance *c = n->first_child_; c != nullptr; c = c->next_)
+    number_predicates(c, ids, subtree_end);
+  (*subtree_end)[id] = ids->size();
+}
+
+bool predicate_dominance::freeze() {
+  if (frozen_)
+    return true;
+  std::vector<int> subtree_end;
+  number_predicates(this, &ids_, &subtree_end);
+  int n = subtree_end.size();
+  if ((int)ids_.size() != n) {
+    printf("%s() error, line %d, predicate appears twice\n",
+           __func__,
+           __LINE__);
+    ids_.clear();
+    return false;
+  }
+
+  words_ = (n + 63) / 64;
+  dominated_.assign(n * words_, 0);
+  for (int i = 0; i < n; i++) {
+    for (int j = i; j < subtree_end[i]; j++)
+      dominated_[i * words_ + j / 64] |= ((uint64_t)1) << (j % 64);
+  }
+  frozen_ = true;
+  return true;
+}
+
 bool dominates(predicate_dominance &root,
                const string &       parent,
                const string &       descendant) {
   if (parent == descendant)
     return true;
+  if (root.frozen_) {
+    auto p = root.ids_.find(parent);
+    auto d = root.ids_.find(descendant);
+    if (p == root.ids_.end() || d == root.ids_.end())
+      return false;
+    int i = p->second;
+    int j = d->second;
+    return (root.dominated_[i * root.words_ + j / 64] >> (j % 64)) & 1;
+  }
   predicate_dominance *pn = root.find_node(parent);
   if (pn == nullptr)
     return false;
@@ -159,9 +212,142 @@ bool statement_already_proved(const vse_clause & cl,
   return false;
 }
 
-bool verify_signed_assertion_and_extract_clause(const key_message &         key,
-                                                const signed_claim_message &sc,
-                                                vse_clause *cl) {
+// Canonical clause encoding
+//   Each field is length prefixed and only the parts same_entity compares
+//   are encoded, so equal encodings mean same_vse_claim holds.  exact is
+//   cleared when the clause names a platform, whose comparison is
+//   one-sided.  Entity or key types same_entity can't compare don't encode.
+
+static void append_field(const string &f, string *out) {
+  uint32_t n = f.size();
+  out->append((const char *)&n, sizeof(n));
+  out->append(f);
+}
+
+static bool canonical_key(const key_message &k, string *out) {
+  if (find_algorithm(k.key_type()) == nullptr)
+    return false;
+  append_field(k.key_type(), out);
+  if (k.has_rsa_key()) {
+    append_field(k.rsa_key().public_modulus(), out);
+    append_field(k.rsa_key().public_exponent(), out);
+    return true;
+  }
+  if (k.has_ecc_key()) {
+    const ecc_message &em = k.ecc_key();
+    append_field(em.curve_p(), out);
+    append_field(em.curve_a(), out);
+    append_field(em.curve_b(), out);
+    append_field(em.base_point().x(), out);
+    append_field(em.base_point().y(), out);
+    append_field(em.public_point().x(), out);
+    append_field(em.public_point().y(), out);
+    return true;
+  }
+  if (k.has_secret_key_bits()) {
+    append_field(k.secret_key_bits(), out);
+    return true;
+  }
+  return false;
+}
+
+static bool canonical_platform(const platform &p, string *out) {
+  append_field(p.platform_type(), out);
+  out->append(1, p.has_key() ? 'k' : '-');
+  if (p.has_key() && !canonical_key(p.attest_key(), out))
+    return false;
+  std::vector<string> props;
+  for (int i = 0; i < p.props().props_size(); i++) {
+    const property &pr = p.props().props(i);
+    string          e;
+    append_field(pr.property_name(), &e);
+    append_field(pr.value_type(), &e);
+    append_field(pr.comparator(), &e);
+    if (pr.value_type() == "int")
+      append_field(std::to_string(pr.int_value()), &e);
+    else if (pr.value_type() == "string")
+      append_field(pr.string_value(), &e);
+    props.push_back(e);
+  }
+  std::sort(props.begin(), props.end());
+  for (const string &e : props)
+    append_field(e, out);
+  return true;
+}
+
+static bool canonical_entity(const entity_message &e,
+                             string *              out,
+                             bool *                exact) {
+  append_field(e.entity_type(), out);
+  if (e.entity_type() == "key")
+    return canonical_key(e.key(), out);
+  if (e.entity_type() == "measurement") {
+    append_field(e.measurement(), out);
+    return true;
+  }
+  if (e.entity_type() == "platform") {
+    *exact = false;
+    return canonical_platform(e.platform_ent(), out);
+  }
+  if (e.entity_type() == "environment") {
+    *exact = false;
+    append_field(e.environment_ent().the_measurement(), out);
+    return canonical_platform(e.environment_ent().the_platform(), out);
+  }
+  return false;
+}
+
+static bool canonical_clause(const vse_clause &cl, string *out, bool *exact) {
+  out->append(1, cl.has_subject() ? 's' : '-');
+  if (cl.has_subject() && !canonical_entity(cl.subject(), out, exact))
+    return false;
+  out->append(1, cl.has_verb() ? 'v' : '-');
+  if (cl.has_verb())
+    append_field(cl.verb(), out);
+  out->append(1, cl.has_object() ? 'o' : '-');
+  if (cl.has_object() && !canonical_entity(cl.object(), out, exact))
+    return false;
+  out->append(1, cl.has_clause() ? 'c' : '-');
+  if (cl.has_clause())
+    return canonical_clause(cl.clause(), out, exact);
+  return true;
+}
+
+proved_index::proved_index(proved_statements *are_proved) {
+  proved_ = are_proved;
+  indexed_ = 0;
+  sync();
+}
+
+void proved_index::sync() {
+  for (; indexed_ < proved_->proved_size(); indexed_++) {
+    string c;
+    bool   exact = true;
+    if (canonical_clause(proved_->proved(indexed_), &c, &exact))
+      canonical_.insert(c);
+  }
+}
+
+bool proved_index::contains(const vse_clause &cl) {
+  sync();
+  string c;
+  bool   exact = true;
+  if (!canonical_clause(cl, &c, &exact))
+    return false;
+  if (canonical_.find(c) != canonical_.end())
+    return true;
+  return !exact && statement_already_proved(cl, proved_);
+}
+
+void proved_index::add(const vse_clause &cl) {
+  sync();
+  proved_->add_proved()->CopyFrom(cl);
+}
+
+// The clause a signed vse-clause claim asserts, signature unchecked.
+static bool extract_clause_from_signed_assertion(
+    const signed_claim_message &sc,
+    vse_clause *                cl) {
 
   if (!sc.has_serialized_claim_message() || !sc.has_signing_key()
       || !sc.has_signing_algorithm() || !sc.has_signature()) {
@@ -211,17 +397,27 @@ bool verify_signed_assertion_and_extract_clause(const key_message &         key,
            __LINE__);
     return false;
   }
+  return true;
+}
+
+bool verify_signed_assertion_and_extract_clause(const key_message &         key,
+                                                const signed_claim_message &sc,
+                                                vse_clause *cl) {
+  if (!extract_clause_from_signed_assertion(sc, cl))
+    return false;
 
   // verify signature
   return verify_signed_claim(sc, key);
 }
 
-bool add_fact_from_signed_claim(const signed_claim_message &signed_claim,
-                                proved_statements *         already_proved) {
+// add_fact_from_signed_claim for a claim whose signature already checked.
+static bool add_fact_from_verified_claim(
+    const signed_claim_message &signed_claim,
+    proved_statements *         already_proved) {
 
   const key_message &k = signed_claim.signing_key();
   vse_clause         tcl;
-  if (verify_signed_assertion_and_extract_clause(k, signed_claim, &tcl)) {
+  if (extract_clause_from_signed_assertion(signed_claim, &tcl)) {
     if (tcl.verb() != "says" || tcl.subject().entity_type() != "key") {
       printf("%s() error, line %d, Add_fact_from_signed_claim: bad subject or "
              "verb\n",
@@ -244,6 +440,13 @@ bool add_fact_from_signed_claim(const signed_claim_message &signed_claim,
   return false;
 }
 
+bool add_fact_from_signed_claim(const signed_claim_message &signed_claim,
+                                proved_statements *         already_proved) {
+  if (!verify_signed_claim(signed_claim, signed_claim.signing_key()))
+    return false;
+  return add_fact_from_verified_claim(signed_claim, already_proved);
+}
+
 bool get_vse_clause_from_signed_claim(const signed_claim_message &scm,
                                       vse_clause *                c) {
   string serialized_cl;
@@ -359,6 +562,241 @@ bool get_signed_platform_claim_from_trusted_list(
   return false;
 }
 
+// Policy database
+// -----------------------------------------------------------------------
+
+bool is_measurement(const vse_clause &cl);
+bool is_platform(const vse_clause &cl);
+
+// Public part of a key, enough to bucket it; same_key decides.
+static string public_key_index(const key_message &k) {
+  string s(k.key_type());
+  s.append(1, '\0');
+  if (k.has_rsa_key()) {
+    s.append(k.rsa_key().public_modulus());
+  } else if (k.has_ecc_key()) {
+    s.append(k.ecc_key().public_point().x());
+    s.append(1, '\0');
+    s.append(k.ecc_key().public_point().y());
+  }
+  return s;
+}
+
+policy_database::policy_database() {
+  verified_ = false;
+  generation_ = 0;
+}
+
+void policy_database::clear() {
+  policy_key_.Clear();
+  verified_ = false;
+  generation_ = 0;
+  owned_.Clear();
+  claims_.clear();
+  said_.clear();
+  measurements_.clear();
+  platform_keys_.clear();
+  platforms_.clear();
+  others_.clear();
+  context_ = verification_context();
+}
+
+bool policy_database::compile(const key_message &          policy_pk,
+                              const signed_claim_sequence &policy) {
+  clear();
+  owned_.CopyFrom(policy);
+  const signed_claim_sequence *seqs[1] = {&owned_};
+  return build(policy_pk, 1, seqs, true, true);
+}
+
+bool policy_database::compile(
+    const key_message &          policy_pk,
+    const signed_claim_sequence &trusted_platforms,
+    const signed_claim_sequence &trusted_measurements) {
+  clear();
+  owned_.CopyFrom(trusted_platforms);
+  for (int i = 0; i < trusted_measurements.claims_size(); i++)
+    owned_.add_claims()->CopyFrom(trusted_measurements.claims(i));
+  const signed_claim_sequence *seqs[1] = {&owned_};
+  return build(policy_pk, 1, seqs, false, true);
+}
+
+bool policy_database::index(
+    const key_message &          policy_pk,
+    const signed_claim_sequence &trusted_platforms,
+    const signed_claim_sequence &trusted_measurements) {
+  clear();
+  const signed_claim_sequence *seqs[2] = {&trusted_platforms,
+                                          &trusted_measurements};
+  return build(policy_pk, 2, seqs, false, false);
+}
+
+bool policy_database::build(const key_message &                 policy_pk,
+                            int                                 num_seqs,
+                            const signed_claim_sequence *const *seqs,
+                            bool                                strict,
+                            bool                                verify) {
+  policy_key_.CopyFrom(policy_pk);
+  if (!context_.init(policy_pk))
+    return false;
+
+  std::vector<const signed_claim_message *> candidates;
+  std::vector<vse_clause>                   clauses;
+  for (int j = 0; j < num_seqs; j++) {
+    for (int i = 0; i < seqs[j]->claims_size(); i++) {
+      const signed_claim_message &sc = seqs[j]->claims(i);
+      vse_clause                  cl;
+      if (!extract_clause_from_signed_assertion(sc, &cl)
+          || cl.verb() != "says" || !cl.has_clause()
+          || cl.subject().entity_type() != "key"
+          || !same_key(policy_pk, cl.subject().key())
+          || !same_key(policy_pk, sc.signing_key())) {
+        if (strict) {
+          printf("%s() error, line %d, claim %d is not a policy key "
+                 "statement\n",
+                 __func__,
+                 __LINE__,
+                 i);
+          return false;
+        }
+        continue;
+      }
+      candidates.push_back(&sc);
+      clauses.push_back(cl);
+    }
+  }
+
+  int                     n = candidates.size();
+  std::unique_ptr<bool[]> ok(new bool[n + 1]);
+  if (verify) {
+    verify_signed_claims(n, candidates.data(), nullptr, 0, ok.get());
+  } else {
+    for (int i = 0; i < n; i++)
+      ok[i] = true;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (!ok[i]) {
+      if (strict) {
+        printf("%s() error, line %d, bad signature on policy claim\n",
+               __func__,
+               __LINE__);
+        return false;
+      }
+      continue;
+    }
+
+    int               k = claims_.size();
+    const vse_clause &c = clauses[i].clause();
+    claims_.push_back(candidates[i]);
+    said_.push_back(clauses[i]);
+    if (is_measurement(c)) {
+      // First one wins, as in a linear scan.
+      measurements_.emplace(c.subject().measurement(), k);
+    } else if (is_platform(c)) {
+      platforms_[c.subject().platform_ent().platform_type()].push_back(k);
+    } else {
+      // The SEV filter keeps these, trusted platform keys included.
+      others_.push_back(k);
+      if ((c.verb() == "is-trusted"
+           || c.verb() == "is-trusted-for-attestation")
+          && c.subject().entity_type() == "key")
+        platform_keys_[public_key_index(c.subject().key())].push_back(k);
+    }
+  }
+  static std::atomic<unsigned long> generations(0);
+  verified_ = verify;
+  generation_ = ++generations;
+  return true;
+}
+
+int policy_database::measurement_index(const string &m) const {
+  auto it = measurements_.find(m);
+  return it == measurements_.end() ? -1 : it->second;
+}
+
+int policy_database::platform_key_index(const key_message &k) const {
+  auto it = platform_keys_.find(public_key_index(k));
+  if (it == platform_keys_.end())
+    return -1;
+  for (int i : it->second) {
+    if (same_key(said_[i].clause().subject().key(), k))
+      return i;
+  }
+  return -1;
+}
+
+int policy_database::platform_index(const platform &p) const {
+  auto it = platforms_.find(p.platform_type());
+  if (it == platforms_.end())
+    return -1;
+  for (int i : it->second) {
+    if (satisfying_platform(said_[i].clause().subject().platform_ent(), p))
+      return i;
+  }
+  return -1;
+}
+
+const signed_claim_message *policy_database::find_measurement(
+    const string &m) const {
+  int i = measurement_index(m);
+  return i < 0 ? nullptr : claims_[i];
+}
+
+const signed_claim_message *policy_database::find_platform_key(
+    const key_message &k) const {
+  int i = platform_key_index(k);
+  return i < 0 ? nullptr : claims_[i];
+}
+
+const signed_claim_message *policy_database::find_platform(
+    const platform &p) const {
+  int i = platform_index(p);
+  return i < 0 ? nullptr : claims_[i];
+}
+
+bool policy_database::add_fact(int                i,
+                               proved_statements *already_proved) const {
+  if (i < 0)
+    return false;
+  if (!verified_ && !verify_signed_claim(*claims_[i], policy_key_))
+    return false;
+  already_proved->add_proved()->CopyFrom(said_[i]);
+  return true;
+}
+
+bool policy_database::add_measurement_fact(
+    const string &     m,
+    proved_statements *already_proved) const {
+  return add_fact(measurement_index(m), already_proved);
+}
+
+bool policy_database::add_platform_key_fact(
+    const key_message &k,
+    proved_statements *already_proved) const {
+  return add_fact(platform_key_index(k), already_proved);
+}
+
+bool policy_database::add_sev_policy_facts(
+    const string &     m,
+    const platform &   p,
+    proved_statements *already_proved) const {
+  int m_index = measurement_index(m);
+  int p_index = platform_index(p);
+  if (m_index < 0 || p_index < 0)
+    return false;
+
+  std::vector<int> keep(others_);
+  keep.push_back(m_index);
+  keep.push_back(p_index);
+  std::sort(keep.begin(), keep.end());
+  for (int i : keep) {
+    if (!add_fact(i, already_proved))
+      return false;
+  }
+  return true;
+}
+
 // Statement construction support
 // -------------------------------------------------------------------------
 
@@ -485,131 +923,39 @@ bool sign_report(const string &     type,
   report.mutable_signing_key()->CopyFrom(public_signing_alg);
   report.set_report(to_be_signed);
 
-  int size = cipher_block_byte_size(signing_alg.c_str());
-  if (size < 0) {
-    printf("%s() error, line %d, sign_report: Bad cipher\n",
-           __func__,
-           __LINE__);
-    return false;
-  }
-
-  byte signature[size];
+  const char *key_type = nullptr;
   if (signing_alg == Enc_method_rsa_2048_sha256_pkcs_sign) {
-    if (signing_key.key_type() != Enc_method_rsa_2048_private) {
-      printf("%s() error, line %d, sign_report: Wrong key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
-      printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (!rsa_sign(Digest_method_sha_256,
-                  rsa_key,
-                  to_be_signed.size(),
-                  (byte *)to_be_signed.data(),
-                  &size,
-                  signature)) {
-      printf("%s() error, line %d, sign_report: rsa_sign failed\n",
-             __func__,
-             __LINE__);
-      RSA_free(rsa_key);
-      return false;
-    }
-    RSA_free(rsa_key);
+    key_type = Enc_method_rsa_2048_private;
   } else if (signing_alg == Enc_method_rsa_4096_sha384_pkcs_sign) {
-    if (signing_key.key_type() != Enc_method_rsa_4096_private) {
-      printf("%s() error, line %d, sign_report: Wrong key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
-      printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (!rsa_sign(Digest_method_sha_384,
-                  rsa_key,
-                  to_be_signed.size(),
-                  (byte *)to_be_signed.data(),
-                  &size,
-                  signature)) {
-      printf("%s() error, line %d, sign_report: rsa_sign failed\n",
-             __func__,
-             __LINE__);
-      RSA_free(rsa_key);
-      return false;
-    }
-    RSA_free(rsa_key);
+    key_type = Enc_method_rsa_4096_private;
   } else if (signing_alg == Enc_method_rsa_3072_sha384_pkcs_sign) {
-    if (signing_key.key_type() != Enc_method_rsa_3072_private) {
-      printf("%s() error, line %d, sign_report: Wrong key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, rsa_key)) {
-      printf("%s() error, line %d, sign_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (!rsa_sign(Digest_method_sha_384,
-                  rsa_key,
-                  to_be_signed.size(),
-                  (byte *)to_be_signed.data(),
-                  &size,
-                  signature)) {
-      printf("%s() error, line %d, sign_report: rsa_sign failed\n",
-             __func__,
-             __LINE__);
-      RSA_free(rsa_key);
-      return false;
-    }
-    RSA_free(rsa_key);
+    key_type = Enc_method_rsa_3072_private;
   } else if (signing_alg == Enc_method_ecc_384_sha384_pkcs_sign) {
-    if (signing_key.key_type() != Enc_method_ecc_384_private) {
-      printf("%s() error, line %d, sign_report: Wrong key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    EC_KEY *ecc_key = key_to_ECC(signing_key);
-    if (ecc_key == nullptr) {
-      printf("%s() error, line %d, sign_report: key_to_ECC failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (!ecc_sign(Digest_method_sha_384,
-                  ecc_key,
-                  to_be_signed.size(),
-                  (byte *)to_be_signed.data(),
-                  &size,
-                  signature)) {
-      printf("%s() error, line %d, sign_report: ecc_sign failed\n",
-             __func__,
-             __LINE__);
-      EC_KEY_free(ecc_key);
-      return false;
-    }
-    EC_KEY_free(ecc_key);
+    key_type = Enc_method_ecc_384_private;
   } else {
     printf("%s() error, line %d, sign_report: unknown signing alg\n",
            __func__,
            __LINE__);
     return false;
   }
+  if (signing_key.key_type() != key_type) {
+    printf("%s() error, line %d, sign_report: Wrong key\n", __func__, __LINE__);
+    return false;
+  }
+
+  string signature;
+  if (!sign_with_key(signing_alg,
+                     signing_key,
+                     to_be_signed.size(),
+                     (byte *)to_be_signed.data(),
+                     &signature)) {
+    printf("%s() error, line %d, sign_report: sign failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
 
-  report.set_signature((byte *)signature, size);
+  report.set_signature(signature);
   if (!report.SerializeToString(serialized_signed_report)) {
     printf("%s() error, line %d, sign_report: Can't serialize report\n",
            __func__,
@@ -641,77 +987,12 @@ bool verify_report(string &           type,
     return false;
   }
 
-  bool success = false;
-  if (sr.signing_algorithm() == Enc_method_rsa_2048_sha256_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
-      printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int size = sr.signature().size();
-    success = rsa_verify(Digest_method_sha_256,
-                         rsa_key,
-                         sr.report().size(),
-                         (byte *)sr.report().data(),
-                         size,
-                         (byte *)sr.signature().data());
-    RSA_free(rsa_key);
-  } else if (sr.signing_algorithm() == Enc_method_rsa_4096_sha384_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
-      printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int size = sr.signature().size();
-    success = rsa_verify(Digest_method_sha_384,
-                         rsa_key,
-                         sr.report().size(),
-                         (byte *)sr.report().data(),
-                         size,
-                         (byte *)sr.signature().data());
-    RSA_free(rsa_key);
-  } else if (sr.signing_algorithm() == Enc_method_rsa_3072_sha384_pkcs_sign) {
-    RSA *rsa_key = RSA_new();
-    if (!key_to_RSA(signer_key, rsa_key)) {
-      printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int size = sr.signature().size();
-    success = rsa_verify(Digest_method_sha_384,
-                         rsa_key,
-                         sr.report().size(),
-                         (byte *)sr.report().data(),
-                         size,
-                         (byte *)sr.signature().data());
-    RSA_free(rsa_key);
-  } else if (sr.signing_algorithm() == Enc_method_ecc_384_sha384_pkcs_sign) {
-    EC_KEY *ecc_key = key_to_ECC(signer_key);
-    if (ecc_key == nullptr) {
-      printf("%s() error, line %d, verify_report: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int size = sr.signature().size();
-    success = ecc_verify(Digest_method_sha_384,
-                         ecc_key,
-                         sr.report().size(),
-                         (byte *)sr.report().data(),
-                         size,
-                         (byte *)sr.signature().data());
-    EC_KEY_free(ecc_key);
-  } else {
-    printf("%s() error, line %d, verify_report: Unsupported algorithm\n",
-           __func__,
-           __LINE__);
-    return false;
-  }
+  bool success = verify_with_key(sr.signing_algorithm(),
+                                 signer_key,
+                                 sr.report().size(),
+                                 (byte *)sr.report().data(),
+                                 sr.signature().size(),
+                                 (byte *)sr.signature().data());
 
 #ifdef DEBUG
   if (!success) {
@@ -800,6 +1081,42 @@ bool init_dominance_tree(predicate_dominance &root) {
   return true;
 }
 
+predicate_dominance &certifier_dominance_tree() {
+  static predicate_dominance *root = []() {
+    predicate_dominance *r = new predicate_dominance();
+    if (!init_dominance_tree(*r) || !r->freeze()) {
+      printf("%s() error, line %d, can't build dominance tree\n",
+             __func__,
+             __LINE__);
+    }
+    return r;
+  }();
+  return *root;
+}
+
+verification_context::verification_context() {
+  initialized_ = false;
+  dom_tree_ = nullptr;
+}
+
+bool verification_context::init(const key_message &policy_pk) {
+  initialized_ = false;
+  dom_tree_ = &certifier_dominance_tree();
+  if (!dom_tree_->frozen_)
+    return false;
+  policy_key_.CopyFrom(policy_pk);
+  axioms_.Clear();
+  if (!init_axiom(policy_key_, &axioms_))
+    return false;
+  initialized_ = true;
+  return true;
+}
+
+void verification_context::start_proof(
+    proved_statements *already_proved) const {
+  already_proved->MergeFrom(axioms_);
+}
+
 #ifdef SEV_SNP
 // policy
 //    byte 0
@@ -1108,26 +1425,43 @@ bool init_proved_statements(key_message &      pk,
                             proved_statements *already_proved) {
 
   cert_keys_seen_list seen_keys_list(max_key_depth);
+  int                 nsa = evp.fact_assertion_size();
+
+  // Signed claims are parsed and their signatures checked together up
+  // front; the loop below still adds facts in evidence order.
+  std::vector<signed_claim_message>         signed_claims(nsa);
+  std::vector<const signed_claim_message *> to_verify;
+  std::vector<int>                          verify_index(nsa, -1);
+  for (int i = 0; i < nsa; i++) {
+    if (evp.fact_assertion(i).evidence_type() != "signed-claim")
+      continue;
+    if (!signed_claims[i].ParseFromString(
+            evp.fact_assertion(i).serialized_evidence())) {
+      printf("%s() error, line %d, init_proved_statements: Can't parse "
+             "serialized evidence\n",
+             __func__,
+             __LINE__);
+      return false;
+    }
+    verify_index[i] = (int)to_verify.size();
+    to_verify.push_back(&signed_claims[i]);
+  }
+  std::unique_ptr<bool[]> verified(new bool[to_verify.size() + 1]);
+  verify_signed_claims((int)to_verify.size(),
+                       to_verify.data(),
+                       nullptr,
+                       1,
+                       verified.get());
+
   // verify already signed assertions, converting to vse_clause
-  int nsa = evp.fact_assertion_size();
   for (int i = 0; i < nsa; i++) {
     if (evp.fact_assertion(i).evidence_type() == "signed-claim") {
-      signed_claim_message sc;
-      string               t_str;
-      t_str.assign((char *)evp.fact_assertion(i).serialized_evidence().data(),
-                   evp.fact_assertion(i).serialized_evidence().size());
-      if (!sc.ParseFromString(t_str)) {
-        printf("%s() error, line %d, init_proved_statements: Can't parse "
-               "serialized evidence\n",
-               __func__,
-               __LINE__);
-        return false;
-      }
+      const signed_claim_message &sc = signed_claims[i];
+      vse_clause                  to_add;
+      const key_message &         km = sc.signing_key();
 
-      vse_clause         to_add;
-      const key_message &km = sc.signing_key();
-
-      if (!verify_signed_assertion_and_extract_clause(km, sc, &to_add)) {
+      if (!verified[verify_index[i]]
+          || !extract_clause_from_signed_assertion(sc, &to_add)) {
         printf("%s() error, line %d, init_proved_statements: signed claim %d "
                "failed\n",
                __func__,
@@ -1395,12 +1729,7 @@ bool init_proved_statements(key_message &      pk,
         printf("init_proved_statements: Can't find issuer key\n");
         return false;
       }
-      EVP_PKEY *signer_pkey = pkey_from_key(*signer_key);
-      if (signer_pkey == nullptr) {
-        printf("init_proved_statements: Can't get pkey\n");
-        return false;
-      }
-      bool success = (X509_verify(x, signer_pkey) == 1);
+      bool success = verify_cert_with_key(x, *signer_key);
       if (success) {
         // add to proved: signing-key says subject-key
         // is-trusted-for-attestation
@@ -1415,10 +1744,6 @@ bool init_proved_statements(key_message &      pk,
       }
 
       // Todo: free on errors too
-      if (signer_pkey != nullptr) {
-        EVP_PKEY_free(signer_pkey);
-        signer_pkey = nullptr;
-      }
       if (x != nullptr) {
         X509_free(x);
         x = nullptr;
@@ -1458,7 +1783,7 @@ bool init_proved_statements(key_message &      pk,
       const key_message &vcek_key = last_clause.clause().subject().key();
 
 #  ifndef SEV_DUMMY_GUEST
-      EVP_PKEY *verify_pkey = pkey_from_key(vcek_key);
+      EVP_PKEY *verify_pkey = cached_pkey(vcek_key);
       if (verify_pkey == nullptr) {
         printf("init_proved_statements: empty dummy verify key\n");
         return false;
@@ -1534,7 +1859,7 @@ bool init_proved_statements(key_message &      pk,
       }
       const key_message &vcek_key = last_clause.clause().subject().key();
 
-      EVP_PKEY *verify_pkey = pkey_from_key(vcek_key);
+      EVP_PKEY *verify_pkey = cached_pkey(vcek_key);
       if (verify_pkey == nullptr) {
         printf("init_proved_statements: empty verify key\n");
         return false;
@@ -1986,9 +2311,9 @@ bool verify_external_proof_step(predicate_dominance &dom_tree,
 }
 
 bool verify_internal_proof_step(predicate_dominance &dom_tree,
-                                vse_clause           s1,
-                                vse_clause           s2,
-                                vse_clause           conclude,
+                                const vse_clause &   s1,
+                                const vse_clause &   s2,
+                                const vse_clause &   conclude,
                                 int                  rule_to_apply) {
   if (rule_to_apply < 1 || rule_to_apply > 10)
     return false;
@@ -2026,12 +2351,14 @@ bool verify_proof(key_message &        policy_pk,
                   proved_statements *  are_proved) {
 
   // verify proof
+  proved_index proved(are_proved);
   for (int i = 0; i < the_proof->steps_size(); i++) {
     bool success;
-    if (!statement_already_proved(the_proof->steps(i).s1(), are_proved))
-
-      if (!statement_already_proved(the_proof->steps(i).s2(), are_proved))
-        return false;
+    if (!proved.contains(the_proof->steps(i).s1())
+        || !proved.contains(the_proof->steps(i).s2())) {
+      printf("verify_proof: step %d premise not already proved\n", i);
+      return false;
+    }
     success = verify_internal_proof_step(dom_tree,
                                          the_proof->steps(i).s1(),
                                          the_proof->steps(i).s2(),
@@ -2045,8 +2372,7 @@ bool verify_proof(key_message &        policy_pk,
       printf("\n");
       return false;
     }
-    vse_clause *to_add = are_proved->add_proved();
-    to_add->CopyFrom(the_proof->steps(i).conclusion());
+    proved.add(the_proof->steps(i).conclusion());
   }
 
   int n = are_proved->proved_size();
@@ -2066,8 +2392,7 @@ bool add_newfacts_for_sev_attestation(
     string &               serialized_ark_cert,
     string &               serialized_ask_cert,
     string &               serialized_vcek_cert,
-    signed_claim_sequence &trusted_platforms,
-    signed_claim_sequence &trusted_measurements,
+    const policy_database &policy,
     proved_statements *    already_proved) {
 
   // At this point, the already_proved should be
@@ -2080,7 +2405,6 @@ bool add_newfacts_for_sev_attestation(
   //    "The policy-key says the ARK-key is-trusted-for-attestation
   //    "The policy-key says the measurement is-trusted
 
-  signed_claim_message sc1;
   if (!already_proved->proved(1).has_subject()) {
     printf("add_newfacts_for_sev_attestation: error 1\n");
     return false;
@@ -2090,13 +2414,11 @@ bool add_newfacts_for_sev_attestation(
     return false;
   }
   const key_message &expected_key = already_proved->proved(1).subject().key();
-  if (!get_signed_platform_claim_from_trusted_list(expected_key,
-                                                   trusted_platforms,
-                                                   &sc1)) {
+  if (policy.find_platform_key(expected_key) == nullptr) {
     printf("add_newfacts_for_sev_attestation: error 3\n");
     return false;
   }
-  if (!add_fact_from_signed_claim(sc1, already_proved)) {
+  if (!policy.add_platform_key_fact(expected_key, already_proved)) {
     printf("add_newfacts_for_sev_attestation: error 4\n");
     return false;
   }
@@ -2114,14 +2436,11 @@ bool add_newfacts_for_sev_attestation(
   expected_measurement.assign((char *)m_ent.measurement().data(),
                               m_ent.measurement().size());
 
-  signed_claim_message sc2;
-  if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
-                                                      &sc2)) {
+  if (policy.find_measurement(expected_measurement) == nullptr) {
     printf("add_newfacts_for_sev_attestation: error 7\n");
     return false;
   }
-  if (!add_fact_from_signed_claim(sc2, already_proved)) {
+  if (!policy.add_measurement_fact(expected_measurement, already_proved)) {
     printf("add_newfacts_for_sev_attestation: error 8\n");
     return false;
   }
@@ -2131,8 +2450,7 @@ bool add_newfacts_for_sev_attestation(
 
 bool add_newfacts_for_sdk_platform_attestation(
     key_message &          policy_pk,
-    signed_claim_sequence &trusted_platforms,
-    signed_claim_sequence &trusted_measurements,
+    const policy_database &policy,
     proved_statements *    already_proved) {
   // At this point, the already_proved should be
   //      "policyKey is-trusted"
@@ -2157,15 +2475,12 @@ bool add_newfacts_for_sdk_platform_attestation(
   expected_measurement.assign((char *)m_ent.measurement().data(),
                               m_ent.measurement().size());
 
-  signed_claim_message sc;
-  if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
-                                                      &sc)) {
+  if (policy.find_measurement(expected_measurement) == nullptr) {
     printf("Add_newfacts_for_sdk_platform__attestation: Can't sign measurement "
            "\n");
     return false;
   }
-  if (!add_fact_from_signed_claim(sc, already_proved)) {
+  if (!policy.add_measurement_fact(expected_measurement, already_proved)) {
     printf("Add_newfacts_for_sdk_platform__attestation: Can't add fact from "
            "signed claim\n");
     return false;
@@ -2174,11 +2489,23 @@ bool add_newfacts_for_sdk_platform_attestation(
   return true;
 }
 
-bool add_new_facts_for_abbreviatedplatformattestation(
+bool add_newfacts_for_sdk_platform_attestation(
     key_message &          policy_pk,
     signed_claim_sequence &trusted_platforms,
     signed_claim_sequence &trusted_measurements,
     proved_statements *    already_proved) {
+  policy_database policy;
+  if (!policy.index(policy_pk, trusted_platforms, trusted_measurements))
+    return false;
+  return add_newfacts_for_sdk_platform_attestation(policy_pk,
+                                                   policy,
+                                                   already_proved);
+}
+
+bool add_new_facts_for_abbreviatedplatformattestation(
+    key_message &          policy_pk,
+    const policy_database &policy,
+    proved_statements *    already_proved) {
 
   // At this point, the already_proved should be
   //    "policyKey is-trusted"
@@ -2199,13 +2526,7 @@ bool add_new_facts_for_abbreviatedplatformattestation(
   const entity_message &m_ent = already_proved->proved(2).clause().object();
   expected_measurement.assign((char *)m_ent.measurement().data(),
                               m_ent.measurement().size());
-  signed_claim_message sc;
-  if (!get_signed_measurement_claim_from_trusted_list(expected_measurement,
-                                                      trusted_measurements,
-                                                      &sc)) {
-    return false;
-  }
-  if (!add_fact_from_signed_claim(sc, already_proved)) {
+  if (!policy.add_measurement_fact(expected_measurement, already_proved)) {
     return false;
   }
 
@@ -2217,18 +2538,26 @@ bool add_new_facts_for_abbreviatedplatformattestation(
     return false;
   }
   const key_message &expected_key = already_proved->proved(1).subject().key();
-  if (!get_signed_platform_claim_from_trusted_list(expected_key,
-                                                   trusted_platforms,
-                                                   &sc)) {
-    return false;
-  }
-  if (!add_fact_from_signed_claim(sc, already_proved)) {
+  if (!policy.add_platform_key_fact(expected_key, already_proved)) {
     return false;
   }
 
   return true;
 }
 
+bool add_new_facts_for_abbreviatedplatformattestation(
+    key_message &          policy_pk,
+    signed_claim_sequence &trusted_platforms,
+    signed_claim_sequence &trusted_measurements,
+    proved_statements *    already_proved) {
+  policy_database policy;
+  if (!policy.index(policy_pk, trusted_platforms, trusted_measurements))
+    return false;
+  return add_new_facts_for_abbreviatedplatformattestation(policy_pk,
+                                                          policy,
+                                                          already_proved);
+}
+
 bool construct_proof_from_sev_evidence(key_message &      policy_pk,
                                        const string &     purpose,
                                        proved_statements *already_proved,
@@ -2584,8 +2913,7 @@ bool construct_proof_from_full_vse_evidence(key_message &      policy_pk,
 bool construct_proof_from_request(const string &         evidence_descriptor,
                                   key_message &          policy_pk,
                                   const string &         purpose,
-                                  signed_claim_sequence &trusted_platforms,
-                                  signed_claim_sequence &trusted_measurements,
+                                  const policy_database &policy,
                                   evidence_package &     evp,
                                   proved_statements *    already_proved,
                                   vse_clause *           to_prove,
@@ -2617,8 +2945,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
     }
   } else if (evidence_descriptor == "platform-attestation-only") {
     if (!add_new_facts_for_abbreviatedplatformattestation(policy_pk,
-                                                          trusted_platforms,
-                                                          trusted_measurements,
+                                                          policy,
                                                           already_proved)) {
       printf("add_new_facts_for_abbreviatedplatformattestation failed\n");
       return false;
@@ -2642,8 +2969,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                           serialized_ark_cert,
                                           serialized_ask_cert,
                                           serialized_vcek_cert,
-                                          trusted_platforms,
-                                          trusted_measurements,
+                                          policy,
                                           already_proved)) {
       printf("construct_proof_from_sev_evidence failed in "
              "add_newfacts_for_sev_attestation\n");
@@ -2657,8 +2983,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
       return false;
   } else if (evidence_descriptor == "oe-evidence") {
     if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
+                                                   policy,
                                                    already_proved))
       return false;
     return construct_proof_from_sdk_evidence(policy_pk,
@@ -2668,8 +2993,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                              pf);
   } else if (evidence_descriptor == "asylo-evidence") {
     if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
+                                                   policy,
                                                    already_proved)) {
       printf("construct_proof_from_full_vse_evidence in "
              "add_newfacts_for_asyloplatform_evidence failed\n");
@@ -2682,8 +3006,7 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
                                              pf);
   } else if (evidence_descriptor == "gramine-evidence") {
     if (!add_newfacts_for_sdk_platform_attestation(policy_pk,
-                                                   trusted_platforms,
-                                                   trusted_measurements,
+                                                   policy,
                                                    already_proved)) {
       printf("construct_proof_from_full_vse_evidence in "
              "add_newfacts_for_gramineplatform_evidence failed\n");
@@ -2701,38 +3024,344 @@ bool construct_proof_from_request(const string &         evidence_descriptor,
   return true;
 }
 
-bool validate_evidence(const string &         evidence_descriptor,
-                       signed_claim_sequence &trusted_platforms,
-                       signed_claim_sequence &trusted_measurements,
-                       const string &         purpose,
-                       evidence_package &     evp,
-                       key_message &          policy_pk) {
+bool construct_proof_from_request(const string &         evidence_descriptor,
+                                  key_message &          policy_pk,
+                                  const string &         purpose,
+                                  signed_claim_sequence &trusted_platforms,
+                                  signed_claim_sequence &trusted_measurements,
+                                  evidence_package &     evp,
+                                  proved_statements *    already_proved,
+                                  vse_clause *           to_prove,
+                                  proof *                pf) {
+  policy_database policy;
+  if (!policy.index(policy_pk, trusted_platforms, trusted_measurements))
+    return false;
+  return construct_proof_from_request(evidence_descriptor,
+                                      policy_pk,
+                                      purpose,
+                                      policy,
+                                      evp,
+                                      already_proved,
+                                      to_prove,
+                                      pf);
+}
+
+// The measurement or environment R1 or R7 concluded an enclave key is
+// trusted from.
+static bool proved_measurement(const proof_step &ps, string *measurement) {
+  if ((ps.rule_applied() != 1 && ps.rule_applied() != 7)
+      || !ps.s1().has_subject())
+    return false;
+  const entity_message &e = ps.s1().subject();
+  if (e.entity_type() == "measurement") {
+    measurement->assign(e.measurement());
+    return true;
+  }
+  if (e.entity_type() == "environment") {
+    measurement->assign(e.environment_ent().the_measurement());
+    return true;
+  }
+  return false;
+}
 
-  proved_statements   already_proved;
-  vse_clause          to_prove;
-  proof               pf;
-  predicate_dominance predicate_dominance_root;
+// Certification verdict cache
+// -----------------------------------------------------------------------
+//  A restarted client sends the same endorsement and measurement with a
+//  new enclave key.  Once "attestKey is-trusted-for-attestation" and
+//  "measurement is-trusted" have been proved for them, the conclusions
+//  are kept under SHA-256(descriptor, policy database generation, policy
+//  key, endorsement evidence, measurement) and a repeat request only has
+//  its attestation verified.  Only compiled databases qualify: an index()
+//  borrows sequences its caller may change.  Failures are never cached.
+
+class verdict_cache {
+ public:
+  static const int max_entries = 4096;
+
+  struct entry {
+    time_t     expires;
+    vse_clause attest_key_trusted;
+    vse_clause measurement_trusted;
+  };
+
+  std::mutex                        mtx_;
+  std::unordered_map<string, entry> entries_;
+  int                               ttl_ = 300;
+
+  bool find(const string &id, entry *e) {
+    std::lock_guard<std::mutex> l(mtx_);
+    auto                        it = entries_.find(id);
+    if (it == entries_.end())
+      return false;
+    if (it->second.expires <= time(nullptr)) {
+      entries_.erase(it);
+      return false;
+    }
+    *e = it->second;
+    return true;
+  }
 
-  if (!init_dominance_tree(predicate_dominance_root)) {
-    printf("%s() error, line %d, validate_evidence: can't init predicate "
-           "dominance tree\n",
-           __func__,
-           __LINE__);
+  void add(const string &    id,
+           const vse_clause &attest_key_trusted,
+           const vse_clause &measurement_trusted,
+           time_t            not_after) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (ttl_ <= 0)
+      return;
+    time_t now = time(nullptr);
+    time_t expires = now + ttl_;
+    if (not_after != 0 && not_after < expires)
+      expires = not_after;
+    if (expires <= now)
+      return;
+    if ((int)entries_.size() >= max_entries) {
+      for (auto it = entries_.begin(); it != entries_.end();) {
+        if (it->second.expires <= now)
+          it = entries_.erase(it);
+        else
+          ++it;
+      }
+      if ((int)entries_.size() >= max_entries)
+        entries_.erase(entries_.begin());
+    }
+    entry &e = entries_[id];
+    e.expires = expires;
+    e.attest_key_trusted.CopyFrom(attest_key_trusted);
+    e.measurement_trusted.CopyFrom(measurement_trusted);
+  }
+};
+
+static verdict_cache &verdicts() {
+  static verdict_cache *c = new verdict_cache();
+  return *c;
+}
+
+void set_verdict_cache_ttl(int seconds) {
+  verdict_cache &             c = verdicts();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  c.ttl_ = seconds;
+  if (seconds <= 0)
+    c.entries_.clear();
+}
+
+void clear_verdict_cache() {
+  verdict_cache &             c = verdicts();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  c.entries_.clear();
+}
+
+int verdict_cache_size() {
+  verdict_cache &             c = verdicts();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  return (int)c.entries_.size();
+}
+
+// The attestation is the one signed-vse-attestation-report; everything
+// else is endorsement and must be a signed claim.  The measurement is
+// read from the unverified report: it only selects the entry, and the
+// report is verified before the entry is used.
+static bool verdict_id(const string &          evidence_descriptor,
+                       const policy_database & policy,
+                       const evidence_package &evp,
+                       int *                   attest_index,
+                       string *                measurement,
+                       string *                id) {
+  if (evidence_descriptor != "full-vse-support"
+      && evidence_descriptor != "platform-attestation-only")
+    return false;
+  if (!policy.verified() || policy.generation() == 0)
+    return false;
+
+  string material;
+  append_field(evidence_descriptor, &material);
+  append_field(std::to_string(policy.generation()), &material);
+  if (!canonical_key(policy.policy_key(), &material))
     return false;
+
+  *attest_index = -1;
+  for (int i = 0; i < evp.fact_assertion_size(); i++) {
+    const evidence &ev = evp.fact_assertion(i);
+    if (ev.evidence_type() == "signed-vse-attestation-report") {
+      if (*attest_index >= 0)
+        return false;
+      *attest_index = i;
+      continue;
+    }
+    if (ev.evidence_type() != "signed-claim")
+      return false;
+    append_field(ev.serialized_evidence(), &material);
   }
+  if (*attest_index < 0)
+    return false;
 
-  if (!init_axiom(policy_pk, &already_proved)) {
-    printf("%s() error, line %d, validate_evidence: can't init axiom\n",
+  const evidence &            attestation = evp.fact_assertion(*attest_index);
+  signed_report               sr;
+  vse_attestation_report_info info;
+  if (!sr.ParseFromString(attestation.serialized_evidence())
+      || !info.ParseFromString(sr.report()))
+    return false;
+  measurement->assign(info.verified_measurement());
+  append_field(*measurement, &material);
+
+  byte digest[32];
+  if (!digest_message(Digest_method_sha_256,
+                      (const byte *)material.data(),
+                      material.size(),
+                      digest,
+                      sizeof(digest)))
+    return false;
+  id->assign((char *)digest, sizeof(digest));
+  return true;
+}
+
+static void fold_not_after(const signed_claim_message *sc,
+                           time_t *                    not_after) {
+  claim_message cm;
+  time_point    tp;
+  time_t        t;
+  if (sc == nullptr || !cm.ParseFromString(sc->serialized_claim_message())
+      || !string_to_time(cm.not_after(), &tp) || !time_point_to_time_t(tp, &t))
+    return;
+  if (*not_after == 0 || t < *not_after)
+    *not_after = t;
+}
+
+// Earliest not-after among the endorsement claims and the policy claims
+// for their signers and the measurement; 0 if none could be read.
+static time_t verdict_not_after(const policy_database & policy,
+                                const evidence_package &evp,
+                                int                     attest_index,
+                                const string &          measurement) {
+  time_t not_after = 0;
+  for (int i = 0; i < evp.fact_assertion_size(); i++) {
+    if (i == attest_index)
+      continue;
+    signed_claim_message sc;
+    if (!sc.ParseFromString(evp.fact_assertion(i).serialized_evidence()))
+      continue;
+    fold_not_after(&sc, &not_after);
+    fold_not_after(policy.find_platform_key(sc.signing_key()), &not_after);
+  }
+  fold_not_after(policy.find_measurement(measurement), &not_after);
+  return not_after;
+}
+
+// Rebuild the proof from a cached verdict: only the attestation, "attestKey
+// says enclaveKey speaks-for measurement", is verified.  *decided stays
+// false when the attestation is by a key other than the one the verdict
+// is for, and the caller then proves in full.
+static bool validate_from_verdict(const verification_context &context,
+                                  key_message &               policy_pk,
+                                  const evidence &            attestation,
+                                  const verdict_cache::entry &e,
+                                  bool *                      decided,
+                                  vse_clause *                proved,
+                                  string *                    measurement) {
+  proved_statements already_proved;
+  vse_clause        to_prove;
+  proof             pf;
+  evidence_package  fresh;
+
+  *decided = false;
+  context.start_proof(&already_proved);
+  fresh.set_prover_type("vse-verifier");
+  fresh.add_fact_assertion()->CopyFrom(attestation);
+  if (!init_proved_statements(policy_pk, fresh, &already_proved)) {
+    *decided = true;
+    return false;
+  }
+  const vse_clause &attest =
+      already_proved.proved(already_proved.proved_size() - 1);
+  if (!attest.has_subject() || attest.subject().entity_type() != "key"
+      || !attest.has_clause() || !attest.clause().has_subject()
+      || !same_key(attest.subject().key(),
+                   e.attest_key_trusted.subject().key()))
+    return false;
+  *decided = true;
+
+  already_proved.add_proved()->CopyFrom(e.attest_key_trusted);
+  already_proved.add_proved()->CopyFrom(e.measurement_trusted);
+  string it("is-trusted-for-authentication");
+  if (!make_unary_vse_clause(attest.clause().subject(), it, &to_prove))
+    return false;
+
+  // "attestKey is-trusted-for-attestation" AND "attestKey says enclaveKey
+  // speaks-for measurement" --> "enclaveKey speaks-for measurement"
+  proof_step *ps = pf.add_steps();
+  ps->mutable_s1()->CopyFrom(e.attest_key_trusted);
+  ps->mutable_s2()->CopyFrom(attest);
+  ps->mutable_conclusion()->CopyFrom(attest.clause());
+  ps->set_rule_applied(6);
+
+  // "measurement is-trusted" AND "enclaveKey speaks-for measurement"
+  //      --> "enclaveKey is-trusted-for-authentication"
+  ps = pf.add_steps();
+  ps->mutable_s1()->CopyFrom(e.measurement_trusted);
+  ps->mutable_s2()->CopyFrom(attest.clause());
+  ps->mutable_conclusion()->CopyFrom(to_prove);
+  ps->set_rule_applied(1);
+
+  if (!verify_proof(policy_pk,
+                    to_prove,
+                    context.dominance_tree(),
+                    &pf,
+                    &already_proved))
+    return false;
+  proved->CopyFrom(to_prove);
+  measurement->assign(e.measurement_trusted.subject().measurement());
+  return true;
+}
+
+bool validate_evidence(const string &         evidence_descriptor,
+                       const policy_database &policy,
+                       const string &         purpose,
+                       evidence_package &     evp,
+                       key_message &          policy_pk,
+                       vse_clause *           proved,
+                       string *               proved_measurement_out) {
+
+  proved_statements           already_proved;
+  vse_clause                  to_prove;
+  proof                       pf;
+  const verification_context &context = policy.context();
+
+  if (!context.initialized() || !same_key(context.policy_key(), policy_pk)) {
+    printf("%s() error, line %d, validate_evidence: policy is not for this "
+           "policy key\n",
            __func__,
            __LINE__);
     return false;
   }
 
+  string               id;
+  string               measurement;
+  int                  attest_index = -1;
+  verdict_cache::entry cached;
+  bool                 cacheable = verdict_id(evidence_descriptor,
+                                              policy,
+                                              evp,
+                                              &attest_index,
+                                              &measurement,
+                                              &id);
+  if (cacheable && verdicts().find(id, &cached)) {
+    bool decided = false;
+    bool valid = validate_from_verdict(context,
+                                       policy_pk,
+                                       evp.fact_assertion(attest_index),
+                                       cached,
+                                       &decided,
+                                       proved,
+                                       proved_measurement_out);
+    if (decided)
+      return valid;
+  }
+
+  context.start_proof(&already_proved);
+
   if (!construct_proof_from_request(evidence_descriptor,
                                     policy_pk,
                                     purpose,
-                                    trusted_platforms,
-                                    trusted_measurements,
+                                    policy,
                                     evp,
                                     &already_proved,
                                     &to_prove,
@@ -2761,12 +3390,33 @@ bool validate_evidence(const string &         evidence_descriptor,
 
   if (!verify_proof(policy_pk,
                     to_prove,
-                    predicate_dominance_root,
+                    context.dominance_tree(),
                     &pf,
                     &already_proved)) {
     printf("verify_proof failed\n");
     return false;
   }
+  if (pf.steps_size() < 1
+      || !proved_measurement(pf.steps(pf.steps_size() - 1),
+                             proved_measurement_out)) {
+    printf("%s() error, line %d, validate_evidence: proof doesn't end with "
+           "a trusted measurement\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  proved->CopyFrom(to_prove);
+
+  // Steps 1 and 2 of construct_proof_from_full_vse_evidence conclude
+  // "measurement is-trusted" and "attestKey is-trusted-for-attestation".
+  if (cacheable && pf.steps_size() == 5 && pf.steps(1).rule_applied() == 3
+      && pf.steps(2).rule_applied() == 5) {
+    verdicts().add(
+        id,
+        pf.steps(2).conclusion(),
+        pf.steps(1).conclusion(),
+        verdict_not_after(policy, evp, attest_index, measurement));
+  }
 
 #ifdef PRINT_ALREADY_PROVED
   printf("Proved:");
@@ -2783,6 +3433,44 @@ bool validate_evidence(const string &         evidence_descriptor,
   return true;
 }
 
+bool validate_evidence(const string &         evidence_descriptor,
+                       const policy_database &policy,
+                       const string &         purpose,
+                       evidence_package &     evp,
+                       key_message &          policy_pk) {
+  vse_clause proved;
+  string     measurement;
+  return validate_evidence(evidence_descriptor,
+                           policy,
+                           purpose,
+                           evp,
+                           policy_pk,
+                           &proved,
+                           &measurement);
+}
+
+// Services validating many requests against one policy should compile a
+// policy_database once and use the overloads above.
+bool validate_evidence(const string &         evidence_descriptor,
+                       signed_claim_sequence &trusted_platforms,
+                       signed_claim_sequence &trusted_measurements,
+                       const string &         purpose,
+                       evidence_package &     evp,
+                       key_message &          policy_pk) {
+  policy_database policy;
+  if (!policy.index(policy_pk, trusted_platforms, trusted_measurements)) {
+    printf("%s() error, line %d, validate_evidence: can't index policy\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return validate_evidence(evidence_descriptor,
+                           policy,
+                           purpose,
+                           evp,
+                           policy_pk);
+}
+
 //  New style proofs with platform information
 // -------------------------------------------------------------------
 
@@ -2794,15 +3482,16 @@ bool verify_proof_from_array(key_message &        policy_pk,
                              proof_step *         steps) {
 
   // verify proof
+  proved_index proved(are_proved);
   for (int i = 0; i < num_steps; i++) {
     bool success;
-    if (!statement_already_proved(steps[i].s1(), are_proved)) {
+    if (!proved.contains(steps[i].s1())) {
       printf("verify_proof_from_array: S1 not already proved\n");
       return false;
     }
 
-    if (!statement_already_proved(steps[i].s2(), are_proved)) {
-      printf("verify_proof_from_array: S1 not already proved\n");
+    if (!proved.contains(steps[i].s2())) {
+      printf("verify_proof_from_array: S2 not already proved\n");
       return false;
     }
     success = verify_internal_proof_step(dom_tree,
@@ -2818,8 +3507,7 @@ bool verify_proof_from_array(key_message &        policy_pk,
       printf("\n");
       return false;
     }
-    vse_clause *to_add = are_proved->add_proved();
-    to_add->CopyFrom(steps[i].conclusion());
+    proved.add(steps[i].conclusion());
   }
 
   int n = are_proved->proved_size();
@@ -3148,10 +3836,18 @@ bool init_policy(signed_claim_sequence &policy,
                  key_message &          policy_pk,
                  proved_statements *    already_proved) {
 
+  // Check every signature at once, then add the facts in order.
+  int                                       n = policy.claims_size();
+  std::vector<const signed_claim_message *> claims(n);
+  std::unique_ptr<bool[]>                   verified(new bool[n + 1]);
+  for (int i = 0; i < n; i++)
+    claims[i] = &policy.claims(i);
+  verify_signed_claims(n, claims.data(), nullptr, 1, verified.get());
+
   for (int i = 0; i < policy.claims_size(); i++) {
 #if 1
     // This is a little wasteful since we parse it in
-    // add_fact_from_signed_claim. Remove this when filter policy is
+    // add_fact_from_verified_claim. Remove this when filter policy is
     // implemented.
     claim_message cm;
     if (!cm.ParseFromString(policy.claims(i).serialized_claim_message())) {
@@ -3173,7 +3869,8 @@ bool init_policy(signed_claim_sequence &policy,
       return false;
     }
 #endif
-    if (!add_fact_from_signed_claim(policy.claims(i), already_proved)) {
+    if (!verified[i]
+        || !add_fact_from_verified_claim(policy.claims(i), already_proved)) {
       printf("init_policy: Can't add claim %d\n", i);
       printf("\n");
       return false;
@@ -3215,71 +3912,59 @@ bool right_platform(const vse_clause &cl, const platform &p) {
   return satisfying_platform(cl.subject().platform_ent(), p);
 }
 
-#ifdef SEV_SNP
 // Exactly one satisfying platform and one satisfying measurement should
 // be in the filtered policy.  It there are none or more than one each,
 // it's an error.  Also check the policy key is doing the saying.
-bool filter_sev_policy(const sev_attestation_message &sev_att,
-                       const key_message &            policy_pk,
-                       const signed_claim_sequence &  policy,
-                       signed_claim_sequence *        filtered_policy) {
-
-  entity_message m_ent;
-  if (!get_measurement_from_sev_attest(sev_att, &m_ent)) {
-    printf("filter_sev_policy: Can't get measurement from attestation\n");
-    return false;
-  }
-  entity_message p_ent;
-  if (!get_platform_from_sev_attest(sev_att, &p_ent)) {
-    printf("filter_sev_policy: Can't get platform from attestation\n");
-    return false;
-  }
-
+bool filter_policy(const string &               measurement,
+                   const platform &             plat,
+                   const key_message &          policy_pk,
+                   const signed_claim_sequence &policy,
+                   signed_claim_sequence *      filtered_policy) {
   bool found_measurement = false;
   bool found_platform = false;
 
   for (int i = 0; i < policy.claims_size(); i++) {
     claim_message cm;
     if (!cm.ParseFromString(policy.claims(i).serialized_claim_message())) {
-      printf("filter_sev_policy: Can't parse serialized claim in policy\n");
+      printf("filter_policy: Can't parse serialized claim in policy\n");
       return false;
     }
     if (cm.claim_format() != "vse-clause") {
-      printf("filter_sev_policy: policy must be a vse-clause\n");
+      printf("filter_policy: policy must be a vse-clause\n");
       return false;
     }
     vse_clause cl;
     if (!cl.ParseFromString(cm.serialized_claim())) {
-      printf("filter_sev_policy: Can't parse serialized policy\n");
+      printf("filter_policy: Can't parse serialized policy\n");
       return false;
     }
     if (!cl.has_subject()) {
-      printf("filter_sev_policy: policy rule misformatted (1)\n");
+      printf("filter_policy: policy rule misformatted (1)\n");
       return false;
     }
     const entity_message &em = cl.subject();
     if (em.entity_type() != "key" || !same_key(policy_pk, em.key())) {
-      printf("filter_sev_policy: the policy key does the saying\n");
+      printf("filter_policy: the policy key does the saying\n");
       return false;
     }
     // In cl, look for: policy_key says measurement is_trusted and
     // policy-key says platform[] has trusted-platform-properties.
     // If match, keep them.  If not, don't.
     if (!cl.has_clause()) {
-      printf("filter_sev_policy: policy rule misformatted (2)\n");
+      printf("filter_policy: policy rule misformatted (2)\n");
       return false;
     }
     if (is_measurement(cl.clause())) {
       if (found_measurement)
         continue;
-      if (!right_measurement(cl.clause(), m_ent.measurement()))
+      if (!right_measurement(cl.clause(), measurement))
         continue;
       found_measurement = true;
     }
     if (is_platform(cl.clause())) {
       if (found_platform)
         continue;
-      if (!right_platform(cl.clause(), p_ent.platform_ent()))
+      if (!right_platform(cl.clause(), plat))
         continue;
       found_platform = true;
     }
@@ -3290,31 +3975,33 @@ bool filter_sev_policy(const sev_attestation_message &sev_att,
   return found_measurement && found_platform;
 }
 
-// Use policy statements for init
-bool validate_evidence_from_policy(const string &         evidence_descriptor,
-                                   signed_claim_sequence &policy,
-                                   const string &         purpose,
-                                   evidence_package &     evp,
-                                   key_message &          policy_pk) {
-
-  proved_statements   already_proved;
-  vse_clause          to_prove;
-  predicate_dominance predicate_dominance_root;
+#ifdef SEV_SNP
+bool filter_sev_policy(const sev_attestation_message &sev_att,
+                       const key_message &            policy_pk,
+                       const signed_claim_sequence &  policy,
+                       signed_claim_sequence *        filtered_policy) {
 
-  if (!init_dominance_tree(predicate_dominance_root)) {
-    printf("validate_evidence: can't init predicate dominance tree\n");
+  entity_message m_ent;
+  if (!get_measurement_from_sev_attest(sev_att, &m_ent)) {
+    printf("filter_sev_policy: Can't get measurement from attestation\n");
     return false;
   }
-
-  if (!init_axiom(policy_pk, &already_proved)) {
-    printf("validate_evidence: can't init axiom\n");
+  entity_message p_ent;
+  if (!get_platform_from_sev_attest(sev_att, &p_ent)) {
+    printf("filter_sev_policy: Can't get platform from attestation\n");
     return false;
   }
+  return filter_policy(m_ent.measurement(),
+                       p_ent.platform_ent(),
+                       policy_pk,
+                       policy,
+                       filtered_policy);
+}
 
-  // Filter the policy first
-  //    The last statement in the evidence package should
-  //    be a sev-attestation which is a
-  //    serialized sev_attestation_message.
+// The last statement in the evidence package should be a
+// sev-attestation, a serialized sev_attestation_message.
+static bool sev_attestation_from_evidence(const evidence_package & evp,
+                                          sev_attestation_message *sev_att) {
   int k = evp.fact_assertion_size();
   if (k < 1) {
     printf("validate_evidence: empty evidence\n");
@@ -3325,25 +4012,24 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
     printf("validate_evidence: wrong evidence type\n");
     return false;
   }
-
-  // Get the actual measurement and platform from that
-  // to filter policy.
-  sev_attestation_message sev_att;
-  if (!sev_att.ParseFromString(ev.serialized_evidence())) {
+  if (!sev_att->ParseFromString(ev.serialized_evidence())) {
     printf("validate_evidence: Can't parse sev attestation\n");
     return false;
   }
+  return true;
+}
 
-  signed_claim_sequence filtered_policy;
-  if (!filter_sev_policy(sev_att, policy_pk, policy, &filtered_policy)) {
-    printf("validate_evidence: can't filter policy\n");
-    return false;
-  }
-
-  if (!init_policy(filtered_policy, policy_pk, &already_proved)) {
-    printf("validate_evidence: init_policy failed\n");
-    return false;
-  }
+// already_proved holds the axiom and the filtered policy.
+static bool prove_sev_evidence_with_plat(
+    const string &       evidence_descriptor,
+    const string &       purpose,
+    evidence_package &   evp,
+    key_message &        policy_pk,
+    predicate_dominance &dom_tree,
+    proved_statements &  already_proved,
+    vse_clause *         proved,
+    string *             measurement) {
+  vse_clause to_prove;
 
   if (!init_proved_statements(policy_pk, evp, &already_proved)) {
     printf("validate_evidence: init_proved_statements\n");
@@ -3394,13 +4080,19 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
 
   if (!verify_proof_from_array(policy_pk,
                                to_prove,
-                               predicate_dominance_root,
+                               dom_tree,
                                &already_proved,
                                num_steps,
                                steps)) {
     printf("validate_evidence_from_policy: verify_proof failed\n");
     return false;
   }
+  if (num_steps < 1 || !proved_measurement(steps[num_steps - 1], measurement)) {
+    printf("validate_evidence_from_policy: proof doesn't end with a trusted "
+           "measurement\n");
+    return false;
+  }
+  proved->CopyFrom(to_prove);
 #  ifdef PRINT_ALREADY_PROVED
   printf("Proved:");
   print_vse_clause(to_prove);
@@ -3416,6 +4108,112 @@ bool validate_evidence_from_policy(const string &         evidence_descriptor,
 
   return true;
 }
+
+// Use policy statements for init
+bool validate_evidence_from_policy(const string &         evidence_descriptor,
+                                   signed_claim_sequence &policy,
+                                   const string &         purpose,
+                                   evidence_package &     evp,
+                                   key_message &          policy_pk) {
+
+  proved_statements already_proved;
+
+  if (!init_axiom(policy_pk, &already_proved)) {
+    printf("validate_evidence: can't init axiom\n");
+    return false;
+  }
+
+  // Filter the policy first, using the actual measurement and platform
+  // in the attestation.
+  sev_attestation_message sev_att;
+  if (!sev_attestation_from_evidence(evp, &sev_att))
+    return false;
+
+  signed_claim_sequence filtered_policy;
+  if (!filter_sev_policy(sev_att, policy_pk, policy, &filtered_policy)) {
+    printf("validate_evidence: can't filter policy\n");
+    return false;
+  }
+
+  if (!init_policy(filtered_policy, policy_pk, &already_proved)) {
+    printf("validate_evidence: init_policy failed\n");
+    return false;
+  }
+
+  vse_clause proved;
+  string     measurement;
+  return prove_sev_evidence_with_plat(evidence_descriptor,
+                                      purpose,
+                                      evp,
+                                      policy_pk,
+                                      certifier_dominance_tree(),
+                                      already_proved,
+                                      &proved,
+                                      &measurement);
+}
+
+// As above, with the policy compiled by policy_database::compile: the
+// filter is an index probe and its facts are already verified.
+bool validate_evidence_from_policy(const string &         evidence_descriptor,
+                                   const policy_database &policy,
+                                   const string &         purpose,
+                                   evidence_package &     evp,
+                                   key_message &          policy_pk,
+                                   vse_clause *           proved,
+                                   string *               measurement) {
+
+  proved_statements           already_proved;
+  const verification_context &context = policy.context();
+
+  if (!context.initialized() || !same_key(context.policy_key(), policy_pk)) {
+    printf("validate_evidence: policy is not for this policy key\n");
+    return false;
+  }
+  context.start_proof(&already_proved);
+
+  sev_attestation_message sev_att;
+  if (!sev_attestation_from_evidence(evp, &sev_att))
+    return false;
+  entity_message m_ent;
+  entity_message p_ent;
+  if (!get_measurement_from_sev_attest(sev_att, &m_ent)
+      || !get_platform_from_sev_attest(sev_att, &p_ent)) {
+    printf("validate_evidence: Can't get measurement or platform from "
+           "attestation\n");
+    return false;
+  }
+  if (!policy.add_sev_policy_facts(m_ent.measurement(),
+                                   p_ent.platform_ent(),
+                                   &already_proved)) {
+    printf("validate_evidence: can't filter policy\n");
+    return false;
+  }
+
+  return prove_sev_evidence_with_plat(evidence_descriptor,
+                                      purpose,
+                                      evp,
+                                      policy_pk,
+                                      context.dominance_tree(),
+                                      already_proved,
+                                      proved,
+                                      measurement);
+}
+
+bool validate_evidence_from_policy(const string &         evidence_descriptor,
+                                   const policy_database &policy,
+                                   const string &         purpose,
+                                   evidence_package &     evp,
+                                   key_message &          policy_pk) {
+  vse_clause proved;
+  string     measurement;
+  return validate_evidence_from_policy(evidence_descriptor,
+                                       policy,
+                                       purpose,
+                                       evp,
+                                       policy_pk,
+                                       &proved,
+                                       &measurement);
+}
 #endif
 
 // -------------------------------------------------------------------------------------
@@ -0,0 +1,102 @@
+//  Copyright (c) 2021-22, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Certifier service in C++.  It speaks the wire format of
+// certifier_service/simpleserver.go: a trust_request_message in and a
+// trust_response_message out, each framed by sized_socket_read/write.
+// The policy is read and compiled into a policy_database once at startup
+// and every request is validated against it on a work-stealing pool (see
+// certifier_service.h).
+//
+//   certifier_server.exe --policy_key_file=policy_key_file.bin
+//       --policy_cert_file=policy_cert_file.bin --policy_file=policy.bin
+//       [--host=localhost] [--port=8123] [--num_workers=0]
+
+#include <gflags/gflags.h>
+
+#include "support.h"
+#include "certifier.h"
+#include "cc_helpers.h"
+#include "certifier_service.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+using namespace certifier::framework;
+using namespace certifier::utilities;
+
+DEFINE_bool(print_all, false, "verbose");
+DEFINE_string(host, "localhost", "address for server");
+DEFINE_int32(port, 8123, "port for server");
+
+DEFINE_string(policy_key_file, "policy_key_file.bin", "policy key file");
+DEFINE_string(policy_cert_file, "policy_cert_file.bin", "policy cert file");
+DEFINE_string(policy_file, "policy.bin", "signed policy claims");
+
+DEFINE_int32(num_workers, 0, "validation threads, every core if 0");
+DEFINE_int32(max_pending, 0, "accepted requests waiting, 4 per worker if 0");
+DEFINE_int32(io_timeout, 30, "seconds allowed for a request or response");
+DEFINE_int32(max_request_size, 1 << 20, "largest request accepted");
+DEFINE_double(duration, 365.26 * 86400.0, "artifact lifetime in seconds");
+
+// ----------------------------------------------------------------------------------
+
+int main(int an, char **av) {
+  gflags::ParseCommandLineFlags(&an, &av, true);
+
+  // A client closing early must not end the service.
+  signal(SIGPIPE, SIG_IGN);
+
+  certifier_service service;
+  service.max_request_size_ = FLAGS_max_request_size;
+  service.duration_ = FLAGS_duration;
+  service.print_all_ = FLAGS_print_all;
+  if (!service.init_from_files(FLAGS_policy_key_file,
+                               FLAGS_policy_cert_file,
+                               FLAGS_policy_file)) {
+    printf("certifier_server: Can't initialize service\n");
+    return 1;
+  }
+
+  work_stealing_pool pool(FLAGS_num_workers, FLAGS_max_pending);
+  int                sock = -1;
+  if (!open_server_socket(FLAGS_host, FLAGS_port, SOMAXCONN, &sock)) {
+    printf("certifier_server: Can't open server socket %s:%d\n",
+           FLAGS_host.c_str(),
+           FLAGS_port);
+    return 1;
+  }
+  printf("certifier_server: %d workers listening on %s:%d\n",
+         pool.num_workers(),
+         FLAGS_host.c_str(),
+         FLAGS_port);
+
+  struct timeval tv = {FLAGS_io_timeout, 0};
+  while (1) {
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int                client = accept(sock, (struct sockaddr *)&addr, &len);
+    if (client < 0) {
+      printf("certifier_server: accept failed\n");
+      continue;
+    }
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    pool.submit([&service, client]() { service.serve(client); });
+  }
+  return 0;
+}
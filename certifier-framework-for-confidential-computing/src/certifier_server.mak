@@ -0,0 +1,149 @@
+#    
+#    File: certifier_server.mak
+#
+#    Multi-threaded certifier service; validates trust requests against
+#    a policy compiled once at startup.
+#
+#      make -f certifier_server.mak
+#      ./certifier_server.exe --policy_key_file=policy_key_file.bin \
+#          --policy_cert_file=policy_cert_file.bin --policy_file=policy.bin
+#
+#    ENABLE_SEV=1 also accepts sev-platform-package requests.
+
+# CERTIFIER_ROOT will be certifier-framework-for-confidential-computing/ dir
+CERTIFIER_ROOT = ..
+
+ifndef SRC_DIR
+SRC_DIR=.
+endif
+ifndef INC_DIR
+INC_DIR=../include
+endif
+ifndef OBJ_DIR
+OBJ_DIR=.
+endif
+ifndef EXE_DIR
+EXE_DIR=.
+endif
+
+ifndef LOCAL_LIB
+    LOCAL_LIB=/usr/local/lib
+endif
+
+CP = $(CERTIFIER_ROOT)/certifier_service/certprotos
+
+S= $(SRC_DIR)
+O= $(OBJ_DIR)
+I= $(INC_DIR)
+
+INCLUDE = -I $(I) -I/usr/local/opt/openssl@1.1/include/ -I $(S)/sev-snp -I $(S)/gramine
+
+CFLAGS_COMMON = $(INCLUDE) -g -std=c++17 -D X64 -Wall -Wno-unused-variable -Wno-deprecated-declarations
+
+CFLAGS  = $(CFLAGS_COMMON) -O3
+
+CFLAGS_PIC =
+
+# Verifies real SEV-SNP attestations, so no SEV_DUMMY_GUEST here.
+ifdef ENABLE_SEV
+CFLAGS += -D SEV_SNP
+endif
+
+CFLAGS += $(CFLAGS_PIC)
+
+CC=g++
+LINK=g++
+PROTO=protoc
+
+LDFLAGS= -L $(LOCAL_LIB) -lprotobuf -lgflags -lpthread -L/usr/local/opt/openssl@1.1/lib/ -lcrypto -lssl -luuid
+
+common_objs = $(O)/certifier.pb.o $(O)/certifier.o      \
+              $(O)/certifier_proofs.o  $(O)/support.o $(O)/simulated_enclave.o \
+              $(O)/application_enclave.o
+
+dobj = $(O)/certifier_server.o $(O)/certifier_service.o $(common_objs) \
+       $(O)/cc_helpers.o $(O)/cc_useful.o
+
+ifdef ENABLE_SEV
+dobj += $(O)/sev_support.o $(O)/sev_report.o $(O)/sev_cert_table.o
+endif
+
+all:	certifier_server.exe
+
+clean:
+	@echo "removing generated files"
+	rm -rf $(S)/certifier.pb.h $(I)/certifier.pb.h $(S)/certifier.pb.cc
+	@echo "removing object files"
+	rm -rf $(O)/*.o
+	@echo "removing executable files"
+	rm -rf $(EXE_DIR)/certifier_server.exe
+
+certifier_server.exe: $(dobj)
+	@echo "\nlinking executable $@"
+	$(LINK) -o $(EXE_DIR)/certifier_server.exe $(dobj) $(LDFLAGS)
+
+$(I)/certifier.pb.h: $(S)/certifier.pb.cc
+$(S)/certifier.pb.cc: $(CP)/certifier.proto
+	$(PROTO) --cpp_out=$(S) --proto_path $(<D) $<
+	mv $(S)/certifier.pb.h $(I)
+
+$(O)/certifier_server.o: $(S)/certifier_server.cc $(I)/certifier.pb.h $(I)/certifier.h $(I)/support.h $(I)/cc_helpers.h $(I)/certifier_service.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier_service.o: $(S)/certifier_service.cc $(I)/certifier.pb.h $(I)/certifier.h $(I)/support.h $(I)/certifier_service.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier.pb.o: $(S)/certifier.pb.cc $(I)/certifier.pb.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier.o: $(S)/certifier.cc $(I)/certifier.pb.h $(I)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier_proofs.o: $(S)/certifier_proofs.cc $(I)/certifier.pb.h $(I)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/support.o: $(S)/support.cc $(I)/support.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/simulated_enclave.o: $(S)/simulated_enclave.cc $(I)/simulated_enclave.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/application_enclave.o: $(S)/application_enclave.cc $(I)/application_enclave.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/cc_helpers.o: $(S)/cc_helpers.cc $(I)/certifier.pb.h $(I)/cc_helpers.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/cc_useful.o: $(S)/cc_useful.cc $(I)/cc_useful.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+ifdef ENABLE_SEV
+SEV_S=$(S)/sev-snp
+
+$(O)/sev_support.o: $(SEV_S)/sev_support.cc \
+$(I)/certifier.h $(I)/support.h $(SEV_S)/attestation.h  $(SEV_S)/sev_guest.h  \
+$(SEV_S)/snp_derive_key.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/sev_cert_table.o: $(SEV_S)/sev_cert_table.cc \
+$(SEV_S)/sev_cert_table.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/sev_report.o: $(SEV_S)/sev_report.cc \
+$(I)/certifier.h $(I)/support.h $(SEV_S)/attestation.h  $(SEV_S)/sev_guest.h  \
+$(SEV_S)/snp_derive_key.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+endif
@@ -0,0 +1,408 @@
+//  Copyright (c) 2021-22, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "certifier_service.h"
+
+#include <sys/socket.h>
+
+using namespace certifier::utilities;
+
+// The pool worker running on this thread, if any, and its index in that
+// pool.  Only the owning pool may use the index.
+struct worker_id {
+  const work_stealing_pool *pool;
+  int                       index;
+};
+static thread_local worker_id current_worker = {nullptr, -1};
+
+work_stealing_pool::work_stealing_pool(int num_workers, int max_pending)
+    : next_(0), queued_(0), stopping_(false) {
+  if (num_workers <= 0)
+    num_workers = (int)std::thread::hardware_concurrency();
+  if (num_workers <= 0)
+    num_workers = 1;
+  max_pending_ = max_pending > 0 ? max_pending : 4 * num_workers;
+  for (int i = 0; i < num_workers; i++)
+    queues_.push_back(std::unique_ptr<worker_queue>(new worker_queue()));
+  for (int i = 0; i < num_workers; i++)
+    threads_.push_back(std::thread([this, i]() { run(i); }));
+}
+
+work_stealing_pool::~work_stealing_pool() {
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+  for (unsigned i = 0; i < threads_.size(); i++)
+    threads_[i].join();
+}
+
+void work_stealing_pool::submit(task t) {
+  // A worker of another pool submits like any other thread.
+  bool own_worker = current_worker.pool == this;
+  {
+    std::unique_lock<std::mutex> l(mtx_);
+    // A worker submitting more work must not wait on itself.
+    if (!own_worker)
+      not_full_.wait(l, [this] { return queued_ < max_pending_; });
+    queued_++;
+  }
+  int i = own_worker ? current_worker.index : next_++ % queues_.size();
+  {
+    std::lock_guard<std::mutex> l(queues_[i]->mtx_);
+    queues_[i]->tasks_.push_back(std::move(t));
+  }
+  not_empty_.notify_one();
+}
+
+bool work_stealing_pool::pop_local(int i, task *t) {
+  worker_queue &              q = *queues_[i];
+  std::lock_guard<std::mutex> l(q.mtx_);
+  if (q.tasks_.empty())
+    return false;
+  *t = std::move(q.tasks_.back());
+  q.tasks_.pop_back();
+  return true;
+}
+
+bool work_stealing_pool::steal(int i, task *t) {
+  int n = queues_.size();
+  for (int k = 1; k < n; k++) {
+    worker_queue &              q = *queues_[(i + k) % n];
+    std::lock_guard<std::mutex> l(q.mtx_);
+    if (q.tasks_.empty())
+      continue;
+    *t = std::move(q.tasks_.front());
+    q.tasks_.pop_front();
+    return true;
+  }
+  return false;
+}
+
+void work_stealing_pool::run(int i) {
+  current_worker.pool = this;
+  current_worker.index = i;
+  while (1) {
+    task t;
+    if (pop_local(i, &t) || steal(i, &t)) {
+      {
+        std::lock_guard<std::mutex> l(mtx_);
+        queued_--;
+      }
+      not_full_.notify_one();
+      t();
+      continue;
+    }
+    // queued_ counts tasks pushed but not yet taken, so a task pushed
+    // after the scan above keeps this wait from sleeping through it.
+    std::unique_lock<std::mutex> l(mtx_);
+    not_empty_.wait(l, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_ && queued_ == 0)
+      return;
+  }
+}
+
+// ----------------------------------------------------------------------------------
+
+// The signing method for a policy key of each type.
+static const char *signing_alg_for_key(const key_message &k) {
+  const string &t = k.key_type();
+  if (t == Enc_method_rsa_2048_private)
+    return Enc_method_rsa_2048_sha256_pkcs_sign;
+  if (t == Enc_method_rsa_3072_private)
+    return Enc_method_rsa_3072_sha384_pkcs_sign;
+  if (t == Enc_method_rsa_4096_private)
+    return Enc_method_rsa_4096_sha384_pkcs_sign;
+  if (t == Enc_method_ecc_256_private)
+    return Enc_method_ecc_256_sha256_pkcs_sign;
+  if (t == Enc_method_ecc_384_private)
+    return Enc_method_ecc_384_sha384_pkcs_sign;
+  return nullptr;
+}
+
+certifier_service::certifier_service()
+    : max_request_size_(1 << 20),
+      duration_(365.26 * 86400.0),
+      print_all_(false),
+      sign_alg_(nullptr),
+      serial_number_(0) {}
+
+bool certifier_service::init(
+    const key_message &          private_policy_key,
+    const string &               serialized_policy_cert,
+    const signed_claim_sequence &policy) {
+  X509 *      policy_cert = nullptr;
+  string      cert_issuer_name;
+  string      cert_issuer_description;
+  key_message cert_subject_key;
+  string      cert_subject_description;
+  uint64_t    cert_sn = 0;
+  bool        ret = false;
+
+  private_policy_key_.CopyFrom(private_policy_key);
+  sign_alg_ = signing_alg_for_key(private_policy_key_);
+  if (sign_alg_ == nullptr
+      || !private_key_to_public_key(private_policy_key_,
+                                    &public_policy_key_)) {
+    printf("%s() error, line %d, Unsupported policy key type %s\n",
+           __func__,
+           __LINE__,
+           private_policy_key_.key_type().c_str());
+    goto done;
+  }
+
+  // The admission certificates name the policy certificate's subject as
+  // their issuer.
+  policy_cert = X509_new();
+  if (!asn1_to_x509(serialized_policy_cert, policy_cert)
+      || !verify_artifact(*policy_cert,
+                          public_policy_key_,
+                          &cert_issuer_name,
+                          &cert_issuer_description,
+                          &cert_subject_key,
+                          &issuer_name_,
+                          &cert_subject_description,
+                          &cert_sn)) {
+    printf("%s() error, line %d, Policy cert isn't signed by the policy key\n",
+           __func__,
+           __LINE__);
+    goto done;
+  }
+  {
+    char org[256];
+    if (X509_NAME_get_text_by_NID(X509_get_subject_name(policy_cert),
+                                  NID_organizationName,
+                                  org,
+                                  sizeof(org))
+        > 0)
+      issuer_description_ = org;
+  }
+
+  if (!policy_.compile(public_policy_key_, policy)) {
+    printf("%s() error, line %d, Can't compile policy\n", __func__, __LINE__);
+    goto done;
+  }
+
+  // Serial numbers stay distinct across restarts.
+  serial_number_ = ((uint64_t)time(nullptr)) << 20;
+  ret = true;
+
+done:
+  if (policy_cert != nullptr)
+    X509_free(policy_cert);
+  return ret;
+}
+
+bool certifier_service::init_from_files(const string &policy_key_file,
+                                        const string &policy_cert_file,
+                                        const string &policy_file) {
+  string                str;
+  string                policy_cert;
+  key_message           private_policy_key;
+  signed_claim_sequence policy;
+
+  if (!read_file_into_string(policy_key_file, &str)
+      || !private_policy_key.ParseFromString(str)) {
+    printf("%s() error, line %d, Can't read policy key %s\n",
+           __func__,
+           __LINE__,
+           policy_key_file.c_str());
+    return false;
+  }
+  if (!read_file_into_string(policy_cert_file, &policy_cert)) {
+    printf("%s() error, line %d, Can't read policy cert %s\n",
+           __func__,
+           __LINE__,
+           policy_cert_file.c_str());
+    return false;
+  }
+  if (!read_file_into_string(policy_file, &str)
+      || !policy.ParseFromString(str)) {
+    printf("%s() error, line %d, Can't read policy %s\n",
+           __func__,
+           __LINE__,
+           policy_file.c_str());
+    return false;
+  }
+  return init(private_policy_key, policy_cert, policy);
+}
+
+bool certifier_service::validate(const string &     evidence_type,
+                                 const string &     purpose,
+                                 evidence_package & evp,
+                                 vse_clause *       proved,
+                                 string *           measurement) {
+  if (evidence_type == "vse-attestation-package") {
+    string descriptor("platform-attestation-only");
+    return validate_evidence(descriptor,
+                             policy_,
+                             purpose,
+                             evp,
+                             public_policy_key_,
+                             proved,
+                             measurement);
+  }
+#ifdef SEV_SNP
+  if (evidence_type == "sev-platform-package") {
+    string descriptor("sev-full-platform");
+    return validate_evidence_from_policy(descriptor,
+                                         policy_,
+                                         purpose,
+                                         evp,
+                                         public_policy_key_,
+                                         proved,
+                                         measurement);
+  }
+#endif
+  printf("%s() error, line %d, Unsupported evidence type %s\n",
+         __func__,
+         __LINE__,
+         evidence_type.c_str());
+  return false;
+}
+
+// An X509 certificate for the enclave key, naming its measurement.
+bool certifier_service::admission_cert(const key_message &subject,
+                                       const string &     measurement,
+                                       string *           artifact) {
+  string subject_name("CertifierUsers");
+  string subject_organization("Measured-");
+  char   hex[3];
+  for (unsigned i = 0; i < measurement.size(); i++) {
+    snprintf(hex, sizeof(hex), "%02x", (byte)measurement[i]);
+    subject_organization.append(hex);
+  }
+
+  X509 *x509_cert = X509_new();
+  bool  ret = produce_artifact((key_message &)private_policy_key_,
+                              issuer_name_,
+                              issuer_description_,
+                              (key_message &)subject,
+                              subject_name,
+                              subject_organization,
+                              serial_number_++,
+                              duration_,
+                              x509_cert,
+                              false)
+             && x509_to_asn1(x509_cert, artifact);
+  X509_free(x509_cert);
+  return ret;
+}
+
+// A signed "policyKey says enclaveKey is-trusted-for-attestation".
+bool certifier_service::platform_rule(const key_message &subject,
+                                      string *           artifact) {
+  entity_message       subject_ent;
+  entity_message       policy_ent;
+  vse_clause           trusted;
+  vse_clause           says;
+  string               serialized_clause;
+  time_point           t_nb;
+  time_point           t_na;
+  string               nb;
+  string               na;
+  string               format("vse-clause");
+  string               descriptor("platform-rule");
+  string               it("is-trusted-for-attestation");
+  string               says_verb("says");
+  claim_message        claim;
+  signed_claim_message rule;
+
+  if (!make_key_entity(subject, &subject_ent)
+      || !make_key_entity(public_policy_key_, &policy_ent)
+      || !make_unary_vse_clause(subject_ent, it, &trusted)
+      || !make_indirect_vse_clause(policy_ent, says_verb, trusted, &says)
+      || !says.SerializeToString(&serialized_clause))
+    return false;
+  if (!time_now(&t_nb)
+      || !add_interval_to_time_point(t_nb, duration_ / 3600.0, &t_na)
+      || !time_to_string(t_nb, &nb) || !time_to_string(t_na, &na))
+    return false;
+  if (!make_claim(serialized_clause.size(),
+                  (byte *)serialized_clause.data(),
+                  format,
+                  descriptor,
+                  nb,
+                  na,
+                  &claim)
+      || !make_signed_claim(sign_alg_, claim, private_policy_key_, &rule))
+    return false;
+  return rule.SerializeToString(artifact);
+}
+
+void certifier_service::serve(int fd) {
+  trust_request_message  request;
+  trust_response_message response;
+  string                 str;
+  int                    size = 0;
+  vse_clause             proved;
+  string                 measurement;
+  string                 artifact;
+  bool                   succeeded = false;
+
+  // sized_socket_read trusts the length prefix; check it first.
+  if (recv(fd, &size, sizeof(size), MSG_PEEK | MSG_WAITALL) != sizeof(size)
+      || size < 0 || size > max_request_size_) {
+    printf("%s() error, line %d, Bad request size %d\n",
+           __func__,
+           __LINE__,
+           size);
+    goto done;
+  }
+  if (sized_socket_read(fd, &str) < 0 || !request.ParseFromString(str)) {
+    printf("%s() error, line %d, Can't read request\n", __func__, __LINE__);
+    goto done;
+  }
+  if (print_all_) {
+    printf("Trust request received:\n");
+    print_trust_request_message(request);
+  }
+
+  response.set_requesting_enclave_tag(request.requesting_enclave_tag());
+  response.set_providing_enclave_tag(request.providing_enclave_tag());
+  if (validate(request.submitted_evidence_type(),
+               request.purpose(),
+               *request.mutable_support(),
+               &proved,
+               &measurement)
+      && proved.has_subject() && proved.subject().entity_type() == "key") {
+    if (request.purpose() == "attestation")
+      succeeded = platform_rule(proved.subject().key(), &artifact);
+    else
+      succeeded =
+          admission_cert(proved.subject().key(), measurement, &artifact);
+  }
+  if (succeeded) {
+    response.set_status("succeeded");
+    response.set_artifact(artifact);
+  } else {
+    response.set_status("failed");
+  }
+  if (print_all_) {
+    printf("Sending response:\n");
+    print_trust_response_message(response);
+  }
+
+  str.clear();
+  if (!response.SerializeToString(&str)
+      || sized_socket_write(fd, str.size(), (byte *)str.data())
+             < (int)str.size()) {
+    printf("%s() error, line %d, Can't send response\n", __func__, __LINE__);
+  }
+
+done:
+  close(fd);
+}
@@ -57,6 +57,14 @@ TEST(test_digest_multiple, test_digest_multiple) {
   EXPECT_FALSE(test_digest_multiple(FLAGS_print_all));
 }
 
+TEST(test_digest_stream, test_digest_stream) {
+  EXPECT_TRUE(test_digest_stream(FLAGS_print_all));
+}
+
+TEST(test_algorithm_registry, test_algorithm_registry) {
+  EXPECT_TRUE(test_algorithm_registry(FLAGS_print_all));
+}
+
 TEST(test_encrypt, test_encrypt) {
   EXPECT_TRUE(test_encrypt(FLAGS_print_all));
 }
@@ -65,6 +73,18 @@ TEST(test_authenticated_encrypt, test_authenticated_encrypt) {
   EXPECT_TRUE(test_authenticated_encrypt(FLAGS_print_all));
 }
 
+TEST(test_aead_stream, test_aead_stream) {
+  EXPECT_TRUE(test_aead_stream(FLAGS_print_all));
+}
+
+TEST(test_nonce_aead, test_nonce_aead) {
+  EXPECT_TRUE(test_nonce_aead(FLAGS_print_all));
+}
+
+TEST(test_chunked_aead, test_chunked_aead) {
+  EXPECT_TRUE(test_chunked_aead(FLAGS_print_all));
+}
+
 TEST(public_keys, test_public_keys) {
   EXPECT_TRUE(test_public_keys(FLAGS_print_all));
 }
@@ -77,6 +97,14 @@ TEST(key_translation, test_key_translation) {
   EXPECT_TRUE(test_key_translation(FLAGS_print_all));
 }
 
+TEST(key_handle_cache, test_key_handle_cache) {
+  EXPECT_TRUE(test_key_handle_cache(FLAGS_print_all));
+}
+
+TEST(verify_cache, test_verify_cache) {
+  EXPECT_TRUE(test_verify_cache(FLAGS_print_all));
+}
+
 TEST(time, test_time) {
   EXPECT_TRUE(test_time(FLAGS_print_all));
 }
@@ -118,6 +146,22 @@ TEST(signed_claims, test_signed_claims) {
   EXPECT_TRUE(test_signed_claims(FLAGS_print_all));
 }
 
+TEST(signed_claims, test_verify_signed_claims) {
+  EXPECT_TRUE(test_verify_signed_claims(FLAGS_print_all));
+}
+
+TEST(policy_database, test_policy_database) {
+  EXPECT_TRUE(test_policy_database(FLAGS_print_all));
+}
+
+TEST(policy_database, test_sev_policy_facts) {
+  EXPECT_TRUE(test_sev_policy_facts(FLAGS_print_all));
+}
+
+TEST(proved_index, test_proved_index) {
+  EXPECT_TRUE(test_proved_index(FLAGS_print_all));
+}
+
 extern bool test__local_certify(string &, bool, string &, string &);
 TEST(local_certify, test_local_certify) {
   string enclave_type("simulated-enclave");
@@ -155,6 +199,14 @@ TEST(full_certification, test_full_certification) {
   EXPECT_TRUE(test_full_certification(FLAGS_print_all));
 }
 
+TEST(certifier_service, test_certifier_service) {
+  EXPECT_TRUE(test_certifier_service(FLAGS_print_all));
+}
+
+TEST(certifier_service, test_work_stealing_pool) {
+  EXPECT_TRUE(test_work_stealing_pool(FLAGS_print_all));
+}
+
 TEST(test_predicate_dominance, test_predicate_dominance) {
   EXPECT_TRUE(test_predicate_dominance(FLAGS_print_all));
 }
@@ -170,6 +222,22 @@ TEST(test_x_509_sign, test_x_509_sign) {
   EXPECT_TRUE(test_x_509_sign(FLAGS_print_all));
 }
 
+TEST(test_dispatch_pool, test_dispatch_pool) {
+  EXPECT_TRUE(test_dispatch_pool(FLAGS_print_all));
+}
+
+TEST(test_channel_reactor, test_channel_reactor) {
+  EXPECT_TRUE(test_channel_reactor(FLAGS_print_all));
+}
+
+TEST(test_tls_resumption, test_tls_resumption) {
+  EXPECT_TRUE(test_tls_resumption(FLAGS_print_all));
+}
+
+TEST(test_dispatch_metrics, test_dispatch_metrics) {
+  EXPECT_TRUE(test_dispatch_metrics(FLAGS_print_all));
+}
+
 // sev tests
 #ifdef RUN_SEV_TESTS
 
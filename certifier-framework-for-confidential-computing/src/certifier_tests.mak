@@ -90,7 +90,7 @@ common_objs = $(O)/certifier.pb.o $(O)/certifier.o      \
               $(O)/application_enclave.o
 
 dobj = $(O)/certifier_tests.o $(common_objs) \
-       $(O)/cc_helpers.o $(O)/cc_useful.o \
+       $(O)/cc_helpers.o $(O)/cc_useful.o $(O)/certifier_service.o \
        $(O)/claims_tests.o $(O)/primitive_tests.o $(O)/certificate_tests.o       \
        $(O)/store_tests.o $(O)/support_tests.o $(O)/x509_tests.o
 
@@ -176,6 +176,10 @@ $(O)/claims_tests.o: $(S)/claims_tests.cc $(I)/certifier.pb.h $(I)/certifier.h $
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
 
+$(O)/certifier_service.o: $(S)/certifier_service.cc $(I)/certifier.pb.h $(I)/certifier.h $(I)/certifier_service.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
 $(O)/sev_tests.o: $(S)/sev_tests.cc $(I)/certifier.pb.h $(I)/certifier.h
 	@echo "\ncompiling $<"
 	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
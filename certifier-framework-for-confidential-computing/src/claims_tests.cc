@@ -15,6 +15,9 @@
 
 #include "certifier.h"
 #include "support.h"
+#include "certifier_service.h"
+
+#include <sys/socket.h>
 
 using namespace certifier::framework;
 using namespace certifier::utilities;
@@ -388,6 +391,460 @@ bool test_signed_claims(bool print_all) {
   return true;
 }
 
+bool test_verify_signed_claims(bool print_all) {
+  key_message keys[2];
+  key_message public_keys[2];
+  for (int k = 0; k < 2; k++) {
+    if (!make_certifier_rsa_key(2048, &keys[k])) {
+      printf("test_verify_signed_claims: make_certifier_rsa_key failed\n");
+      return false;
+    }
+    keys[k].set_key_name(k == 0 ? "batch-key-0" : "batch-key-1");
+    keys[k].set_key_type(Enc_method_rsa_2048_private);
+    keys[k].set_key_format("vse-key");
+    if (!private_key_to_public_key(keys[k], &public_keys[k]))
+      return false;
+  }
+
+  // Claims from two keys, interleaved; enough to verify on threads.
+  const int            n = 20;
+  signed_claim_message signed_claims[n];
+  string               says("says");
+  string               speaks_for("speaks-for");
+  string               vse_clause_format("vse-clause");
+  time_point           t_nb;
+  time_point           t_na;
+  string               nb;
+  string               na;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+  for (int i = 0; i < n; i++) {
+    string m(32, (char)i);
+    entity_message key_ent;
+    entity_message m_ent;
+    vse_clause     cl1;
+    vse_clause     cl2;
+    claim_message  claim;
+    string         serialized;
+    string         descript("batch claim");
+    if (!make_key_entity(public_keys[i % 2], &key_ent)
+        || !make_measurement_entity(m, &m_ent)
+        || !make_simple_vse_clause(key_ent, speaks_for, m_ent, &cl1)
+        || !make_indirect_vse_clause(key_ent, says, cl1, &cl2)
+        || !cl2.SerializeToString(&serialized)
+        || !make_claim(serialized.size(),
+                       (byte *)serialized.data(),
+                       vse_clause_format,
+                       descript,
+                       nb,
+                       na,
+                       &claim)
+        || !make_signed_claim(Enc_method_rsa_2048_sha256_pkcs_sign,
+                              claim,
+                              keys[i % 2],
+                              &signed_claims[i])) {
+      printf("test_verify_signed_claims: can't make claim %d\n", i);
+      return false;
+    }
+  }
+
+  const signed_claim_message *claims[n];
+  const key_message *         against[n];
+  bool                        results[n];
+  for (int i = 0; i < n; i++) {
+    claims[i] = &signed_claims[i];
+    against[i] = &public_keys[i % 2];
+  }
+  if (!verify_signed_claims(n, claims, nullptr, 0, results)
+      || !verify_signed_claims(n, claims, against, 1, results)) {
+    printf("test_verify_signed_claims: batch failed\n");
+    return false;
+  }
+
+  // One bad signature and one wrong key only fail their own claims.
+  signed_claims[3].mutable_signature()->at(5) ^= 1;
+  against[6] = &public_keys[1];
+  if (verify_signed_claims(n, claims, against, 3, results)) {
+    printf("test_verify_signed_claims: bad claims accepted\n");
+    return false;
+  }
+  for (int i = 0; i < n; i++) {
+    if (results[i] != (i != 3 && i != 6)) {
+      printf("test_verify_signed_claims: wrong result for claim %d\n", i);
+      return false;
+    }
+  }
+  if (print_all)
+    printf("test_verify_signed_claims: %d claims, 2 keys\n", n);
+  return true;
+}
+
+// signer says cl, signed by signer.
+static bool make_says_claim(const key_message &   signer,
+                            const vse_clause &    cl,
+                            signed_claim_message *out) {
+  key_message    public_signer;
+  entity_message signer_ent;
+  vse_clause     says_cl;
+  string         says("says");
+  string         serialized;
+  string         format("vse-clause");
+  string         descript("policy claim");
+  time_point     t_nb;
+  time_point     t_na;
+  string         nb;
+  string         na;
+  claim_message  claim;
+  time_now(&t_nb);
+  add_interval_to_time_point(t_nb, 24.0, &t_na);
+  time_to_string(t_nb, &nb);
+  time_to_string(t_na, &na);
+  return private_key_to_public_key(signer, &public_signer)
+         && make_key_entity(public_signer, &signer_ent)
+         && make_indirect_vse_clause(signer_ent, says, cl, &says_cl)
+         && says_cl.SerializeToString(&serialized)
+         && make_claim(serialized.size(),
+                       (byte *)serialized.data(),
+                       format,
+                       descript,
+                       nb,
+                       na,
+                       &claim)
+         && make_signed_claim(Enc_method_rsa_2048_sha256_pkcs_sign,
+                              claim,
+                              signer,
+                              out);
+}
+
+bool test_policy_database(bool print_all) {
+  key_message policy_key;
+  key_message policy_pk;
+  key_message other_key;
+  key_message platform_key;
+  key_message platform_pk;
+  if (!make_certifier_rsa_key(2048, &policy_key)
+      || !make_certifier_rsa_key(2048, &other_key)
+      || !make_certifier_rsa_key(2048, &platform_key)
+      || !private_key_to_public_key(policy_key, &policy_pk)
+      || !private_key_to_public_key(platform_key, &platform_pk)) {
+    printf("test_policy_database: can't make keys\n");
+    return false;
+  }
+
+  // Measurements 0..n-1 from the policy key, measurement n from another key.
+  const int             n = 8;
+  signed_claim_sequence trusted_measurements;
+  signed_claim_sequence trusted_platforms;
+  string                is_trusted("is-trusted");
+  string                for_attestation("is-trusted-for-attestation");
+  for (int i = 0; i <= n; i++) {
+    string         m(32, (char)(i + 1));
+    entity_message m_ent;
+    vse_clause     cl;
+    if (!make_measurement_entity(m, &m_ent)
+        || !make_unary_vse_clause(m_ent, is_trusted, &cl)
+        || !make_says_claim(i < n ? policy_key : other_key,
+                            cl,
+                            trusted_measurements.add_claims())) {
+      printf("test_policy_database: can't make measurement claim %d\n", i);
+      return false;
+    }
+  }
+  entity_message platform_ent;
+  vse_clause     platform_cl;
+  if (!make_key_entity(platform_pk, &platform_ent)
+      || !make_unary_vse_clause(platform_ent, for_attestation, &platform_cl)
+      || !make_says_claim(policy_key,
+                          platform_cl,
+                          trusted_platforms.add_claims())) {
+    printf("test_policy_database: can't make platform claim\n");
+    return false;
+  }
+
+  policy_database policy;
+  if (!policy.compile(policy_pk, trusted_platforms, trusted_measurements)) {
+    printf("test_policy_database: compile failed\n");
+    return false;
+  }
+  if (policy.size() != n + 1 || !policy.verified()) {
+    printf("test_policy_database: wrong size %d\n", policy.size());
+    return false;
+  }
+
+  string m3(32, (char)4);
+  string unlisted(32, (char)(n + 1));
+  string short_m(16, (char)4);
+  if (policy.find_measurement(m3) == nullptr
+      || policy.find_measurement(unlisted) != nullptr
+      || policy.find_measurement(short_m) != nullptr
+      || policy.find_platform_key(platform_pk) == nullptr
+      || policy.find_platform_key(policy_pk) != nullptr) {
+    printf("test_policy_database: wrong lookup\n");
+    return false;
+  }
+
+  proved_statements proved;
+  if (!policy.add_measurement_fact(m3, &proved)
+      || !policy.add_platform_key_fact(platform_pk, &proved)
+      || policy.add_measurement_fact(unlisted, &proved)
+      || proved.proved_size() != 2 || proved.proved(0).verb() != "says"
+      || proved.proved(0).clause().subject().measurement() != m3
+      || !same_key(proved.proved(1).clause().subject().key(), platform_pk)) {
+    printf("test_policy_database: wrong facts\n");
+    return false;
+  }
+
+  // A policy must be entirely the policy key's.
+  policy_database strict;
+  if (strict.compile(policy_pk, trusted_measurements)) {
+    printf("test_policy_database: strict compile accepted other key\n");
+    return false;
+  }
+
+  // A bad signature is dropped by compile and refused by an index lookup.
+  trusted_measurements.mutable_claims(3)->mutable_signature()->at(7) ^= 1;
+  policy_database indexed;
+  if (!policy.compile(policy_pk, trusted_platforms, trusted_measurements)
+      || policy.find_measurement(m3) != nullptr
+      || !indexed.index(policy_pk, trusted_platforms, trusted_measurements)
+      || indexed.verified() || indexed.find_measurement(m3) == nullptr
+      || indexed.add_measurement_fact(m3, &proved)) {
+    printf("test_policy_database: bad signature accepted\n");
+    return false;
+  }
+
+  if (print_all)
+    printf("test_policy_database: %d claims indexed\n", policy.size());
+  return true;
+}
+
+// The compiled SEV filter keeps the same facts, in the same order, as
+// filter_policy followed by init_policy.
+bool test_sev_policy_facts(bool print_all) {
+  key_message policy_key;
+  key_message policy_pk;
+  key_message ark_key;
+  key_message ark_pk;
+  if (!make_certifier_rsa_key(2048, &policy_key)
+      || !make_certifier_rsa_key(2048, &ark_key)
+      || !private_key_to_public_key(policy_key, &policy_pk)
+      || !private_key_to_public_key(ark_key, &ark_pk)) {
+    printf("test_sev_policy_facts: can't make keys\n");
+    return false;
+  }
+
+  string   debug("debug");
+  string   api_major("api_major");
+  string   string_type("string");
+  string   int_type("int");
+  string   eq("=");
+  string   ge(">=");
+  string   no("no");
+  string   empty;
+  property debug_off;
+  property api_5;
+  property api_ge_3;
+  property api_ge_9;
+  if (!make_property(debug, string_type, eq, 0, no, &debug_off)
+      || !make_property(api_major, int_type, eq, 5, empty, &api_5)
+      || !make_property(api_major, int_type, ge, 3, empty, &api_ge_3)
+      || !make_property(api_major, int_type, ge, 9, empty, &api_ge_9))
+    return false;
+
+  // Policy platforms: api >= 9 (unmet), debug off, api >= 3.  The
+  // attested platform meets the last two; the first of them is kept.
+  properties attested_props;
+  attested_props.add_props()->CopyFrom(debug_off);
+  attested_props.add_props()->CopyFrom(api_5);
+  platform          attested;
+  const property *  wanted[] = {&api_ge_9, &debug_off, &api_ge_3};
+  vse_clause        plat_cl[3];
+  string            has_props("has-trusted-platform-property");
+  if (!make_platform("amd-sev-snp", attested_props, nullptr, &attested))
+    return false;
+  for (int i = 0; i < 3; i++) {
+    properties     props;
+    platform       plat;
+    entity_message plat_ent;
+    props.add_props()->CopyFrom(*wanted[i]);
+    if (!make_platform("amd-sev-snp", props, nullptr, &plat)
+        || !make_platform_entity(plat, &plat_ent)
+        || !make_unary_vse_clause(plat_ent, has_props, &plat_cl[i]))
+      return false;
+  }
+
+  vse_clause     m_cl[3];
+  vse_clause     ark_cl;
+  entity_message ark_ent;
+  string         is_trusted("is-trusted");
+  string         for_attestation("is-trusted-for-attestation");
+  for (int i = 0; i < 3; i++) {
+    entity_message m_ent;
+    if (!make_measurement_entity(string(32, (char)(i + 1)), &m_ent)
+        || !make_unary_vse_clause(m_ent, is_trusted, &m_cl[i]))
+      return false;
+  }
+  if (!make_key_entity(ark_pk, &ark_ent)
+      || !make_unary_vse_clause(ark_ent, for_attestation, &ark_cl))
+    return false;
+
+  // Measurements and platforms interleaved around the ARK rule.
+  const vse_clause *order[] = {&m_cl[0],
+                               &plat_cl[0],
+                               &ark_cl,
+                               &m_cl[1],
+                               &plat_cl[1],
+                               &m_cl[2],
+                               &plat_cl[2]};
+  signed_claim_sequence policy;
+  for (const vse_clause *cl : order) {
+    if (!make_says_claim(policy_key, *cl, policy.add_claims())) {
+      printf("test_sev_policy_facts: can't make policy\n");
+      return false;
+    }
+  }
+
+  string                measurement(32, (char)2);
+  signed_claim_sequence filtered;
+  proved_statements     expected;
+  proved_statements     facts;
+  policy_database       compiled;
+  if (!filter_policy(measurement, attested, policy_pk, policy, &filtered)
+      || !init_policy(filtered, policy_pk, &expected)) {
+    printf("test_sev_policy_facts: baseline filter failed\n");
+    return false;
+  }
+  if (!compiled.compile(policy_pk, policy)
+      || !compiled.add_sev_policy_facts(measurement, attested, &facts)) {
+    printf("test_sev_policy_facts: compiled filter failed\n");
+    return false;
+  }
+  if (print_all)
+    printf("test_sev_policy_facts: %d facts kept\n", facts.proved_size());
+  if (facts.proved_size() != 3 || expected.proved_size() != 3) {
+    printf("test_sev_policy_facts: kept %d facts, expected 3 (baseline %d)\n",
+           facts.proved_size(),
+           expected.proved_size());
+    return false;
+  }
+  for (int i = 0; i < facts.proved_size(); i++) {
+    if (!same_vse_claim(facts.proved(i), expected.proved(i))) {
+      printf("test_sev_policy_facts: fact %d differs\n", i);
+      return false;
+    }
+  }
+  if (!same_vse_claim(facts.proved(0).clause(), ark_cl)
+      || !same_vse_claim(facts.proved(1).clause(), m_cl[1])
+      || !same_vse_claim(facts.proved(2).clause(), plat_cl[1])) {
+    printf("test_sev_policy_facts: wrong facts kept\n");
+    return false;
+  }
+  return true;
+}
+
+bool test_proved_index(bool print_all) {
+  key_message k;
+  key_message pk;
+  if (!make_certifier_rsa_key(2048, &k) || !private_key_to_public_key(k, &pk))
+    return false;
+
+  entity_message key_ent;
+  entity_message m_ent;
+  string         is_trusted("is-trusted");
+  string         speaks_for("speaks-for");
+  string         says("says");
+  string         m(32, 'm');
+  vse_clause     key_trusted;
+  vse_clause     m_trusted;
+  vse_clause     speaks;
+  vse_clause     key_says;
+  if (!make_key_entity(pk, &key_ent) || !make_measurement_entity(m, &m_ent)
+      || !make_unary_vse_clause(key_ent, is_trusted, &key_trusted)
+      || !make_unary_vse_clause(m_ent, is_trusted, &m_trusted)
+      || !make_simple_vse_clause(key_ent, speaks_for, m_ent, &speaks)
+      || !make_indirect_vse_clause(key_ent, says, speaks, &key_says))
+    return false;
+
+  // A platform with two properties, proved; one with a subset, asked.
+  string   name1("debug");
+  string   name2("api_major");
+  string   string_type("string");
+  string   int_type("int");
+  string   eq("=");
+  string   ge(">=");
+  string   no("no");
+  string   empty;
+  property p1;
+  property p2;
+  if (!make_property(name1, string_type, eq, 0, no, &p1)
+      || !make_property(name2, int_type, ge, 3, empty, &p2))
+    return false;
+  properties both;
+  properties one;
+  both.add_props()->CopyFrom(p1);
+  both.add_props()->CopyFrom(p2);
+  one.add_props()->CopyFrom(p1);
+  string         has_props("has-trusted-platform-property");
+  platform       plat_both;
+  platform       plat_one;
+  entity_message plat_both_ent;
+  entity_message plat_one_ent;
+  vse_clause     plat_both_cl;
+  vse_clause     plat_one_cl;
+  if (!make_platform("amd-sev-snp", both, nullptr, &plat_both)
+      || !make_platform("amd-sev-snp", one, nullptr, &plat_one)
+      || !make_platform_entity(plat_both, &plat_both_ent)
+      || !make_platform_entity(plat_one, &plat_one_ent)
+      || !make_unary_vse_clause(plat_both_ent, has_props, &plat_both_cl)
+      || !make_unary_vse_clause(plat_one_ent, has_props, &plat_one_cl))
+    return false;
+
+  proved_statements proved;
+  proved.add_proved()->CopyFrom(key_trusted);
+  proved.add_proved()->CopyFrom(plat_both_cl);
+  proved_index index(&proved);
+
+  // Key names are not part of a key's identity.
+  vse_clause renamed(key_trusted);
+  renamed.mutable_subject()->mutable_key()->set_key_name("another-name");
+  if (!index.contains(key_trusted) || !index.contains(renamed)
+      || index.contains(m_trusted) || index.contains(key_says)) {
+    printf("test_proved_index: wrong membership\n");
+    return false;
+  }
+
+  index.add(key_says);
+  proved.add_proved()->CopyFrom(m_trusted);
+  if (!index.contains(key_says) || !index.contains(m_trusted)
+      || index.contains(speaks) || proved.proved_size() != 4) {
+    printf("test_proved_index: additions not found\n");
+    return false;
+  }
+
+  // Same answers as the scan, including the one-sided platform match.
+  const vse_clause *asked[] = {&key_trusted,
+                                &m_trusted,
+                                &speaks,
+                                &key_says,
+                                &plat_both_cl,
+                                &plat_one_cl};
+  for (const vse_clause *cl : asked) {
+    if (index.contains(*cl) != statement_already_proved(*cl, &proved)) {
+      printf("test_proved_index: differs from scan\n");
+      print_vse_clause(*cl);
+      printf("\n");
+      return false;
+    }
+  }
+  if (!index.contains(plat_one_cl)) {
+    printf("test_proved_index: platform subset not found\n");
+    return false;
+  }
+  return true;
+}
+
 //  Proofs and certification -----------------------------
 
 // test_support.cc has test code that can be used in an enclave
@@ -449,5 +906,206 @@ bool test_predicate_dominance(bool print_all) {
   if (dominates(root, it, it3))
     return false;
 
+  // A frozen tree answers from its bitmap, the same way.
+  predicate_dominance frozen;
+  if (!init_top_level_is_trusted(frozen) || !frozen.freeze()
+      || frozen.insert(it, it3)) {
+    printf("test_predicate_dominance: can't freeze\n");
+    return false;
+  }
+  string preds[4] = {it, it1, it2, it3};
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      bool expected = i == j || (i == 0 && j < 3);
+      if (dominates(root, preds[i], preds[j]) != expected
+          || dominates(frozen, preds[i], preds[j]) != expected) {
+        printf("test_predicate_dominance: wrong answer for %s, %s\n",
+               preds[i].c_str(),
+               preds[j].c_str());
+        return false;
+      }
+    }
+  }
+
+  predicate_dominance &shared = certifier_dominance_tree();
+  if (!shared.frozen_ || !dominates(shared, it, it1)
+      || dominates(shared, it1, it)) {
+    printf("test_predicate_dominance: bad shared tree\n");
+    return false;
+  }
+
+  key_message policy_key;
+  key_message policy_pk;
+  if (!make_certifier_rsa_key(2048, &policy_key)
+      || !private_key_to_public_key(policy_key, &policy_pk))
+    return false;
+  verification_context context;
+  proved_statements    proved;
+  if (!context.init(policy_pk)) {
+    printf("test_predicate_dominance: can't init context\n");
+    return false;
+  }
+  context.start_proof(&proved);
+  context.start_proof(&proved);
+  if (proved.proved_size() != 2 || proved.proved(1).verb() != it
+      || !same_key(proved.proved(1).subject().key(), policy_pk)
+      || &context.dominance_tree() != &shared) {
+    printf("test_predicate_dominance: bad axioms\n");
+    return false;
+  }
+
+  return true;
+}
+
+// Send request to service.serve over a socketpair and return its reply;
+// false if the service closed without answering.
+static bool exchange(certifier_service &           service,
+                     const trust_request_message &request,
+                     trust_response_message *     response) {
+  int    fds[2];
+  string str;
+  bool   ret = false;
+  if (!request.SerializeToString(&str)
+      || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    return false;
+  if (sized_socket_write(fds[0], str.size(), (byte *)str.data())
+      == (int)str.size()) {
+    service.serve(fds[1]);
+    str.clear();
+    ret = sized_socket_read(fds[0], &str) > 0 && response->ParseFromString(str);
+  } else {
+    close(fds[1]);
+  }
+  close(fds[0]);
+  return ret;
+}
+
+bool test_certifier_service(bool print_all) {
+  string                enclave_type("simulated-enclave");
+  string                evidence_descriptor("platform-attestation-only");
+  string                unused;
+  string                policy_name("policy-key");
+  string                policy_desc("policy root");
+  signed_claim_sequence trusted_platforms;
+  signed_claim_sequence trusted_measurements;
+  signed_claim_sequence policy;
+  key_message           policy_key;
+  key_message           policy_pk;
+  evidence_package      evp;
+  string                policy_cert;
+  X509 *                root = X509_new();
+
+  evp.set_prover_type("vse-verifier");
+  if (!construct_standard_evidence_package(enclave_type,
+                                           false,
+                                           unused,
+                                           evidence_descriptor,
+                                           &trusted_platforms,
+                                           &trusted_measurements,
+                                           &policy_key,
+                                           &policy_pk,
+                                           &evp)) {
+    printf("test_certifier_service: can't construct evidence\n");
+    X509_free(root);
+    return false;
+  }
+  for (int i = 0; i < trusted_platforms.claims_size(); i++)
+    policy.add_claims()->CopyFrom(trusted_platforms.claims(i));
+  for (int i = 0; i < trusted_measurements.claims_size(); i++)
+    policy.add_claims()->CopyFrom(trusted_measurements.claims(i));
+  bool made_cert = produce_artifact(policy_key,
+                                    policy_name,
+                                    policy_desc,
+                                    policy_pk,
+                                    policy_name,
+                                    policy_desc,
+                                    1L,
+                                    86400.0,
+                                    root,
+                                    true)
+                   && x509_to_asn1(root, &policy_cert);
+  X509_free(root);
+  certifier_service service;
+  service.print_all_ = print_all;
+  if (!made_cert || !service.init(policy_key, policy_cert, policy)) {
+    printf("test_certifier_service: can't start service\n");
+    return false;
+  }
+
+  trust_request_message  request;
+  trust_response_message response;
+  request.set_requesting_enclave_tag("requesting-enclave");
+  request.set_providing_enclave_tag("providing-enclave");
+  request.set_submitted_evidence_type("vse-attestation-package");
+  request.set_purpose("authentication");
+  request.mutable_support()->CopyFrom(evp);
+
+  // Authentication gets an admission certificate issued by the policy key.
+  if (!exchange(service, request, &response)
+      || response.status() != "succeeded"
+      || response.requesting_enclave_tag() != "requesting-enclave"
+      || response.providing_enclave_tag() != "providing-enclave") {
+    printf("test_certifier_service: authentication request failed\n");
+    return false;
+  }
+  X509 *      cert = X509_new();
+  string      issuer_name;
+  string      issuer_desc;
+  key_message subject_key;
+  string      subject_name;
+  string      subject_desc;
+  uint64_t    sn = 0;
+  char        issuer_cn[256];
+  bool        cert_ok = asn1_to_x509(response.artifact(), cert)
+                 && verify_artifact(*cert,
+                                    policy_pk,
+                                    &issuer_name,
+                                    &issuer_desc,
+                                    &subject_key,
+                                    &subject_name,
+                                    &subject_desc,
+                                    &sn)
+                 && X509_NAME_get_text_by_NID(X509_get_issuer_name(cert),
+                                              NID_commonName,
+                                              issuer_cn,
+                                              sizeof(issuer_cn))
+                        > 0;
+  X509_free(cert);
+  if (!cert_ok || policy_name != issuer_cn
+      || subject_name != "CertifierUsers") {
+    printf("test_certifier_service: bad admission certificate\n");
+    return false;
+  }
+
+  // Attestation gets a platform rule signed by the policy key.
+  signed_claim_message rule;
+  request.set_purpose("attestation");
+  response.Clear();
+  if (!exchange(service, request, &response)
+      || response.status() != "succeeded"
+      || !rule.ParseFromString(response.artifact())
+      || !verify_signed_claim(rule, policy_pk)) {
+    printf("test_certifier_service: attestation request failed\n");
+    return false;
+  }
+
+  // Unknown evidence is refused.
+  request.set_submitted_evidence_type("unknown-package");
+  response.Clear();
+  if (!exchange(service, request, &response) || response.status() != "failed"
+      || !response.artifact().empty()) {
+    printf("test_certifier_service: unknown evidence accepted\n");
+    return false;
+  }
+
+  // An oversized request is dropped unanswered.
+  service.max_request_size_ = 64;
+  response.Clear();
+  if (exchange(service, request, &response)) {
+    printf("test_certifier_service: oversized request answered\n");
+    return false;
+  }
+  if (print_all)
+    printf("test_certifier_service: %d claim policy\n", policy.claims_size());
   return true;
 }
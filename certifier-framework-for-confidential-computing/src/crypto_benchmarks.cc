@@ -0,0 +1,576 @@
+//  Copyright (c) 2021-23, VMware Inc, and the Certifier Authors.  All rights
+//  reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Micro-benchmarks for the support.cc primitives.  Results go to
+// crypto_benchmarks.json (google benchmark's JSON schema) as well as the
+// console; any --benchmark_* flag overrides the defaults, e.g.
+//
+//   crypto_benchmarks.exe --benchmark_filter=authenticated_encrypt
+//   crypto_benchmarks.exe --benchmark_out=baseline.json
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "certifier.h"
+#include "support.h"
+#include "simulated_enclave.h"
+
+using namespace certifier::framework;
+using namespace certifier::utilities;
+
+const int64_t min_size = 64;
+const int64_t max_size = 64 << 20;
+// protect_blob keeps the blob on the stack.
+const int64_t max_protect_size = 1 << 20;
+
+static std::vector<int64_t> sizes(int64_t largest) {
+  std::vector<int64_t> v;
+  for (int64_t n = min_size; n <= largest; n *= 8)
+    v.push_back(n);
+  if (v.back() != largest)
+    v.push_back(largest);
+  return v;
+}
+
+static void fill(std::vector<byte> *v) {
+  for (size_t i = 0; i < v->size(); i++)
+    (*v)[i] = (byte)(i * 131 + 7);
+}
+
+// Authenticated encryption
+// -----------------------------------------------------------------------
+
+static void bm_authenticated_encrypt(benchmark::State &state,
+                                     const char *      alg) {
+  int               n = state.range(0);
+  std::vector<byte> in(n);
+  std::vector<byte> out(n + 256);
+  byte              key[128];
+  byte              iv[block_size];
+  fill(&in);
+  memset(key, 0x5a, sizeof(key));
+  memset(iv, 0x33, sizeof(iv));
+
+  for (auto _ : state) {
+    int out_size = out.size();
+    if (!authenticated_encrypt(alg,
+                               in.data(),
+                               n,
+                               key,
+                               sizeof(key),
+                               iv,
+                               sizeof(iv),
+                               out.data(),
+                               &out_size)) {
+      state.SkipWithError("authenticated_encrypt failed");
+      break;
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * n);
+}
+
+static void bm_authenticated_decrypt(benchmark::State &state,
+                                     const char *      alg) {
+  int               n = state.range(0);
+  std::vector<byte> in(n);
+  std::vector<byte> cipher(n + 256);
+  std::vector<byte> out(n + 256);
+  byte              key[128];
+  byte              iv[block_size];
+  int               cipher_size = cipher.size();
+  fill(&in);
+  memset(key, 0x5a, sizeof(key));
+  memset(iv, 0x33, sizeof(iv));
+  if (!authenticated_encrypt(alg,
+                             in.data(),
+                             n,
+                             key,
+                             sizeof(key),
+                             iv,
+                             sizeof(iv),
+                             cipher.data(),
+                             &cipher_size)) {
+    state.SkipWithError("authenticated_encrypt failed");
+    return;
+  }
+
+  for (auto _ : state) {
+    int out_size = out.size();
+    if (!authenticated_decrypt(alg,
+                               cipher.data(),
+                               cipher_size,
+                               key,
+                               sizeof(key),
+                               out.data(),
+                               &out_size)) {
+      state.SkipWithError("authenticated_decrypt failed");
+      break;
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * n);
+}
+
+// Hashing
+// -----------------------------------------------------------------------
+
+static void bm_digest_message(benchmark::State &state, const char *alg) {
+  int               n = state.range(0);
+  std::vector<byte> in(n);
+  byte              digest[64];
+  fill(&in);
+
+  for (auto _ : state) {
+    if (!digest_message(alg, in.data(), n, digest, sizeof(digest))) {
+      state.SkipWithError("digest_message failed");
+      break;
+    }
+    benchmark::DoNotOptimize(digest);
+  }
+  state.SetBytesProcessed(state.iterations() * n);
+}
+
+// Public key operations, over a digest-sized message
+// -----------------------------------------------------------------------
+
+const int signed_msg_size = 256;
+
+static void bm_rsa_sign(benchmark::State &state,
+                        int               bits,
+                        const char *      digest_alg) {
+  key_message k;
+  byte        msg[signed_msg_size];
+  byte        sig[1024];
+  memset(msg, 0x42, sizeof(msg));
+  RSA *r = RSA_new();
+  if (!make_certifier_rsa_key(bits, &k) || !key_to_RSA(k, r)) {
+    state.SkipWithError("can't make key");
+    RSA_free(r);
+    return;
+  }
+
+  for (auto _ : state) {
+    int sig_size = sizeof(sig);
+    if (!rsa_sign(digest_alg, r, sizeof(msg), msg, &sig_size, sig)) {
+      state.SkipWithError("rsa_sign failed");
+      break;
+    }
+  }
+  RSA_free(r);
+}
+
+static void bm_rsa_verify(benchmark::State &state,
+                          int               bits,
+                          const char *      digest_alg) {
+  key_message k;
+  byte        msg[signed_msg_size];
+  byte        sig[1024];
+  int         sig_size = sizeof(sig);
+  memset(msg, 0x42, sizeof(msg));
+  RSA *r = RSA_new();
+  if (!make_certifier_rsa_key(bits, &k) || !key_to_RSA(k, r)
+      || !rsa_sign(digest_alg, r, sizeof(msg), msg, &sig_size, sig)) {
+    state.SkipWithError("can't make key or signature");
+    RSA_free(r);
+    return;
+  }
+
+  for (auto _ : state) {
+    if (!rsa_verify(digest_alg, r, sizeof(msg), msg, sig_size, sig)) {
+      state.SkipWithError("rsa_verify failed");
+      break;
+    }
+  }
+  RSA_free(r);
+}
+
+static void bm_ecc_sign(benchmark::State &state,
+                        int               bits,
+                        const char *      digest_alg) {
+  key_message k;
+  byte        msg[signed_msg_size];
+  byte        sig[256];
+  memset(msg, 0x42, sizeof(msg));
+  EC_KEY *e = nullptr;
+  if (!make_certifier_ecc_key(bits, &k) || (e = key_to_ECC(k)) == nullptr) {
+    state.SkipWithError("can't make key");
+    return;
+  }
+
+  for (auto _ : state) {
+    int sig_size = sizeof(sig);
+    if (!ecc_sign(digest_alg, e, sizeof(msg), msg, &sig_size, sig)) {
+      state.SkipWithError("ecc_sign failed");
+      break;
+    }
+  }
+  EC_KEY_free(e);
+}
+
+static void bm_ecc_verify(benchmark::State &state,
+                          int               bits,
+                          const char *      digest_alg) {
+  key_message k;
+  byte        msg[signed_msg_size];
+  byte        sig[256];
+  int         sig_size = sizeof(sig);
+  memset(msg, 0x42, sizeof(msg));
+  EC_KEY *e = nullptr;
+  if (!make_certifier_ecc_key(bits, &k) || (e = key_to_ECC(k)) == nullptr
+      || !ecc_sign(digest_alg, e, sizeof(msg), msg, &sig_size, sig)) {
+    state.SkipWithError("can't make key or signature");
+    if (e != nullptr)
+      EC_KEY_free(e);
+    return;
+  }
+
+  for (auto _ : state) {
+    if (!ecc_verify(digest_alg, e, sizeof(msg), msg, sig_size, sig)) {
+      state.SkipWithError("ecc_verify failed");
+      break;
+    }
+  }
+  EC_KEY_free(e);
+}
+
+// Claims
+// -----------------------------------------------------------------------
+
+static bool make_test_claim(const key_message &signer, claim_message *claim) {
+  key_message    public_signer;
+  entity_message e1;
+  entity_message e2;
+  string         measurement(32, 'm');
+  string         speaks_for("speaks-for");
+  string         says("says");
+  vse_clause     clause1;
+  vse_clause     clause2;
+  if (!private_key_to_public_key(signer, &public_signer)
+      || !make_key_entity(public_signer, &e1)
+      || !make_measurement_entity(measurement, &e2)
+      || !make_simple_vse_clause(e1, speaks_for, e2, &clause1)
+      || !make_indirect_vse_clause(e1, says, clause1, &clause2))
+    return false;
+
+  string     serialized_clause;
+  string     format("vse-clause");
+  string     description("benchmark");
+  time_point t_nb;
+  time_point t_na;
+  string     nb;
+  string     na;
+  clause2.SerializeToString(&serialized_clause);
+  if (!time_now(&t_nb) || !add_interval_to_time_point(t_nb, 24.0, &t_na)
+      || !time_to_string(t_nb, &nb) || !time_to_string(t_na, &na))
+    return false;
+  return make_claim(serialized_clause.size(),
+                    (byte *)serialized_clause.data(),
+                    format,
+                    description,
+                    nb,
+                    na,
+                    claim);
+}
+
+static bool make_signing_key(const char *sign_alg, key_message *k) {
+  if (strcmp(sign_alg, Enc_method_rsa_2048_sha256_pkcs_sign) == 0)
+    return make_certifier_rsa_key(2048, k);
+  if (strcmp(sign_alg, Enc_method_ecc_384_sha384_pkcs_sign) == 0)
+    return make_certifier_ecc_key(384, k);
+  return false;
+}
+
+static void bm_make_signed_claim(benchmark::State &state,
+                                 const char *      sign_alg) {
+  key_message   k;
+  claim_message claim;
+  if (!make_signing_key(sign_alg, &k) || !make_test_claim(k, &claim)) {
+    state.SkipWithError("can't make claim");
+    return;
+  }
+
+  for (auto _ : state) {
+    signed_claim_message sc;
+    if (!make_signed_claim(sign_alg, claim, k, &sc)) {
+      state.SkipWithError("make_signed_claim failed");
+      break;
+    }
+  }
+}
+
+// cached: with the verification cache on, every iteration after the
+// first is a cache hit.
+static void bm_verify_signed_claim(benchmark::State &state,
+                                   const char *      sign_alg,
+                                   bool              cached) {
+  key_message          k;
+  key_message          public_k;
+  claim_message        claim;
+  signed_claim_message sc;
+  if (!make_signing_key(sign_alg, &k) || !make_test_claim(k, &claim)
+      || !private_key_to_public_key(k, &public_k)
+      || !make_signed_claim(sign_alg, claim, k, &sc)) {
+    state.SkipWithError("can't make signed claim");
+    return;
+  }
+
+  clear_verify_cache();
+  set_verify_cache_ttl(cached ? 300 : 0);
+  for (auto _ : state) {
+    if (!verify_signed_claim(sc, public_k)) {
+      state.SkipWithError("verify_signed_claim failed");
+      break;
+    }
+  }
+  set_verify_cache_ttl(300);
+  clear_verify_cache();
+}
+
+// Protection
+// -----------------------------------------------------------------------
+
+static void bm_protect_blob(benchmark::State &state, const char *alg) {
+  int               n = state.range(0);
+  std::vector<byte> in(n);
+  std::vector<byte> out(n + 4096);
+  byte              key_bits[128];
+  string            enclave_type("simulated-enclave");
+  key_message       k;
+  fill(&in);
+  memset(key_bits, 0x61, sizeof(key_bits));
+  k.set_key_name("benchmark-key");
+  k.set_key_type(alg);
+  k.set_key_format("vse-key");
+  k.set_secret_key_bits(key_bits, cipher_key_byte_size(alg));
+
+  for (auto _ : state) {
+    int out_size = out.size();
+    if (!protect_blob(enclave_type, k, n, in.data(), &out_size, out.data())) {
+      state.SkipWithError("protect_blob failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * n);
+}
+
+// Certificates
+// -----------------------------------------------------------------------
+
+static bool make_artifact(key_message &signing_key,
+                          key_message &subject_key,
+                          X509 *       cert) {
+  string issuer_name("Policy-key");
+  string issuer_description("Policy-key");
+  string subject_name("benchmark-enclave");
+  string subject_description("writer");
+  return produce_artifact(signing_key,
+                          issuer_name,
+                          issuer_description,
+                          subject_key,
+                          subject_name,
+                          subject_description,
+                          1,
+                          60.0 * 60.0 * 24.0,
+                          cert,
+                          true);
+}
+
+static void bm_produce_artifact(benchmark::State &state, int bits) {
+  key_message signing_key;
+  key_message subject_key;
+  if (!make_certifier_rsa_key(bits, &signing_key)
+      || !make_certifier_rsa_key(2048, &subject_key)) {
+    state.SkipWithError("can't make keys");
+    return;
+  }
+
+  for (auto _ : state) {
+    X509 *cert = X509_new();
+    bool  ok = make_artifact(signing_key, subject_key, cert);
+    X509_free(cert);
+    if (!ok) {
+      state.SkipWithError("produce_artifact failed");
+      break;
+    }
+  }
+}
+
+static void bm_verify_artifact(benchmark::State &state,
+                               int               bits,
+                               bool              cached) {
+  key_message signing_key;
+  key_message subject_key;
+  X509 *      cert = X509_new();
+  if (!make_certifier_rsa_key(bits, &signing_key)
+      || !make_certifier_rsa_key(2048, &subject_key)
+      || !make_artifact(signing_key, subject_key, cert)) {
+    state.SkipWithError("can't make certificate");
+    X509_free(cert);
+    return;
+  }
+
+  clear_verify_cache();
+  set_verify_cache_ttl(cached ? 300 : 0);
+  for (auto _ : state) {
+    string      issuer_name;
+    string      issuer_description;
+    string      subject_name;
+    string      subject_description;
+    key_message cert_key;
+    uint64_t    sn;
+    if (!verify_artifact(*cert,
+                         signing_key,
+                         &issuer_name,
+                         &issuer_description,
+                         &cert_key,
+                         &subject_name,
+                         &subject_description,
+                         &sn)) {
+      state.SkipWithError("verify_artifact failed");
+      break;
+    }
+  }
+  set_verify_cache_ttl(300);
+  clear_verify_cache();
+  X509_free(cert);
+}
+
+// -----------------------------------------------------------------------
+
+static void register_benchmarks() {
+  for (int i = 0; i < Num_symmetric_key_algorithms; i++) {
+    const char *alg = Enc_authenticated_symmetric_key_algorithms[i];
+    const alg_descriptor *d = find_algorithm(alg);
+    if (d == nullptr || d->aead_encrypt == nullptr)
+      continue;
+    string name(alg);
+    benchmark::RegisterBenchmark(("authenticated_encrypt/" + name).c_str(),
+                                 bm_authenticated_encrypt,
+                                 alg)
+        ->ArgsProduct({sizes(max_size)});
+    benchmark::RegisterBenchmark(("authenticated_decrypt/" + name).c_str(),
+                                 bm_authenticated_decrypt,
+                                 alg)
+        ->ArgsProduct({sizes(max_size)});
+    benchmark::RegisterBenchmark(("protect_blob/" + name).c_str(),
+                                 bm_protect_blob,
+                                 alg)
+        ->ArgsProduct({sizes(max_protect_size)});
+  }
+
+  const char *digests[] = {Digest_method_sha_256,
+                           Digest_method_sha_384,
+                           Digest_method_sha_512};
+  for (const char *alg : digests) {
+    benchmark::RegisterBenchmark(("digest_message/" + string(alg)).c_str(),
+                                 bm_digest_message,
+                                 alg)
+        ->ArgsProduct({sizes(max_size)});
+  }
+
+  struct {
+    int         bits;
+    const char *digest;
+  } rsa[] = {{2048, Digest_method_sha_256},
+             {3072, Digest_method_sha_384},
+             {4096, Digest_method_sha_384}};
+  for (auto &r : rsa) {
+    string bits = std::to_string(r.bits);
+    benchmark::RegisterBenchmark(("rsa_sign/" + bits).c_str(),
+                                 bm_rsa_sign,
+                                 r.bits,
+                                 r.digest);
+    benchmark::RegisterBenchmark(("rsa_verify/" + bits).c_str(),
+                                 bm_rsa_verify,
+                                 r.bits,
+                                 r.digest);
+    benchmark::RegisterBenchmark(("produce_artifact/rsa-" + bits).c_str(),
+                                 bm_produce_artifact,
+                                 r.bits);
+    benchmark::RegisterBenchmark(("verify_artifact/rsa-" + bits).c_str(),
+                                 bm_verify_artifact,
+                                 r.bits,
+                                 false);
+  }
+  benchmark::RegisterBenchmark("verify_artifact/rsa-2048/cached",
+                               bm_verify_artifact,
+                               2048,
+                               true);
+
+  benchmark::RegisterBenchmark("ecc_sign/P-256",
+                               bm_ecc_sign,
+                               256,
+                               Digest_method_sha_256);
+  benchmark::RegisterBenchmark("ecc_verify/P-256",
+                               bm_ecc_verify,
+                               256,
+                               Digest_method_sha_256);
+  benchmark::RegisterBenchmark("ecc_sign/P-384",
+                               bm_ecc_sign,
+                               384,
+                               Digest_method_sha_384);
+  benchmark::RegisterBenchmark("ecc_verify/P-384",
+                               bm_ecc_verify,
+                               384,
+                               Digest_method_sha_384);
+
+  const char *sign_algs[] = {Enc_method_rsa_2048_sha256_pkcs_sign,
+                             Enc_method_ecc_384_sha384_pkcs_sign};
+  for (const char *alg : sign_algs) {
+    string name(alg);
+    benchmark::RegisterBenchmark(("make_signed_claim/" + name).c_str(),
+                                 bm_make_signed_claim,
+                                 alg);
+    benchmark::RegisterBenchmark(("verify_signed_claim/" + name).c_str(),
+                                 bm_verify_signed_claim,
+                                 alg,
+                                 false);
+    benchmark::RegisterBenchmark(
+        ("verify_signed_claim/" + name + "/cached").c_str(),
+        bm_verify_signed_claim,
+        alg,
+        true);
+  }
+}
+
+int main(int an, char **av) {
+  // Defaults first so that flags on the command line win.
+  std::vector<char *> args;
+  string              out_flag("--benchmark_out=crypto_benchmarks.json");
+  string              format_flag("--benchmark_out_format=json");
+  args.push_back(av[0]);
+  args.push_back((char *)out_flag.c_str());
+  args.push_back((char *)format_flag.c_str());
+  for (int i = 1; i < an; i++)
+    args.push_back(av[i]);
+  int num_args = args.size();
+
+  extern bool simulator_init();
+  if (!simulator_init()) {
+    printf("%s() error, line: %d, simulator_init failed\n", __func__, __LINE__);
+    return 1;
+  }
+
+  register_benchmarks();
+  benchmark::Initialize(&num_args, args.data());
+  if (benchmark::ReportUnrecognizedArguments(num_args, args.data()))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
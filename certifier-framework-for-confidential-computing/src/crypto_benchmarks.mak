@@ -0,0 +1,106 @@
+#    
+#    File: crypto_benchmarks.mak
+#
+#    Micro-benchmarks for the support.cc crypto primitives; needs
+#    google benchmark (libbenchmark-dev).
+#
+#      make -f crypto_benchmarks.mak
+#      ./crypto_benchmarks.exe [--benchmark_filter=...]
+#
+#    Results are written to crypto_benchmarks.json unless
+#    --benchmark_out is given.
+
+# CERTIFIER_ROOT will be certifier-framework-for-confidential-computing/ dir
+CERTIFIER_ROOT = ..
+
+ifndef SRC_DIR
+SRC_DIR=.
+endif
+ifndef INC_DIR
+INC_DIR=../include
+endif
+ifndef OBJ_DIR
+OBJ_DIR=.
+endif
+ifndef EXE_DIR
+EXE_DIR=.
+endif
+
+ifndef LOCAL_LIB
+    LOCAL_LIB=/usr/local/lib
+endif
+
+CP = $(CERTIFIER_ROOT)/certifier_service/certprotos
+
+S= $(SRC_DIR)
+O= $(OBJ_DIR)
+I= $(INC_DIR)
+
+INCLUDE = -I $(I) -I/usr/local/opt/openssl@1.1/include/ -I $(S)/sev-snp -I $(S)/gramine
+
+CFLAGS_COMMON = $(INCLUDE) -g -std=c++17 -D X64 -Wall -Wno-unused-variable -Wno-deprecated-declarations
+
+CFLAGS  = $(CFLAGS_COMMON) -O3
+
+CFLAGS_PIC =
+
+CFLAGS += $(CFLAGS_PIC)
+
+CC=g++
+LINK=g++
+PROTO=protoc
+
+LDFLAGS= -L $(LOCAL_LIB) -lprotobuf -lbenchmark -lpthread -L/usr/local/opt/openssl@1.1/lib/ -lcrypto -lssl -luuid
+
+common_objs = $(O)/certifier.pb.o $(O)/certifier.o      \
+              $(O)/certifier_proofs.o  $(O)/support.o $(O)/simulated_enclave.o \
+              $(O)/application_enclave.o
+
+dobj = $(O)/crypto_benchmarks.o $(common_objs)
+
+all:	crypto_benchmarks.exe
+
+clean:
+	@echo "removing generated files"
+	rm -rf $(S)/certifier.pb.h $(I)/certifier.pb.h $(S)/certifier.pb.cc
+	@echo "removing object files"
+	rm -rf $(O)/*.o
+	@echo "removing executable files"
+	rm -rf $(EXE_DIR)/crypto_benchmarks.exe
+
+crypto_benchmarks.exe: $(dobj)
+	@echo "\nlinking executable $@"
+	$(LINK) -o $(EXE_DIR)/crypto_benchmarks.exe $(dobj) $(LDFLAGS)
+
+$(I)/certifier.pb.h: $(S)/certifier.pb.cc
+$(S)/certifier.pb.cc: $(CP)/certifier.proto
+	$(PROTO) --cpp_out=$(S) --proto_path $(<D) $<
+	mv $(S)/certifier.pb.h $(I)
+
+$(O)/crypto_benchmarks.o: $(S)/crypto_benchmarks.cc $(I)/certifier.pb.h $(I)/certifier.h $(I)/support.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier.pb.o: $(S)/certifier.pb.cc $(I)/certifier.pb.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier.o: $(S)/certifier.cc $(I)/certifier.pb.h $(I)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/certifier_proofs.o: $(S)/certifier_proofs.cc $(I)/certifier.pb.h $(I)/certifier.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/support.o: $(S)/support.cc $(I)/support.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/simulated_enclave.o: $(S)/simulated_enclave.cc $(I)/simulated_enclave.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
+
+$(O)/application_enclave.o: $(S)/application_enclave.cc $(I)/application_enclave.h
+	@echo "\ncompiling $<"
+	$(CC) $(CFLAGS) -o $(@D)/$@ -c $<
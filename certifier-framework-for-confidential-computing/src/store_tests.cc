@@ -152,6 +152,41 @@ bool test_protect(bool print_all) {
   if (memcmp(unencrypted_data2, (byte *)secret_data, strlen(secret_data)) != 0)
     return false;
 
+  // Keys for the other authenticated ciphers only need their own size.
+  const char *other_algs[] = {Enc_method_aes_256_gcm,
+                              Enc_method_chacha20_poly1305};
+  for (int i = 0; i < (int)(sizeof(other_algs) / sizeof(other_algs[0])); i++) {
+    key_message other_key;
+    key_message recovered_key;
+    other_key.CopyFrom(key_start);
+    other_key.set_key_type(other_algs[i]);
+    other_key.set_secret_key_bits((void *)key_str,
+                                  cipher_key_byte_size(other_algs[i]));
+    int  other_blob_size = 1024;
+    byte other_blob[other_blob_size];
+    int  other_data_size = 512;
+    byte other_data[other_data_size];
+    if (!protect_blob(enclave_type,
+                      other_key,
+                      (int)strlen(secret_data),
+                      (byte *)secret_data,
+                      &other_blob_size,
+                      other_blob)
+        || !unprotect_blob(enclave_type,
+                           other_blob_size,
+                           other_blob,
+                           &recovered_key,
+                           &other_data_size,
+                           other_data)) {
+      printf("%s protect/unprotect failed\n", other_algs[i]);
+      return false;
+    }
+    if (!same_key(other_key, recovered_key)
+        || other_data_size != (int)strlen(secret_data)
+        || memcmp(other_data, secret_data, other_data_size) != 0)
+      return false;
+  }
+
   return true;
 }
 
@@ -25,6 +25,8 @@
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/crypto.h>
 
 #include "support.h"
 #include "certifier.pb.h"
@@ -32,7 +34,21 @@
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/random.h>
+#include <sys/auxv.h>
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#endif
+#include <errno.h>
+#include <pthread.h>
 #include <string>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
 
 #include "certifier_algorithms.cc"
 
@@ -40,117 +56,273 @@ using std::string;
 using namespace certifier::framework;
 using namespace certifier::utilities;
 
+// Algorithm registry
 // -----------------------------------------------------------------------
 
-class name_size {
- public:
-  const char *name_;
-  int         size_;
-};
+bool aes_256_cbc_sha256_encrypt(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *iv,
+                                byte *out,
+                                int * out_size);
+bool aes_256_cbc_sha256_decrypt(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *out,
+                                int * out_size);
+bool aes_256_cbc_sha384_encrypt(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *iv,
+                                byte *out,
+                                int * out_size);
+bool aes_256_cbc_sha384_decrypt(byte *in,
+                                int   in_len,
+                                byte *key,
+                                byte *out,
+                                int * out_size);
+bool aes_256_gcm_encrypt(byte *in,
+                         int   in_len,
+                         byte *key,
+                         byte *iv,
+                         byte *out,
+                         int * out_size);
+bool aes_256_gcm_decrypt(byte *in,
+                         int   in_len,
+                         byte *key,
+                         byte *out,
+                         int * out_size);
+bool aes_256_gcm_siv_encrypt(byte *in,
+                             int   in_len,
+                             byte *key,
+                             byte *iv,
+                             byte *out,
+                             int * out_size);
+bool aes_256_gcm_siv_decrypt(byte *in,
+                             int   in_len,
+                             byte *key,
+                             byte *out,
+                             int * out_size);
+bool chacha20_poly1305_encrypt(byte *in,
+                               int   in_len,
+                               byte *key,
+                               byte *iv,
+                               byte *out,
+                               int * out_size);
+bool chacha20_poly1305_decrypt(byte *in,
+                               int   in_len,
+                               byte *key,
+                               byte *out,
+                               int * out_size);
+static const EVP_CIPHER *aes_256_gcm_siv_cipher();
+
+// Indexed by alg_id.  The names are run-time globals, so the table is
+// filled in during static initialization, after certifier_algorithms.cc
+// above.  rsa-1024-sha256-pkcs-sign has sizes but is not accepted for
+// signing.
+//
+// name, id, class,
+//     block, key, digest, mac, iv, pkey type, digest, public key,
+//     md, cipher, aead encrypt, aead decrypt
 
 // clang-format off
 
-name_size cipher_block_byte_name_size[] = {
-    { Enc_method_aes_256                    , 16 },
-    { Enc_method_aes_256_cbc_hmac_sha256    , 16 },
-    { Enc_method_aes_256_cbc_hmac_sha384    , 16 },
-    { Enc_method_aes_256_gcm                , 16 },
-    { Enc_method_aes_128                    , 16 },
-    { Enc_method_aes_128_cbc_hmac_sha256    , 16 },
-    { Enc_method_rsa_2048_sha256_pkcs_sign  , 256 },
-    { Enc_method_rsa_2048                   , 256 },
-    { Enc_method_rsa_1024_sha256_pkcs_sign  , 128 },
-    { Enc_method_rsa_1024                   , 128 },
-    { Enc_method_rsa_1024_private           , 128 },
-    { Enc_method_rsa_1024_public            , 128 },
-    { Enc_method_rsa_2048_private           , 256 },
-    { Enc_method_rsa_2048_public            , 256 },
-    { Enc_method_rsa_4096_sha384_pkcs_sign  , 512 },
-    { Enc_method_rsa_4096_private           , 512 },
-    { Enc_method_rsa_4096_public            , 512 },
-    { Enc_method_ecc_384_public             , 48 },
-    { Enc_method_ecc_384_private            , 48 },
-    { Enc_method_ecc_256_public             , 32 },
-    { Enc_method_ecc_256_private            , 32 },
+static const alg_descriptor algorithm_table[num_alg_ids] = {
+  { "", alg_unknown, alg_class_none,
+      -1, -1, -1, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_aes_128, alg_aes_128, alg_class_cipher,
+      16, -1, -1, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, EVP_aes_128_cbc, nullptr, nullptr },
+  { Enc_method_aes_128_cbc_hmac_sha256, alg_aes_128_cbc_hmac_sha256, alg_class_aead,
+      16, -1, -1, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha256, EVP_aes_128_cbc, nullptr, nullptr },
+  { Enc_method_aes_256, alg_aes_256, alg_class_cipher,
+      16, 32, -1, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, EVP_aes_256_cbc, nullptr, nullptr },
+  { Enc_method_aes_256_cbc, alg_aes_256_cbc, alg_class_cipher,
+      -1, -1, -1, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, EVP_aes_256_cbc, nullptr, nullptr },
+  { Enc_method_aes_256_cbc_hmac_sha256, alg_aes_256_cbc_hmac_sha256, alg_class_aead,
+      16, 64, -1, 32, 16, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha256, EVP_aes_256_cbc, aes_256_cbc_sha256_encrypt, aes_256_cbc_sha256_decrypt },
+  { Enc_method_aes_256_cbc_hmac_sha384, alg_aes_256_cbc_hmac_sha384, alg_class_aead,
+      16, 80, -1, 48, 16, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha384, EVP_aes_256_cbc, aes_256_cbc_sha384_encrypt, aes_256_cbc_sha384_decrypt },
+  { Enc_method_aes_256_gcm, alg_aes_256_gcm, alg_class_aead,
+      16, 32, -1, 16, 16, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, EVP_aes_256_gcm, aes_256_gcm_encrypt, aes_256_gcm_decrypt },
+  { Enc_method_aes_256_gcm_siv, alg_aes_256_gcm_siv, alg_class_aead,
+      16, 32, -1, 16, 12, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, aes_256_gcm_siv_cipher, aes_256_gcm_siv_encrypt, aes_256_gcm_siv_decrypt },
+  { Enc_method_chacha20_poly1305, alg_chacha20_poly1305, alg_class_aead,
+      64, 32, -1, 16, 12, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      nullptr, EVP_chacha20_poly1305, chacha20_poly1305_encrypt, chacha20_poly1305_decrypt },
+  { Enc_method_ecc_256_private, alg_ecc_256_private, alg_class_key,
+      32, -1, -1, -1, -1, EVP_PKEY_EC, alg_unknown, alg_ecc_256_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_256_public, alg_ecc_256_public, alg_class_key,
+      32, -1, -1, -1, -1, EVP_PKEY_EC, alg_unknown, alg_ecc_256_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_256_sha256_pkcs_sign, alg_ecc_256_sha256_pkcs_sign, alg_class_sign,
+      -1, -1, -1, -1, -1, EVP_PKEY_EC, alg_sha_256, alg_unknown,
+      EVP_sha256, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_384, alg_ecc_384, alg_class_key_family,
+      -1, -1, -1, -1, -1, EVP_PKEY_EC, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_384_private, alg_ecc_384_private, alg_class_key,
+      48, -1, -1, -1, -1, EVP_PKEY_EC, alg_unknown, alg_ecc_384_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_384_public, alg_ecc_384_public, alg_class_key,
+      48, -1, -1, -1, -1, EVP_PKEY_EC, alg_unknown, alg_ecc_384_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_ecc_384_sha384_pkcs_sign, alg_ecc_384_sha384_pkcs_sign, alg_class_sign,
+      -1, -1, -1, -1, -1, EVP_PKEY_EC, alg_sha_384, alg_unknown,
+      EVP_sha384, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_1024, alg_rsa_1024, alg_class_key_family,
+      128, 128, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_1024_private, alg_rsa_1024_private, alg_class_key,
+      128, 128, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_1024_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_1024_public, alg_rsa_1024_public, alg_class_key,
+      128, 128, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_1024_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_1024_sha256_pkcs_sign, alg_rsa_1024_sha256_pkcs_sign, alg_class_sign,
+      128, 128, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_2048, alg_rsa_2048, alg_class_key_family,
+      256, 256, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_2048_private, alg_rsa_2048_private, alg_class_key,
+      256, 256, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_2048_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_2048_public, alg_rsa_2048_public, alg_class_key,
+      256, 256, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_2048_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_2048_sha256_pkcs_sign, alg_rsa_2048_sha256_pkcs_sign, alg_class_sign,
+      256, 256, -1, -1, -1, EVP_PKEY_RSA, alg_sha_256, alg_unknown,
+      EVP_sha256, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_3072, alg_rsa_3072, alg_class_key_family,
+      -1, -1, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_3072_private, alg_rsa_3072_private, alg_class_key,
+      -1, 384, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_3072_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_3072_public, alg_rsa_3072_public, alg_class_key,
+      -1, 384, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_3072_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_3072_sha384_pkcs_sign, alg_rsa_3072_sha384_pkcs_sign, alg_class_sign,
+      -1, 384, -1, -1, -1, EVP_PKEY_RSA, alg_sha_384, alg_unknown,
+      EVP_sha384, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_4096, alg_rsa_4096, alg_class_key_family,
+      -1, -1, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_unknown,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_4096_private, alg_rsa_4096_private, alg_class_key,
+      512, 512, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_4096_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_4096_public, alg_rsa_4096_public, alg_class_key,
+      512, 512, -1, -1, -1, EVP_PKEY_RSA, alg_unknown, alg_rsa_4096_public,
+      nullptr, nullptr, nullptr, nullptr },
+  { Enc_method_rsa_4096_sha384_pkcs_sign, alg_rsa_4096_sha384_pkcs_sign, alg_class_sign,
+      512, 512, -1, -1, -1, EVP_PKEY_RSA, alg_sha_384, alg_unknown,
+      EVP_sha384, nullptr, nullptr, nullptr },
+  { Digest_method_sha256, alg_sha256, alg_class_digest,
+      -1, -1, 32, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha256, nullptr, nullptr, nullptr },
+  { Digest_method_sha_256, alg_sha_256, alg_class_digest,
+      -1, -1, 32, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha256, nullptr, nullptr, nullptr },
+  { Digest_method_sha_384, alg_sha_384, alg_class_digest,
+      -1, -1, 48, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha384, nullptr, nullptr, nullptr },
+  { Digest_method_sha_512, alg_sha_512, alg_class_digest,
+      -1, -1, 64, -1, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha512, nullptr, nullptr, nullptr },
+  { Integrity_method_hmac_sha256, alg_hmac_sha256, alg_class_mac,
+      -1, -1, -1, 32, -1, EVP_PKEY_NONE, alg_unknown, alg_unknown,
+      EVP_sha256, nullptr, nullptr, nullptr },
 };
 
-name_size cipher_key_byte_name_size[] = {
-    { Enc_method_aes_256                    , 32 },
-    { Enc_method_aes_256_cbc_hmac_sha256    , 64 },
-    { Enc_method_aes_256_cbc_hmac_sha384    , 80 },
-    { Enc_method_aes_256_gcm                , 32 },
-    { Enc_method_rsa_2048_sha256_pkcs_sign  , 256 },
-    { Enc_method_rsa_2048                   , 256 },
-    { Enc_method_rsa_1024_sha256_pkcs_sign  , 128 },
-    { Enc_method_rsa_1024                   , 128 },
-    { Enc_method_rsa_2048_private           , 256 },
-    { Enc_method_rsa_2048_public            , 256 },
-    { Enc_method_rsa_1024_private           , 128 },
-    { Enc_method_rsa_1024_public            , 128 },
-    { Enc_method_rsa_3072_sha384_pkcs_sign  , 384 },
-    { Enc_method_rsa_3072_private           , 384 },
-    { Enc_method_rsa_3072_public            , 384 },
-    { Enc_method_rsa_4096_sha384_pkcs_sign  , 512 },
-    { Enc_method_rsa_4096_private           , 512 },
-    { Enc_method_rsa_4096_public            , 512 },
-};
+// clang-format on
 
-name_size digest_byte_name_size[] = {
-    { Digest_method_sha256   , 32 },
-    { Digest_method_sha_256  , 32 },
-    { Digest_method_sha_384  , 48 },
-    { Digest_method_sha_512  , 64 },
+class alg_name_hash {
+ public:
+  size_t operator()(const char *s) const {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s != '\0'; s++) {
+      h ^= (byte)*s;
+      h *= 0x100000001b3ULL;
+    }
+    return (size_t)h;
+  }
 };
 
-name_size mac_byte_name_size[] = {
-    { Integrity_method_hmac_sha256       , 32 },
-    { Enc_method_aes_256_cbc_hmac_sha256 , 32 },
-    { Enc_method_aes_256_cbc_hmac_sha384 , 48 },
-    { Enc_method_aes_256_gcm             , 16 },
+class alg_name_equal {
+ public:
+  bool operator()(const char *a, const char *b) const {
+    return strcmp(a, b) == 0;
+  }
 };
 
-// clang-format on
-
-int certifier::utilities::cipher_block_byte_size(const char *alg_name) {
-  int size = sizeof(cipher_block_byte_name_size)
-             / sizeof(cipher_block_byte_name_size[0]);
+typedef std::unordered_map<const char *,
+                           const alg_descriptor *,
+                           alg_name_hash,
+                           alg_name_equal>
+    alg_name_map;
+
+static alg_name_map build_algorithm_names() {
+  alg_name_map names;
+  for (int i = alg_unknown + 1; i < num_alg_ids; i++)
+    names[algorithm_table[i].name] = &algorithm_table[i];
+  return names;
+}
 
-  for (int i = 0; i < size; i++) {
-    if (strcmp(alg_name, cipher_block_byte_name_size[i].name_) == 0)
-      return cipher_block_byte_name_size[i].size_;
+const alg_descriptor *certifier::utilities::find_algorithm(
+    const char *alg_name) {
+  if (alg_name == nullptr)
+    return nullptr;
+  for (int i = alg_unknown + 1; i < num_alg_ids; i++) {
+    if (algorithm_table[i].name == alg_name)
+      return &algorithm_table[i];
   }
-  return -1;
+
+  // Built once, read-only afterwards.
+  static const alg_name_map names = build_algorithm_names();
+  alg_name_map::const_iterator it = names.find(alg_name);
+  return it == names.end() ? nullptr : it->second;
 }
 
-int certifier::utilities::cipher_key_byte_size(const char *alg_name) {
-  int size =
-      sizeof(cipher_key_byte_name_size) / sizeof(cipher_key_byte_name_size[0]);
+const alg_descriptor *certifier::utilities::find_algorithm(
+    const string &alg_name) {
+  return find_algorithm(alg_name.c_str());
+}
 
-  for (int i = 0; i < size; i++) {
-    if (strcmp(alg_name, cipher_key_byte_name_size[i].name_) == 0)
-      return cipher_key_byte_name_size[i].size_;
-  }
-  return -1;
+const alg_descriptor *certifier::utilities::algorithm_by_id(alg_id id) {
+  if (id <= alg_unknown || id >= num_alg_ids)
+    return nullptr;
+  return &algorithm_table[id];
 }
 
-int certifier::utilities::digest_output_byte_size(const char *alg_name) {
-  int size = sizeof(digest_byte_name_size) / sizeof(digest_byte_name_size[0]);
+int certifier::utilities::cipher_block_byte_size(const char *alg_name) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  return d == nullptr ? -1 : d->block_size;
+}
 
-  for (int i = 0; i < size; i++) {
-    if (strcmp(alg_name, digest_byte_name_size[i].name_) == 0)
-      return digest_byte_name_size[i].size_;
-  }
-  return -1;
+int certifier::utilities::cipher_key_byte_size(const char *alg_name) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  return d == nullptr ? -1 : d->key_size;
 }
 
-int certifier::utilities::mac_output_byte_size(const char *alg_name) {
-  int size = sizeof(mac_byte_name_size) / sizeof(mac_byte_name_size[0]);
+int certifier::utilities::digest_output_byte_size(const char *alg_name) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  return d == nullptr ? -1 : d->digest_size;
+}
 
-  for (int i = 0; i < size; i++) {
-    if (strcmp(alg_name, mac_byte_name_size[i].name_) == 0)
-      return mac_byte_name_size[i].size_;
-  }
-  return -1;
+int certifier::utilities::mac_output_byte_size(const char *alg_name) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  return d == nullptr ? -1 : d->mac_size;
 }
 
 bool certifier::utilities::write_file(const string &file_name,
@@ -260,6 +432,20 @@ bool certifier::utilities::tm_time_to_time_point(struct tm * tm_time,
   return true;
 }
 
+bool certifier::utilities::time_point_to_time_t(const time_point &tp,
+                                                time_t *          t) {
+  struct tm tm_time;
+  memset(&tm_time, 0, sizeof(tm_time));
+  tm_time.tm_year = tp.year() - 1900;
+  tm_time.tm_mon = tp.month() - 1;
+  tm_time.tm_mday = tp.day();
+  tm_time.tm_hour = tp.hour();
+  tm_time.tm_min = tp.minute();
+  tm_time.tm_sec = (int)tp.seconds();
+  *t = timegm(&tm_time);
+  return *t != (time_t)-1;
+}
+
 bool certifier::utilities::asn1_time_to_tm_time(const ASN1_TIME *s,
                                                 struct tm *      tm_time) {
   if (1 != ASN1_TIME_to_tm(s, tm_time)) {
@@ -659,6 +845,126 @@ done:
   return ret;
 }
 
+// Runs worker on num_threads threads, the caller's included: every core
+// when num_threads <= 0, and never more threads than items.
+static void run_workers(int                          num_threads,
+                        uint64_t                     num_items,
+                        const std::function<void()> &worker) {
+  if (num_threads <= 0)
+    num_threads = (int)std::thread::hardware_concurrency();
+  if (num_threads <= 0)
+    num_threads = 1;
+  if ((uint64_t)num_threads > num_items)
+    num_threads = num_items > 0 ? (int)num_items : 1;
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t < num_threads; t++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+}
+
+// Hashing
+// -----------------------------------------------------------------------
+
+static const EVP_MD *digest_md(const char *alg) {
+  const alg_descriptor *d = find_algorithm(alg);
+  if (d == nullptr || d->cls != alg_class_digest)
+    return nullptr;
+  return d->md();
+}
+
+certifier::utilities::digest_stream::digest_stream() {
+  ctx_ = EVP_MD_CTX_new();
+  started_ = false;
+}
+
+certifier::utilities::digest_stream::~digest_stream() {
+  if (ctx_ != nullptr)
+    EVP_MD_CTX_free(ctx_);
+}
+
+bool certifier::utilities::digest_stream::init(const char *alg) {
+  started_ = false;
+  const EVP_MD *md = digest_md(alg);
+  if (md == nullptr) {
+    printf("%s() error, line: %d, unknown hash\n", __func__, __LINE__);
+    return false;
+  }
+  if (ctx_ == nullptr || 1 != EVP_DigestInit_ex(ctx_, md, nullptr)) {
+    printf("%s() error, line: %d, EVP_DigestInit failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  started_ = true;
+  return true;
+}
+
+bool certifier::utilities::digest_stream::update(const byte *data,
+                                                 size_t      len) {
+  if (!started_)
+    return false;
+  if (len > 0 && 1 != EVP_DigestUpdate(ctx_, data, len)) {
+    printf("%s() error, line: %d, EVP_DigestUpdate failed\n",
+           __func__,
+           __LINE__);
+    started_ = false;
+    return false;
+  }
+  return true;
+}
+
+// Maps the file where possible; pipes and the like are read instead.
+bool certifier::utilities::digest_stream::update_file(
+    const string &file_name) {
+  if (!started_)
+    return false;
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("%s() error, line: %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  // read() rather than mmap(): a mapped file truncated while it is being
+  // hashed raises SIGBUS, while read() just sees an earlier end of file.
+  bool              ret = true;
+  std::vector<byte> buf(1 << 20);
+  while (ret) {
+    ssize_t n = read(fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      ret = (n == 0);
+      break;
+    }
+    ret = update(buf.data(), n);
+  }
+  close(fd);
+  return ret;
+}
+
+bool certifier::utilities::digest_stream::final(byte *        digest,
+                                                unsigned int *digest_len) {
+  if (!started_)
+    return false;
+  started_ = false;
+  if ((int)*digest_len < EVP_MD_CTX_size(ctx_)) {
+    printf("%s() error, line: %d, digest_len wrong\n", __func__, __LINE__);
+    return false;
+  }
+  if (1 != EVP_DigestFinal_ex(ctx_, digest, digest_len)) {
+    printf("%s() error, line: %d, EVP_DigestFinal_ex failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
 bool certifier::utilities::digest_message(const char * alg,
                                           const byte * message,
                                           int          message_len,
@@ -677,68 +983,168 @@ bool certifier::utilities::digest_message(const char * alg,
     return false;
   }
 
-  EVP_MD_CTX *mdctx;
+  // One context per thread, reused from call to call.
+  static thread_local digest_stream ds;
+  return ds.init(alg) && ds.update(message, message_len)
+         && ds.final(digest, &digest_len);
+}
 
-  if (strcmp(alg, Digest_method_sha_256) == 0
-      || strcmp(alg, Digest_method_sha256) == 0) {
-    if ((mdctx = EVP_MD_CTX_new()) == NULL) {
-      printf("%s() error, line: %d, EVP_MD_CTX_new failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (1 != EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL)) {
-      printf("%s() error, line: %d, EVP_DigestInit failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-  } else if (strcmp(alg, Digest_method_sha_384) == 0) {
-    if ((mdctx = EVP_MD_CTX_new()) == NULL) {
-      printf("%s() error, line: %d, EVP_MD_CTX_new failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (1 != EVP_DigestInit_ex(mdctx, EVP_sha384(), NULL)) {
-      printf("%s() error, line: %d, EVP_DigestInit failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-  } else if (strcmp(alg, Digest_method_sha_512) == 0) {
-    if ((mdctx = EVP_MD_CTX_new()) == NULL) {
-      printf("%s() error, line: %d, EVP_MD_CTX_new failed\n",
-             __func__,
-             __LINE__);
-      return false;
+bool certifier::utilities::digest_file(const char *  alg,
+                                       const string &file_name,
+                                       byte *        digest,
+                                       unsigned int *digest_len) {
+  digest_stream ds;
+  return ds.init(alg) && ds.update_file(file_name)
+         && ds.final(digest, digest_len);
+}
+
+// Tree hash.  Leaves are SHA-256(0 | chunk), interior nodes
+// SHA-256(1 | left | right), with an odd node carried up unchanged, and
+// the result SHA-256(2 | leaf_size | length | root) so that neither
+// parameter can be changed under the same value.
+const byte tree_leaf_tag = 0;
+const byte tree_node_tag = 1;
+const byte tree_root_tag = 2;
+const int  tree_default_leaf_size = 1 << 20;
+
+static bool tree_hash_parts(EVP_MD_CTX *ctx,
+                            byte        tag,
+                            const byte *a,
+                            size_t      a_len,
+                            const byte *b,
+                            size_t      b_len,
+                            byte *      out) {
+  unsigned int len = 32;
+  return 1 == EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr)
+         && 1 == EVP_DigestUpdate(ctx, &tag, 1)
+         && (a_len == 0 || 1 == EVP_DigestUpdate(ctx, a, a_len))
+         && (b_len == 0 || 1 == EVP_DigestUpdate(ctx, b, b_len))
+         && 1 == EVP_DigestFinal_ex(ctx, out, &len);
+}
+
+bool certifier::utilities::tree_hash(const byte *data,
+                                     size_t      len,
+                                     size_t      leaf_size,
+                                     int         num_threads,
+                                     byte *      digest) {
+  if (leaf_size == 0)
+    leaf_size = tree_default_leaf_size;
+  uint64_t num_leaves = len == 0 ? 1 : (len + leaf_size - 1) / leaf_size;
+  std::vector<byte> level(num_leaves * 32);
+
+  std::atomic<uint64_t> next(0);
+  std::atomic<bool>     ok(true);
+  auto                  worker = [&]() {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx == nullptr) {
+      ok = false;
+      return;
     }
-    if (1 != EVP_DigestInit_ex(mdctx, EVP_sha512(), NULL)) {
-      printf("%s() error, line: %d, EVP_DigestInit failed\n",
-             __func__,
-             __LINE__);
-      return false;
+    while (ok) {
+      uint64_t i = next++;
+      if (i >= num_leaves)
+        break;
+      size_t off = i * leaf_size;
+      size_t n = (len - off < leaf_size) ? len - off : leaf_size;
+      if (!tree_hash_parts(ctx,
+                           tree_leaf_tag,
+                           data + off,
+                           n,
+                           nullptr,
+                           0,
+                           &level[i * 32]))
+        ok = false;
     }
-  } else {
-    printf("%s() error, line: %d, unknown hash \n", __func__, __LINE__);
+    EVP_MD_CTX_free(ctx);
+  };
+  run_workers(num_threads, num_leaves, worker);
+  if (!ok) {
+    printf("%s() error, line: %d, can't hash leaves\n", __func__, __LINE__);
     return false;
   }
 
-  if (1 != EVP_DigestUpdate(mdctx, message, message_len)) {
-    printf("%s() error, line: %d, EVP_DigestUpdate failed\n",
+  // The levels above the leaves are a small fraction of the work.
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  if (ctx == nullptr)
+    return false;
+  bool     ret = true;
+  uint64_t width = num_leaves;
+  byte     params[16];
+  while (ret && width > 1) {
+    uint64_t i = 0;
+    for (; ret && i + 1 < width; i += 2) {
+      ret = tree_hash_parts(ctx,
+                            tree_node_tag,
+                            &level[i * 32],
+                            32,
+                            &level[(i + 1) * 32],
+                            32,
+                            &level[(i / 2) * 32]);
+    }
+    if (i < width)
+      memmove(&level[(i / 2) * 32], &level[i * 32], 32);
+    width = (width + 1) / 2;
+  }
+  for (int i = 0; i < 8; i++) {
+    params[7 - i] = (byte)((uint64_t)leaf_size >> (8 * i));
+    params[15 - i] = (byte)((uint64_t)len >> (8 * i));
+  }
+  ret = ret
+        && tree_hash_parts(ctx,
+                           tree_root_tag,
+                           params,
+                           sizeof(params),
+                           level.data(),
+                           32,
+                           digest);
+  EVP_MD_CTX_free(ctx);
+  return ret;
+}
+
+bool certifier::utilities::tree_hash_file(const string &file_name,
+                                          size_t        leaf_size,
+                                          int           num_threads,
+                                          byte *        digest) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("%s() error, line: %d, can't open %s\n",
            __func__,
-           __LINE__);
+           __LINE__,
+           file_name.c_str());
     return false;
   }
-  if (1 != EVP_DigestFinal_ex(mdctx, digest, &digest_len)) {
-    printf("%s() error, line: %d, EVP_DigestFinal_ex failed\n",
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    printf("%s() error, line: %d, %s is not a regular file\n",
            __func__,
-           __LINE__);
+           __LINE__,
+           file_name.c_str());
+    close(fd);
     return false;
   }
-  EVP_MD_CTX_free(mdctx);
 
-  return true;
+  // Read rather than mapped, as in update_file, so a file truncated while
+  // it is read is hashed as far as it got instead of raising SIGBUS.
+  std::vector<byte> buf(st.st_size);
+  size_t            len = 0;
+  while (len < buf.size()) {
+    ssize_t n = read(fd, buf.data() + len, buf.size() - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      printf("%s() error, line: %d, can't read %s\n",
+             __func__,
+             __LINE__,
+             file_name.c_str());
+      close(fd);
+      return false;
+    }
+    if (n == 0)
+      break;
+    len += n;
+  }
+  close(fd);
+  return tree_hash(buf.data(), len, leaf_size, num_threads, digest);
 }
 
 bool aes_256_cbc_sha256_encrypt(byte *in,
@@ -1090,122 +1496,1352 @@ done:
   return ret;
 }
 
-bool certifier::utilities::authenticated_encrypt(const char *alg_name,
-                                                 byte *      in,
-                                                 int         in_len,
-                                                 byte *      key,
-                                                 int         key_len,
-                                                 byte *      iv,
-                                                 int         iv_len,
-                                                 byte *      out,
-                                                 int *       out_size) {
+// ChaCha20-Poly1305 and AES-256-GCM-SIV share one layout:
+//   12 byte nonce (the first bytes of iv) | ciphertext | 16 byte tag
+// ChaCha20-Poly1305 is constant time without AES instructions;
+// GCM-SIV only leaks message equality if a nonce repeats.
+const int aead_nonce_size = 12;
+const int aead_tag_size = 16;
+
+static const EVP_CIPHER *aes_256_gcm_siv_cipher() {
+  // Provided from OpenSSL 3.2 on; nullptr before that.
+  static EVP_CIPHER *cipher =
+      EVP_CIPHER_fetch(nullptr, "AES-256-GCM-SIV", nullptr);
+  return cipher;
+}
 
-  int key_size = cipher_key_byte_size(alg_name);
-  if (key_size > key_len) {
-    printf("%s() error, line: %d, authenticated_encrypt: key length too short\n"
-           "%s\n",
-           __func__,
-           __LINE__,
-           alg_name);
+bool aes_256_gcm_siv_available() {
+  return aes_256_gcm_siv_cipher() != nullptr;
+}
+
+static bool evp_aead_encrypt(const EVP_CIPHER *cipher,
+                             byte *            in,
+                             int               in_len,
+                             byte *            key,
+                             byte *            iv,
+                             byte *            out,
+                             int *             out_size) {
+  if (cipher == nullptr) {
+    printf("%s() error, line: %d, cipher not available\n", __func__, __LINE__);
     return false;
   }
-  if (strcmp(alg_name, "aes-256-cbc-hmac-sha256") == 0) {
-    return aes_256_cbc_sha256_encrypt(in, in_len, key, iv, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha384) == 0) {
-    return aes_256_cbc_sha384_encrypt(in, in_len, key, iv, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_gcm) == 0) {
-    return aes_256_gcm_encrypt(in, in_len, key, iv, out, out_size);
-  } else {
-    printf("%s() error, line: %d, authenticated_decrypt: unsupported algorithm "
-           "%s\n",
-           __func__,
-           __LINE__,
-           alg_name);
+  if (in_len < 0 || *out_size < in_len + aead_nonce_size + aead_tag_size) {
+    printf("%s() error, line: %d, output too small\n", __func__, __LINE__);
     return false;
   }
-}
 
-bool certifier::utilities::authenticated_decrypt(const char *alg_name,
-                                                 byte *      in,
-                                                 int         in_len,
-                                                 byte *      key,
-                                                 int         key_len,
-                                                 byte *      out,
-                                                 int *       out_size) {
-  int key_size = cipher_key_byte_size(alg_name);
-  if (key_size > key_len) {
-    printf("%s() error, line: %d, authenticated_decrypt: key length too short\n"
-           "%s\n",
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  int             len = 0;
+  int             ciphertext_len = 0;
+  bool            ret = true;
+  if (ctx == nullptr) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_new failed\n",
            __func__,
-           __LINE__,
-           alg_name);
+           __LINE__);
     return false;
   }
-
-  if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha256) == 0) {
-    return aes_256_cbc_sha256_decrypt(in, in_len, key, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_cbc_hmac_sha384) == 0) {
-    return aes_256_cbc_sha384_decrypt(in, in_len, key, out, out_size);
-  } else if (strcmp(alg_name, Enc_method_aes_256_gcm) == 0) {
-    return aes_256_gcm_decrypt(in, in_len, key, out, out_size);
-  } else {
-    printf("%s() error, line: %d, authenticated_decrypt: unsupported algorithm "
-           "%s\n",
+  if (1 != EVP_EncryptInit_ex(ctx, cipher, nullptr, nullptr, nullptr)
+      || 1
+             != EVP_CIPHER_CTX_ctrl(ctx,
+                                    EVP_CTRL_AEAD_SET_IVLEN,
+                                    aead_nonce_size,
+                                    nullptr)
+      || 1 != EVP_EncryptInit_ex(ctx, nullptr, nullptr, key, iv)) {
+    printf("%s() error, line: %d, EVP_EncryptInit_ex failed\n",
            __func__,
-           __LINE__,
-           alg_name);
-    return false;
+           __LINE__);
+    ret = false;
+    goto done;
   }
-}
-
-const int rsa_alg_type = 1;
-const int ecc_alg_type = 2;
-bool      certifier::utilities::private_key_to_public_key(const key_message &in,
-                                                     key_message *      out) {
 
-  int n_bytes = 0;
-  int alg_type = 0;
-  if (in.key_type() == Enc_method_rsa_2048_private) {
-    alg_type = rsa_alg_type;
-    out->set_key_type(Enc_method_rsa_2048_public);
-    n_bytes = cipher_block_byte_size(Enc_method_rsa_2048_public);
-  } else if (in.key_type() == Enc_method_rsa_1024_private) {
-    alg_type = rsa_alg_type;
-    out->set_key_type(Enc_method_rsa_1024_public);
-    n_bytes = cipher_block_byte_size(Enc_method_rsa_1024_public);
-  } else if (in.key_type() == Enc_method_rsa_3072_private) {
-    alg_type = rsa_alg_type;
-    out->set_key_type(Enc_method_rsa_3072_public);
-    n_bytes = cipher_block_byte_size(Enc_method_rsa_3072_public);
-  } else if (in.key_type() == Enc_method_rsa_4096_private) {
-    alg_type = rsa_alg_type;
-    out->set_key_type(Enc_method_rsa_4096_public);
-    n_bytes = cipher_block_byte_size(Enc_method_rsa_4096_public);
-  } else if (in.key_type() == Enc_method_ecc_384_private) {
-    alg_type = ecc_alg_type;
-    out->set_key_type(Enc_method_ecc_384_public);
-    n_bytes = cipher_block_byte_size(Enc_method_ecc_384_public);
-  } else if (in.key_type() == Enc_method_ecc_256_private) {
-    alg_type = ecc_alg_type;
-    out->set_key_type(Enc_method_ecc_256_public);
-    n_bytes = cipher_block_byte_size(Enc_method_ecc_256_public);
-  } else {
-    printf("%s() error, line %d, private_key_to_public_key: bad key type "
-           "(n_bytes=%d)\n",
+  memcpy(out, iv, aead_nonce_size);
+  if (1
+      != EVP_EncryptUpdate(ctx, out + aead_nonce_size, &len, in, in_len)) {
+    printf("%s() error, line: %d, EVP_EncryptUpdate failed\n",
            __func__,
-           __LINE__,
-           n_bytes);
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  ciphertext_len = len;
+  if (1
+      != EVP_EncryptFinal_ex(ctx,
+                             out + aead_nonce_size + ciphertext_len,
+                             &len)) {
+    printf("%s() error, line: %d, EVP_EncryptFinal_ex failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  ciphertext_len += len;
+  if (1
+      != EVP_CIPHER_CTX_ctrl(ctx,
+                             EVP_CTRL_AEAD_GET_TAG,
+                             aead_tag_size,
+                             out + aead_nonce_size + ciphertext_len)) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  *out_size = aead_nonce_size + ciphertext_len + aead_tag_size;
+
+done:
+  EVP_CIPHER_CTX_free(ctx);
+  return ret;
+}
 
+static bool evp_aead_decrypt(const EVP_CIPHER *cipher,
+                             byte *            in,
+                             int               in_len,
+                             byte *            key,
+                             byte *            out,
+                             int *             out_size) {
+  if (cipher == nullptr) {
+    printf("%s() error, line: %d, cipher not available\n", __func__, __LINE__);
     return false;
   }
-
+  int stream_len = in_len - aead_nonce_size - aead_tag_size;
+  if (stream_len < 0 || *out_size < stream_len) {
+    printf("%s() error, line: %d, input too short or output too small\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  int             len = 0;
+  int             plaintext_len = 0;
+  bool            ret = true;
+  if (ctx == nullptr) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_new failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  // The tag goes in first: GCM-SIV checks it as it decrypts.
+  if (1 != EVP_DecryptInit_ex(ctx, cipher, nullptr, nullptr, nullptr)
+      || 1
+             != EVP_CIPHER_CTX_ctrl(ctx,
+                                    EVP_CTRL_AEAD_SET_IVLEN,
+                                    aead_nonce_size,
+                                    nullptr)
+      || 1 != EVP_DecryptInit_ex(ctx, nullptr, nullptr, key, in)
+      || 1
+             != EVP_CIPHER_CTX_ctrl(ctx,
+                                    EVP_CTRL_AEAD_SET_TAG,
+                                    aead_tag_size,
+                                    in + in_len - aead_tag_size)) {
+    printf("%s() error, line: %d, EVP_DecryptInit_ex failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (1
+      != EVP_DecryptUpdate(ctx,
+                           out,
+                           &len,
+                           in + aead_nonce_size,
+                           stream_len)) {
+    printf("%s() error, line: %d, EVP_DecryptUpdate failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  plaintext_len = len;
+  if (EVP_DecryptFinal_ex(ctx, out + plaintext_len, &len) <= 0) {
+    printf("%s() error, line: %d, EVP_DecryptFinal failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  *out_size = plaintext_len + len;
+
+done:
+  if (!ret)
+    OPENSSL_cleanse(out, stream_len);
+  EVP_CIPHER_CTX_free(ctx);
+  return ret;
+}
+
+bool chacha20_poly1305_encrypt(byte *in,
+                               int   in_len,
+                               byte *key,
+                               byte *iv,
+                               byte *out,
+                               int * out_size) {
+  return evp_aead_encrypt(EVP_chacha20_poly1305(),
+                          in,
+                          in_len,
+                          key,
+                          iv,
+                          out,
+                          out_size);
+}
+
+bool chacha20_poly1305_decrypt(byte *in,
+                               int   in_len,
+                               byte *key,
+                               byte *out,
+                               int * out_size) {
+  return evp_aead_decrypt(EVP_chacha20_poly1305(),
+                          in,
+                          in_len,
+                          key,
+                          out,
+                          out_size);
+}
+
+bool aes_256_gcm_siv_encrypt(byte *in,
+                             int   in_len,
+                             byte *key,
+                             byte *iv,
+                             byte *out,
+                             int * out_size) {
+  return evp_aead_encrypt(aes_256_gcm_siv_cipher(),
+                          in,
+                          in_len,
+                          key,
+                          iv,
+                          out,
+                          out_size);
+}
+
+bool aes_256_gcm_siv_decrypt(byte *in,
+                             int   in_len,
+                             byte *key,
+                             byte *out,
+                             int * out_size) {
+  return evp_aead_decrypt(aes_256_gcm_siv_cipher(),
+                          in,
+                          in_len,
+                          key,
+                          out,
+                          out_size);
+}
+
+// Without AES and carry-less multiply instructions AES-GCM is slower than
+// ChaCha20-Poly1305 and its table lookups leak timing.
+const char *certifier::utilities::preferred_authenticated_algorithm() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"))
+    return Enc_method_aes_256_gcm;
+#elif defined(__aarch64__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  if ((hwcap & HWCAP_AES) != 0 && (hwcap & HWCAP_PMULL) != 0)
+    return Enc_method_aes_256_gcm;
+#endif
+  return Enc_method_chacha20_poly1305;
+}
+
+bool certifier::utilities::authenticated_algorithm_available(
+    const char *alg_name) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  if (d == nullptr || d->aead_encrypt == nullptr)
+    return false;
+  return d->cipher == nullptr || d->cipher() != nullptr;
+}
+
+bool certifier::utilities::authenticated_encrypt(const char *alg_name,
+                                                 byte *      in,
+                                                 int         in_len,
+                                                 byte *      key,
+                                                 int         key_len,
+                                                 byte *      iv,
+                                                 int         iv_len,
+                                                 byte *      out,
+                                                 int *       out_size) {
+
+  const alg_descriptor *d = find_algorithm(alg_name);
+  if (d == nullptr || d->aead_encrypt == nullptr) {
+    printf("%s() error, line: %d, authenticated_encrypt: unsupported algorithm "
+           "%s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    return false;
+  }
+  if (d->key_size > key_len || d->iv_size > iv_len) {
+    printf("%s() error, line: %d, authenticated_encrypt: key or iv too short\n"
+           "%s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    return false;
+  }
+  return d->aead_encrypt(in, in_len, key, iv, out, out_size);
+}
+
+bool certifier::utilities::authenticated_decrypt(const char *alg_name,
+                                                 byte *      in,
+                                                 int         in_len,
+                                                 byte *      key,
+                                                 int         key_len,
+                                                 byte *      out,
+                                                 int *       out_size) {
+  const alg_descriptor *d = find_algorithm(alg_name);
+  if (d == nullptr || d->aead_decrypt == nullptr) {
+    printf("%s() error, line: %d, authenticated_decrypt: unsupported algorithm "
+           "%s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    return false;
+  }
+  if (d->key_size > key_len) {
+    printf("%s() error, line: %d, authenticated_decrypt: key length too short\n"
+           "%s\n",
+           __func__,
+           __LINE__,
+           alg_name);
+    return false;
+  }
+  return d->aead_decrypt(in, in_len, key, out, out_size);
+}
+
+// Streaming authenticated encryption
+// -----------------------------------------------------------------------
+
+certifier::utilities::aead_stream::aead_stream() {
+  alg_ = alg_unknown;
+  encrypt_ = false;
+  started_ = false;
+  ctx_ = EVP_CIPHER_CTX_new();
+  hmac_ = HMAC_CTX_new();
+  mac_size_ = 0;
+  use_hmac_ = false;
+  iv_size_ = 0;
+  iv_len_ = 0;
+  num_held_ = 0;
+}
+
+certifier::utilities::aead_stream::~aead_stream() {
+  if (ctx_ != nullptr)
+    EVP_CIPHER_CTX_free(ctx_);
+  if (hmac_ != nullptr)
+    HMAC_CTX_free(hmac_);
+  OPENSSL_cleanse(iv_, sizeof(iv_));
+  OPENSSL_cleanse(held_, sizeof(held_));
+}
+
+bool certifier::utilities::aead_stream::init(const char *alg,
+                                             byte *      key,
+                                             int         key_len,
+                                             bool        encrypt) {
+  alg_ = alg_unknown;
+  if (ctx_ == nullptr || hmac_ == nullptr) {
+    printf("%s() error, line: %d, no cipher context\n", __func__, __LINE__);
+    return false;
+  }
+  const alg_descriptor *d = find_algorithm(alg);
+  if (d == nullptr || d->aead_encrypt == nullptr
+      || d->id == alg_aes_256_gcm_siv) {
+    printf("%s() error, line: %d, unsupported algorithm %s\n",
+           __func__,
+           __LINE__,
+           alg);
+    return false;
+  }
+  int key_size = d->key_size;
+  if (key_size < 0 || key_size > key_len) {
+    printf("%s() error, line: %d, key length too short for %s\n",
+           __func__,
+           __LINE__,
+           alg);
+    return false;
+  }
+  const EVP_CIPHER *cipher = d->cipher();
+  const EVP_MD *    md = d->md == nullptr ? nullptr : d->md();
+
+  // Key now, iv once it is known.
+  int enc = encrypt ? 1 : 0;
+  if (1 != EVP_CipherInit_ex(ctx_, cipher, nullptr, nullptr, nullptr, enc)) {
+    printf("%s() error, line: %d, EVP_CipherInit_ex failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (md == nullptr
+      && 1
+             != EVP_CIPHER_CTX_ctrl(ctx_,
+                                    EVP_CTRL_AEAD_SET_IVLEN,
+                                    d->iv_size,
+                                    nullptr)) {
+    printf("%s() error, line: %d, EVP_CIPHER_CTX_ctrl failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (1 != EVP_CipherInit_ex(ctx_, nullptr, nullptr, key, nullptr, enc)) {
+    printf("%s() error, line: %d, EVP_CipherInit_ex failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  mac_size_ = d->mac_size;
+  use_hmac_ = md != nullptr;
+  iv_size_ = d->iv_size;
+  if (md != nullptr) {
+    // Same MAC key as aes_256_cbc_sha*_encrypt.
+    if (1 != HMAC_Init_ex(hmac_, &key[key_size / 2], mac_size_, md, nullptr)) {
+      printf("%s() error, line: %d, HMAC_Init_ex failed\n", __func__, __LINE__);
+      return false;
+    }
+  }
+
+  alg_ = d->id;
+  encrypt_ = encrypt;
+  started_ = false;
+  iv_len_ = 0;
+  num_held_ = 0;
+  return true;
+}
+
+bool certifier::utilities::aead_stream::start(byte *iv) {
+  int enc = encrypt_ ? 1 : 0;
+  if (1 != EVP_CipherInit_ex(ctx_, nullptr, nullptr, nullptr, iv, enc)) {
+    printf("%s() error, line: %d, EVP_CipherInit_ex failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (use_hmac_ && 1 != HMAC_Update(hmac_, iv, iv_size_)) {
+    printf("%s() error, line: %d, HMAC_Update failed\n", __func__, __LINE__);
+    return false;
+  }
+  started_ = true;
+  return true;
+}
+
+// MAC covers the iv and ciphertext, so it is fed ciphertext going either way.
+bool certifier::utilities::aead_stream::cipher_update(byte *in,
+                                                      int   in_len,
+                                                      byte *out,
+                                                      int * out_len) {
+  *out_len = 0;
+  if (in_len <= 0)
+    return true;
+  bool mac = use_hmac_;
+  if (mac && !encrypt_ && 1 != HMAC_Update(hmac_, in, in_len))
+    return false;
+  if (1 != EVP_CipherUpdate(ctx_, out, out_len, in, in_len)) {
+    printf("%s() error, line: %d, EVP_CipherUpdate failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (mac && encrypt_ && 1 != HMAC_Update(hmac_, out, *out_len))
+    return false;
+  return true;
+}
+
+bool certifier::utilities::aead_stream::init_encrypt(const char *alg,
+                                                     byte *      key,
+                                                     int         key_len,
+                                                     byte *      iv,
+                                                     int         iv_len) {
+  if (!init(alg, key, key_len, true))
+    return false;
+  if (iv == nullptr || iv_len < iv_size_) {
+    printf("%s() error, line: %d, iv too short\n", __func__, __LINE__);
+    alg_ = alg_unknown;
+    return false;
+  }
+  memcpy(iv_, iv, iv_size_);
+  iv_len_ = iv_size_;
+  return true;
+}
+
+bool certifier::utilities::aead_stream::init_decrypt(const char *alg,
+                                                     byte *      key,
+                                                     int         key_len) {
+  return init(alg, key, key_len, false);
+}
+
+bool certifier::utilities::aead_stream::update(byte *in,
+                                               int   in_len,
+                                               byte *out,
+                                               int * out_size) {
+  if (alg_ == alg_unknown || in_len < 0 || *out_size < in_len + max_expansion) {
+    printf("%s() error, line: %d, not initialized or output too small\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  int written = 0;
+  int n = 0;
+
+  if (encrypt_) {
+    if (!started_) {
+      if (!start(iv_))
+        return false;
+      memcpy(out, iv_, iv_size_);
+      written = iv_size_;
+    }
+    if (!cipher_update(in, in_len, out + written, &n))
+      return false;
+    *out_size = written + n;
+    return true;
+  }
+
+  // Decrypt: the stream starts with the iv ...
+  if (!started_) {
+    int k = iv_size_ - iv_len_;
+    if (k > in_len)
+      k = in_len;
+    memcpy(iv_ + iv_len_, in, k);
+    iv_len_ += k;
+    in += k;
+    in_len -= k;
+    if (iv_len_ < iv_size_) {
+      *out_size = 0;
+      return true;
+    }
+    if (!start(iv_))
+      return false;
+  }
+
+  // ... and ends with the tag, so hold back the last mac_size_ bytes.
+  int total = num_held_ + in_len;
+  if (total <= mac_size_) {
+    memcpy(held_ + num_held_, in, in_len);
+    num_held_ = total;
+    *out_size = 0;
+    return true;
+  }
+  int release = total - mac_size_;
+  int from_held = release < num_held_ ? release : num_held_;
+  if (!cipher_update(held_, from_held, out, &n))
+    return false;
+  written = n;
+  int from_in = release - from_held;
+  if (!cipher_update(in, from_in, out + written, &n))
+    return false;
+  written += n;
+
+  int keep = num_held_ - from_held;
+  memmove(held_, held_ + from_held, keep);
+  memcpy(held_ + keep, in + from_in, in_len - from_in);
+  num_held_ = mac_size_;
+  *out_size = written;
+  return true;
+}
+
+bool certifier::utilities::aead_stream::final(byte *out, int *out_size) {
+  if (alg_ == alg_unknown || *out_size < max_expansion) {
+    printf("%s() error, line: %d, not initialized or output too small\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  bool ret = true;
+  int  written = 0;
+  int  n = 0;
+  byte mac[EVP_MAX_MD_SIZE];
+  unsigned int mac_len = 0;
+
+  if (encrypt_) {
+    if (!started_) {
+      if (!start(iv_)) {
+        ret = false;
+        goto done;
+      }
+      memcpy(out, iv_, iv_size_);
+      written = iv_size_;
+    }
+    if (1 != EVP_CipherFinal_ex(ctx_, out + written, &n)) {
+      printf("%s() error, line: %d, EVP_CipherFinal_ex failed\n",
+             __func__,
+             __LINE__);
+      ret = false;
+      goto done;
+    }
+    if (!use_hmac_) {
+      written += n;
+      if (1
+          != EVP_CIPHER_CTX_ctrl(ctx_,
+                                 EVP_CTRL_AEAD_GET_TAG,
+                                 mac_size_,
+                                 out + written)) {
+        ret = false;
+        goto done;
+      }
+    } else {
+      if (1 != HMAC_Update(hmac_, out + written, n)) {
+        ret = false;
+        goto done;
+      }
+      written += n;
+      if (1 != HMAC_Final(hmac_, out + written, &mac_len)) {
+        ret = false;
+        goto done;
+      }
+    }
+    written += mac_size_;
+    goto done;
+  }
+
+  if (!started_ || num_held_ != mac_size_) {
+    printf("%s() error, line: %d, truncated input\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (!use_hmac_) {
+    if (1
+        != EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_SET_TAG, mac_size_, held_)) {
+      ret = false;
+      goto done;
+    }
+  } else {
+    if (1 != HMAC_Final(hmac_, mac, &mac_len)
+        || CRYPTO_memcmp(mac, held_, mac_size_) != 0) {
+      printf("%s() error, line: %d, HMAC failed\n", __func__, __LINE__);
+      ret = false;
+      goto done;
+    }
+  }
+  if (1 != EVP_CipherFinal_ex(ctx_, out, &n)) {
+    printf("%s() error, line: %d, EVP_CipherFinal_ex failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  written = n;
+
+done:
+  // Another message needs another init.
+  alg_ = alg_unknown;
+  *out_size = ret ? written : 0;
+  return ret;
+}
+
+// Full-length write; short writes happen on pipes and network filesystems.
+static bool write_all(int fd, const byte *buf, int len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool aead_stream_file(certifier::utilities::aead_stream &s,
+                             const string &                     in_file,
+                             const string &                     out_file) {
+  const int         buf_size = 1 << 20;
+  std::vector<byte> in_buf(buf_size);
+  std::vector<byte> out_buf(buf_size + aead_stream::max_expansion);
+  string            tmp_file = out_file + ".partial";
+  bool              ret = true;
+  int               out_size = 0;
+
+  int in = open(in_file.c_str(), O_RDONLY);
+  if (in < 0) {
+    printf("%s() error, line: %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           in_file.c_str());
+    return false;
+  }
+  int out = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out < 0) {
+    printf("%s() error, line: %d, can't create %s\n",
+           __func__,
+           __LINE__,
+           tmp_file.c_str());
+    close(in);
+    return false;
+  }
+
+  while (1) {
+    ssize_t n = read(in, in_buf.data(), buf_size);
+    if (n < 0) {
+      ret = false;
+      goto done;
+    }
+    if (n == 0)
+      break;
+    out_size = (int)out_buf.size();
+    if (!s.update(in_buf.data(), (int)n, out_buf.data(), &out_size)
+        || !write_all(out, out_buf.data(), out_size)) {
+      ret = false;
+      goto done;
+    }
+  }
+  out_size = (int)out_buf.size();
+  if (!s.final(out_buf.data(), &out_size)
+      || !write_all(out, out_buf.data(), out_size)) {
+    ret = false;
+    goto done;
+  }
+
+done:
+  close(in);
+  if (close(out) != 0)
+    ret = false;
+  if (ret && rename(tmp_file.c_str(), out_file.c_str()) != 0) {
+    printf("%s() error, line: %d, can't rename to %s\n",
+           __func__,
+           __LINE__,
+           out_file.c_str());
+    ret = false;
+  }
+  if (!ret)
+    unlink(tmp_file.c_str());
+  return ret;
+}
+
+bool certifier::utilities::authenticated_encrypt_file(const char *  alg,
+                                                      byte *        key,
+                                                      int           key_len,
+                                                      const string &in_file,
+                                                      const string &out_file) {
+  byte iv[block_size];
+  if (!get_random(num_bits_in_byte * block_size, iv)) {
+    printf("%s() error, line: %d, can't get iv\n", __func__, __LINE__);
+    return false;
+  }
+  aead_stream s;
+  if (!s.init_encrypt(alg, key, key_len, iv, block_size))
+    return false;
+  return aead_stream_file(s, in_file, out_file);
+}
+
+bool certifier::utilities::authenticated_decrypt_file(const char *  alg,
+                                                      byte *        key,
+                                                      int           key_len,
+                                                      const string &in_file,
+                                                      const string &out_file) {
+  aead_stream s;
+  if (!s.init_decrypt(alg, key, key_len))
+    return false;
+  return aead_stream_file(s, in_file, out_file);
+}
+
+// Chunked authenticated encryption
+// -----------------------------------------------------------------------
+
+const byte chunked_aead_magic[4] = {'C', 'C', 'A', 'E'};
+const int  chunked_aead_version = 1;
+const int  chunked_aead_key_size = 32;
+const int  chunked_aead_nonce_size = 12;
+const int  chunked_aead_salt_size = 16;
+const int  chunked_aead_default_chunk = 1 << 20;
+const int  chunked_aead_max_chunk = 1 << 30;
+
+static void put_big_endian(byte *p, uint64_t v, int n) {
+  for (int i = n - 1; i >= 0; i--) {
+    p[i] = (byte)(v & 0xff);
+    v >>= 8;
+  }
+}
+
+static uint64_t get_big_endian(const byte *p, int n) {
+  uint64_t v = 0;
+  for (int i = 0; i < n; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+// Everything both directions need to find and seal a chunk.
+struct chunked_layout {
+  byte     header[certifier::utilities::chunked_aead_header_size];
+  uint64_t chunk_size;
+  uint64_t plain_size;
+  uint64_t num_chunks;
+  byte     enc_key[chunked_aead_key_size];
+  byte     mac_key[chunked_aead_key_size];
+
+  chunked_layout() { memset(this, 0, sizeof(*this)); }
+  ~chunked_layout() {
+    OPENSSL_cleanse(enc_key, sizeof(enc_key));
+    OPENSSL_cleanse(mac_key, sizeof(mac_key));
+  }
+
+  uint64_t plain_offset(uint64_t i) const { return i * chunk_size; }
+  uint64_t sealed_offset(uint64_t i) const {
+    return certifier::utilities::chunked_aead_header_size
+           + i * (chunk_size + certifier::utilities::chunked_aead_tag_size);
+  }
+  int plain_len(uint64_t i) const {
+    if (i + 1 < num_chunks)
+      return (int)chunk_size;
+    return (int)(plain_size - plain_offset(i));
+  }
+  uint64_t container_size() const {
+    return certifier::utilities::chunked_aead_header_size + plain_size
+           + num_chunks * certifier::utilities::chunked_aead_tag_size
+           + certifier::utilities::chunked_aead_mac_size;
+  }
+  uint64_t mac_offset() const {
+    return container_size() - certifier::utilities::chunked_aead_mac_size;
+  }
+};
+
+// Per-file keys, so chunk indices can serve as nonces.
+static bool chunked_derive_keys(byte *key, int key_len, chunked_layout *l) {
+  if (key == nullptr || key_len < chunked_aead_key_size) {
+    printf("%s() error, line: %d, key too short\n", __func__, __LINE__);
+    return false;
+  }
+  const byte *salt = &l->header[24];
+  byte        info[chunked_aead_salt_size + 1];
+  memcpy(info, salt, chunked_aead_salt_size);
+  unsigned int len = chunked_aead_key_size;
+
+  info[chunked_aead_salt_size] = 1;
+  if (HMAC(EVP_sha256(),
+           key,
+           chunked_aead_key_size,
+           info,
+           sizeof(info),
+           l->enc_key,
+           &len)
+      == nullptr)
+    return false;
+  info[chunked_aead_salt_size] = 2;
+  len = chunked_aead_key_size;
+  if (HMAC(EVP_sha256(),
+           key,
+           chunked_aead_key_size,
+           info,
+           sizeof(info),
+           l->mac_key,
+           &len)
+      == nullptr)
+    return false;
+  return true;
+}
+
+static void chunked_set_sizes(chunked_layout *l) {
+  if (l->plain_size == 0)
+    l->num_chunks = 1;
+  else
+    l->num_chunks = (l->plain_size + l->chunk_size - 1) / l->chunk_size;
+}
+
+static bool chunked_new_layout(byte *          key,
+                               int             key_len,
+                               uint64_t        plain_size,
+                               int             chunk_size,
+                               chunked_layout *l) {
+  if (chunk_size <= 0)
+    chunk_size = chunked_aead_default_chunk;
+  if (chunk_size > chunked_aead_max_chunk) {
+    printf("%s() error, line: %d, chunk size %d too large\n",
+           __func__,
+           __LINE__,
+           chunk_size);
+    return false;
+  }
+  l->chunk_size = chunk_size;
+  l->plain_size = plain_size;
+  chunked_set_sizes(l);
+
+  memcpy(l->header, chunked_aead_magic, sizeof(chunked_aead_magic));
+  put_big_endian(&l->header[4], chunked_aead_version, 4);
+  put_big_endian(&l->header[8], l->chunk_size, 4);
+  put_big_endian(&l->header[12], 0, 4);
+  put_big_endian(&l->header[16], l->plain_size, 8);
+  if (!certifier::utilities::get_random(
+          num_bits_in_byte * chunked_aead_salt_size,
+          &l->header[24])) {
+    printf("%s() error, line: %d, can't get salt\n", __func__, __LINE__);
+    return false;
+  }
+  return chunked_derive_keys(key, key_len, l);
+}
+
+static bool chunked_read_layout(byte *          key,
+                                int             key_len,
+                                const byte *    header,
+                                uint64_t        container_size,
+                                chunked_layout *l) {
+  if (container_size < (uint64_t)certifier::utilities::chunked_aead_header_size
+      || memcmp(header, chunked_aead_magic, sizeof(chunked_aead_magic)) != 0
+      || get_big_endian(&header[4], 4) != chunked_aead_version) {
+    printf("%s() error, line: %d, not a chunked container\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  memcpy(l->header, header, sizeof(l->header));
+  l->chunk_size = get_big_endian(&header[8], 4);
+  l->plain_size = get_big_endian(&header[16], 8);
+  if (l->chunk_size == 0 || l->chunk_size > (uint64_t)chunked_aead_max_chunk
+      || l->plain_size > container_size) {
+    printf("%s() error, line: %d, bad container header\n", __func__, __LINE__);
+    return false;
+  }
+  chunked_set_sizes(l);
+  if (l->container_size() != container_size) {
+    printf("%s() error, line: %d, container is %llu bytes, expected %llu\n",
+           __func__,
+           __LINE__,
+           (unsigned long long)container_size,
+           (unsigned long long)l->container_size());
+    return false;
+  }
+  return chunked_derive_keys(key, key_len, l);
+}
+
+// The per-file key is set once per context; each chunk only resets the
+// nonce.  The header is in every chunk's aad, so a chunk can't be moved
+// to another container, and the last flag stops truncation at a chunk
+// boundary.
+static bool chunked_start_chunk(EVP_CIPHER_CTX *      ctx,
+                                const chunked_layout &l,
+                                uint64_t              index) {
+  byte nonce[chunked_aead_nonce_size];
+  memset(nonce, 0, sizeof(nonce));
+  put_big_endian(&nonce[4], index, 8);
+  if (1 != EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, -1))
+    return false;
+
+  byte aad[certifier::utilities::chunked_aead_header_size + 9];
+  memcpy(aad, l.header, sizeof(l.header));
+  put_big_endian(&aad[sizeof(l.header)], index, 8);
+  aad[sizeof(aad) - 1] = (index + 1 == l.num_chunks) ? 1 : 0;
+  int n = 0;
+  if (1 != EVP_CipherUpdate(ctx, nullptr, &n, aad, sizeof(aad)))
+    return false;
+  return true;
+}
+
+static bool chunked_seal(EVP_CIPHER_CTX *      ctx,
+                         const chunked_layout &l,
+                         uint64_t              index,
+                         const byte *          in,
+                         byte *                out,
+                         byte *                tag) {
+  int len = l.plain_len(index);
+  int n = 0;
+  if (!chunked_start_chunk(ctx, l, index))
+    return false;
+  if (len > 0 && 1 != EVP_CipherUpdate(ctx, out, &n, in, len))
+    return false;
+  if (1 != EVP_CipherFinal_ex(ctx, out + n, &n))
+    return false;
+  if (1
+      != EVP_CIPHER_CTX_ctrl(ctx,
+                             EVP_CTRL_GCM_GET_TAG,
+                             certifier::utilities::chunked_aead_tag_size,
+                             tag))
+    return false;
+  return true;
+}
+
+static bool chunked_open(EVP_CIPHER_CTX *      ctx,
+                         const chunked_layout &l,
+                         uint64_t              index,
+                         const byte *          in,
+                         const byte *          tag,
+                         byte *                out) {
+  int  len = l.plain_len(index);
+  int  n = 0;
+  byte expected[certifier::utilities::chunked_aead_tag_size];
+  memcpy(expected, tag, sizeof(expected));
+  if (!chunked_start_chunk(ctx, l, index))
+    return false;
+  if (len > 0 && 1 != EVP_CipherUpdate(ctx, out, &n, in, len))
+    return false;
+  if (1
+      != EVP_CIPHER_CTX_ctrl(ctx,
+                             EVP_CTRL_GCM_SET_TAG,
+                             sizeof(expected),
+                             expected))
+    return false;
+  if (1 != EVP_CipherFinal_ex(ctx, out + n, &n)) {
+    printf("%s() error, line: %d, chunk %llu failed authentication\n",
+           __func__,
+           __LINE__,
+           (unsigned long long)index);
+    return false;
+  }
+  return true;
+}
+
+static EVP_CIPHER_CTX *chunked_new_context(const chunked_layout &l,
+                                           bool                  encrypt) {
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  if (ctx == nullptr)
+    return nullptr;
+  if (1
+      != EVP_CipherInit_ex(ctx,
+                           EVP_aes_256_gcm(),
+                           nullptr,
+                           l.enc_key,
+                           nullptr,
+                           encrypt ? 1 : 0)) {
+    EVP_CIPHER_CTX_free(ctx);
+    return nullptr;
+  }
+  return ctx;
+}
+
+// Hands chunks out to worker threads, each with its own cipher context,
+// until they run out or one fails.
+static bool chunked_run(const chunked_layout &l,
+                        bool                  encrypt,
+                        int                   num_threads,
+                        const std::function<bool(EVP_CIPHER_CTX *, uint64_t)>
+                            &do_chunk) {
+  std::atomic<uint64_t> next(0);
+  std::atomic<bool>     ok(true);
+  auto                  worker = [&]() {
+    EVP_CIPHER_CTX *ctx = chunked_new_context(l, encrypt);
+    if (ctx == nullptr) {
+      ok = false;
+      return;
+    }
+    while (ok) {
+      uint64_t i = next++;
+      if (i >= l.num_chunks)
+        break;
+      if (!do_chunk(ctx, i))
+        ok = false;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+  };
+  run_workers(num_threads, l.num_chunks, worker);
+  return ok;
+}
+
+// The index: header and every chunk tag, in order.
+static bool chunked_index_mac(const chunked_layout &   l,
+                              const std::vector<byte> &tags,
+                              byte *                   mac) {
+  std::vector<byte> data(sizeof(l.header) + tags.size());
+  memcpy(data.data(), l.header, sizeof(l.header));
+  memcpy(data.data() + sizeof(l.header), tags.data(), tags.size());
+  unsigned int len = certifier::utilities::chunked_aead_mac_size;
+  return HMAC(EVP_sha256(),
+              l.mac_key,
+              sizeof(l.mac_key),
+              data.data(),
+              data.size(),
+              mac,
+              &len)
+         != nullptr;
+}
+
+static bool chunked_check_index(const chunked_layout &   l,
+                                const std::vector<byte> &tags,
+                                const byte *             mac) {
+  byte computed[certifier::utilities::chunked_aead_mac_size];
+  if (!chunked_index_mac(l, tags, computed))
+    return false;
+  if (CRYPTO_memcmp(computed, mac, sizeof(computed)) != 0) {
+    printf("%s() error, line: %d, index failed authentication\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+bool certifier::utilities::chunked_aead_encrypt(byte *        key,
+                                                int           key_len,
+                                                const string &in,
+                                                int           chunk_size,
+                                                int           num_threads,
+                                                string *      out) {
+  chunked_layout l;
+  if (!chunked_new_layout(key, key_len, in.size(), chunk_size, &l))
+    return false;
+
+  out->assign(l.container_size(), 0);
+  byte *            dst = (byte *)&(*out)[0];
+  const byte *      src = (const byte *)in.data();
+  std::vector<byte> tags(l.num_chunks * chunked_aead_tag_size);
+  memcpy(dst, l.header, sizeof(l.header));
+
+  auto seal_one = [&](EVP_CIPHER_CTX *ctx, uint64_t i) {
+    byte *sealed = dst + l.sealed_offset(i);
+    byte *tag = sealed + l.plain_len(i);
+    if (!chunked_seal(ctx, l, i, src + l.plain_offset(i), sealed, tag))
+      return false;
+    memcpy(&tags[i * chunked_aead_tag_size], tag, chunked_aead_tag_size);
+    return true;
+  };
+  if (!chunked_run(l, true, num_threads, seal_one)
+      || !chunked_index_mac(l, tags, dst + l.mac_offset())) {
+    printf("%s() error, line: %d, can't seal chunks\n", __func__, __LINE__);
+    out->clear();
+    return false;
+  }
+  return true;
+}
+
+bool certifier::utilities::chunked_aead_decrypt(byte *        key,
+                                                int           key_len,
+                                                const string &in,
+                                                int           num_threads,
+                                                string *      out) {
+  chunked_layout l;
+  const byte *   src = (const byte *)in.data();
+  if (in.size() < (size_t)chunked_aead_header_size
+      || !chunked_read_layout(key, key_len, src, in.size(), &l))
+    return false;
+
+  // The tags are all in hand, so check the index before any decryption.
+  std::vector<byte> tags(l.num_chunks * chunked_aead_tag_size);
+  for (uint64_t i = 0; i < l.num_chunks; i++) {
+    memcpy(&tags[i * chunked_aead_tag_size],
+           src + l.sealed_offset(i) + l.plain_len(i),
+           chunked_aead_tag_size);
+  }
+  if (!chunked_check_index(l, tags, src + l.mac_offset()))
+    return false;
+
+  out->assign(l.plain_size, 0);
+  byte *dst = l.plain_size > 0 ? (byte *)&(*out)[0] : nullptr;
+  auto  open_one = [&](EVP_CIPHER_CTX *ctx, uint64_t i) {
+    const byte *sealed = src + l.sealed_offset(i);
+    return chunked_open(ctx,
+                        l,
+                        i,
+                        sealed,
+                        sealed + l.plain_len(i),
+                        dst + l.plain_offset(i));
+  };
+  if (!chunked_run(l, false, num_threads, open_one)) {
+    OPENSSL_cleanse(dst, l.plain_size);
+    out->clear();
+    return false;
+  }
+  return true;
+}
+
+bool certifier::utilities::chunked_aead_decrypt_chunk(byte *        key,
+                                                      int           key_len,
+                                                      const string &in,
+                                                      uint64_t      index,
+                                                      string *      out) {
+  chunked_layout l;
+  const byte *   src = (const byte *)in.data();
+  if (in.size() < (size_t)chunked_aead_header_size
+      || !chunked_read_layout(key, key_len, src, in.size(), &l))
+    return false;
+  if (index >= l.num_chunks) {
+    printf("%s() error, line: %d, no chunk %llu\n",
+           __func__,
+           __LINE__,
+           (unsigned long long)index);
+    return false;
+  }
+
+  EVP_CIPHER_CTX *ctx = chunked_new_context(l, false);
+  if (ctx == nullptr)
+    return false;
+  out->assign(l.plain_len(index), 0);
+  const byte *sealed = src + l.sealed_offset(index);
+  bool        ret = chunked_open(ctx,
+                          l,
+                          index,
+                          sealed,
+                          sealed + l.plain_len(index),
+                          (byte *)&(*out)[0]);
+  EVP_CIPHER_CTX_free(ctx);
+  if (!ret)
+    out->clear();
+  return ret;
+}
+
+static bool pread_all(int fd, byte *buf, uint64_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pread(fd, buf, len, offset);
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+static bool pwrite_all(int fd, const byte *buf, uint64_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+static bool chunked_aead_file(byte *        key,
+                              int           key_len,
+                              const string &in_file,
+                              const string &out_file,
+                              int           chunk_size,
+                              int           num_threads,
+                              bool          encrypt) {
+  chunked_layout    l;
+  std::vector<byte> tags;
+  byte              mac[certifier::utilities::chunked_aead_mac_size];
+  string            tmp_file = out_file + ".partial";
+  bool              ret = true;
+  struct stat       st;
+  int               out = -1;
+
+  int in = open(in_file.c_str(), O_RDONLY);
+  if (in < 0 || fstat(in, &st) != 0) {
+    printf("%s() error, line: %d, can't open %s\n",
+           __func__,
+           __LINE__,
+           in_file.c_str());
+    if (in >= 0)
+      close(in);
+    return false;
+  }
+  if (encrypt) {
+    if (!chunked_new_layout(key, key_len, st.st_size, chunk_size, &l)) {
+      close(in);
+      return false;
+    }
+  } else {
+    byte header[certifier::utilities::chunked_aead_header_size];
+    if ((uint64_t)st.st_size < sizeof(header)
+        || !pread_all(in, header, sizeof(header), 0)
+        || !chunked_read_layout(key, key_len, header, st.st_size, &l)) {
+      close(in);
+      return false;
+    }
+  }
+  tags.resize(l.num_chunks * certifier::utilities::chunked_aead_tag_size);
+
+  out = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out < 0) {
+    printf("%s() error, line: %d, can't create %s\n",
+           __func__,
+           __LINE__,
+           tmp_file.c_str());
+    close(in);
+    return false;
+  }
+
+  if (encrypt) {
+    auto seal_one = [&](EVP_CIPHER_CTX *ctx, uint64_t i) {
+      int               len = l.plain_len(i);
+      std::vector<byte> buf(len);
+      std::vector<byte> sealed(len + certifier::utilities::chunked_aead_tag_size);
+      if (!pread_all(in, buf.data(), len, l.plain_offset(i)))
+        return false;
+      if (!chunked_seal(ctx, l, i, buf.data(), sealed.data(), &sealed[len]))
+        return false;
+      memcpy(&tags[i * certifier::utilities::chunked_aead_tag_size],
+             &sealed[len],
+             certifier::utilities::chunked_aead_tag_size);
+      return pwrite_all(out, sealed.data(), sealed.size(), l.sealed_offset(i));
+    };
+    if (!pwrite_all(out, l.header, sizeof(l.header), 0)
+        || !chunked_run(l, true, num_threads, seal_one)
+        || !chunked_index_mac(l, tags, mac)
+        || !pwrite_all(out, mac, sizeof(mac), l.mac_offset())) {
+      ret = false;
+      goto done;
+    }
+  } else {
+    auto open_one = [&](EVP_CIPHER_CTX *ctx, uint64_t i) {
+      int               len = l.plain_len(i);
+      std::vector<byte> sealed(len + certifier::utilities::chunked_aead_tag_size);
+      std::vector<byte> buf(len);
+      if (!pread_all(in, sealed.data(), sealed.size(), l.sealed_offset(i)))
+        return false;
+      memcpy(&tags[i * certifier::utilities::chunked_aead_tag_size],
+             &sealed[len],
+             certifier::utilities::chunked_aead_tag_size);
+      if (!chunked_open(ctx, l, i, sealed.data(), &sealed[len], buf.data()))
+        return false;
+      return pwrite_all(out, buf.data(), len, l.plain_offset(i));
+    };
+    // Every chunk is checked as it is opened; the index is checked once
+    // all tags have been seen, before the output is renamed into place.
+    if (!chunked_run(l, false, num_threads, open_one)
+        || !pread_all(in, mac, sizeof(mac), l.mac_offset())
+        || !chunked_check_index(l, tags, mac)) {
+      ret = false;
+      goto done;
+    }
+  }
+
+done:
+  close(in);
+  if (close(out) != 0)
+    ret = false;
+  if (ret && rename(tmp_file.c_str(), out_file.c_str()) != 0) {
+    printf("%s() error, line: %d, can't rename to %s\n",
+           __func__,
+           __LINE__,
+           out_file.c_str());
+    ret = false;
+  }
+  if (!ret)
+    unlink(tmp_file.c_str());
+  return ret;
+}
+
+bool certifier::utilities::chunked_aead_encrypt_file(byte *        key,
+                                                     int           key_len,
+                                                     const string &in_file,
+                                                     const string &out_file,
+                                                     int           chunk_size,
+                                                     int num_threads) {
+  return chunked_aead_file(key,
+                           key_len,
+                           in_file,
+                           out_file,
+                           chunk_size,
+                           num_threads,
+                           true);
+}
+
+bool certifier::utilities::chunked_aead_decrypt_file(byte *        key,
+                                                     int           key_len,
+                                                     const string &in_file,
+                                                     const string &out_file,
+                                                     int num_threads) {
+  return chunked_aead_file(key,
+                           key_len,
+                           in_file,
+                           out_file,
+                           0,
+                           num_threads,
+                           false);
+}
+
+bool certifier::utilities::private_key_to_public_key(const key_message &in,
+                                                     key_message *      out) {
+
+  const alg_descriptor *d = find_algorithm(in.key_type());
+  if (d == nullptr || d->cls != alg_class_key || d->public_key == d->id) {
+    printf("%s() error, line %d, private_key_to_public_key: bad key type\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  int alg_type = d->pkey_type;
+  out->set_key_type(algorithm_by_id(d->public_key)->name);
+
   out->set_key_name(in.key_name());
   out->set_key_format(in.key_format());
   out->set_not_before(in.not_before());
   out->set_not_after(in.not_after());
   out->set_certificate(in.certificate().data(), in.certificate().size());
 
-  if (alg_type == rsa_alg_type) {
+  if (alg_type == EVP_PKEY_RSA) {
     rsa_message *rk = new rsa_message;
     rk->set_public_modulus(in.rsa_key().public_modulus().data(),
                            in.rsa_key().public_modulus().size());
@@ -1213,7 +2849,7 @@ bool      certifier::utilities::private_key_to_public_key(const key_message &in,
                             in.rsa_key().public_exponent().size());
     out->set_allocated_rsa_key(rk);
     return true;
-  } else if (alg_type == ecc_alg_type) {
+  } else if (alg_type == EVP_PKEY_EC) {
     ecc_message *ek = new ecc_message;
     ek->CopyFrom(in.ecc_key());
     ek->mutable_private_multiplier()->clear();
@@ -1333,208 +2969,126 @@ bool rsa_sign(const char *alg,
               int *       sig_size,
               byte *      sig) {
 
-  EVP_PKEY *private_key = EVP_PKEY_new();
-  if (private_key == nullptr) {
-    printf("%s() error, line: %d, rsa_sign: EVP_PKEY_new failed\n",
+  const EVP_MD *md = digest_md(alg);
+  if (md == nullptr) {
+    printf("%s() error, line: %d, rsa_sign: unsuported digest\n",
            __func__,
            __LINE__);
     return false;
   }
-  EVP_PKEY_assign_RSA(private_key, key);
 
-  EVP_MD_CTX *sign_ctx = EVP_MD_CTX_create();
+  // The caller keeps its reference to key.
+  bool        ret = true;
+  size_t      t = *sig_size;
+  EVP_MD_CTX *sign_ctx = nullptr;
+  EVP_PKEY *  private_key = EVP_PKEY_new();
+  if (private_key == nullptr || 1 != EVP_PKEY_set1_RSA(private_key, key)) {
+    printf("%s() error, line: %d, rsa_sign: EVP_PKEY_new failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+
+  sign_ctx = EVP_MD_CTX_create();
   if (sign_ctx == nullptr) {
     printf("%s() error, line: %d, rsa_sign: EVP_MD_CTX_create() failed\n",
            __func__,
            __LINE__);
-    return false;
+    ret = false;
+    goto done;
   }
 
-  unsigned int size_digest = 0;
-  if (strcmp(Digest_method_sha_256, alg) == 0) {
-    if (EVP_DigestSignInit(sign_ctx,
-                           nullptr,
-                           EVP_sha256(),
-                           nullptr,
-                           private_key)
-        <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    size_t t = *sig_size;
-    if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    *sig_size = t;
-  } else if (strcmp(Digest_method_sha_384, alg) == 0) {
-    if (EVP_DigestSignInit(sign_ctx,
-                           nullptr,
-                           EVP_sha384(),
-                           nullptr,
-                           private_key)
-        <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    size_t t = *sig_size;
-    if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
-      printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    *sig_size = t;
-  } else {
-    printf("%s() error, line: %d, rsa_sign: unsuported digest\n",
+  if (EVP_DigestSignInit(sign_ctx, nullptr, md, nullptr, private_key) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignInit() failed\n",
            __func__,
            __LINE__);
-    return false;
+    ret = false;
+    goto done;
   }
-  EVP_MD_CTX_destroy(sign_ctx);
-
-  return true;
-}
-
-bool rsa_verify(const char *alg,
-                RSA *       key,
-                int         size,
-                byte *      msg,
-                int         sig_size,
-                byte *      sig) {
-
-  if (strcmp(Digest_method_sha_256, alg) == 0) {
-    unsigned int size_digest = digest_output_byte_size(Digest_method_sha_256);
-    byte         digest[size_digest];
-    memset(digest, 0, size_digest);
-
-    if (!digest_message(Digest_method_sha_256,
-                        (const byte *)msg,
-                        size,
-                        digest,
-                        size_digest)) {
-      printf("%s() error, line: %d, rsa_verify: digest_message failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int  size_decrypted = RSA_size(key);
-    byte decrypted[size_decrypted];
-    memset(decrypted, 0, size_decrypted);
-    int n = RSA_public_encrypt(sig_size, sig, decrypted, key, RSA_NO_PADDING);
-    if (n < 0) {
-      printf("%s() error, line: %d, rsa_verify: RSA_public_encrypt failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    if (memcmp(digest, &decrypted[n - size_digest], size_digest) != 0) {
-      printf("%s() error, line: %d, rsa_verify: digests don't match\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
+  if (EVP_DigestSignUpdate(sign_ctx, msg, size) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignUpdate() failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (EVP_DigestSignFinal(sign_ctx, sig, &t) <= 0) {
+    printf("%s() error, line: %d, rsa_sign: EVP_DigestSignFinal() failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  *sig_size = t;
 
-    const int check_size = 16;
-    byte      check_buf[16] = {
-        0x00,
-        0x01,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-    };
-    if (memcmp(check_buf, decrypted, check_size) != 0) {
-      printf("%s() error, line: %d, rsa_verify: Bad header\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    return memcmp(digest, &decrypted[n - size_digest], size_digest) == 0;
-  } else if (strcmp(Digest_method_sha_384, alg) == 0) {
-    unsigned int size_digest = digest_output_byte_size(Digest_method_sha_384);
-    byte         digest[size_digest];
-    memset(digest, 0, size_digest);
-    if (!digest_message(Digest_method_sha_384,
-                        (const byte *)msg,
-                        size,
-                        digest,
-                        size_digest)) {
-      printf("%s() error, line: %d, digest_message failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    int  size_decrypted = RSA_size(key);
-    byte decrypted[size_decrypted];
-    memset(decrypted, 0, size_decrypted);
-    int n = RSA_public_encrypt(sig_size, sig, decrypted, key, RSA_NO_PADDING);
-    if (n < 0) {
-      printf("%s() error, line: %d, rsa_verify: RSA_public_encrypt failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    const int check_size = 16;
-    byte      check_buf[16] = {
-        0x00,
-        0x01,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-        0xff,
-    };
-    if (memcmp(check_buf, decrypted, check_size) != 0) {
-      printf("%s() error, line: %d, rsa_verify: Bad header\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    return memcmp(digest, &decrypted[n - size_digest], size_digest) == 0;
-  } else {
+done:
+  if (sign_ctx != nullptr)
+    EVP_MD_CTX_destroy(sign_ctx);
+  if (private_key != nullptr)
+    EVP_PKEY_free(private_key);
+  return ret;
+}
+
+bool rsa_verify(const char *alg,
+                RSA *       key,
+                int         size,
+                byte *      msg,
+                int         sig_size,
+                byte *      sig) {
+
+  int size_digest = digest_output_byte_size(alg);
+  if (digest_md(alg) == nullptr || size_digest <= 0) {
     printf("%s() error, line: %d, rsa_verify: unsupported digest\n",
            __func__,
            __LINE__);
     return false;
   }
+  byte digest[size_digest];
+  memset(digest, 0, size_digest);
+  if (!digest_message(alg, (const byte *)msg, size, digest, size_digest)) {
+    printf("%s() error, line: %d, rsa_verify: digest_message failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  int  size_decrypted = RSA_size(key);
+  byte decrypted[size_decrypted];
+  memset(decrypted, 0, size_decrypted);
+  int n = RSA_public_encrypt(sig_size, sig, decrypted, key, RSA_NO_PADDING);
+  if (n < size_digest) {
+    printf("%s() error, line: %d, rsa_verify: RSA_public_encrypt failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  const int check_size = 16;
+  byte      check_buf[16] = {
+      0x00,
+      0x01,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+      0xff,
+  };
+  if (memcmp(check_buf, decrypted, check_size) != 0) {
+    printf("%s() error, line: %d, rsa_verify: Bad header\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return memcmp(digest, &decrypted[n - size_digest], size_digest) == 0;
 }
 
 bool generate_new_rsa_key(int num_bits, RSA *r) {
@@ -2331,24 +3885,157 @@ bool make_certifier_ecc_key(int n, key_message *k) {
   return true;
 }
 
+// Random numbers
 // -----------------------------------------------------------------------
 
-bool certifier::utilities::get_random(int num_bits, byte *out) {
-  bool ret = true;
-  int  k = 0;
-  int  n = ((num_bits + num_bits_in_byte - 1) / num_bits_in_byte);
-
-  int in = open("/dev/random", O_RDONLY, 0644);
-  while (k < n) {
-    int m = read(in, out + k, n - k);
-    if (m < 0) {
-      ret = false;
+// Each thread runs its own AES-256-CTR generator with fast key erasure:
+// every refill produces the next key along with the output, and the old
+// key is gone.  Seeds come from getrandom(), which never blocks once the
+// kernel pool is initialized, and the generator reseeds after
+// random_reseed_bytes of output and in a forked child.  Forks are
+// detected with a pthread_atfork generation counter rather than by
+// comparing getpid(), which glibc no longer caches.
+const int      random_key_size = 32;
+const int      random_buffer_size = 512;
+const uint64_t random_reseed_bytes = 1ULL << 24;
+
+// Kernels before 3.17 lack getrandom(); /dev/urandom is the fallback.
+static bool get_entropy(byte *out, size_t n) {
+  int fd = -1;
+  while (n > 0) {
+    ssize_t m = (fd < 0) ? getrandom(out, n, 0) : read(fd, out, n);
+    if (m < 0 && errno == ENOSYS && fd < 0) {
+      fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return false;
+      continue;
+    }
+    if (m < 0 && errno == EINTR)
+      continue;
+    if (m <= 0)
       break;
+    out += m;
+    n -= m;
+  }
+  if (fd >= 0)
+    close(fd);
+  return n == 0;
+}
+
+// Bumped in every forked child; 0 means "never seeded".
+static std::atomic<uint64_t> fork_generation(1);
+
+static void bump_fork_generation() {
+  fork_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+class thread_random {
+ public:
+  thread_random()
+      : ctx_(nullptr),
+        avail_(0),
+        since_seed_(0),
+        generation_(0) {}
+  ~thread_random() {
+    if (ctx_ != nullptr)
+      EVP_CIPHER_CTX_free(ctx_);
+    OPENSSL_cleanse(buf_, sizeof(buf_));
+  }
+
+  bool generate(byte *out, size_t n) {
+    if (!ready())
+      return false;
+    while (n > 0) {
+      if (avail_ == 0 && !refill())
+        return false;
+      size_t k = n < (size_t)avail_ ? n : (size_t)avail_;
+      byte * src = &buf_[sizeof(buf_) - avail_];
+      memcpy(out, src, k);
+      OPENSSL_cleanse(src, k);
+      avail_ -= k;
+      out += k;
+      n -= k;
     }
-    k += m;
+    return true;
   }
-  close(in);
-  return ret;
+
+ private:
+  bool ready() {
+    if (ctx_ == nullptr) {
+      static bool registered =
+          pthread_atfork(nullptr, nullptr, bump_fork_generation) == 0;
+      if (!registered)
+        return false;
+      ctx_ = EVP_CIPHER_CTX_new();
+      if (ctx_ == nullptr)
+        return false;
+    }
+    if (generation_ != fork_generation.load(std::memory_order_relaxed)
+        || since_seed_ >= random_reseed_bytes)
+      return reseed();
+    return true;
+  }
+
+  bool reseed() {
+    uint64_t generation = fork_generation.load(std::memory_order_relaxed);
+    byte     key[random_key_size];
+    bool     ret = get_entropy(key, sizeof(key)) && rekey(key);
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(buf_, sizeof(buf_));
+    avail_ = 0;
+    since_seed_ = 0;
+    generation_ = ret ? generation : 0;
+    return ret;
+  }
+
+  bool rekey(const byte *key) {
+    byte iv[block_size];
+    memset(iv, 0, sizeof(iv));
+    return 1 == EVP_EncryptInit_ex(ctx_, EVP_aes_256_ctr(), nullptr, key, iv);
+  }
+
+  // Keystream over zeros: the first random_key_size bytes become the
+  // next key, the rest is output.
+  bool refill() {
+    int n = 0;
+    memset(buf_, 0, sizeof(buf_));
+    if (1 != EVP_EncryptUpdate(ctx_, buf_, &n, buf_, sizeof(buf_))
+        || n != (int)sizeof(buf_) || !rekey(buf_)) {
+      generation_ = 0;
+      return false;
+    }
+    OPENSSL_cleanse(buf_, random_key_size);
+    avail_ = sizeof(buf_) - random_key_size;
+    since_seed_ += avail_;
+    return true;
+  }
+
+  EVP_CIPHER_CTX *ctx_;
+  byte            buf_[random_buffer_size];
+  int             avail_;
+  uint64_t        since_seed_;
+  uint64_t        generation_;
+};
+
+static thread_local thread_random thread_rng;
+
+bool certifier::utilities::get_random_bytes(size_t n, byte *out) {
+  if (n == 0)
+    return true;
+  if (out == nullptr || !thread_rng.generate(out, n)) {
+    printf("%s() error, line: %d, can't generate random bytes\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+bool certifier::utilities::get_random(int num_bits, byte *out) {
+  if (num_bits < 0)
+    return false;
+  int n = ((num_bits + num_bits_in_byte - 1) / num_bits_in_byte);
+  return get_random_bytes(n, out);
 }
 
 // may want to check leading 0's
@@ -2368,6 +4055,12 @@ bool same_point(const point_message &pt1, const point_message &pt2) {
   return true;
 }
 
+static bool symmetric_key_type(const string &key_type) {
+  const alg_descriptor *d = find_algorithm(key_type);
+  return d != nullptr
+         && (d->cls == alg_class_cipher || d->cls == alg_class_aead);
+}
+
 bool same_key(const key_message &k1, const key_message &k2) {
   if (k1.key_type() != k2.key_type()) {
     return false;
@@ -2392,9 +4085,7 @@ bool same_key(const key_message &k1, const key_message &k2) {
       return false;
     }
     return true;
-  } else if (k1.key_type() == Enc_method_aes_256_cbc_hmac_sha256
-             || k1.key_type() == Enc_method_aes_256_cbc
-             || k1.key_type() == Enc_method_aes_256) {
+  } else if (symmetric_key_type(k1.key_type())) {
     if (!k1.has_secret_key_bits()) {
       printf("%s() error, line: %d, no secret key bits\n", __func__, __LINE__);
       return false;
@@ -3067,171 +4758,34 @@ bool make_signed_claim(const char *          alg,
   out->set_serialized_claim_message((void *)serialized_claim.data(),
                                     serialized_claim.size());
 
-  int  sig_size = 0;
-  bool success = false;
-  if (strcmp(alg, Enc_method_rsa_2048_sha256_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-
-    sig_size = RSA_size(r);
-    byte sig[sig_size];
-    success = rsa_sha256_sign(r,
-                              serialized_claim.size(),
-                              (byte *)serialized_claim.data(),
-                              &sig_size,
-                              sig);
-    RSA_free(r);
-
-    // sign serialized claim
-    key_message *psk = new key_message;
-    if (!private_key_to_public_key(key, psk)) {
-      printf("%s() error, line: %d, make_signed_claim: "
-             "private_key_to_public_key failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    out->set_allocated_signing_key(psk);
-    out->set_signing_algorithm(alg);
-    out->set_signature((void *)sig, sig_size);
-  } else if (strcmp(alg, Enc_method_rsa_3072_sha384_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-
-    sig_size = RSA_size(r);
-    byte sig[sig_size];
-    success = rsa_sign(Digest_method_sha_384,
-                       r,
-                       serialized_claim.size(),
-                       (byte *)serialized_claim.data(),
-                       &sig_size,
-                       sig);
-    if (!success) {
-      printf("%s() error, line: %d, make_signed_claim: rsa_sign failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    RSA_free(r);
-
-    // sign serialized claim
-    key_message *psk = new key_message;
-    if (!private_key_to_public_key(key, psk)) {
-      printf("make_signed_claim: private_key_to_public_key failed\n");
-      return false;
-    }
-    out->set_allocated_signing_key(psk);
-    out->set_signing_algorithm(alg);
-    out->set_signature((void *)sig, sig_size);
-  } else if (strcmp(alg, Enc_method_rsa_4096_sha384_pkcs_sign) == 0) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, make_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-
-    sig_size = RSA_size(r);
-    byte sig[sig_size];
-    success = rsa_sign(Digest_method_sha_384,
-                       r,
-                       serialized_claim.size(),
-                       (byte *)serialized_claim.data(),
-                       &sig_size,
-                       sig);
-    if (!success) {
-      printf("%s() error, line: %d, make_signed_claim: rsa_sign failed\n",
-             __func__,
-             __LINE__);
-    }
-    RSA_free(r);
+  string sig;
+  if (!sign_with_key(alg,
+                     key,
+                     serialized_claim.size(),
+                     (byte *)serialized_claim.data(),
+                     &sig)) {
+    printf("%s() error, line: %d, make_signed_claim: sign failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
 
-    // sign serialized claim
-    key_message *psk = new key_message;
-    if (!private_key_to_public_key(key, psk)) {
-      printf("%s() error, line: %d, make_signed_claim: "
-             "private_key_to_public_key failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    out->set_allocated_signing_key(psk);
-    out->set_signing_algorithm(alg);
-    out->set_signature((void *)sig, sig_size);
-  } else if (strcmp(alg, Enc_method_ecc_384_sha384_pkcs_sign) == 0) {
-    EC_KEY *k = key_to_ECC(key);
-    if (k == nullptr) {
-      printf("%s() error, line: %d, make_signed_claim: to_ECC failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    sig_size = 2 * ECDSA_size(k);
-    byte sig[sig_size];
-
-    success = ecc_sign(Digest_method_sha_384,
-                       k,
-                       serialized_claim.size(),
-                       (byte *)serialized_claim.data(),
-                       &sig_size,
-                       sig);
-    EC_KEY_free(k);
-
-    // sign serialized claim
-    key_message *psk = new key_message;
-    if (!private_key_to_public_key(key, psk)) {
-      printf("%s() error, line: %d, make_signed_claim: "
-             "private_key_to_public_key failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    out->set_allocated_signing_key(psk);
-    out->set_signature((void *)sig, sig_size);
-  } else if (strcmp(alg, Enc_method_ecc_256_sha256_pkcs_sign) == 0) {
-    EC_KEY *k = key_to_ECC(key);
-    if (k == nullptr) {
-      printf("%s() error, line: %d, make_signed_claim: to_ECC failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    sig_size = 2 * ECDSA_size(k);
-    byte sig[sig_size];
-
-    success = ecc_sign(Digest_method_sha_256,
-                       k,
-                       serialized_claim.size(),
-                       (byte *)serialized_claim.data(),
-                       &sig_size,
-                       sig);
-    EC_KEY_free(k);
-
-    // sign serialized claim
-    key_message *psk = new key_message;
-    if (!private_key_to_public_key(key, psk))
-      return false;
-    out->set_allocated_signing_key(psk);
-    out->set_signature((void *)sig, sig_size);
-  } else {
+  key_message *psk = new key_message;
+  if (!private_key_to_public_key(key, psk)) {
+    printf("%s() error, line: %d, make_signed_claim: "
+           "private_key_to_public_key failed\n",
+           __func__,
+           __LINE__);
+    delete psk;
     return false;
   }
-  return success;
+  out->set_allocated_signing_key(psk);
+  out->set_signature(sig);
+  return true;
 }
 
-bool verify_signed_claim(const signed_claim_message &signed_claim,
-                         const key_message &         key) {
+// Everything verify_signed_claim checks except the signature.
+static bool signed_claim_in_force(const signed_claim_message &signed_claim) {
 
   if (!signed_claim.has_serialized_claim_message()) {
     printf("%s() error, line: %d, verify_signed_claim: no serialized claim\n",
@@ -3322,94 +4876,19 @@ bool verify_signed_claim(const signed_claim_message &signed_claim,
            __LINE__);
     return false;
   }
+  return true;
+}
 
-  bool success = false;
-  if (signed_claim.signing_algorithm()
-      == Enc_method_rsa_2048_sha256_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    success = rsa_sha256_verify(
-        r,
-        (int)signed_claim.serialized_claim_message().size(),
-        (byte *)signed_claim.serialized_claim_message().data(),
-        (int)signed_claim.signature().size(),
-        (byte *)signed_claim.signature().data());
-    RSA_free(r);
-  } else if (signed_claim.signing_algorithm()
-             == Enc_method_rsa_3072_sha384_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    success = rsa_verify(Digest_method_sha_384,
-                         r,
-                         (int)signed_claim.serialized_claim_message().size(),
-                         (byte *)signed_claim.serialized_claim_message().data(),
-                         (int)signed_claim.signature().size(),
-                         (byte *)signed_claim.signature().data());
-    RSA_free(r);
-  } else if (signed_claim.signing_algorithm()
-             == Enc_method_rsa_4096_sha384_pkcs_sign) {
-    RSA *r = RSA_new();
-    if (!key_to_RSA(key, r)) {
-      printf("%s() error, line: %d, verify_signed_claim: key_to_RSA failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    success = rsa_verify(Digest_method_sha_384,
-                         r,
-                         (int)signed_claim.serialized_claim_message().size(),
-                         (byte *)signed_claim.serialized_claim_message().data(),
-                         (int)signed_claim.signature().size(),
-                         (byte *)signed_claim.signature().data());
-    RSA_free(r);
-  } else if (signed_claim.signing_algorithm()
-             == Enc_method_ecc_384_sha384_pkcs_sign) {
-    EC_KEY *k = key_to_ECC(key);
-    if (k == nullptr) {
-      printf("%s() error, line: %d, verify_signed_claim: key_to_ECC failed\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    success = ecc_verify(Digest_method_sha_384,
-                         k,
-                         (int)signed_claim.serialized_claim_message().size(),
-                         (byte *)signed_claim.serialized_claim_message().data(),
-                         (int)signed_claim.signature().size(),
-                         (byte *)signed_claim.signature().data());
-    EC_KEY_free(k);
-  } else if (signed_claim.signing_algorithm()
-             == Enc_method_ecc_256_sha256_pkcs_sign) {
-    EC_KEY *k = key_to_ECC(key);
-    if (k == nullptr) {
-      return false;
-    }
-    success = ecc_verify(Digest_method_sha_256,
-                         k,
+bool verify_signed_claim(const signed_claim_message &signed_claim,
+                         const key_message &         key) {
+  if (!signed_claim_in_force(signed_claim))
+    return false;
+  return verify_with_key(signed_claim.signing_algorithm(),
+                         key,
                          (int)signed_claim.serialized_claim_message().size(),
                          (byte *)signed_claim.serialized_claim_message().data(),
                          (int)signed_claim.signature().size(),
                          (byte *)signed_claim.signature().data());
-    EC_KEY_free(k);
-  } else {
-    printf("%s() error, line: %d, verify_signed_claim: unsupported signing "
-           "algorithm\n",
-           __func__,
-           __LINE__);
-    return false;
-  }
-
-  return success;
 }
 
 // -----------------------------------------------------------------------
@@ -3564,159 +5043,67 @@ bool certifier::utilities::produce_artifact(key_message &signing_key,
     buf[2] = 0x81;
     ASN1_OCTET_STRING_set(os, (const unsigned char *)buf, 3);
     ex = X509_EXTENSION_create_by_NID(NULL, nid, 0, os);
-    X509_add_ext(x509, ex, -1);
-    free(ex);
-
-    nid = OBJ_create(VCEK_EXT_SNPSPL, "snpSPL", "snpSPL");
-    buf[0] = 0x2;
-    buf[1] = 0x1;
-    buf[2] = 0x0;
-    ASN1_OCTET_STRING_set(os, (const unsigned char *)buf, 3);
-    ex = X509_EXTENSION_create_by_NID(NULL, nid, 0, os);
-    X509_add_ext(x509, ex, -1);
-    free(ex);
-
-    nid = OBJ_create(VCEK_EXT_UCODESPL, "ucodeSPL", "ucodeSPL");
-    buf[0] = 0x2;
-    buf[1] = 0x2;
-    buf[2] = 0x0;
-    buf[3] = 0x30;
-    ASN1_OCTET_STRING_set(os, (const unsigned char *)buf, 4);
-    ex = X509_EXTENSION_create_by_NID(NULL, nid, 0, os);
-    X509_add_ext(x509, ex, -1);
-    free(ex);
-  }
-
-  EVP_PKEY *signing_pkey = EVP_PKEY_new();
-  if (signing_key.key_type() == Enc_method_rsa_1024_private
-      || signing_key.key_type() == Enc_method_rsa_2048_private
-      || signing_key.key_type() == Enc_method_rsa_3072_private
-      || signing_key.key_type() == Enc_method_rsa_4096_private) {
-    RSA *signing_rsa_key = RSA_new();
-    if (!key_to_RSA(signing_key, signing_rsa_key)) {
-      printf("produce_artifact: can't get rsa signing key\n");
-      return false;
-    }
-    EVP_PKEY_set1_RSA(signing_pkey, signing_rsa_key);
-    X509_set_pubkey(x509, signing_pkey);
-
-    EVP_PKEY *subject_pkey = EVP_PKEY_new();
-    if (subject_key.key_type() == Enc_method_rsa_1024_public
-        || subject_key.key_type() == Enc_method_rsa_2048_public
-        || subject_key.key_type() == Enc_method_rsa_4096_public
-        || subject_key.key_type() == Enc_method_rsa_3072_public
-        || subject_key.key_type() == Enc_method_rsa_1024_private
-        || subject_key.key_type() == Enc_method_rsa_2048_private
-        || subject_key.key_type() == Enc_method_rsa_3072_private
-        || subject_key.key_type() == Enc_method_rsa_4096_private) {
-      RSA *subject_rsa_key = RSA_new();
-      if (!key_to_RSA(subject_key, subject_rsa_key)) {
-        printf("%s() error, line: %d, produce_artifact: can't get rsa subject "
-               "key\n",
-               __func__,
-               __LINE__);
-        return false;
-      }
-      EVP_PKEY_set1_RSA(subject_pkey, subject_rsa_key);
-      X509_set_pubkey(x509, subject_pkey);
-      RSA_free(subject_rsa_key);
-    } else if (subject_key.key_type() == Enc_method_ecc_384_public
-               || subject_key.key_type() == Enc_method_ecc_384_private
-               || subject_key.key_type() == Enc_method_ecc_256_public
-               || subject_key.key_type() == Enc_method_ecc_256_private) {
-      EC_KEY *subject_ecc_key = key_to_ECC(subject_key);
-      if (subject_ecc_key == nullptr) {
-        printf(
-            "%s() error, line: %d, produce_artifact: can't get subject key\n",
-            __func__,
-            __LINE__);
-        return false;
-      }
-      EVP_PKEY_set1_EC_KEY(subject_pkey, subject_ecc_key);
-      X509_set_pubkey(x509, subject_pkey);
-      EC_KEY_free(subject_ecc_key);
-    } else {
-      printf("%s() error, line: %d, produce_artifact: unknown public key type "
-             "%s\n",
-             __func__,
-             __LINE__,
-             subject_key.key_type().c_str());
-      return false;
-    }
-    if (signing_key.key_type() == Enc_method_rsa_4096_private
-        || signing_key.key_type() == Enc_method_ecc_384_private) {
-      X509_sign(x509, signing_pkey, EVP_sha384());
-    } else {
-      X509_sign(x509, signing_pkey, EVP_sha256());
-    }
-    EVP_PKEY_free(signing_pkey);
-    EVP_PKEY_free(subject_pkey);
-    RSA_free(signing_rsa_key);
-  } else if (signing_key.key_type() == Enc_method_ecc_384_private
-             || signing_key.key_type() == Enc_method_ecc_256_private) {
-    EC_KEY *signing_ecc_key = key_to_ECC(signing_key);
-    if (signing_ecc_key == nullptr) {
-      printf("%s() error, line: %d, produce_artifact: can't get signing key\n",
-             __func__,
-             __LINE__);
-      return false;
-    }
-    EVP_PKEY *signing_pkey = EVP_PKEY_new();
-    EVP_PKEY_set1_EC_KEY(signing_pkey, signing_ecc_key);
-    X509_set_pubkey(x509, signing_pkey);
-
-    EVP_PKEY *subject_pkey = EVP_PKEY_new();
-    if (subject_key.key_type() == Enc_method_rsa_1024_public
-        || subject_key.key_type() == Enc_method_rsa_2048_public
-        || subject_key.key_type() == Enc_method_rsa_3072_public
-        || subject_key.key_type() == Enc_method_rsa_4096_public
-        || subject_key.key_type() == Enc_method_rsa_1024_private
-        || subject_key.key_type() == Enc_method_rsa_2048_private
-        || subject_key.key_type() == Enc_method_rsa_3072_private
-        || subject_key.key_type() == Enc_method_rsa_4096_private) {
-      RSA *subject_rsa_key = RSA_new();
-      if (!key_to_RSA(subject_key, subject_rsa_key)) {
-        printf("%s() error, line: %d, produce_artifact: can't get rsa subject "
-               "key\n",
-               __func__,
-               __LINE__);
-        return false;
-      }
-      EVP_PKEY_set1_RSA(subject_pkey, subject_rsa_key);
-      X509_set_pubkey(x509, subject_pkey);
-      RSA_free(subject_rsa_key);
-    } else if (subject_key.key_type() == Enc_method_ecc_384_public
-               || subject_key.key_type() == Enc_method_ecc_384_private
-               || subject_key.key_type() == Enc_method_ecc_256_public
-               || subject_key.key_type() == Enc_method_ecc_256_private) {
-      EC_KEY *subject_ecc_key = key_to_ECC(subject_key);
-      if (subject_ecc_key == nullptr) {
-        printf(
-            "%s() error, line: %d, produce_artifact: can't get subject key\n",
-            __func__,
-            __LINE__);
-        return false;
-      }
-      EVP_PKEY_set1_EC_KEY(subject_pkey, subject_ecc_key);
-      X509_set_pubkey(x509, subject_pkey);
-      EC_KEY_free(subject_ecc_key);
-    } else {
-      printf("%s() error, line: %d, produce_artifact: unknown public key type "
-             "%s\n",
-             __func__,
-             __LINE__,
-             subject_key.key_type().c_str());
-      return false;
-    }
-    X509_sign(x509, signing_pkey, EVP_sha384());
-    EVP_PKEY_free(signing_pkey);
-    EVP_PKEY_free(subject_pkey);
-  } else {
+    X509_add_ext(x509, ex, -1);
+    free(ex);
+
+    nid = OBJ_create(VCEK_EXT_SNPSPL, "snpSPL", "snpSPL");
+    buf[0] = 0x2;
+    buf[1] = 0x1;
+    buf[2] = 0x0;
+    ASN1_OCTET_STRING_set(os, (const unsigned char *)buf, 3);
+    ex = X509_EXTENSION_create_by_NID(NULL, nid, 0, os);
+    X509_add_ext(x509, ex, -1);
+    free(ex);
+
+    nid = OBJ_create(VCEK_EXT_UCODESPL, "ucodeSPL", "ucodeSPL");
+    buf[0] = 0x2;
+    buf[1] = 0x2;
+    buf[2] = 0x0;
+    buf[3] = 0x30;
+    ASN1_OCTET_STRING_set(os, (const unsigned char *)buf, 4);
+    ex = X509_EXTENSION_create_by_NID(NULL, nid, 0, os);
+    X509_add_ext(x509, ex, -1);
+    free(ex);
+  }
+
+  if (signing_key.key_type() != Enc_method_rsa_1024_private
+      && signing_key.key_type() != Enc_method_rsa_2048_private
+      && signing_key.key_type() != Enc_method_rsa_3072_private
+      && signing_key.key_type() != Enc_method_rsa_4096_private
+      && signing_key.key_type() != Enc_method_ecc_384_private
+      && signing_key.key_type() != Enc_method_ecc_256_private) {
     printf("%s() error, line: %d, produce_artifact: Unsupported algorithm\n",
            __func__,
            __LINE__);
     return false;
   }
+  EVP_PKEY *signing_pkey = cached_pkey(signing_key);
+  if (signing_pkey == nullptr) {
+    printf("%s() error, line: %d, produce_artifact: can't get signing key\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  EVP_PKEY *subject_pkey = cached_pkey(subject_key);
+  if (subject_pkey == nullptr) {
+    printf("%s() error, line: %d, produce_artifact: can't get subject key "
+           "%s\n",
+           __func__,
+           __LINE__,
+           subject_key.key_type().c_str());
+    EVP_PKEY_free(signing_pkey);
+    return false;
+  }
+  X509_set_pubkey(x509, subject_pkey);
+  if (signing_key.key_type() == Enc_method_rsa_1024_private
+      || signing_key.key_type() == Enc_method_rsa_2048_private
+      || signing_key.key_type() == Enc_method_rsa_3072_private) {
+    X509_sign(x509, signing_pkey, EVP_sha256());
+  } else {
+    X509_sign(x509, signing_pkey, EVP_sha384());
+  }
+  EVP_PKEY_free(signing_pkey);
+  EVP_PKEY_free(subject_pkey);
 
   ASN1_INTEGER_free(a);
   ASN1_TIME_free(tm_start);
@@ -3735,52 +5122,28 @@ bool certifier::utilities::verify_artifact(X509 &       cert,
                                            string *  subject_organization_str,
                                            uint64_t *sn) {
 
-  bool success = false;
-  if (verify_key.key_type() == Enc_method_rsa_1024_public
-      || verify_key.key_type() == Enc_method_rsa_1024_private
-      || verify_key.key_type() == Enc_method_rsa_2048_public
-      || verify_key.key_type() == Enc_method_rsa_2048_private
-      || verify_key.key_type() == Enc_method_rsa_3072_public
-      || verify_key.key_type() == Enc_method_rsa_3072_private
-      || verify_key.key_type() == Enc_method_rsa_4096_public
-      || verify_key.key_type() == Enc_method_rsa_4096_private) {
-    EVP_PKEY *verify_pkey = EVP_PKEY_new();
-    RSA *     verify_rsa_key = RSA_new();
-    if (!key_to_RSA(verify_key, verify_rsa_key))
-      return false;
-    EVP_PKEY_set1_RSA(verify_pkey, verify_rsa_key);
-
+  bool                  success = false;
+  const alg_descriptor *d = find_algorithm(verify_key.key_type());
+  int key_type = (d != nullptr && d->cls == alg_class_key) ? d->pkey_type
+                                                           : EVP_PKEY_NONE;
+  if (key_type == EVP_PKEY_RSA) {
     EVP_PKEY *subject_pkey = X509_get_pubkey(&cert);
     RSA *     subject_rsa_key = EVP_PKEY_get1_RSA(subject_pkey);
     if (!RSA_to_key(subject_rsa_key, subject_key)) {
       return false;
     }
-    success = (X509_verify(&cert, verify_pkey) == 1);
-    RSA_free(verify_rsa_key);
+    success = verify_cert_with_key(&cert, verify_key);
     RSA_free(subject_rsa_key);
-    EVP_PKEY_free(verify_pkey);
     EVP_PKEY_free(subject_pkey);
     // Todo: Make this work
-  } else if (verify_key.key_type() == Enc_method_ecc_384_public
-             || verify_key.key_type() == Enc_method_ecc_384_private
-             || verify_key.key_type() == Enc_method_ecc_256_public
-             || verify_key.key_type() == Enc_method_ecc_256_private) {
-    EVP_PKEY *verify_pkey = EVP_PKEY_new();
-    EC_KEY *  verify_ecc_key = key_to_ECC(verify_key);
-    if (verify_ecc_key == nullptr) {
-      return false;
-    }
-    EVP_PKEY_set1_EC_KEY(verify_pkey, verify_ecc_key);
-
+  } else if (key_type == EVP_PKEY_EC) {
     EVP_PKEY *subject_pkey = X509_get_pubkey(&cert);
     EC_KEY *  subject_ecc_key = EVP_PKEY_get1_EC_KEY(subject_pkey);
     if (!ECC_to_key(subject_ecc_key, subject_key)) {
       return false;
     }
-    success = (X509_verify(&cert, verify_pkey) == 1);
-    EC_KEY_free(verify_ecc_key);
+    success = verify_cert_with_key(&cert, verify_key);
     EC_KEY_free(subject_ecc_key);
-    EVP_PKEY_free(verify_pkey);
     EVP_PKEY_free(subject_pkey);
   } else {
     printf("%s() error, line: %d, Unsupported key type\n", __func__, __LINE__);
@@ -3876,40 +5239,121 @@ int sized_pipe_read(int fd, string *out) {
   return n;
 }
 
+// Largest plaintext that fits in one TLS record.
+const int max_ssl_record_payload = 16384;
+
+static bool ssl_write_all(SSL *ssl, const byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = SSL_write(ssl, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
+static bool ssl_read_all(SSL *ssl, byte *buf, int size) {
+  int total = 0;
+  while (total < size) {
+    int n = SSL_read(ssl, buf + total, size - total);
+    if (n <= 0)
+      return false;
+    total += n;
+  }
+  return true;
+}
+
 // little endian only
+//   The size header travels in the same TLS record as the start of the
+//   payload, so a small message costs one record (and usually one segment)
+//   rather than two.  The rest of a large payload is written in place.
 int sized_ssl_write(SSL *ssl, int size, byte *buf) {
-  if (SSL_write(ssl, (byte *)&size, sizeof(int)) < (int)sizeof(int))
+  if (size < 0)
+    return -1;
+
+  byte first[max_ssl_record_payload];
+  int  head = size;
+  if (head > (max_ssl_record_payload - (int)sizeof(int)))
+    head = max_ssl_record_payload - (int)sizeof(int);
+  memcpy(first, (byte *)&size, sizeof(int));
+  memcpy(&first[sizeof(int)], buf, head);
+
+  if (!ssl_write_all(ssl, first, sizeof(int) + head))
     return -1;
-  if (SSL_write(ssl, buf, size) < size)
+  if (!ssl_write_all(ssl, buf + head, size - head))
     return -1;
   return size;
 }
 
 // little endian only
+//   Decrypts straight into out's storage.  Returns 0 and an empty out if the
+//   peer closed before a message arrived.  out grows (doubling) only as the
+//   payload arrives, so a size header alone can't make us allocate it.
 int sized_ssl_read(SSL *ssl, string *out) {
   out->clear();
   int size = 0;
   int n = SSL_read(ssl, (byte *)&size, sizeof(int));
-  if (n < 0)
+  if (n <= 0)
     return n;
+  if (n < (int)sizeof(int)
+      && !ssl_read_all(ssl, ((byte *)&size) + n, sizeof(int) - n))
+    return -1;
+  if (size < 0)
+    return -1;
 
-  int       total = 0;
-  const int read_stride = 8192;
-  byte      buf[read_stride];
-
+  int total = 0;
   while (total < size) {
-    if ((size - total) > read_stride)
-      n = SSL_read(ssl, buf, read_stride);
-    else
-      n = SSL_read(ssl, buf, size - total);
-    if (n < 0) {
-      return n;
-    } else {
-      out->append((char *)buf, n);
-      total += n;
+    if (total == (int)out->size()) {
+      size_t grow = out->size() < (size_t)max_ssl_record_payload
+                        ? (size_t)max_ssl_record_payload
+                        : 2 * out->size();
+      out->resize(grow < (size_t)size ? grow : (size_t)size);
+    }
+    n = SSL_read(ssl, (byte *)&(*out)[total], out->size() - total);
+    if (n <= 0) {
+      out->clear();
+      return -1;
     }
+    total += n;
   }
-  return total;
+  return size;
+}
+
+// little endian only
+//   Reads one message into the caller's buffer.  A message larger than
+//   max_size is consumed and discarded so the stream stays in step, and -1
+//   is returned.
+int sized_ssl_read(SSL *ssl, int max_size, byte *buf) {
+  int size = 0;
+  int n = SSL_read(ssl, (byte *)&size, sizeof(int));
+  if (n <= 0)
+    return n;
+  if (n < (int)sizeof(int)
+      && !ssl_read_all(ssl, ((byte *)&size) + n, sizeof(int) - n))
+    return -1;
+  if (size < 0)
+    return -1;
+
+  if (size <= max_size) {
+    if (!ssl_read_all(ssl, buf, size))
+      return -1;
+    return size;
+  }
+
+  printf("%s() error, line: %d, message size %d exceeds buffer size %d\n",
+         __func__,
+         __LINE__,
+         size,
+         max_size);
+  byte discard[max_ssl_record_payload];
+  while (size > 0) {
+    int k = size > max_ssl_record_payload ? max_ssl_record_payload : size;
+    if (!ssl_read_all(ssl, discard, k))
+      return -1;
+    size -= k;
+  }
+  return -1;
 }
 
 // little endian only
@@ -4061,14 +5505,10 @@ key_message *get_issuer_key(X509 *x, cert_keys_seen_list &list) {
 EVP_PKEY *pkey_from_key(const key_message &k) {
   EVP_PKEY *pkey = EVP_PKEY_new();
 
-  if (k.key_type() == Enc_method_rsa_1024_public
-      || k.key_type() == Enc_method_rsa_1024_private
-      || k.key_type() == Enc_method_rsa_3072_public
-      || k.key_type() == Enc_method_rsa_3072_private
-      || k.key_type() == Enc_method_rsa_2048_public
-      || k.key_type() == Enc_method_rsa_2048_private
-      || k.key_type() == Enc_method_rsa_4096_public
-      || k.key_type() == Enc_method_rsa_4096_private) {
+  const alg_descriptor *d = find_algorithm(k.key_type());
+  int key_type = (d != nullptr && d->cls == alg_class_key) ? d->pkey_type
+                                                           : EVP_PKEY_NONE;
+  if (key_type == EVP_PKEY_RSA) {
     RSA *rsa_key = RSA_new();
     if (!key_to_RSA(k, rsa_key)) {
       printf("%s() error, line: %d, pkey_from_key: Can't translate key to RSA "
@@ -4086,10 +5526,7 @@ EVP_PKEY *pkey_from_key(const key_message &k) {
       return nullptr;
     }
     return pkey;
-  } else if (k.key_type() == Enc_method_ecc_384_public
-             || k.key_type() == Enc_method_ecc_384_private
-             || k.key_type() == Enc_method_ecc_256_public
-             || k.key_type() == Enc_method_ecc_256_private) {
+  } else if (key_type == EVP_PKEY_EC) {
     EC_KEY *ecc_key = key_to_ECC(k);
     if (ecc_key == nullptr) {
       EVP_PKEY_free(pkey);
@@ -4106,6 +5543,498 @@ EVP_PKEY *pkey_from_key(const key_message &k) {
   }
 }
 
+// Key handle cache
+// -----------------------------------------------------------------------
+//  Converting a key_message to OpenSSL objects (BIGNUM decoding, curve
+//  point checks, RSA Montgomery setup) costs more than many of the
+//  operations done with the key.  Converted keys are kept here as
+//  ref-counted EVP_PKEYs keyed by a fingerprint of the key material, so
+//  each key is converted once per process.
+
+class key_handle_cache {
+ public:
+  static const int max_handles = 1024;
+
+  std::mutex                           mtx_;
+  std::unordered_map<string, EVP_PKEY *> handles_;
+
+  void clear() {
+    std::lock_guard<std::mutex> l(mtx_);
+    for (auto &h : handles_)
+      EVP_PKEY_free(h.second);
+    handles_.clear();
+  }
+};
+
+static key_handle_cache &key_handles() {
+  static key_handle_cache *c = new key_handle_cache();
+  return *c;
+}
+
+// SHA-256 over the key type and key material; names, certificates and
+// validity are not part of the handle.
+static bool key_fingerprint(const key_message &k, string *fp) {
+  string material(k.key_type());
+  material.append(1, '\0');
+  if (k.has_rsa_key() && !k.rsa_key().AppendToString(&material))
+    return false;
+  material.append(1, '\0');
+  if (k.has_ecc_key() && !k.ecc_key().AppendToString(&material))
+    return false;
+
+  unsigned int size = digest_output_byte_size(Digest_method_sha_256);
+  byte         digest[size];
+  if (!digest_message(Digest_method_sha_256,
+                      (const byte *)material.data(),
+                      material.size(),
+                      digest,
+                      size)) {
+    return false;
+  }
+  fp->assign((char *)digest, size);
+  return true;
+}
+
+EVP_PKEY *cached_pkey(const key_message &k) {
+  string fp;
+  if (!key_fingerprint(k, &fp)) {
+    printf("%s() error, line: %d, Can't fingerprint key\n", __func__, __LINE__);
+    return nullptr;
+  }
+
+  key_handle_cache &c = key_handles();
+  {
+    std::lock_guard<std::mutex> l(c.mtx_);
+    auto                        it = c.handles_.find(fp);
+    if (it != c.handles_.end()) {
+      EVP_PKEY_up_ref(it->second);
+      return it->second;
+    }
+  }
+
+  // Convert outside the lock; if two threads race, the first one wins.
+  EVP_PKEY *pkey = pkey_from_key(k);
+  if (pkey == nullptr)
+    return nullptr;
+
+  std::lock_guard<std::mutex> l(c.mtx_);
+  auto                        it = c.handles_.find(fp);
+  if (it != c.handles_.end()) {
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_up_ref(it->second);
+    return it->second;
+  }
+  if ((int)c.handles_.size() >= key_handle_cache::max_handles) {
+    EVP_PKEY_free(c.handles_.begin()->second);
+    c.handles_.erase(c.handles_.begin());
+  }
+  c.handles_[fp] = pkey;
+  EVP_PKEY_up_ref(pkey);
+  return pkey;
+}
+
+void clear_key_handle_cache() {
+  key_handles().clear();
+}
+
+int key_handle_cache_size() {
+  key_handle_cache &          c = key_handles();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  return (int)c.handles_.size();
+}
+
+// Verification result cache
+// -----------------------------------------------------------------------
+//  The same policy claims, endorsements and admissions certificates are
+//  verified on every certification and handshake.  Successful checks
+//  are remembered here under SHA-256(key fingerprint, algorithm, message
+//  digest, signature) until the TTL runs out or, for certificates, the
+//  certificate expires, whichever is first.  Failures are never cached.
+
+class verify_result_cache {
+ public:
+  static const int max_entries = 4096;
+
+  struct entry {
+    time_t expires;
+    string key_fp;
+  };
+
+  std::mutex                     mtx_;
+  std::unordered_map<string, entry> entries_;
+  int                            ttl_ = 300;
+
+  bool find(const string &id) {
+    std::lock_guard<std::mutex> l(mtx_);
+    auto                        it = entries_.find(id);
+    if (it == entries_.end())
+      return false;
+    if (it->second.expires <= time(nullptr)) {
+      entries_.erase(it);
+      return false;
+    }
+    return true;
+  }
+
+  void add(const string &id, const string &key_fp, time_t not_after) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (ttl_ <= 0)
+      return;
+    time_t now = time(nullptr);
+    time_t expires = now + ttl_;
+    if (not_after != 0 && not_after < expires)
+      expires = not_after;
+    if (expires <= now)
+      return;
+    if ((int)entries_.size() >= max_entries) {
+      for (auto it = entries_.begin(); it != entries_.end();) {
+        if (it->second.expires <= now)
+          it = entries_.erase(it);
+        else
+          ++it;
+      }
+      if ((int)entries_.size() >= max_entries)
+        entries_.erase(entries_.begin());
+    }
+    entry &e = entries_[id];
+    e.expires = expires;
+    e.key_fp = key_fp;
+  }
+};
+
+static verify_result_cache &verify_results() {
+  static verify_result_cache *c = new verify_result_cache();
+  return *c;
+}
+
+static bool verify_result_id(const string &key_fp,
+                             const string &alg,
+                             const byte *  msg,
+                             int           msg_len,
+                             const byte *  sig,
+                             int           sig_len,
+                             string *      id) {
+  digest_stream ds;
+  byte          msg_digest[32];
+  byte          out[32];
+  unsigned int  len = sizeof(msg_digest);
+  if (!ds.init(Digest_method_sha_256) || !ds.update(msg, msg_len)
+      || !ds.final(msg_digest, &len))
+    return false;
+  len = sizeof(out);
+  if (!ds.init(Digest_method_sha_256)
+      || !ds.update((const byte *)key_fp.data(), key_fp.size())
+      || !ds.update((const byte *)alg.c_str(), alg.size() + 1)
+      || !ds.update(msg_digest, sizeof(msg_digest)) || !ds.update(sig, sig_len)
+      || !ds.final(out, &len))
+    return false;
+  id->assign((char *)out, len);
+  return true;
+}
+
+void set_verify_cache_ttl(int seconds) {
+  verify_result_cache &       c = verify_results();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  c.ttl_ = seconds;
+  if (seconds <= 0)
+    c.entries_.clear();
+}
+
+void clear_verify_cache() {
+  verify_result_cache &       c = verify_results();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  c.entries_.clear();
+}
+
+void invalidate_verify_cache_key(const key_message &k) {
+  string fp;
+  if (!key_fingerprint(k, &fp))
+    return;
+  verify_result_cache &       c = verify_results();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  for (auto it = c.entries_.begin(); it != c.entries_.end();) {
+    if (it->second.key_fp == fp)
+      it = c.entries_.erase(it);
+    else
+      ++it;
+  }
+}
+
+int verify_cache_size() {
+  verify_result_cache &       c = verify_results();
+  std::lock_guard<std::mutex> l(c.mtx_);
+  return (int)c.entries_.size();
+}
+
+bool verify_cert_with_key(X509 *x, const key_message &signer_key) {
+  byte *der = nullptr;
+  int   der_len = i2d_X509(x, &der);
+  if (der_len <= 0) {
+    printf("%s() error, line: %d, Can't encode cert\n", __func__, __LINE__);
+    return false;
+  }
+
+  string fp;
+  string id;
+  bool   cacheable = key_fingerprint(signer_key, &fp)
+                   && verify_result_id(fp, "x509", der, der_len, nullptr, 0, &id);
+  OPENSSL_free(der);
+  if (cacheable && verify_results().find(id))
+    return true;
+
+  EVP_PKEY *pkey = cached_pkey(signer_key);
+  if (pkey == nullptr)
+    return false;
+  bool success = (X509_verify(x, pkey) == 1);
+  EVP_PKEY_free(pkey);
+
+  time_point not_after;
+  time_t     expires;
+  if (success && cacheable && get_not_after_from_cert(x, &not_after)
+      && time_point_to_time_t(not_after, &expires))
+    verify_results().add(id, fp, expires);
+  return success;
+}
+
+bool signing_alg_params(const string &signing_alg,
+                        const char ** digest_alg,
+                        int *         pkey_type) {
+  const alg_descriptor *d = find_algorithm(signing_alg);
+  if (d == nullptr || d->cls != alg_class_sign || d->digest == alg_unknown)
+    return false;
+  *digest_alg = algorithm_by_id(d->digest)->name;
+  *pkey_type = d->pkey_type;
+  return true;
+}
+
+// PKCS #1 v1.5 for RSA keys, DER encoded ECDSA for EC keys; the same
+// signatures rsa_sign and ecc_sign produce.
+bool pkey_sign(const char *digest_alg,
+               EVP_PKEY *  pkey,
+               int         size,
+               byte *      msg,
+               int *       sig_size,
+               byte *      sig) {
+  const EVP_MD *md = digest_md(digest_alg);
+  if (md == nullptr || pkey == nullptr) {
+    printf("%s() error, line: %d, bad digest or key\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  if (ctx == nullptr)
+    return false;
+
+  bool   ret = true;
+  size_t t = (size_t)*sig_size;
+  if (EVP_DigestSignInit(ctx, nullptr, md, nullptr, pkey) <= 0) {
+    printf("%s() error, line: %d, EVP_DigestSignInit failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (EVP_DigestSign(ctx, sig, &t, msg, size) <= 0) {
+    printf("%s() error, line: %d, EVP_DigestSign failed\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+  *sig_size = (int)t;
+
+done:
+  EVP_MD_CTX_free(ctx);
+  return ret;
+}
+
+bool pkey_verify(const char *digest_alg,
+                 EVP_PKEY *  pkey,
+                 int         size,
+                 byte *      msg,
+                 int         sig_size,
+                 byte *      sig) {
+  const EVP_MD *md = digest_md(digest_alg);
+  if (md == nullptr || pkey == nullptr) {
+    printf("%s() error, line: %d, bad digest or key\n", __func__, __LINE__);
+    return false;
+  }
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  if (ctx == nullptr)
+    return false;
+
+  bool ret = true;
+  if (EVP_DigestVerifyInit(ctx, nullptr, md, nullptr, pkey) <= 0) {
+    printf("%s() error, line: %d, EVP_DigestVerifyInit failed\n",
+           __func__,
+           __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (EVP_DigestVerify(ctx, sig, sig_size, msg, size) != 1) {
+    ERR_clear_error();
+    ret = false;
+    goto done;
+  }
+
+done:
+  EVP_MD_CTX_free(ctx);
+  return ret;
+}
+
+// Signs with a cached handle for key; alg is one of the *_pkcs_sign methods.
+bool sign_with_key(const string &     alg,
+                   const key_message &key,
+                   int                size,
+                   byte *             msg,
+                   string *           sig) {
+  const char *digest_alg = nullptr;
+  int         pkey_type = 0;
+  if (!signing_alg_params(alg, &digest_alg, &pkey_type)) {
+    printf("%s() error, line: %d, unsupported signing algorithm %s\n",
+           __func__,
+           __LINE__,
+           alg.c_str());
+    return false;
+  }
+  EVP_PKEY *pkey = cached_pkey(key);
+  if (pkey == nullptr) {
+    printf("%s() error, line: %d, Can't get key handle\n", __func__, __LINE__);
+    return false;
+  }
+  bool ret = false;
+  int  sig_size = EVP_PKEY_size(pkey);
+  byte sig_buf[sig_size];
+  if (EVP_PKEY_id(pkey) != pkey_type) {
+    printf("%s() error, line: %d, key does not match %s\n",
+           __func__,
+           __LINE__,
+           alg.c_str());
+  } else if (pkey_sign(digest_alg, pkey, size, msg, &sig_size, sig_buf)) {
+    sig->assign((char *)sig_buf, sig_size);
+    ret = true;
+  }
+  EVP_PKEY_free(pkey);
+  return ret;
+}
+
+bool verify_with_key(const string &     alg,
+                     const key_message &key,
+                     int                size,
+                     byte *             msg,
+                     int                sig_size,
+                     byte *             sig) {
+  const char *digest_alg = nullptr;
+  int         pkey_type = 0;
+  if (!signing_alg_params(alg, &digest_alg, &pkey_type)) {
+    printf("%s() error, line: %d, unsupported signing algorithm %s\n",
+           __func__,
+           __LINE__,
+           alg.c_str());
+    return false;
+  }
+  string fp;
+  string id;
+  bool   cacheable = key_fingerprint(key, &fp)
+                   && verify_result_id(fp, alg, msg, size, sig, sig_size, &id);
+  if (cacheable && verify_results().find(id))
+    return true;
+
+  EVP_PKEY *pkey = cached_pkey(key);
+  if (pkey == nullptr) {
+    printf("%s() error, line: %d, Can't get key handle\n", __func__, __LINE__);
+    return false;
+  }
+  bool ret = EVP_PKEY_id(pkey) == pkey_type
+             && pkey_verify(digest_alg, pkey, size, msg, sig_size, sig);
+  EVP_PKEY_free(pkey);
+  if (ret && cacheable)
+    verify_results().add(id, fp, 0);
+  return ret;
+}
+
+static bool verify_claim_with_pkey(const signed_claim_message &claim,
+                                   const string &              key_fp,
+                                   EVP_PKEY *                  pkey) {
+  const char *digest_alg = nullptr;
+  int         pkey_type = 0;
+  if (pkey == nullptr || !signed_claim_in_force(claim))
+    return false;
+
+  const string &msg = claim.serialized_claim_message();
+  const string &sig = claim.signature();
+  string        id;
+  bool          cacheable = verify_result_id(key_fp,
+                                    claim.signing_algorithm(),
+                                    (const byte *)msg.data(),
+                                    msg.size(),
+                                    (const byte *)sig.data(),
+                                    sig.size(),
+                                    &id);
+  if (cacheable && verify_results().find(id))
+    return true;
+
+  if (!signing_alg_params(claim.signing_algorithm(), &digest_alg, &pkey_type)
+      || EVP_PKEY_id(pkey) != pkey_type) {
+    printf("%s() error, line: %d, bad signing algorithm %s\n",
+           __func__,
+           __LINE__,
+           claim.signing_algorithm().c_str());
+    return false;
+  }
+  bool ret = pkey_verify(digest_alg,
+                         pkey,
+                         (int)msg.size(),
+                         (byte *)msg.data(),
+                         (int)sig.size(),
+                         (byte *)sig.data());
+  if (ret && cacheable)
+    verify_results().add(id, key_fp, 0);
+  return ret;
+}
+
+bool verify_signed_claims(int                                n,
+                          const signed_claim_message *const *claims,
+                          const key_message *const *         keys,
+                          int                                num_threads,
+                          bool *                             results) {
+  // Group by key first: each distinct key is converted once and its
+  // handle shared by every claim it signed.
+  std::map<string, EVP_PKEY *> handles;
+  std::vector<EVP_PKEY *>      claim_pkey(n, nullptr);
+  std::vector<string>          claim_fp(n);
+  for (int i = 0; i < n; i++) {
+    const key_message &k = keys != nullptr ? *keys[i] : claims[i]->signing_key();
+    if (!key_fingerprint(k, &claim_fp[i]))
+      continue;
+    auto it = handles.find(claim_fp[i]);
+    if (it == handles.end())
+      it = handles.insert(std::make_pair(claim_fp[i], cached_pkey(k))).first;
+    claim_pkey[i] = it->second;
+  }
+
+  // Thread start-up costs more than a few verifications save: short
+  // batches run inline and each thread takes a few claims.
+  const int             min_parallel_claims = 16;
+  const int             claims_per_thread = 4;
+  std::atomic<int>      next(0);
+  std::atomic<bool>     all(true);
+  auto                  worker = [&]() {
+    for (int i = next++; i < n; i = next++) {
+      results[i] =
+          verify_claim_with_pkey(*claims[i], claim_fp[i], claim_pkey[i]);
+      if (!results[i])
+        all = false;
+    }
+  };
+  run_workers(n < min_parallel_claims ? 1 : num_threads,
+              (n + claims_per_thread - 1) / claims_per_thread,
+              worker);
+
+  for (auto it = handles.begin(); it != handles.end(); ++it) {
+    if (it->second != nullptr)
+      EVP_PKEY_free(it->second);
+  }
+  return all;
+}
+
 // make a public key from the X509 cert's subject key
 bool x509_to_public_key(X509 *x, key_message *k) {
   EVP_PKEY *subject_pkey = X509_get_pubkey(x);
@@ -15,6 +15,10 @@
 
 #include "certifier.h"
 #include "support.h"
+#include "certifier_service.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <thread>
 
 using namespace certifier::utilities;
 
@@ -33,6 +37,60 @@ bool test_random(bool print_all) {
     print_bytes(n, out);
     printf("\n");
   }
+
+  // Successive calls, bulk calls and other threads all get fresh output.
+  byte next[n];
+  byte other[n];
+  byte bulk[3 * 4096 + 5];
+  if (!get_random(n * 8, next) || !get_random_bytes(sizeof(bulk), bulk)) {
+    printf("%s() error, line: %d, get_random failed\n", __func__, __LINE__);
+    return false;
+  }
+  bool        thread_ok = false;
+  std::thread t([&]() { thread_ok = get_random(n * 8, other); });
+  t.join();
+  if (!thread_ok || memcmp(out, next, n) == 0 || memcmp(out, other, n) == 0
+      || memcmp(next, other, n) == 0
+      || memcmp(bulk, bulk + 4096, 4096) == 0) {
+    printf("%s() error, line: %d, repeated random output\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // A forked child must not continue the parent's stream.
+  byte forked[n];
+  byte parent[n];
+  int  fds[2];
+  if (pipe(fds) != 0) {
+    printf("%s() error, line: %d, can't make pipe\n", __func__, __LINE__);
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    bool ok = get_random(n * 8, forked) && write(fds[1], forked, n) == n;
+    _exit(ok ? 0 : 1);
+  }
+  close(fds[1]);
+  int  status = 0;
+  bool got = pid > 0 && read(fds[0], forked, n) == n;
+  close(fds[0]);
+  if (pid > 0)
+    waitpid(pid, &status, 0);
+  if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+      || !get_random(n * 8, parent)) {
+    printf("%s() error, line: %d, forked get_random failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (memcmp(forked, parent, n) == 0) {
+    printf("%s() error, line: %d, child repeated parent's output\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
   return true;
 }
 
@@ -316,6 +374,482 @@ bool test_authenticated_encrypt(bool print_all) {
   return true;
 }
 
+static bool aead_stream_through(aead_stream &s,
+                                byte *       in,
+                                int          in_len,
+                                int          chunk,
+                                string *     out) {
+  byte buf[chunk + aead_stream::max_expansion];
+  out->clear();
+  for (int i = 0; i < in_len; i += chunk) {
+    int n = in_len - i < chunk ? in_len - i : chunk;
+    int k = sizeof(buf);
+    if (!s.update(in + i, n, buf, &k))
+      return false;
+    out->append((char *)buf, k);
+  }
+  int k = sizeof(buf);
+  if (!s.final(buf, &k))
+    return false;
+  out->append((char *)buf, k);
+  return true;
+}
+
+bool test_aead_stream(bool print_all) {
+  const char *algs[] = {
+      Enc_method_aes_256_gcm,
+      Enc_method_aes_256_cbc_hmac_sha256,
+      Enc_method_aes_256_cbc_hmac_sha384,
+  };
+  const int in_size = 5003;
+  const int key_size = 96;
+  byte      key[key_size];
+  byte      iv[block_size];
+  byte      plain[in_size];
+  byte      cipher[in_size + 256];
+
+  for (int i = 0; i < key_size; i++)
+    key[i] = (byte)(3 * i + 1);
+  for (int i = 0; i < block_size; i++)
+    iv[i] = (byte)(i % 16);
+  for (int i = 0; i < in_size; i++)
+    plain[i] = (byte)(i * 7);
+
+  // One stream object for everything: contexts are reused across inits.
+  aead_stream s;
+  for (unsigned a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+    int cipher_size = sizeof(cipher);
+    if (!authenticated_encrypt(algs[a],
+                               plain,
+                               in_size,
+                               key,
+                               key_size,
+                               iv,
+                               block_size,
+                               cipher,
+                               &cipher_size)) {
+      printf("%s() error, line: %d, authenticated_encrypt %s failed\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      return false;
+    }
+
+    string streamed;
+    if (!s.init_encrypt(algs[a], key, key_size, iv, block_size)
+        || !aead_stream_through(s, plain, in_size, 7, &streamed)
+        || streamed.size() != (size_t)cipher_size
+        || memcmp(streamed.data(), cipher, cipher_size) != 0) {
+      printf("%s() error, line: %d, streamed %s encrypt differs\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      return false;
+    }
+
+    const int chunks[] = {1, 13, 4096};
+    for (unsigned c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+      string recovered;
+      if (!s.init_decrypt(algs[a], key, key_size)
+          || !aead_stream_through(s, cipher, cipher_size, chunks[c], &recovered)
+          || recovered.size() != (size_t)in_size
+          || memcmp(recovered.data(), plain, in_size) != 0) {
+        printf("%s() error, line: %d, streamed %s decrypt failed, chunk %d\n",
+               __func__,
+               __LINE__,
+               algs[a],
+               chunks[c]);
+        return false;
+      }
+    }
+
+    string bad;
+    if (s.init_decrypt(algs[a], key, key_size)
+        && aead_stream_through(s, cipher, cipher_size - 1, 64, &bad)) {
+      printf("%s() error, line: %d, truncated %s accepted\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      return false;
+    }
+    cipher[cipher_size / 2] ^= 1;
+    if (s.init_decrypt(algs[a], key, key_size)
+        && aead_stream_through(s, cipher, cipher_size, 64, &bad)) {
+      printf("%s() error, line: %d, tampered %s accepted\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      return false;
+    }
+    if (print_all)
+      printf("aead_stream %s ok, %d bytes\n", algs[a], cipher_size);
+  }
+
+  string in_file("./test_aead_stream.in");
+  string enc_file("./test_aead_stream.enc");
+  string out_file("./test_aead_stream.out");
+  string recovered;
+  bool   ok = write_file(in_file, in_size, plain)
+            && authenticated_encrypt_file(Enc_method_aes_256_gcm,
+                                          key,
+                                          key_size,
+                                          in_file,
+                                          enc_file)
+            && authenticated_decrypt_file(Enc_method_aes_256_gcm,
+                                          key,
+                                          key_size,
+                                          enc_file,
+                                          out_file)
+            && read_file_into_string(out_file, &recovered)
+            && recovered.size() == (size_t)in_size
+            && memcmp(recovered.data(), plain, in_size) == 0;
+  unlink(in_file.c_str());
+  unlink(enc_file.c_str());
+  unlink(out_file.c_str());
+  if (!ok) {
+    printf("%s() error, line: %d, file round trip failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
+bool test_nonce_aead(bool print_all) {
+  byte key[32];
+  byte iv[block_size];
+  byte plain[1000];
+  byte cipher[sizeof(plain) + 64];
+  byte decrypted[sizeof(plain) + 64];
+  for (int i = 0; i < (int)sizeof(key); i++)
+    key[i] = (byte)(3 * i + 1);
+  for (int i = 0; i < (int)sizeof(iv); i++)
+    iv[i] = (byte)(100 + i);
+  for (int i = 0; i < (int)sizeof(plain); i++)
+    plain[i] = (byte)(i * 7);
+
+  const char *p = preferred_authenticated_algorithm();
+  if (strcmp(p, Enc_method_aes_256_gcm) != 0
+      && strcmp(p, Enc_method_chacha20_poly1305) != 0) {
+    printf("%s() error, line: %d, bad preferred algorithm %s\n",
+           __func__,
+           __LINE__,
+           p);
+    return false;
+  }
+
+  const char *algs[] = {Enc_method_chacha20_poly1305,
+                        Enc_method_aes_256_gcm_siv};
+  for (int a = 0; a < (int)(sizeof(algs) / sizeof(algs[0])); a++) {
+    const alg_descriptor *d = find_algorithm(algs[a]);
+    if (d == nullptr) {
+      printf("%s() error, line: %d, %s missing\n", __func__, __LINE__, algs[a]);
+      return false;
+    }
+    // Only algorithms this OpenSSL provides are listed and accepted.
+    bool listed = false;
+    for (int i = 0; i < Num_symmetric_key_algorithms; i++) {
+      if (strcmp(Enc_authenticated_symmetric_key_algorithms[i], algs[a]) == 0)
+        listed = true;
+    }
+    bool provided = d->cipher() != nullptr;
+    if (listed != provided
+        || authenticated_algorithm_available(algs[a]) != provided) {
+      printf("%s() error, line: %d, %s listed %d, provided %d\n",
+             __func__,
+             __LINE__,
+             algs[a],
+             listed,
+             provided);
+      return false;
+    }
+    if (!provided) {
+      if (print_all)
+        printf("%s not provided by this OpenSSL, skipped\n", algs[a]);
+      continue;
+    }
+
+    const int sizes[] = {0, 1, 64, (int)sizeof(plain)};
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+      int n = sizes[s];
+      int cipher_size = sizeof(cipher);
+      int decrypted_size = sizeof(decrypted);
+      if (!authenticated_encrypt(algs[a],
+                                 plain,
+                                 n,
+                                 key,
+                                 sizeof(key),
+                                 iv,
+                                 sizeof(iv),
+                                 cipher,
+                                 &cipher_size)
+          || cipher_size != 12 + n + 16 || memcmp(cipher, iv, 12) != 0) {
+        printf("%s() error, line: %d, %s encrypt failed\n",
+               __func__,
+               __LINE__,
+               algs[a]);
+        return false;
+      }
+      if (!authenticated_decrypt(algs[a],
+                                 cipher,
+                                 cipher_size,
+                                 key,
+                                 sizeof(key),
+                                 decrypted,
+                                 &decrypted_size)
+          || decrypted_size != n || memcmp(decrypted, plain, n) != 0) {
+        printf("%s() error, line: %d, %s decrypt failed\n",
+               __func__,
+               __LINE__,
+               algs[a]);
+        return false;
+      }
+
+      // A flipped bit in the nonce, ciphertext or tag is rejected.
+      int where[] = {0, 12 + n / 2, cipher_size - 1};
+      for (int w = 0; w < 3; w++) {
+        cipher[where[w]] ^= 0x10;
+        decrypted_size = sizeof(decrypted);
+        bool opened = authenticated_decrypt(algs[a],
+                                            cipher,
+                                            cipher_size,
+                                            key,
+                                            sizeof(key),
+                                            decrypted,
+                                            &decrypted_size);
+        cipher[where[w]] ^= 0x10;
+        if (opened) {
+          printf("%s() error, line: %d, %s accepted a modified message\n",
+                 __func__,
+                 __LINE__,
+                 algs[a]);
+          return false;
+        }
+      }
+    }
+
+    // Short iv and truncated input.
+    int cipher_size = sizeof(cipher);
+    int decrypted_size = sizeof(decrypted);
+    if (authenticated_encrypt(algs[a],
+                              plain,
+                              10,
+                              key,
+                              sizeof(key),
+                              iv,
+                              8,
+                              cipher,
+                              &cipher_size)
+        || authenticated_decrypt(algs[a],
+                                 cipher,
+                                 20,
+                                 key,
+                                 sizeof(key),
+                                 decrypted,
+                                 &decrypted_size)) {
+      printf("%s() error, line: %d, %s bad arguments accepted\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      return false;
+    }
+  }
+
+  // ChaCha20-Poly1305 streams to the one-shot layout; GCM-SIV cannot.
+  int one_shot_size = sizeof(cipher);
+  if (!authenticated_encrypt(Enc_method_chacha20_poly1305,
+                             plain,
+                             sizeof(plain),
+                             key,
+                             sizeof(key),
+                             iv,
+                             sizeof(iv),
+                             cipher,
+                             &one_shot_size))
+    return false;
+  aead_stream s;
+  byte        streamed[sizeof(plain) + 3 * aead_stream::max_expansion];
+  int         total = 0;
+  if (!s.init_encrypt(Enc_method_chacha20_poly1305,
+                      key,
+                      sizeof(key),
+                      iv,
+                      sizeof(iv)))
+    return false;
+  for (int off = 0; off < (int)sizeof(plain); off += 400) {
+    int k = (int)sizeof(plain) - off < 400 ? (int)sizeof(plain) - off : 400;
+    int n = sizeof(streamed) - total;
+    if (!s.update(plain + off, k, streamed + total, &n))
+      return false;
+    total += n;
+  }
+  int n = sizeof(streamed) - total;
+  if (!s.final(streamed + total, &n))
+    return false;
+  total += n;
+  if (total != one_shot_size || memcmp(streamed, cipher, total) != 0) {
+    printf("%s() error, line: %d, stream differs from one-shot\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  total = 0;
+  if (!s.init_decrypt(Enc_method_chacha20_poly1305, key, sizeof(key)))
+    return false;
+  for (int off = 0; off < one_shot_size; off += 333) {
+    int k = one_shot_size - off < 333 ? one_shot_size - off : 333;
+    n = sizeof(streamed) - total;
+    if (!s.update(cipher + off, k, streamed + total, &n))
+      return false;
+    total += n;
+  }
+  n = sizeof(streamed) - total;
+  if (!s.final(streamed + total, &n))
+    return false;
+  total += n;
+  if (total != (int)sizeof(plain) || memcmp(streamed, plain, total) != 0) {
+    printf("%s() error, line: %d, stream decrypt failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (s.init_decrypt(Enc_method_aes_256_gcm_siv, key, sizeof(key))) {
+    printf("%s() error, line: %d, GCM-SIV stream accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all)
+    printf("preferred authenticated algorithm: %s\n", p);
+  return true;
+}
+
+bool test_chunked_aead(bool print_all) {
+  const int in_size = 100003;
+  const int chunk_size = 4096;
+  byte      key[32];
+  string    plain;
+
+  for (int i = 0; i < (int)sizeof(key); i++)
+    key[i] = (byte)(5 * i + 2);
+  for (int i = 0; i < in_size; i++)
+    plain.push_back((char)(i * 13));
+
+  // Serial and parallel containers must open the same way.
+  const int threads[] = {1, 4};
+  string    sealed;
+  for (unsigned t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+    string recovered;
+    if (!chunked_aead_encrypt(key,
+                              sizeof(key),
+                              plain,
+                              chunk_size,
+                              threads[t],
+                              &sealed)
+        || !chunked_aead_decrypt(key,
+                                 sizeof(key),
+                                 sealed,
+                                 threads[1 - t],
+                                 &recovered)
+        || recovered != plain) {
+      printf("%s() error, line: %d, round trip failed, %d threads\n",
+             __func__,
+             __LINE__,
+             threads[t]);
+      return false;
+    }
+  }
+  if (print_all)
+    printf("chunked container: %d bytes for %d\n", (int)sealed.size(), in_size);
+
+  // Random access, including the short last chunk.
+  const uint64_t num_chunks = (in_size + chunk_size - 1) / chunk_size;
+  const uint64_t picks[] = {0, 7, num_chunks - 1};
+  for (unsigned p = 0; p < sizeof(picks) / sizeof(picks[0]); p++) {
+    string   chunk;
+    uint64_t off = picks[p] * chunk_size;
+    if (!chunked_aead_decrypt_chunk(key, sizeof(key), sealed, picks[p], &chunk)
+        || chunk != plain.substr(off, chunk_size)) {
+      printf("%s() error, line: %d, chunk %d wrong\n",
+             __func__,
+             __LINE__,
+             (int)picks[p]);
+      return false;
+    }
+  }
+
+  string bad;
+  string tampered = sealed;
+  tampered[chunked_aead_header_size + 3 * (chunk_size + 16) + 10] ^= 1;
+  if (chunked_aead_decrypt(key, sizeof(key), tampered, 4, &bad)
+      || !chunked_aead_decrypt_chunk(key, sizeof(key), tampered, 2, &bad)
+      || chunked_aead_decrypt_chunk(key, sizeof(key), tampered, 3, &bad)) {
+    printf("%s() error, line: %d, tampered chunk handling wrong\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Swapping two whole chunks must fail even though each tag is intact.
+  tampered = sealed;
+  const int span = chunk_size + 16;
+  string    c1 = tampered.substr(chunked_aead_header_size + span, span);
+  string    c2 = tampered.substr(chunked_aead_header_size + 2 * span, span);
+  tampered.replace(chunked_aead_header_size + span, span, c2);
+  tampered.replace(chunked_aead_header_size + 2 * span, span, c1);
+  if (chunked_aead_decrypt(key, sizeof(key), tampered, 1, &bad)
+      || chunked_aead_decrypt_chunk(key, sizeof(key), tampered, 1, &bad)) {
+    printf("%s() error, line: %d, reordered chunks accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (chunked_aead_decrypt(key,
+                           sizeof(key),
+                           sealed.substr(0, sealed.size() - 1),
+                           1,
+                           &bad)) {
+    printf("%s() error, line: %d, truncated container accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  string empty;
+  string recovered;
+  if (!chunked_aead_encrypt(key, sizeof(key), empty, 0, 0, &sealed)
+      || !chunked_aead_decrypt(key, sizeof(key), sealed, 0, &recovered)
+      || !recovered.empty()) {
+    printf("%s() error, line: %d, empty round trip failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  string in_file("./test_chunked_aead.in");
+  string enc_file("./test_chunked_aead.enc");
+  string out_file("./test_chunked_aead.out");
+  bool   ok = write_file_from_string(in_file, plain)
+            && chunked_aead_encrypt_file(key,
+                                         sizeof(key),
+                                         in_file,
+                                         enc_file,
+                                         chunk_size,
+                                         4)
+            && chunked_aead_decrypt_file(key, sizeof(key), enc_file, out_file, 3)
+            && read_file_into_string(out_file, &recovered)
+            && recovered == plain;
+  unlink(in_file.c_str());
+  unlink(enc_file.c_str());
+  unlink(out_file.c_str());
+  if (!ok) {
+    printf("%s() error, line: %d, file round trip failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
 bool test_public_keys(bool print_all) {
 
   RSA *r1 = RSA_new();
@@ -899,6 +1433,230 @@ bool test_digest_multiple(bool print_all) {
   return memcmp(digest_multiple, digest_updated, sizeof(digest_updated)) == 0;
 }
 
+bool test_algorithm_registry(bool print_all) {
+  // Every id has its own entry and the name resolves back to it, from
+  // the global pointer and from a copy of the name.
+  for (int i = alg_unknown + 1; i < num_alg_ids; i++) {
+    const alg_descriptor *d = algorithm_by_id((alg_id)i);
+    if (d == nullptr || d->id != i || d->name == nullptr) {
+      printf("%s() error, line: %d, bad entry %d\n", __func__, __LINE__, i);
+      return false;
+    }
+    string copy(d->name);
+    if (find_algorithm(d->name) != d || find_algorithm(copy) != d) {
+      printf("%s() error, line: %d, %s does not resolve\n",
+             __func__,
+             __LINE__,
+             d->name);
+      return false;
+    }
+  }
+  if (find_algorithm("aes-257") != nullptr || find_algorithm("") != nullptr
+      || find_algorithm((const char *)nullptr) != nullptr
+      || algorithm_by_id(alg_unknown) != nullptr
+      || cipher_key_byte_size("aes-257") != -1) {
+    printf("%s() error, line: %d, unknown name resolved\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Sizes are those of the original name tables.
+  string gcm(Enc_method_aes_256_gcm);
+  if (cipher_block_byte_size(gcm.c_str()) != 16
+      || cipher_key_byte_size(gcm.c_str()) != 32
+      || mac_output_byte_size(gcm.c_str()) != 16
+      || cipher_key_byte_size(Enc_method_aes_256_cbc_hmac_sha384) != 80
+      || mac_output_byte_size(Integrity_method_hmac_sha256) != 32
+      || mac_output_byte_size(Integrity_method_aes_256_cbc_hmac_sha256) != 32
+      || digest_output_byte_size(Digest_method_sha256) != 32
+      || digest_output_byte_size(Digest_method_sha_512) != 64
+      || digest_output_byte_size(Enc_method_aes_256) != -1
+      || cipher_block_byte_size(Enc_method_rsa_3072_public) != -1
+      || cipher_key_byte_size(Enc_method_rsa_3072_public) != 384
+      || cipher_block_byte_size(Enc_method_ecc_384_private) != 48
+      || cipher_key_byte_size(Enc_method_ecc_384_private) != -1
+      || cipher_block_byte_size(Enc_method_rsa_4096_sha384_pkcs_sign) != 512) {
+    printf("%s() error, line: %d, wrong sizes\n", __func__, __LINE__);
+    return false;
+  }
+
+  const char *digest_alg = nullptr;
+  int         pkey_type = 0;
+  if (!signing_alg_params(Enc_method_rsa_3072_sha384_pkcs_sign,
+                          &digest_alg,
+                          &pkey_type)
+      || strcmp(digest_alg, Digest_method_sha_384) != 0
+      || pkey_type != EVP_PKEY_RSA
+      || !signing_alg_params(Enc_method_ecc_256_sha256_pkcs_sign,
+                             &digest_alg,
+                             &pkey_type)
+      || strcmp(digest_alg, Digest_method_sha_256) != 0
+      || pkey_type != EVP_PKEY_EC
+      || signing_alg_params(Enc_method_rsa_1024_sha256_pkcs_sign,
+                            &digest_alg,
+                            &pkey_type)
+      || signing_alg_params(Enc_method_rsa_2048_public,
+                            &digest_alg,
+                            &pkey_type)) {
+    printf("%s() error, line: %d, wrong signing parameters\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Only the authenticated ciphers that are implemented dispatch.
+  byte key[64];
+  byte iv[block_size];
+  byte in[32];
+  byte out[128];
+  int  out_size = sizeof(out);
+  memset(key, 1, sizeof(key));
+  memset(iv, 2, sizeof(iv));
+  memset(in, 3, sizeof(in));
+  if (authenticated_encrypt(Enc_method_aes_128_cbc_hmac_sha256,
+                            in,
+                            sizeof(in),
+                            key,
+                            sizeof(key),
+                            iv,
+                            sizeof(iv),
+                            out,
+                            &out_size)
+      || authenticated_encrypt(Digest_method_sha_256,
+                               in,
+                               sizeof(in),
+                               key,
+                               sizeof(key),
+                               iv,
+                               sizeof(iv),
+                               out,
+                               &out_size)) {
+    printf("%s() error, line: %d, unsupported algorithm accepted\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Private key types map to their public types.
+  key_message priv;
+  key_message pub;
+  if (!make_certifier_ecc_key(256, &priv)
+      || !private_key_to_public_key(priv, &pub)
+      || pub.key_type() != Enc_method_ecc_256_public
+      || private_key_to_public_key(pub, &priv)) {
+    printf("%s() error, line: %d, private_key_to_public_key\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  if (print_all)
+    printf("%d algorithms\n", num_alg_ids - 1);
+  return true;
+}
+
+bool test_digest_stream(bool print_all) {
+  const int    in_size = 300007;
+  string       data;
+  byte         expected[64];
+  byte         digest[64];
+  unsigned int len = sizeof(digest);
+
+  for (int i = 0; i < in_size; i++)
+    data.push_back((char)(i * 31 + 7));
+
+  // Incremental and file digests match the one-shot digest.
+  const char *algs[] = {Digest_method_sha256,
+                        Digest_method_sha_384,
+                        Digest_method_sha_512};
+  string      file_name("./test_digest_stream.in");
+  if (!write_file_from_string(file_name, data)) {
+    printf("%s() error, line: %d, can't write %s\n",
+           __func__,
+           __LINE__,
+           file_name.c_str());
+    return false;
+  }
+  digest_stream ds;
+  for (unsigned a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+    unsigned int n = digest_output_byte_size(algs[a]);
+    if (!digest_message(algs[a],
+                        (const byte *)data.data(),
+                        in_size,
+                        expected,
+                        sizeof(expected))) {
+      unlink(file_name.c_str());
+      return false;
+    }
+    bool ok = ds.init(algs[a]);
+    for (int off = 0; ok && off < in_size; off += 1013) {
+      int k = (in_size - off < 1013) ? in_size - off : 1013;
+      ok = ds.update((const byte *)data.data() + off, k);
+    }
+    len = sizeof(digest);
+    ok = ok && ds.final(digest, &len) && len == n
+         && memcmp(digest, expected, n) == 0;
+    len = sizeof(digest);
+    ok = ok && digest_file(algs[a], file_name, digest, &len) && len == n
+         && memcmp(digest, expected, n) == 0;
+    if (!ok) {
+      printf("%s() error, line: %d, %s digests differ\n",
+             __func__,
+             __LINE__,
+             algs[a]);
+      unlink(file_name.c_str());
+      return false;
+    }
+  }
+
+  // Tree hash: independent of thread count and of memory vs file, bound
+  // to the leaf size, and a single leaf is the documented construction.
+  byte serial[32];
+  byte parallel[32];
+  byte from_file[32];
+  byte other_leaf[32];
+  bool ok = tree_hash((const byte *)data.data(), in_size, 4096, 1, serial)
+            && tree_hash((const byte *)data.data(), in_size, 4096, 4, parallel)
+            && tree_hash_file(file_name, 4096, 3, from_file)
+            && tree_hash((const byte *)data.data(), in_size, 8192, 4, other_leaf)
+            && memcmp(serial, parallel, 32) == 0
+            && memcmp(serial, from_file, 32) == 0
+            && memcmp(serial, other_leaf, 32) != 0;
+  unlink(file_name.c_str());
+  if (!ok) {
+    printf("%s() error, line: %d, tree hashes wrong\n", __func__, __LINE__);
+    return false;
+  }
+
+  byte leaf[32];
+  byte root[32];
+  byte params[17];
+  byte zero = 0;
+  memset(params, 0, sizeof(params));
+  params[0] = 2;
+  params[7] = 0x10;  // leaf size 4096
+  params[16] = 100;  // length
+  len = sizeof(leaf);
+  ok = ds.init(Digest_method_sha256) && ds.update(&zero, 1)
+       && ds.update((const byte *)data.data(), 100) && ds.final(leaf, &len);
+  len = sizeof(expected);
+  ok = ok && ds.init(Digest_method_sha256) && ds.update(params, sizeof(params))
+       && ds.update(leaf, 32) && ds.final(expected, &len)
+       && tree_hash((const byte *)data.data(), 100, 4096, 0, root)
+       && memcmp(root, expected, 32) == 0;
+  if (!ok) {
+    printf("%s() error, line: %d, single leaf tree hash wrong\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (print_all) {
+    printf("Tree hash: ");
+    print_bytes(32, serial);
+    printf("\n");
+  }
+  return true;
+}
+
 bool test_sign_and_verify(bool print_all) {
   RSA *r = RSA_new();
 
@@ -993,6 +1751,224 @@ bool test_key_translation(bool print_all) {
   return true;
 }
 
+bool test_key_handle_cache(bool print_all) {
+  key_message rsa_priv;
+  key_message rsa_pub;
+  if (!make_certifier_rsa_key(2048, &rsa_priv)
+      || !private_key_to_public_key(rsa_priv, &rsa_pub)) {
+    printf("%s() error, line: %d, can't make rsa key\n", __func__, __LINE__);
+    return false;
+  }
+
+  clear_key_handle_cache();
+  EVP_PKEY *p1 = cached_pkey(rsa_priv);
+  rsa_priv.set_key_name("renamed");
+  EVP_PKEY *p2 = cached_pkey(rsa_priv);
+  bool      same = p1 != nullptr && p1 == p2;
+  EVP_PKEY_free(p1);
+  EVP_PKEY_free(p2);
+  if (!same || key_handle_cache_size() != 1) {
+    printf("%s() error, line: %d, handle not reused\n", __func__, __LINE__);
+    return false;
+  }
+
+  const char *msg = "I am a test message, verify me";
+  int         msg_size = strlen(msg);
+  string      sig;
+  if (!sign_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                     rsa_priv,
+                     msg_size,
+                     (byte *)msg,
+                     &sig)) {
+    printf("%s() error, line: %d, sign_with_key failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (!verify_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                       rsa_pub,
+                       msg_size,
+                       (byte *)msg,
+                       sig.size(),
+                       (byte *)sig.data())) {
+    printf("%s() error, line: %d, verify_with_key failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Signatures still interoperate with the RSA* path.
+  RSA *r = RSA_new();
+  if (!key_to_RSA(rsa_pub, r)
+      || !rsa_sha256_verify(r,
+                            msg_size,
+                            (byte *)msg,
+                            sig.size(),
+                            (byte *)sig.data())) {
+    printf("%s() error, line: %d, rsa_sha256_verify failed\n",
+           __func__,
+           __LINE__);
+    RSA_free(r);
+    return false;
+  }
+  RSA_free(r);
+
+  sig[sig.size() / 2] ^= 1;
+  if (verify_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                      rsa_pub,
+                      msg_size,
+                      (byte *)msg,
+                      sig.size(),
+                      (byte *)sig.data())) {
+    printf("%s() error, line: %d, bad signature verified\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  key_message ecc_priv;
+  key_message ecc_pub;
+  if (!make_certifier_ecc_key(384, &ecc_priv)
+      || !private_key_to_public_key(ecc_priv, &ecc_pub)) {
+    printf("%s() error, line: %d, can't make ecc key\n", __func__, __LINE__);
+    return false;
+  }
+  if (sign_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                    ecc_priv,
+                    msg_size,
+                    (byte *)msg,
+                    &sig)) {
+    printf("%s() error, line: %d, signed with wrong key type\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (!sign_with_key(Enc_method_ecc_384_sha384_pkcs_sign,
+                     ecc_priv,
+                     msg_size,
+                     (byte *)msg,
+                     &sig)) {
+    printf("%s() error, line: %d, ecc sign_with_key failed\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  EC_KEY *ek = key_to_ECC(ecc_pub);
+  bool    ok = ek != nullptr
+            && ecc_verify(Digest_method_sha_384,
+                          ek,
+                          msg_size,
+                          (byte *)msg,
+                          sig.size(),
+                          (byte *)sig.data());
+  EC_KEY_free(ek);
+  if (!ok) {
+    printf("%s() error, line: %d, ecc_verify failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (print_all)
+    printf("key handles cached: %d\n", key_handle_cache_size());
+  return key_handle_cache_size() == 3;
+}
+
+bool test_verify_cache(bool print_all) {
+  key_message priv;
+  key_message pub;
+  if (!make_certifier_rsa_key(2048, &priv)
+      || !private_key_to_public_key(priv, &pub)) {
+    printf("%s() error, line: %d, can't make rsa key\n", __func__, __LINE__);
+    return false;
+  }
+  const char *msg = "verify me once, then from the cache";
+  int         msg_size = strlen(msg);
+  string      sig;
+  if (!sign_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                     priv,
+                     msg_size,
+                     (byte *)msg,
+                     &sig)) {
+    printf("%s() error, line: %d, sign_with_key failed\n", __func__, __LINE__);
+    return false;
+  }
+
+  // Good signatures are cached once; bad ones never are.
+  clear_verify_cache();
+  for (int i = 0; i < 2; i++) {
+    if (!verify_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                         pub,
+                         msg_size,
+                         (byte *)msg,
+                         sig.size(),
+                         (byte *)sig.data())
+        || verify_cache_size() != 1) {
+      printf("%s() error, line: %d, not cached\n", __func__, __LINE__);
+      return false;
+    }
+  }
+  string bad = sig;
+  bad[bad.size() / 2] ^= 1;
+  if (verify_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                      pub,
+                      msg_size,
+                      (byte *)msg,
+                      bad.size(),
+                      (byte *)bad.data())
+      || verify_cache_size() != 1) {
+    printf("%s() error, line: %d, bad signature handling\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  invalidate_verify_cache_key(pub);
+  if (verify_cache_size() != 0) {
+    printf("%s() error, line: %d, invalidation failed\n", __func__, __LINE__);
+    return false;
+  }
+  set_verify_cache_ttl(0);
+  bool ok = verify_with_key(Enc_method_rsa_2048_sha256_pkcs_sign,
+                            pub,
+                            msg_size,
+                            (byte *)msg,
+                            sig.size(),
+                            (byte *)sig.data())
+            && verify_cache_size() == 0;
+  set_verify_cache_ttl(300);
+  if (!ok) {
+    printf("%s() error, line: %d, cached with ttl 0\n", __func__, __LINE__);
+    return false;
+  }
+
+  // A certificate's entry ends with the certificate.
+  string issuer_name("cache-issuer");
+  string issuer_desc("issuer");
+  string subject_name("cache-subject");
+  string subject_desc("subject");
+  X509 * cert = X509_new();
+  if (!produce_artifact(priv,
+                        issuer_name,
+                        issuer_desc,
+                        priv,
+                        subject_name,
+                        subject_desc,
+                        1,
+                        1.0,
+                        cert,
+                        true)) {
+    X509_free(cert);
+    return false;
+  }
+  ok = verify_cert_with_key(cert, pub) && verify_cache_size() == 1;
+  sleep(2);
+  ok = ok && verify_cert_with_key(cert, pub) && verify_cache_size() == 0;
+  X509_free(cert);
+  if (!ok) {
+    printf("%s() error, line: %d, cert entry outlived cert\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  return true;
+}
+
 bool test_time(bool print_all) {
   time_point t_now;
   time_point t_test;
@@ -1054,3 +2030,77 @@ bool test_time(bool print_all) {
   }
   return true;
 }
+
+bool test_work_stealing_pool(bool print_all) {
+  std::mutex              mtx;
+  std::condition_variable cv;
+  int                     done = 0;
+  bool                    blocker_saw_all = false;
+
+  // A worker stuck on a long task doesn't strand the tasks queued behind
+  // it: the other worker steals them.
+  {
+    work_stealing_pool pool(2, 0);
+    pool.submit([&]() {
+      std::unique_lock<std::mutex> l(mtx);
+      blocker_saw_all =
+          cv.wait_for(l, std::chrono::seconds(5), [&] { return done == 4; });
+    });
+    for (int i = 0; i < 4; i++) {
+      pool.submit([&]() {
+        std::lock_guard<std::mutex> l(mtx);
+        done++;
+        cv.notify_all();
+      });
+    }
+  }
+  if (!blocker_saw_all) {
+    printf("%s() error, line: %d, queued tasks not stolen\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // Destroying the pool runs every task still queued.
+  std::atomic<int> ran(0);
+  {
+    work_stealing_pool pool(1, 100);
+    pool.submit(
+        []() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); });
+    for (int i = 0; i < 20; i++)
+      pool.submit([&ran]() { ran++; });
+  }
+  if (print_all)
+    printf("work_stealing_pool: %d of 20 queued tasks ran\n", (int)ran);
+  if (ran != 20) {
+    printf("%s() error, line: %d, %d of 20 queued tasks ran at shutdown\n",
+           __func__,
+           __LINE__,
+           (int)ran);
+    return false;
+  }
+
+  // A worker of one pool submits to another as an outside thread: into
+  // that pool's own queues, and subject to its max_pending.
+  std::atomic<int> nested(0);
+  {
+    work_stealing_pool inner(1, 1);
+    {
+      work_stealing_pool outer(4, 0);
+      for (int i = 0; i < 8; i++) {
+        outer.submit([&]() {
+          for (int j = 0; j < 5; j++)
+            inner.submit([&nested]() { nested++; });
+        });
+      }
+    }
+  }
+  if (nested != 40) {
+    printf("%s() error, line: %d, %d of 40 nested tasks ran\n",
+           __func__,
+           __LINE__,
+           (int)nested);
+    return false;
+  }
+  return true;
+}
@@ -617,6 +617,80 @@ bool test__local_certify(string &enclave_type,
     return false;
   }
 
+  // Again, against the policy compiled once.
+  policy_database policy;
+  if (!policy.compile(policy_pk, trusted_platforms, trusted_measurements)
+      || !validate_evidence(evidence_descriptor,
+                            policy,
+                            purpose,
+                            evp,
+                            policy_pk)) {
+    printf("validate_evidence with compiled policy failed\n");
+    return false;
+  }
+
+  // The same endorsement and measurement again is decided from the
+  // verdict cache, but its attestation is still checked.
+  vse_clause proved;
+  string     measurement;
+  if (verdict_cache_size() == 0
+      || !validate_evidence(evidence_descriptor,
+                            policy,
+                            purpose,
+                            evp,
+                            policy_pk,
+                            &proved,
+                            &measurement)) {
+    printf("validate_evidence from cached verdict failed\n");
+    return false;
+  }
+  evidence_package tampered;
+  tampered.CopyFrom(evp);
+  for (int i = 0; i < tampered.fact_assertion_size(); i++) {
+    evidence *ev = tampered.mutable_fact_assertion(i);
+    if (ev->evidence_type() != "signed-vse-attestation-report")
+      continue;
+    signed_report sr;
+    string        t_str;
+    if (!sr.ParseFromString(ev->serialized_evidence()))
+      return false;
+    sr.mutable_signature()->at(0) ^= 1;
+    if (!sr.SerializeToString(&t_str))
+      return false;
+    ev->set_serialized_evidence(t_str);
+  }
+  if (validate_evidence(evidence_descriptor,
+                        policy,
+                        purpose,
+                        tampered,
+                        policy_pk)) {
+    printf("validate_evidence accepted a bad attestation\n");
+    return false;
+  }
+
+  // A TTL of 0 turns the cache off; the full proof proves the same.
+  vse_clause full_proved;
+  string     full_measurement;
+  set_verdict_cache_ttl(0);
+  bool uncached = validate_evidence(evidence_descriptor,
+                                    policy,
+                                    purpose,
+                                    evp,
+                                    policy_pk,
+                                    &full_proved,
+                                    &full_measurement)
+                  && verdict_cache_size() == 0;
+  set_verdict_cache_ttl(300);
+  if (!uncached) {
+    printf("validate_evidence without verdict cache failed\n");
+    return false;
+  }
+  if (!same_vse_claim(proved, full_proved) || measurement.empty()
+      || measurement != full_measurement) {
+    printf("cached verdict proved a different statement\n");
+    return false;
+  }
+
   return true;
 }
 
@@ -17,6 +17,12 @@
 #include "support.h"
 #include "simulated_enclave.h"
 #include "application_enclave.h"
+#include "cc_helpers.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 using namespace certifier::framework;
 using namespace certifier::utilities;
@@ -873,3 +879,505 @@ bool test_sev_request(bool print_all) {
 
   return true;
 }
+
+// Channel tests
+// ----------------------------------------------------------------------------------
+//  Loopback channels on an ephemeral port.  Both ends authenticate with
+//  the same admissions cert, signed by a throwaway policy root.
+
+static bool make_channel_keys(key_message *policy_key,
+                              string *     policy_cert,
+                              key_message *auth_key,
+                              string *     auth_cert) {
+  string      policy_name("channel-test-policy");
+  string      policy_desc("policy root");
+  string      auth_name("channel-test-auth");
+  string      auth_desc("admissions");
+  key_message pub_policy_key;
+  key_message pub_auth_key;
+  bool        ret = true;
+  X509 *      root = X509_new();
+  X509 *      cert = X509_new();
+
+  if (!make_certifier_rsa_key(2048, policy_key)
+      || !make_certifier_rsa_key(2048, auth_key)) {
+    printf("%s() error, line %d, can't make keys\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+  policy_key->set_key_name(policy_name);
+  policy_key->set_key_format("vse-key");
+  auth_key->set_key_name(auth_name);
+  auth_key->set_key_format("vse-key");
+  if (!private_key_to_public_key(*policy_key, &pub_policy_key)
+      || !private_key_to_public_key(*auth_key, &pub_auth_key)) {
+    printf("%s() error, line %d, can't get public keys\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (!produce_artifact(*policy_key,
+                        policy_name,
+                        policy_desc,
+                        pub_policy_key,
+                        policy_name,
+                        policy_desc,
+                        1L,
+                        86400.0,
+                        root,
+                        true)
+      || !produce_artifact(*policy_key,
+                           policy_name,
+                           policy_desc,
+                           pub_auth_key,
+                           auth_name,
+                           auth_desc,
+                           2L,
+                           86400.0,
+                           cert,
+                           false)) {
+    printf("%s() error, line %d, can't make certs\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+  if (!x509_to_asn1(root, policy_cert) || !x509_to_asn1(cert, auth_cert)) {
+    printf("%s() error, line %d, can't encode certs\n", __func__, __LINE__);
+    ret = false;
+    goto done;
+  }
+
+done:
+  X509_free(root);
+  X509_free(cert);
+  return ret;
+}
+
+// Listen on an ephemeral localhost port.
+static bool open_test_listener(int *sock, int *port) {
+  if (!open_server_socket("localhost", 0, 64, sock))
+    return false;
+  struct sockaddr_in addr;
+  socklen_t          len = sizeof(addr);
+  if (getsockname(*sock, (struct sockaddr *)&addr, &len) != 0) {
+    close(*sock);
+    return false;
+  }
+  *port = ntohs(addr.sin_port);
+  return true;
+}
+
+// Connect, send msg and expect it echoed back.  If resumed is not null,
+// it is set to whether the handshake resumed a cached session.
+static bool echo_through(int                    port,
+                         const channel_context &ctx,
+                         const string &         msg,
+                         bool *                 resumed) {
+  string                       role("client");
+  secure_authenticated_channel c(role);
+  if (!c.init_client_ssl("localhost", port, ctx))
+    return false;
+  if (resumed != nullptr)
+    *resumed = c.session_resumed();
+  string reply;
+  bool   ret = c.write(msg.size(), (byte *)msg.data()) > 0 && c.read(&reply) > 0
+             && reply == msg;
+  c.close();
+  return ret;
+}
+
+static std::mutex              dispatch_mtx;
+static std::condition_variable dispatch_cv;
+static int                     dispatch_wanted = 0;
+static int                     dispatch_active = 0;
+static int                     dispatch_peak = 0;
+
+// Echo one message, after waiting (up to 5 seconds) until dispatch_wanted
+// handlers are running at once.
+static void echo_together(secure_authenticated_channel &c) {
+  {
+    std::unique_lock<std::mutex> l(dispatch_mtx);
+    dispatch_active++;
+    if (dispatch_active > dispatch_peak)
+      dispatch_peak = dispatch_active;
+    dispatch_cv.notify_all();
+    dispatch_cv.wait_for(l, std::chrono::seconds(5), [] {
+      return dispatch_peak >= dispatch_wanted;
+    });
+  }
+  string msg;
+  if (c.read(&msg) > 0)
+    c.write(msg.size(), (byte *)msg.data());
+  {
+    std::lock_guard<std::mutex> l(dispatch_mtx);
+    dispatch_active--;
+  }
+  c.close();
+}
+
+// Run server_dispatch with num_workers on a fresh listener, echo
+// num_clients concurrent clients and return once dispatch has stopped.
+static bool run_dispatch(const channel_context &ctx,
+                         int                    num_workers,
+                         int                    num_clients,
+                         int *                  echoed) {
+  int sock = -1;
+  int port = 0;
+  if (!open_test_listener(&sock, &port)) {
+    printf("%s() error, line %d, can't listen\n", __func__, __LINE__);
+    return false;
+  }
+
+  bool        served = false;
+  std::thread server([&]() {
+    served = server_dispatch(sock, ctx, num_workers, 0, echo_together);
+  });
+
+  std::atomic<int>         ok(0);
+  std::vector<std::thread> clients;
+  for (int i = 0; i < num_clients; i++) {
+    clients.push_back(std::thread([&ok, &ctx, port, i]() {
+      // Sizes up to several TLS records exercise the growing read buffer.
+      string msg("dispatch-" + std::to_string(i));
+      msg.resize(msg.size() + 100000 * i, '.');
+      if (echo_through(port, ctx, msg, nullptr))
+        ok++;
+    }));
+  }
+  for (unsigned i = 0; i < clients.size(); i++)
+    clients[i].join();
+
+  shutdown(sock, SHUT_RDWR);
+  server.join();
+  close(sock);
+  *echoed = ok;
+  return served;
+}
+
+bool test_dispatch_pool(bool print_all) {
+  key_message     policy_key;
+  key_message     auth_key;
+  string          policy_cert;
+  string          auth_cert;
+  channel_context ctx;
+  int             echoed = 0;
+
+  if (!make_channel_keys(&policy_key, &policy_cert, &auth_key, &auth_cert)
+      || !ctx.init(policy_cert, auth_key, auth_cert)) {
+    printf("%s() error, line %d, can't make channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  // All four clients must be in their handlers at once.
+  const int num_workers = 4;
+  dispatch_wanted = num_workers;
+  dispatch_peak = 0;
+  if (!run_dispatch(ctx, num_workers, num_workers, &echoed)) {
+    printf("%s() error, line %d, pooled dispatch failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (print_all)
+    printf("pooled: %d echoed, %d handlers at once\n", echoed, dispatch_peak);
+  if (echoed != num_workers || dispatch_peak != num_workers) {
+    printf("%s() error, line %d, %d echoed, %d at once\n",
+           __func__,
+           __LINE__,
+           echoed,
+           dispatch_peak);
+    return false;
+  }
+
+  // Serial dispatch serves one client at a time.
+  dispatch_wanted = 1;
+  dispatch_peak = 0;
+  if (!run_dispatch(ctx, 0, 3, &echoed)) {
+    printf("%s() error, line %d, serial dispatch failed\n", __func__, __LINE__);
+    return false;
+  }
+  if (print_all)
+    printf("serial: %d echoed, %d handlers at once\n", echoed, dispatch_peak);
+  if (echoed != 3 || dispatch_peak != 1) {
+    printf("%s() error, line %d, %d echoed, %d at once\n",
+           __func__,
+           __LINE__,
+           echoed,
+           dispatch_peak);
+    return false;
+  }
+  return true;
+}
+
+bool test_channel_reactor(bool print_all) {
+  key_message      policy_key;
+  key_message      auth_key;
+  string           policy_cert;
+  string           auth_cert;
+  channel_context  ctx;
+  channel_reactor  reactor;
+  std::atomic<int> closed(0);
+  bool             ret = true;
+
+  if (!make_channel_keys(&policy_key, &policy_cert, &auth_key, &auth_cert)
+      || !ctx.init(policy_cert, auth_key, auth_cert)) {
+    printf("%s() error, line %d, can't make channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+
+  reactor.max_message_size_ = 1024;
+  reactor.on_message_ = [](async_channel &c, const string &msg) {
+    c.async_write(msg.size(), (byte *)msg.data());
+  };
+  reactor.on_close_ = [&closed](async_channel &c) { closed++; };
+  if (!reactor.init(2)
+      || !reactor.listen("localhost", 0, policy_cert, auth_key, auth_cert)) {
+    printf("%s() error, line %d, can't start reactor\n", __func__, __LINE__);
+    return false;
+  }
+  int         port = reactor.port();
+  std::thread runner([&reactor]() { reactor.run(); });
+
+  // Blocking clients interoperate with reactor channels.
+  for (int i = 0; i < 3; i++) {
+    if (!echo_through(port, ctx, "reactor-" + std::to_string(i), nullptr)) {
+      printf("%s() error, line %d, echo %d failed\n", __func__, __LINE__, i);
+      ret = false;
+      goto done;
+    }
+  }
+
+  // A message over max_message_size_ closes the channel unanswered.
+  {
+    string                       role("client");
+    secure_authenticated_channel c(role);
+    string                       big(4096, 'x');
+    string                       reply;
+    if (!c.init_client_ssl("localhost", port, ctx)) {
+      printf("%s() error, line %d, can't connect\n", __func__, __LINE__);
+      ret = false;
+      goto done;
+    }
+    c.write(big.size(), (byte *)big.data());
+    if (c.read(&reply) > 0) {
+      printf("%s() error, line %d, oversized message answered\n",
+             __func__,
+             __LINE__);
+      ret = false;
+    }
+    c.close();
+  }
+  for (int i = 0; i < 500 && closed < 4; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  if (print_all)
+    printf("reactor port %d, %d channels closed\n", port, (int)closed);
+  if (closed != 4) {
+    printf("%s() error, line %d, %d channels closed\n",
+           __func__,
+           __LINE__,
+           (int)closed);
+    ret = false;
+  }
+
+done:
+  reactor.stop();
+  runner.join();
+  return ret;
+}
+
+bool test_tls_resumption(bool print_all) {
+  key_message     policy_key;
+  key_message     auth_key;
+  string          policy_cert;
+  string          auth_cert;
+  channel_context ctx;
+  int             sock = -1;
+  int             port = 0;
+  bool            resumed[4] = {false, false, false, false};
+  bool            ret = true;
+
+  if (!make_channel_keys(&policy_key, &policy_cert, &auth_key, &auth_cert)
+      || !ctx.init(policy_cert, auth_key, auth_cert)) {
+    printf("%s() error, line %d, can't make channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (!open_test_listener(&sock, &port)) {
+    printf("%s() error, line %d, can't listen\n", __func__, __LINE__);
+    return false;
+  }
+  dispatch_wanted = 1;
+  std::thread server(
+      [&]() { server_dispatch(sock, ctx, 1, 0, echo_together); });
+
+  // The first connection is a full handshake and caches the ticket it
+  // receives; later ones resume.  Clearing the cache forces a full
+  // handshake again.
+  for (int i = 0; i < 4; i++) {
+    if (i == 3)
+      clear_tls_session_cache();
+    if (!echo_through(port, ctx, "resume-" + std::to_string(i), &resumed[i])) {
+      printf("%s() error, line %d, echo %d failed\n", __func__, __LINE__, i);
+      ret = false;
+      break;
+    }
+  }
+  shutdown(sock, SHUT_RDWR);
+  server.join();
+  close(sock);
+  if (!ret)
+    return false;
+
+  if (print_all) {
+    printf("resumed: %d %d %d %d\n",
+           resumed[0],
+           resumed[1],
+           resumed[2],
+           resumed[3]);
+  }
+  if (resumed[0] || !resumed[1] || !resumed[2] || resumed[3]) {
+    printf("%s() error, line %d, unexpected resumption\n", __func__, __LINE__);
+    return false;
+  }
+  return true;
+}
+
+// Poll until done() holds, for up to 5 seconds.
+static bool wait_until(std::function<bool()> done) {
+  for (int i = 0; i < 500; i++) {
+    if (done())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return done();
+}
+
+bool test_dispatch_metrics(bool print_all) {
+  key_message      policy_key;
+  key_message      auth_key;
+  string           policy_cert;
+  string           auth_cert;
+  channel_context  ctx;
+  dispatch_metrics m;
+  string           metrics_file("./test_dispatch_metrics.txt");
+  string           text;
+  std::atomic<int> callbacks(0);
+  std::atomic<int> last_completed(-1);
+  int              sock = -1;
+  int              port = 0;
+  int              raw = -1;
+  bool             ret = true;
+
+  if (!make_channel_keys(&policy_key, &policy_cert, &auth_key, &auth_cert)
+      || !ctx.init(policy_cert, auth_key, auth_cert)) {
+    printf("%s() error, line %d, can't make channel context\n",
+           __func__,
+           __LINE__);
+    return false;
+  }
+  if (!open_test_listener(&sock, &port)) {
+    printf("%s() error, line %d, can't listen\n", __func__, __LINE__);
+    return false;
+  }
+
+  reset_dispatch_metrics();
+  unlink(metrics_file.c_str());
+  if (!add_metrics_callback(
+          [&callbacks, &last_completed](const dispatch_metrics &s) {
+            last_completed = (int)s.handshakes_completed_;
+            callbacks++;
+          },
+          10)
+      || !add_metrics_file_sink(metrics_file, 10)) {
+    printf("%s() error, line %d, can't add sinks\n", __func__, __LINE__);
+    close(sock);
+    stop_metrics_sinks();
+    return false;
+  }
+
+  dispatch_wanted = 1;
+  std::thread server(
+      [&]() { server_dispatch(sock, ctx, 2, 0, echo_together); });
+
+  // Three good channels, then a client that hangs up mid-handshake.
+  for (int i = 0; i < 3; i++) {
+    if (!echo_through(port, ctx, "metrics-" + std::to_string(i), nullptr)) {
+      printf("%s() error, line %d, echo %d failed\n", __func__, __LINE__, i);
+      ret = false;
+    }
+  }
+  if (open_client_socket("localhost", port, &raw))
+    close(raw);
+  wait_until([&m]() {
+    get_dispatch_metrics(&m);
+    return m.connections_accepted_ >= 4;
+  });
+  shutdown(sock, SHUT_RDWR);
+  server.join();
+  close(sock);
+  if (!ret) {
+    stop_metrics_sinks();
+    return false;
+  }
+
+  get_dispatch_metrics(&m);
+  if (print_all)
+    printf("%s\n", m.to_text().c_str());
+  if (m.connections_accepted_ != 4 || m.handshakes_completed_ != 3
+      || m.handshake_failures_[dispatch_metrics::FAIL_CLOSED] != 1
+      || m.channels_closed_ != 3 || m.bytes_in_ == 0 || m.bytes_out_ == 0
+      || m.queue_wait_us_.count_ != 4 || m.ssl_accept_us_.count_ != 3
+      || m.handler_us_.count_ != 3
+      || m.channel_bytes_in_.count_ != 3) {
+    printf("%s() error, line %d, unexpected counters\n", __func__, __LINE__);
+    ret = false;
+  }
+  text = m.to_text();
+  if (text.find("certifier_handshakes_completed_total 3\n") == string::npos
+      || text.find("certifier_handler_us_count 3\n") == string::npos) {
+    printf("%s() error, line %d, bad text format\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  // Both sinks catch up with the final counters.
+  if (!wait_until([&last_completed]() { return last_completed == 3; })) {
+    printf("%s() error, line %d, callback sink saw %d handshakes\n",
+           __func__,
+           __LINE__,
+           (int)last_completed);
+    ret = false;
+  }
+  if (!wait_until([&metrics_file, &text]() {
+        string contents;
+        return read_file_into_string(metrics_file, &contents)
+               && contents == text;
+      })) {
+    printf("%s() error, line %d, file sink not written\n", __func__, __LINE__);
+    ret = false;
+  }
+
+  // No callbacks after stop.
+  stop_metrics_sinks();
+  int after_stop = callbacks;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  if (callbacks != after_stop) {
+    printf("%s() error, line %d, sink ran after stop\n", __func__, __LINE__);
+    ret = false;
+  }
+  unlink(metrics_file.c_str());
+
+  // Histogram bounds.
+  metrics_histogram h;
+  h.count_ = 4;
+  h.buckets_[0] = 1;  // 0
+  h.buckets_[3] = 2;  // 4..7
+  h.buckets_[10] = 1; // 512..1023
+  h.max_ = 1000;
+  if (h.quantile_bound(0.25) != 0 || h.quantile_bound(0.5) != 7
+      || h.quantile_bound(1.0) != 1023) {
+    printf("%s() error, line %d, bad quantile bounds\n", __func__, __LINE__);
+    ret = false;
+  }
+  return ret;
+}
@@ -14,6 +14,7 @@
 // limitations under the License.
 
 // make_measurement.exe --type=hash --input=input-file --output=output-file
+// make_measurement.exe --type=tree_hash --input=input-file --output=output-file
 
 #include <sstream>
 #include <gflags/gflags.h>
@@ -26,6 +27,7 @@ using namespace certifier::utilities;
 int parse_other_files_size(string &        other_files,
                            vector<string> &other_files_list,
                            vector<int> &   other_files_size);
+int write_measurement(string &output, unsigned int out_len, byte *out);
 
 DEFINE_bool(print_all, false, "verbose");
 DEFINE_bool(print_debug, false, "print debugging info");
@@ -36,6 +38,8 @@ DEFINE_string(other_files,
               "Comma-separated list of other files to include in measurement; "
               "e.g., policy_key.py,certifier_framework.py");
 DEFINE_string(output, "measurement_utility.exe.measurement", "output file");
+DEFINE_uint64(leaf_size, 1 << 20, "tree_hash chunk size");
+DEFINE_int32(num_threads, 0, "tree_hash threads, 0 for every core");
 
 
 const int sha256_size = 32;
@@ -45,22 +49,19 @@ const int sha256_size = 32;
  * a list of other-files that need to be included in the measurement,
  * specified by the other_files argument.
  *
- * NOTE: We make sure to read-in the contents of all files that go into the
- * measurement ino one buffer. This slightly reduces the chance that while
- * this utility is running, we don't run into the Time-of-Check to Time-of-Use,
- * abbreviated as "TOCTOU", 'vulnerability'. That might happen if we read-in
- * file-1 first, and while other files are being read, contents of file-1
- * is changed. Second, and more importantly, we use the digest_message()
- * interface, which is a wrapper around EVP_Digest*() interfaces. This
- * wrapper does not yield a hash that can be updated across a call to
- * individual files.
+ * The files are streamed in order through one incremental digest, so the
+ * measurement is the SHA-256 of their concatenated contents without
+ * holding all of them in memory.
+ *
+ * NOTE: Each file is read once, with read() rather than a mapping, so a
+ * file truncated while this utility runs gives a wrong measurement rather
+ * than a crash.  Neither this nor reading everything into one buffer first
+ * closes the Time-of-Check to Time-of-Use, abbreviated as "TOCTOU",
+ * window: file-1 can still change after it is hashed and before it is
+ * used.  Measure files that can't change underneath the utility.
  */
 int hash_utility(string &input, string &other_files, string &output) {
 
-  int in_size = file_size(input);
-  int in_read = in_size;
-  int to_hash_size = in_size;
-
   vector<string> other_files_list;
   vector<int>    other_files_size;
 
@@ -74,82 +75,54 @@ int hash_utility(string &input, string &other_files, string &output) {
     printf("Error, reading one or more input files.\n");
     return 1;
   }
-  to_hash_size += (other_files_total_size);
 
-  byte *       to_hash = (byte *)malloc(to_hash_size * sizeof(byte));
-  byte *       to_hash_start = to_hash;
   byte         out[sha256_size];
   unsigned int out_len = sha256_size;
-
   memset(out, 0, sizeof(out));
 
-  if (to_hash == nullptr) {
-    printf("Can't malloc %d bytes.\n", to_hash_size);
-    return 1;
-  }
-
-  // Read-in input file to be measured
-  if (!read_file(input, &in_read, to_hash)) {
-    free(to_hash_start);
+  digest_stream ds;
+  if (!ds.init(Digest_method_sha256) || !ds.update_file(input)) {
     printf("Can't read %s\n", input.c_str());
     return 1;
   }
-  if (FLAGS_print_debug) {
-    printf("%d: to_hash_size=%d, in_size=%d, in_read=%d, "
-           "other_files_total_size=%d\n",
-           __LINE__,
-           to_hash_size,
-           in_size,
-           in_read,
-           other_files_total_size);
-  }
-
-  // Read-in the other files to be measured, if provided
-  int other_files_read_size = 0;
-  if (other_files_total_size) {
-    to_hash += in_read;
-
-    // Read-in other files specified, after contents of input file read-in
-    for (int fctr = 0; fctr < (int)other_files_list.size(); fctr++) {
-      int bytes_read_this_file = other_files_size[fctr];
-
-      if (!read_file(other_files_list[fctr], &bytes_read_this_file, to_hash)) {
-        free(to_hash_start);
-        printf("Can't read %s\n", other_files_list[fctr].c_str());
-        return 1;
-      }
-      if (FLAGS_print_debug) {
-        printf("%d: File: '%s', bytes read=%d\n",
-               __LINE__,
-               other_files_list[fctr].c_str(),
-               bytes_read_this_file);
-      }
-      to_hash += bytes_read_this_file;
-      other_files_read_size += bytes_read_this_file;
+  for (int fctr = 0; fctr < (int)other_files_list.size(); fctr++) {
+    if (!ds.update_file(other_files_list[fctr])) {
+      printf("Can't read %s\n", other_files_list[fctr].c_str());
+      return 1;
+    }
+    if (FLAGS_print_debug) {
+      printf("%d: File: '%s', size=%d\n",
+             __LINE__,
+             other_files_list[fctr].c_str(),
+             other_files_size[fctr]);
     }
   }
+  if (!ds.final(out, &out_len)) {
+    return 1;
+  }
+  return write_measurement(output, out_len, out);
+}
 
-  // Verify that read did not bust-up to_hash[] array
-  if ((in_read + other_files_read_size) > to_hash_size) {
-    free(to_hash_start);
-    printf("Detected overflow of data read into to_hash[] array of %d bytes"
-           ", in_read=%d, other_files_read_size=%d, sum=%d\n",
-           to_hash_size,
-           in_read,
-           other_files_read_size,
-           (in_read + other_files_read_size));
+/*
+ * Tree hash of a single input: SHA-256 over --leaf_size chunks hashed in
+ * parallel and combined into a Merkle root.  This is not the same value
+ * as --type=hash, so policies must be written for the type in use.
+ */
+int tree_hash_utility(string &input, string &other_files, string &output) {
+  if (other_files.size()) {
+    printf("Error, --other_files is not supported with --type=tree_hash\n");
     return 1;
   }
-  if (!digest_message(Digest_method_sha256,
-                      to_hash_start,
-                      to_hash_size,
-                      out,
-                      out_len)) {
-    free(to_hash_start);
+  byte out[sha256_size];
+  if (!tree_hash_file(input, FLAGS_leaf_size, FLAGS_num_threads, out)) {
+    printf("Can't hash %s\n", input.c_str());
     return 1;
   }
+  return write_measurement(output, sha256_size, out);
+}
+
+int write_measurement(string &output, unsigned int out_len, byte *out) {
   if (!write_file(output, (int)out_len, out)) {
-    free(to_hash_start);
     printf("Can't write %s\n", output.c_str());
     return 1;
   }
@@ -159,8 +132,6 @@ int hash_utility(string &input, string &other_files, string &output) {
     print_bytes((int)out_len, out);
     printf("\n");
   }
-
-  free(to_hash_start);
   return 0;
 }
 
@@ -206,6 +177,8 @@ int main(int an, char **av) {
 
   if (FLAGS_type == "hash")
     return hash_utility(FLAGS_input, FLAGS_other_files, FLAGS_output);
+  if (FLAGS_type == "tree_hash")
+    return tree_hash_utility(FLAGS_input, FLAGS_other_files, FLAGS_output);
 
   return 1;
 }